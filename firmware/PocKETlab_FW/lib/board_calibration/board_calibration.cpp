@@ -0,0 +1,153 @@
+#include "board_calibration.h"
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+
+bool CalibrationEngine::fit(const float* codes, const float* volts, uint8_t count, bool piecewise, CalibrationEntry& entry) {
+    if (count < 2 || count > CAL_MAX_POINTS) {
+        return false;
+    }
+    
+    // Straight line first (double sums: codes are up to 4095, volts a few mV apart)
+    double mean_x = 0.0, mean_y = 0.0;
+    for (uint8_t i = 0; i < count; i++) {
+        mean_x += codes[i];
+        mean_y += volts[i];
+    }
+    mean_x /= count;
+    mean_y /= count;
+    double sxx = 0.0, sxy = 0.0;
+    for (uint8_t i = 0; i < count; i++) {
+        double dx = codes[i] - mean_x;
+        sxx += dx * dx;
+        sxy += dx * (volts[i] - mean_y);
+    }
+    if (sxx <= 0.0 || sxy <= 0.0) {
+        return false;  // Flat sweep, or an output that does not follow its code
+    }
+    
+    CalibrationEntry result = nominal((float)(sxy / sxx));
+    result.offset = (float)(mean_y - sxy / sxx * mean_x);
+    result.points = count;
+    
+    if (piecewise && count >= 3) {
+        // What is left after the line, in codes, sampled at the nodes between neighbouring points
+        uint8_t order[CAL_MAX_POINTS];
+        float residual[CAL_MAX_POINTS];
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t j = i;
+            while (j > 0 && codes[order[j - 1]] > codes[i]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t k = order[i];
+            residual[i] = (volts[k] - result.offset) / result.gain - codes[k];
+        }
+        for (int node = 0; node < CAL_PWL_POINTS; node++) {
+            float position = (float)(node << CAL_PWL_SHIFT);
+            float r;
+            if (position <= codes[order[0]]) {
+                r = residual[0];
+            } else if (position >= codes[order[count - 1]]) {
+                r = residual[count - 1];
+            } else {
+                uint8_t i = 1;
+                while (codes[order[i]] < position) i++;
+                float x0 = codes[order[i - 1]], x1 = codes[order[i]];
+                r = x1 > x0 ? residual[i - 1] + (residual[i] - residual[i - 1]) * (position - x0) / (x1 - x0) : residual[i];
+            }
+            result.pwl[node] = (int16_t)constrain(lroundf(r * CAL_PWL_FRACTION), -32768L, 32767L);
+        }
+        result.piecewise = 1;
+    }
+    
+    // Residual of the finished correction, as the conversions will apply it
+    CalibrationCoefficients c = coefficients(result, 1.0f);
+    double sum_sq = 0.0;
+    for (uint8_t i = 0; i < count; i++) {
+        double error = volts[i] - toVolts(c, codes[i]);
+        sum_sq += error * error;
+    }
+    result.residual = (float)sqrt(sum_sq / count);
+    
+    entry = result;
+    return true;
+}
+
+CalibrationEntry CalibrationEngine::nominal(float gain) {
+    CalibrationEntry entry;
+    entry.gain = gain;
+    entry.offset = 0.0f;
+    for (int i = 0; i < CAL_PWL_POINTS; i++) {
+        entry.pwl[i] = 0;
+    }
+    entry.residual = 0.0f;
+    entry.points = 0;
+    entry.piecewise = 0;
+    return entry;
+}
+
+CalibrationCoefficients CalibrationEngine::coefficients(const CalibrationEntry& entry, float scale) {
+    CalibrationCoefficients c;
+    c.volts_gain = entry.gain * scale;
+    c.volts_offset = entry.offset * scale;
+    c.code_gain = 1.0f / c.volts_gain;
+    c.code_offset = -c.volts_offset / c.volts_gain;
+    for (int i = 0; i < CAL_PWL_POINTS; i++) {
+        c.pwl[i] = entry.pwl[i];
+    }
+    c.piecewise = entry.piecewise != 0;
+    return c;
+}
+
+uint32_t CalibrationEngine::_crc(const BoardCalibration& cal) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&cal, offsetof(BoardCalibration, crc));
+}
+
+bool CalibrationEngine::load(BoardCalibration& cal) {
+    Preferences prefs;
+    if (!prefs.begin(CAL_NVS_NAMESPACE, true)) {
+        return false;  // Namespace not created yet: never calibrated
+    }
+    BoardCalibration stored;
+    size_t length = prefs.getBytes(CAL_NVS_KEY, &stored, sizeof(stored));
+    prefs.end();
+    
+    if (length != sizeof(stored) || stored.version != CAL_VERSION || stored.size != sizeof(stored) ||
+        stored.crc != _crc(stored)) {
+        return false;
+    }
+    cal = stored;
+    return true;
+}
+
+bool CalibrationEngine::save(BoardCalibration& cal) {
+    cal.version = CAL_VERSION;
+    cal.size = sizeof(BoardCalibration);
+    cal.crc = _crc(cal);
+    
+    Preferences prefs;
+    if (!prefs.begin(CAL_NVS_NAMESPACE, false)) {
+        return false;
+    }
+    size_t written = prefs.putBytes(CAL_NVS_KEY, &cal, sizeof(cal));
+    prefs.end();
+    return written == sizeof(cal);
+}
+
+bool CalibrationEngine::erase() {
+    Preferences prefs;
+    if (!prefs.begin(CAL_NVS_NAMESPACE, false)) {
+        return false;
+    }
+    bool ok = prefs.clear();
+    prefs.end();
+    return ok;
+}
+
+const char* CalibrationEngine::mapName(CalibrationMap map) {
+    static const char* names[CAL_MAPS] = {"signal_a", "signal_b", "power", "input_a", "input_b"};
+    return map < CAL_MAPS ? names[map] : "unknown";
+}
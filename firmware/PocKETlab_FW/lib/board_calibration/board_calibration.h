@@ -0,0 +1,107 @@
+#ifndef BOARD_CALIBRATION_H
+#define BOARD_CALIBRATION_H
+
+#include <Arduino.h>
+
+// NVS storage
+#define CAL_NVS_NAMESPACE "pocketcal"
+#define CAL_NVS_KEY "table"
+#define CAL_VERSION 1
+
+// Piecewise-linear correction: nodes every 512 codes (0, 512, ..., 4096), values in 1/16 LSB
+#define CAL_PWL_POINTS 9
+#define CAL_PWL_SHIFT 9
+#define CAL_PWL_FRACTION 16
+#define CAL_CODE_MAX 4095
+#define CAL_MAX_POINTS 33            // Sweep points a fit accepts
+
+// Conversions the board calibration corrects. Each relates a 12-bit code to volts.
+enum CalibrationMap {
+    CAL_SIGNAL_DAC_A = 0,        // Signal DAC A code -> DAC voltage before the amplifier (FB_AO)
+    CAL_SIGNAL_DAC_B,            // Signal DAC B code -> DAC voltage before the amplifier (FB_A1)
+    CAL_POWER_DAC,               // Power DAC channel 0 code -> output voltage (FB_VOUT)
+    CAL_SIGNAL_ADC_A,            // MCP3202 CH0 code -> input voltage (loopback from signal output A)
+    CAL_SIGNAL_ADC_B,            // MCP3202 CH1 code -> input voltage (loopback from signal output B)
+    CAL_MAPS
+};
+
+// volts = gain * (code + correction(code)) + offset
+struct CalibrationEntry {
+    float gain;                  // V per LSB
+    float offset;                // V
+    int16_t pwl[CAL_PWL_POINTS]; // Code correction at the nodes, 1/16 LSB (all zero = straight line)
+    float residual;              // RMS fit residual after correction, V
+    uint8_t points;              // Sweep points behind the fit, 0 = never calibrated (nominal scaling)
+    uint8_t piecewise;
+};
+
+// The table kept in NVS. version/size/crc are filled in by CalibrationEngine::save().
+struct BoardCalibration {
+    uint16_t version;
+    uint16_t size;
+    CalibrationEntry map[CAL_MAPS];
+    uint32_t crc;
+};
+
+// An entry prepared for the conversions, so each one is a multiply-add plus an optional
+// fixed-point table lookup. scale folds in a gain outside the calibrated path (signal amplifier).
+//   volts = (code + correction(code)) * volts_gain + volts_offset
+//   code  = volts * code_gain + code_offset - correction(code)
+struct CalibrationCoefficients {
+    float volts_gain;
+    float volts_offset;
+    float code_gain;
+    float code_offset;
+    int16_t pwl[CAL_PWL_POINTS];
+    bool piecewise;
+};
+
+// Fit, storage and application of the per-board gain/offset tables
+class CalibrationEngine {
+public:
+    // Least-squares gain/offset over a sweep (codes ascending or not), then, if piecewise, the
+    // remaining residual sampled at the correction nodes. Fails with fewer than 2 points or a flat sweep.
+    static bool fit(const float* codes, const float* volts, uint8_t count, bool piecewise, CalibrationEntry& entry);
+
+    // Uncalibrated entry: a straight line through zero
+    static CalibrationEntry nominal(float gain);
+    static CalibrationCoefficients coefficients(const CalibrationEntry& entry, float scale);
+
+    // NVS copy. load() fails (leaving cal untouched) when nothing valid is stored.
+    static bool load(BoardCalibration& cal);
+    static bool save(BoardCalibration& cal);
+    static bool erase();
+
+    static const char* mapName(CalibrationMap map);   // "signal_a", "signal_b", "power", "input_a", "input_b"
+
+    // Correction at a code in 1/16 LSB, linear between the nodes (integer math)
+    static inline int32_t correction(const int16_t* pwl, int32_t code) {
+        if (code <= 0) return pwl[0];
+        if (code >= (CAL_PWL_POINTS - 1) << CAL_PWL_SHIFT) return pwl[CAL_PWL_POINTS - 1];
+        int32_t node = code >> CAL_PWL_SHIFT;
+        int32_t frac = code & ((1 << CAL_PWL_SHIFT) - 1);
+        return (pwl[node] * ((1 << CAL_PWL_SHIFT) - frac) + pwl[node + 1] * frac) >> CAL_PWL_SHIFT;
+    }
+
+    static inline float toVolts(const CalibrationCoefficients& c, float code) {
+        if (c.piecewise) {
+            code += (float)correction(c.pwl, (int32_t)code) * (1.0f / CAL_PWL_FRACTION);
+        }
+        return code * c.volts_gain + c.volts_offset;
+    }
+
+    static inline uint16_t toCode(const CalibrationCoefficients& c, float volts) {
+        float code = volts * c.code_gain + c.code_offset;
+        if (c.piecewise) {
+            code -= (float)correction(c.pwl, (int32_t)code) * (1.0f / CAL_PWL_FRACTION);
+        }
+        if (code < 0.0f) code = 0.0f;
+        if (code > (float)CAL_CODE_MAX) code = (float)CAL_CODE_MAX;
+        return (uint16_t)(code + 0.5f);
+    }
+
+private:
+    static uint32_t _crc(const BoardCalibration& cal);
+};
+
+#endif // BOARD_CALIBRATION_H
@@ -1,11 +1,33 @@
 #include "driver_control.h"
 #include <Arduino.h>
 #include <math.h>
+#include <mbedtls/base64.h>
+
+// Output channel drivers, indexed by DriverChannel
+static void stageSignalA(PocKETlabIO& io, float voltage) { io.setSignalVoltage(SIGNAL_CHANNEL_A, voltage); }
+static void stageSignalB(PocKETlabIO& io, float voltage) { io.setSignalVoltage(SIGNAL_CHANNEL_B, voltage); }
+static void stagePower(PocKETlabIO& io, float voltage) { io.setPowerVoltage(voltage); }
+static float readSignalA(PocKETlabIO& io) { return io.readSignalVoltage(SIGNAL_CHANNEL_A); }
+static float readSignalB(PocKETlabIO& io) { return io.readSignalVoltage(SIGNAL_CHANNEL_B); }
+static float readPower(PocKETlabIO& io) { return io.readPowerVoltage(); }
+
+static const ChannelDriver kChannelDrivers[CHANNEL_COUNT] = {
+    {stageSignalA, readSignalA},
+    {stageSignalB, readSignalB},
+    {stagePower, readPower}
+};
+
+static const char* const kChannelNames[CHANNEL_COUNT] = {"CH0", "CH1", "CH2"};
+
+static const char* const kModeNames[DRIVER_MODES] = {
+    "none", "va", "bode", "step", "impulse", "testbed", "control_system", "scope", "spectrum",
+    "impedance", "curve_tracer", "sequence", "recipe", "logger", "calibration"
+};
 
 // Basic constructor
-DriverControl::DriverControl(PostmanMQTT& postman, PocKETlabIO& io) : _postman(postman), _io(io), 
+DriverControl::DriverControl(PostmanMQTT& postman, PocKETlabIO& io, ScanScheduler& scan) : _postman(postman), _io(io), _scan(scan), 
     _testbed_running(false), _control_system_running(false), _va_running(false),
-    _bode_running(false), _step_running(false), _impulse_running(false) {
+    _bode_running(false), _step_running(false), _impulse_running(false), _recipe_vm(io) {
     // Initialize hardware or other setup
     Serial.println("DriverControl initialized.");
     
@@ -27,6 +49,11 @@ DriverControl::DriverControl(PostmanMQTT& postman, PocKETlabIO& io) : _postman(p
     _buffer_count = 0;
     _last_data_send = 0;
     
+    // Initialize system identification
+    _identify_task_handle = NULL;
+    _identify_running = false;
+    _identify_done = false;
+    
     // Initialize VA measurement
     _va_last_measurement = 0;
     _va_measurement_delay_ms = 100;  // 100ms between measurements
@@ -39,18 +66,123 @@ DriverControl::DriverControl(PostmanMQTT& postman, PocKETlabIO& io) : _postman(p
     _bode_buffer_count = 0;
     _bode_last_measurement = 0;
     _bode_measurement_delay_ms = 50;  // 50ms between frequency measurements
-    
-    // Initialize Step measurement
-    _step_buffer_count = 0;
-    _step_last_measurement = 0;
-    
-    // Initialize Impulse measurement
-    _impulse_buffer_count = 0;
-    _impulse_last_measurement = 0;
+    _bode_codes = nullptr;
+    _bode_raw[0] = nullptr;
+    _bode_raw[1] = nullptr;
+    _bode_block = nullptr;
+    _bode_spectrum_x = nullptr;
+    _bode_spectrum_y = nullptr;
+    _bode_points = nullptr;
+    _bode_results = nullptr;
+    _bode_free_queue = xQueueCreate(2, sizeof(uint8_t));
+    _bode_ready_queue = xQueueCreate(2, sizeof(uint8_t));
+    _bode_task_handle = NULL;
+    _bode_analysis_handle = NULL;
+    _bode_analyzed = 0;
+    _bode_results_ready = false;
+    
+    // Initialize Step/Impulse capture engine
+    _capture_task_handle = NULL;
+    _capture_running = false;
+    _capture_done = false;
+    _capture_config.publish_index = 0;
+    _capture_free_queue = xQueueCreate(2, sizeof(uint8_t));
+    _capture_ready_queue = xQueueCreate(2, sizeof(uint8_t));
+    _capture_stream_block = -1;
+    
+    // Initialize Scope
+    _scope_running = false;
+    _scope_buffers[0] = nullptr;
+    _scope_buffers[1] = nullptr;
+    _scope_min = nullptr;
+    _scope_max = nullptr;
+    _scope_frame_held = false;
+    _scope_frame_ready = false;
+    _scope_capturing = false;
+    _scope_task_handle = NULL;
+    
+    // Initialize Spectrum
+    _spectrum_running = false;
+    _spectrum_codes = nullptr;
+    _spectrum_ready = false;
+    _spectrum_capturing = false;
+    _spectrum_task_handle = NULL;
+    
+    // Initialize Impedance analyzer
+    _impedance_running = false;
+    _impedance_measuring = false;
+    _impedance_task_handle = NULL;
+    _impedance_queue = xQueueCreate(IMPEDANCE_QUEUE_LENGTH, sizeof(ImpedancePoint));
+    
+    // Initialize Curve tracer
+    _curve_running = false;
+    _curve_measuring = false;
+    _curve_task_handle = NULL;
+    _curve_queue = xQueueCreate(CURVE_QUEUE_LENGTH, sizeof(CurvePoint));
+    
+    // Initialize Sequence (the row table is allocated on first upload)
+    _sequence_running = false;
+    _sequence_executing = false;
+    _sequence_task_handle = NULL;
+    _sequence_rows = nullptr;
+    _sequence_config = SequenceConfig();
+    _sequence_queue = xQueueCreate(SEQUENCE_QUEUE_LENGTH, sizeof(SequenceSample));
+    
+    // Initialize Recipe VM: results wait for room in the queue rather than being dropped
+    _recipe_running = false;
+    _recipe_executing = false;
+    _recipe_task_handle = NULL;
+    _recipe_status = RECIPE_PASSED;
+    _recipe_duration_ms = 0;
+    strlcpy(_recipe_name, "recipe", sizeof(_recipe_name));
+    _recipe_queue = xQueueCreate(RECIPE_QUEUE_LENGTH, sizeof(RecipeResult));
+    _recipe_vm.setEmitCallback([this](const RecipeResult& result) {
+        while (_recipe_running && xQueueSend(_recipe_queue, &result, pdMS_TO_TICKS(10)) != pdTRUE) {
+        }
+    });
+    
+    // Initialize Power regulation (testbed option)
+    _regulation_running = false;
+    _regulation_config = RegulationConfig();
+    _regulation_timer = NULL;
+    _regulation_task_handle = NULL;
+    _regulation_voltage = 0.0f;
+    _regulation_current = 0.0f;
+    _regulation_command = 0.0f;
+    _regulation_trim = 0.0f;
+    _regulation_cc = false;
+    _regulation_reported_cc = false;
+    _regulation_overruns = 0;
+    
+    // Initialize Power protection reporting
+    _protection_reported_trips = 0;
+    
+    // Initialize Data logger (chunk buffers are allocated per run, the flash index on first use)
+    _logger_running = false;
+    _logger_sampling = false;
+    _logger_writing = false;
+    _logger_flash_error = false;
+    _logger_config = LoggerConfig();
+    _logger_timer = NULL;
+    _logger_sample_task_handle = NULL;
+    _logger_write_task_handle = NULL;
+    for (int i = 0; i < LOGGER_BUFFER_CHUNKS; ++i) { _logger_buffers[i] = nullptr; }
+    _logger_free_queue = xQueueCreate(LOGGER_BUFFER_CHUNKS, sizeof(uint8_t));
+    _logger_ready_queue = xQueueCreate(LOGGER_BUFFER_CHUNKS, sizeof(LoggerBlock));
+    
+    // Initialize Board calibration
+    _calibration_running = false;
+    _calibration_done = false;
+    _calibration_config = CalibrationConfig();
+    _calibration_error = nullptr;
+    _calibration_start_ms = 0;
+    _calibration_task_handle = NULL;
+    for (int i = 0; i < CAL_MAPS; ++i) { _calibration_status[i] = CAL_RUN_UNCHANGED; }
     
     // Initialize current mode tracking
-    _current_mode = "none";
+    _current_mode = DRIVER_MODE_NONE;
     for (int i = 0; i < 4; ++i) { _testbed_da_value_v[i] = NAN; _testbed_db_value_v[i] = NAN; }
+    for (int s = 0; s < SCAN_SOURCES; ++s) { _testbed_scan[s] = -1; }
 }
 
 // Basic destructor
@@ -58,6 +190,9 @@ DriverControl::~DriverControl() {
     // Stop control system task if running
     stopControlSystemTask();
     
+    // Stop system identification if running
+    stopIdentification();
+    
     // Stop VA measurement if running
     stopVAMeasurement();
     
@@ -70,6 +205,43 @@ DriverControl::~DriverControl() {
     // Stop Impulse measurement if running
     stopImpulseMeasurement();
     
+    // Stop Scope if running
+    stopScope();
+    
+    // Stop Spectrum if running
+    stopSpectrum();
+    
+    // Stop Impedance analyzer if running
+    stopImpedance();
+    
+    // Stop Curve tracer if running
+    stopCurveTracer();
+    
+    // Stop Sequence if running
+    stopSequence();
+    free(_sequence_rows);
+    _sequence_rows = nullptr;
+    
+    // Stop Recipe if running
+    stopRecipe();
+    
+    // Stop Power regulation if running
+    stopPowerRegulation();
+    if (_regulation_timer != NULL) {
+        esp_timer_delete(_regulation_timer);
+        _regulation_timer = NULL;
+    }
+    
+    // Stop Data logger if running
+    stopLogger();
+    if (_logger_timer != NULL) {
+        esp_timer_delete(_logger_timer);
+        _logger_timer = NULL;
+    }
+    
+    // Stop Board calibration if running (the previous table stays in effect)
+    stopCalibration();
+    
     // Clean up StateSpaceControl objects
     if (_simulation != nullptr) {
         delete _simulation;
@@ -84,6 +256,36 @@ DriverControl::~DriverControl() {
     if (_data_mutex != NULL) {
         vSemaphoreDelete(_data_mutex);
     }
+    if (_capture_free_queue != NULL) {
+        vQueueDelete(_capture_free_queue);
+    }
+    if (_impedance_queue != NULL) {
+        vQueueDelete(_impedance_queue);
+    }
+    if (_curve_queue != NULL) {
+        vQueueDelete(_curve_queue);
+    }
+    if (_sequence_queue != NULL) {
+        vQueueDelete(_sequence_queue);
+    }
+    if (_recipe_queue != NULL) {
+        vQueueDelete(_recipe_queue);
+    }
+    if (_logger_free_queue != NULL) {
+        vQueueDelete(_logger_free_queue);
+    }
+    if (_logger_ready_queue != NULL) {
+        vQueueDelete(_logger_ready_queue);
+    }
+    if (_bode_free_queue != NULL) {
+        vQueueDelete(_bode_free_queue);
+    }
+    if (_bode_ready_queue != NULL) {
+        vQueueDelete(_bode_ready_queue);
+    }
+    if (_capture_ready_queue != NULL) {
+        vQueueDelete(_capture_ready_queue);
+    }
     
     // Cleanup resources
     Serial.println("DriverControl destroyed.");
@@ -105,6 +307,39 @@ void DriverControl::handleCommand(const JsonDocument& doc) {
         return;
     }
     
+    // Full-resolution read-back of the held scope frame (action: "fetch")
+    if (doc["payload"]["action"].is<const char*>() && 
+        strcmp(doc["payload"]["action"].as<const char*>(), "fetch") == 0 && strcmp(mode, "scope") == 0) {
+        handleScopeFetch(doc["payload"]["settings"].as<JsonObjectConst>());
+        return;
+    }
+    
+    // Re-enable the power output after a protection trip (action: "reset")
+    if (doc["payload"]["action"].is<const char*>() && 
+        strcmp(doc["payload"]["action"].as<const char*>(), "reset") == 0 && strcmp(mode, "protection") == 0) {
+        handleProtectionReset();
+        return;
+    }
+    
+    // Calibration table actions, both in the payload like stop: report the table in effect
+    // (action: "status") or go back to nominal scaling and erase the stored one (action: "reset")
+    if (doc["payload"]["action"].is<const char*>() && strcmp(mode, "calibration") == 0) {
+        const char* action = doc["payload"]["action"].as<const char*>();
+        if (strcmp(action, "status") == 0) {
+            publishCalibration(false, false);
+            return;
+        }
+        if (strcmp(action, "reset") == 0) {
+            handleCalibrationReset();
+            return;
+        }
+    }
+    
+    // Power regulation holds the testbed setpoint; other modes that drive outputs take the power DAC over
+    if (strcmp(mode, "testbed") != 0 && strcmp(mode, "logger") != 0 && strcmp(mode, "protection") != 0) {
+        stopPowerRegulation();
+    }
+    
     // Handle regular payload-based commands with settings
     if (strcmp(mode, "va") == 0) {
         handleVA(doc["payload"]["settings"].as<JsonObjectConst>());
@@ -118,6 +353,24 @@ void DriverControl::handleCommand(const JsonDocument& doc) {
         handleTestbed(doc["payload"]["settings"].as<JsonObjectConst>());
     } else if (strcmp(mode, "control_system") == 0) {
         handleControlSystem(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "scope") == 0) {
+        handleScope(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "spectrum") == 0) {
+        handleSpectrum(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "impedance") == 0) {
+        handleImpedance(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "curve_tracer") == 0) {
+        handleCurveTracer(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "sequence") == 0) {
+        handleSequence(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "recipe") == 0) {
+        handleRecipe(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "logger") == 0) {
+        handleLogger(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "protection") == 0) {
+        handleProtection(doc["payload"]["settings"].as<JsonObjectConst>());
+    } else if (strcmp(mode, "calibration") == 0) {
+        handleCalibration(doc["payload"]["settings"].as<JsonObjectConst>());
     } else {
         Serial.printf("ERROR: Unknown mode: %s\n", mode);
     }
@@ -134,18 +387,24 @@ void DriverControl::loop() {
 
             JsonObject payload = doc["payload"].to<JsonObject>();
             JsonObject readings = payload["readings"].to<JsonObject>();
-            readings["output_voltage"] = roundTo3Decimals(_io.readPowerVoltage());
-            readings["output_current"] = roundTo3Decimals(_io.readPowerCurrent());
-            readings["input_ch0"] = roundTo3Decimals(_io.readSignalVoltage(SIGNAL_CHANNEL_A));
-            readings["input_ch1"] = roundTo3Decimals(_io.readSignalVoltage(SIGNAL_CHANNEL_B));
+            if (_regulation_running) {
+                // Filtered feedback from the regulation loop
+                readings["output_voltage"] = roundTo3Decimals(_regulation_voltage);
+                readings["output_current"] = roundTo3Decimals(_regulation_current);
+            } else {
+                readings["output_voltage"] = roundTo3Decimals(testbedReading(SCAN_POWER_VOLTAGE));
+                readings["output_current"] = roundTo3Decimals(testbedReading(SCAN_POWER_CURRENT));
+            }
+            readings["input_ch0"] = roundTo3Decimals(testbedReading(SCAN_SIGNAL_A));
+            readings["input_ch1"] = roundTo3Decimals(testbedReading(SCAN_SIGNAL_B));
 
             // DA/DB channels: publish voltages only (0 or 3.3 for digital; 0..3.3 for analog)
             JsonArray daArr = readings["da"].to<JsonArray>();
             for (uint8_t i = 0; i < 4; ++i) {
                 float v = _testbed_da_value_v[i];
                 if (isnan(v)) {
-                    // If not explicitly set, read analog voltage from pin
-                    v = _io.analogReadDA(i);
+                    // If not explicitly set, the analog voltage on the pin
+                    v = testbedReading((ScanSource)(SCAN_DA0 + i));
                 }
                 daArr.add(roundTo3Decimals(v));
             }
@@ -155,19 +414,54 @@ void DriverControl::loop() {
                 float v = _testbed_db_value_v[i];
                 if (isnan(v)) {
                     // Fallback to digital read mapped to 0/3.3V
-                    int pin = (i==0?PIN_DB0:i==1?PIN_DB1:i==2?PIN_DB2:PIN_DB3);
+                    int pin = PocKETlabIO::outputPin(4 + i);
                     v = (digitalRead(pin) == HIGH) ? 3.3f : 0.0f;
                 }
                 dbArr.add(roundTo3Decimals(v));
             }
 
-            payload["status"] = "regulating"; // Placeholder
+            if (_io.isPowerTripped()) {
+                payload["status"] = "fault";
+            } else {
+                payload["status"] = _regulation_running && _regulation_cc ? "current_limited" : "regulating";
+            }
             payload["continuous"] = true;
+            if (_regulation_running) {
+                JsonObject regulation = payload["regulation"].to<JsonObject>();
+                regulation["command"] = roundTo3Decimals(_regulation_command);
+                regulation["trim"] = roundTo3Decimals(_regulation_trim);
+                regulation["overruns"] = (uint32_t)_regulation_overruns;
+            }
+            JsonObject scan = payload["scan"].to<JsonObject>();
+            scan["tick_rate"] = roundTo3Decimals(_scan.getTickRate());
+            scan["achieved_rate"] = roundTo3Decimals(_scan.getAchievedRate(_testbed_scan[SCAN_SIGNAL_A]));
+            scan["overruns"] = _scan.getOverruns();
 
             _postman.publish("data", doc);
         }
     }
     
+    // Apply, save and report a finished calibration run
+    if (_calibration_running && _calibration_done) {
+        performCalibrationPublish();
+    }
+    
+    // Report power protection trips (the output is already off)
+    if (_io.getLastTrip().count != _protection_reported_trips) {
+        performProtectionPublish();
+    }
+    
+    // Announce CV/CC crossovers of the power regulation loop as they happen
+    if (_regulation_running && _regulation_cc != _regulation_reported_cc) {
+        _regulation_reported_cc = _regulation_cc;
+        _postman.sendStatus(_regulation_reported_cc ? "current_limited" : "regulating", "testbed");
+    }
+    
+    // Publish identification progress and the fitted model
+    if (_identify_running) {
+        performIdentifyPublish();
+    }
+    
     // Handle buffered data sending for control system (every 200ms to match buffer fill rate)
     if (_control_system_running) {
         // Buffer fills every 200ms at 100Hz with 20 samples (20 / 100Hz = 0.2s)
@@ -187,20 +481,53 @@ void DriverControl::loop() {
     
     // Handle Bode characteristics measurement
     if (_bode_running) {
-        if (millis() - _bode_last_measurement >= _bode_measurement_delay_ms) {
+        if (_bode_config.method != BODE_METHOD_STEPPED) {
+            // Broadband: the Bode tasks measure, loop() only publishes
+            performBroadbandBodePublish();
+        } else if (millis() - _bode_last_measurement >= _bode_measurement_delay_ms) {
             performBodeMeasurement();
             _bode_last_measurement = millis();
         }
     }
     
-    // Handle Step response measurement
-    if (_step_running) {
-        performStepMeasurement();
+    // Handle Step/Impulse response: the capture task samples, loop() only publishes
+    if (_step_running || _impulse_running) {
+        performCapturePublish();
     }
     
-    // Handle Impulse response measurement
-    if (_impulse_running) {
-        performImpulseMeasurement();
+    // Publish decimated scope frames as the scope task completes them
+    if (_scope_running) {
+        performScopePublish();
+    }
+    
+    // Publish spectrum updates as the spectrum task completes them
+    if (_spectrum_running) {
+        performSpectrumPublish();
+    }
+    
+    // Publish impedance points as the impedance task measures them
+    if (_impedance_running) {
+        performImpedancePublish();
+    }
+    
+    // Publish curve tracer points, one curve per series
+    if (_curve_running) {
+        performCurveTracerPublish();
+    }
+    
+    // Publish sequence captures as rows execute
+    if (_sequence_running) {
+        performSequencePublish();
+    }
+    
+    // Publish recipe results as the recipe emits them
+    if (_recipe_running) {
+        performRecipePublish();
+    }
+    
+    // Report logger progress; sampling and flash writes carry on without loop()
+    if (_logger_running) {
+        performLoggerPublish();
     }
 }
 
@@ -211,40 +538,46 @@ void DriverControl::handleVA(JsonObjectConst settings) {
     stopVAMeasurement();
     
     // Parse settings - support both API spec format and legacy flat format
-    String channel;
-    String mode_type;
+    const char* channel_name;
+    const char* mode_name;
     
     // Try API spec format first (nested structure)
     if (settings["channel"].is<const char*>()) {
-        channel = settings["channel"].as<String>();
+        channel_name = settings["channel"].as<const char*>();
     } else if (settings["va_channel"].is<const char*>()) {
         // Legacy flat format
-        channel = settings["va_channel"].as<String>();
+        channel_name = settings["va_channel"].as<const char*>();
     } else {
         _postman.sendError("E001", "Missing channel parameter", "va", "channel", "", "Provide CH0, CH1, or CH2");
         return;
     }
     
     if (settings["mode_type"].is<const char*>()) {
-        mode_type = settings["mode_type"].as<String>();
+        mode_name = settings["mode_type"].as<const char*>();
     } else if (settings["va_mode_type"].is<const char*>()) {
         // Legacy flat format
-        mode_type = settings["va_mode_type"].as<String>();
+        mode_name = settings["va_mode_type"].as<const char*>();
     } else {
         _postman.sendError("E001", "Missing mode_type parameter", "va", "mode_type", "", "Provide CV or CC");
         return;
     }
     
-    // Validate channel and mode combination
-    if (!isValidVAChannel(channel, mode_type)) {
+    // Validate channel and mode combination (all channels support both CV and CC)
+    DriverChannel channel;
+    bool valid_mode = strcmp(mode_name, "CV") == 0 || strcmp(mode_name, "CC") == 0;
+    if (!parseChannel(channel_name, channel) || !valid_mode) {
         _postman.sendError("E007", "Channel conflict or invalid mode", "va", "channel/mode_type", 
-                          (channel + "/" + mode_type).c_str(), "Valid channels: CH0, CH1, CH2; Valid modes: CV, CC");
+                          (String(channel_name) + "/" + mode_name).c_str(), "Valid channels: CH0, CH1, CH2; Valid modes: CV, CC");
         return;
     }
+    const VAModeType mode_type = strcmp(mode_name, "CV") == 0 ? VA_MODE_CV : VA_MODE_CC;
     
-    // Configure measurement
+    // Configure measurement. CH0 and CH1 both drive signal A: the DUT sits between the
+    // outputs with the shunt on B
     _va_config.channel = channel;
     _va_config.mode_type = mode_type;
+    _va_config.power_sense = channel == CHANNEL_CH2;
+    _va_config.drive = channelDriver(_va_config.power_sense ? CHANNEL_CH2 : CHANNEL_CH0);
     
     // Parse shunt resistance (required for current calculation)
     if (settings["shunt_resistance"].is<float>()) {
@@ -264,16 +597,20 @@ void DriverControl::handleVA(JsonObjectConst settings) {
     _va_config.cc_output_voltage = 0.0f;
     _va_config.output_voltage = 0.0f;  // Start from 0V output
     _va_config.capped = false;
+    _va_config.cv_slope = 1.0f;  // Assume the whole drive appears across the DUT until measured
+    _va_config.last_device_voltage = 0.0f;
+    _va_config.cv_has_history = false;
+    _va_config.solver_iterations = 0;
     
     // Set max output voltage based on channel
-    if (_va_config.channel == "CH0" || _va_config.channel == "CH1") {
+    if (!_va_config.power_sense) {
         _va_config.max_output_voltage = _io.getSignalVoltageRange();  // ~13.7V
     } else {
         _va_config.max_output_voltage = _io.getPowerVoltageRange();   // ~13.5V
     }
     
     // Parse voltage/current settings - support both nested and flat formats
-    if (mode_type == "CV") {
+    if (mode_type == VA_MODE_CV) {
         // Try nested cv_settings first (API spec format)
         if (settings["cv_settings"].is<JsonObjectConst>()) {
             JsonObjectConst cv = settings["cv_settings"].as<JsonObjectConst>();
@@ -297,7 +634,75 @@ void DriverControl::handleVA(JsonObjectConst settings) {
         // Calculate total steps for CV mode
         _va_config.total_steps = (int)(((_va_config.end_voltage - _va_config.start_voltage) / _va_config.step_voltage) + 1);
         
-    } else if (mode_type == "CC") {
+        // Optional pulsed bias: each DAC update becomes a short hardware-timed pulse
+        _va_config.pulsed = false;
+        _va_config.pulse_late_count = 0;
+        _va_config.pulse_timeout_count = 0;
+        if (settings["pulse"].is<JsonObjectConst>()) {
+            JsonObjectConst pulse = settings["pulse"].as<JsonObjectConst>();
+            int width_us = pulse["width_us"].is<int>() ? pulse["width_us"].as<int>() : 500;
+            int sample_delay_us = pulse["sample_delay_us"].is<int>() ? pulse["sample_delay_us"].as<int>() : width_us / 2;
+            int samples = pulse["samples"].is<int>() ? pulse["samples"].as<int>() : 4;
+            float duty_cycle = pulse["duty_cycle"].is<float>() ? pulse["duty_cycle"].as<float>() : 0.01f;
+            float idle_voltage = pulse["idle_voltage"].is<float>() ? pulse["idle_voltage"].as<float>() : 0.0f;
+            
+            // Each burst sample pair is ~60us on the 1MHz bus, staging the idle code takes ~30us
+            const int US_PER_SAMPLE_PAIR = 60;
+            if (width_us < 100 || width_us > 10000 || samples < 1 || samples > VA_PULSE_MAX_SAMPLES ||
+                sample_delay_us < 50 || sample_delay_us + samples * US_PER_SAMPLE_PAIR >= width_us) {
+                _postman.sendError("E001", "Pulse timing out of range", "va", "pulse", "", 
+                                  "width_us 100-10000, samples 1-16, 50 <= sample_delay_us and sample window inside the pulse");
+                return;
+            }
+            if (duty_cycle < 0.001f || duty_cycle > 0.5f) {
+                _postman.sendError("E001", "Pulse duty cycle out of range", "va", "pulse.duty_cycle", "", 
+                                  "Duty cycle must be 0.001 to 0.5");
+                return;
+            }
+            if (width_us / duty_cycle > VA_MAX_PULSE_PERIOD_US) {
+                _postman.sendError("E001", "Pulse period too long", "va", "pulse.duty_cycle", "", 
+                                  "width_us / duty_cycle must be at most 1000000 (1s per pulse)");
+                return;
+            }
+            if (_va_config.power_sense) {
+                // FB_IOUT comes from the feedback scan (one value per 500us frame), not from inside the pulse
+                _postman.sendError("E001", "Pulsed bias needs a signal channel", "va", "pulse", "", 
+                                  "Pulses are only available on CH0/CH1: the power current cannot be sampled inside a pulse");
+                return;
+            }
+            if (idle_voltage < 0.0f || idle_voltage > _va_config.max_output_voltage) {
+                _postman.sendError("E001", "Pulse idle voltage out of range", "va", "pulse.idle_voltage", "", 
+                                  "Idle voltage must be within the channel output range");
+                return;
+            }
+            _va_config.pulsed = true;
+            _va_config.pulse_width_us = width_us;
+            _va_config.pulse_sample_delay_us = sample_delay_us;
+            _va_config.pulse_samples = samples;
+            _va_config.pulse_duty_cycle = duty_cycle;
+            _va_config.pulse_idle_voltage = idle_voltage;
+        }
+        
+        // Optional adaptive sampling: step_voltage becomes the finest spacing refinement may reach
+        _va_config.adaptive = false;
+        if (settings["sampling"].is<JsonObjectConst>()) {
+            JsonObjectConst sampling = settings["sampling"].as<JsonObjectConst>();
+            if (sampling["mode"].is<const char*>() && strcmp(sampling["mode"].as<const char*>(), "adaptive") == 0) {
+                int max_points = sampling["max_points"].is<int>() ? sampling["max_points"].as<int>() : 40;
+                int initial_points = sampling["initial_points"].is<int>() ? sampling["initial_points"].as<int>() : 9;
+                
+                if (initial_points < 3 || max_points < initial_points || max_points > VA_ADAPTIVE_MAX_POINTS) {
+                    _postman.sendError("E006", "Adaptive point budget out of range", "va", "sampling", "", 
+                                      "Use 3 <= initial_points <= max_points <= 128");
+                    return;
+                }
+                _va_config.adaptive = true;
+                _va_config.initial_points = initial_points;
+                _va_config.total_steps = max_points;
+            }
+        }
+        
+    } else {
         // Try nested cc_settings first (API spec format)
         if (settings["cc_settings"].is<JsonObjectConst>()) {
             JsonObjectConst cc = settings["cc_settings"].as<JsonObjectConst>();
@@ -320,14 +725,31 @@ void DriverControl::handleVA(JsonObjectConst settings) {
         }
         // Calculate total steps for CC mode
         _va_config.total_steps = (int)(((_va_config.end_current - _va_config.start_current) / _va_config.step_current) + 1);
+        
+        if (settings["sampling"].is<JsonObjectConst>() && settings["sampling"]["mode"].is<const char*>() &&
+            strcmp(settings["sampling"]["mode"].as<const char*>(), "adaptive") == 0) {
+            _postman.sendError("E001", "Adaptive sampling requires CV mode", "va", "sampling", "adaptive", 
+                              "Use uniform sampling for CC sweeps");
+            return;
+        }
+        if (settings["pulse"].is<JsonObjectConst>()) {
+            _postman.sendError("E001", "Pulsed measurement requires CV mode", "va", "pulse", "", 
+                              "Use CV mode for pulsed I-V sweeps");
+            return;
+        }
+        _va_config.adaptive = false;
+        _va_config.pulsed = false;
     }
     
     // Initialize measurement state
     _va_config.current_step = 0;
     _va_buffer_count = 0;  // Reset buffer for new measurement
+    _va_adaptive_count = 0;
+    _va_adaptive_grid_index = 0;
+    _va_adaptive_limit = _va_config.end_voltage;
     _va_running = true;
     _va_last_measurement = millis();
-    _current_mode = "va";  // Set current mode
+    _current_mode = DRIVER_MODE_VA;  // Set current mode
     
     // Calculate estimated duration (100ms per measurement + some overhead)
     int estimated_duration = (_va_config.total_steps * _va_measurement_delay_ms) / 1000 + 5;
@@ -336,7 +758,7 @@ void DriverControl::handleVA(JsonObjectConst settings) {
     _postman.sendResponse("va", "success", "VA measurement started", estimated_duration);
     
     Serial.printf("VA measurement started: %s mode on %s, %d steps, ~%ds\n", 
-                  mode_type.c_str(), channel.c_str(), _va_config.total_steps, estimated_duration);
+                  mode_name, channel_name, _va_config.total_steps, estimated_duration);
 }
 
 void DriverControl::handleBode(JsonObjectConst settings) {
@@ -344,17 +766,25 @@ void DriverControl::handleBode(JsonObjectConst settings) {
     
     // Stop any existing Bode measurement
     stopBodeMeasurement();
+    if (_bode_task_handle != NULL || _bode_analysis_handle != NULL) {
+        // The old task timed out stopping and still owns the buffers
+        _postman.sendError("E006", "Previous Bode measurement still stopping", "bode", "", "", "Retry in a moment");
+        return;
+    }
     
-    _current_mode = "bode";
+    _current_mode = DRIVER_MODE_BODE;
     
     // Parse settings according to API spec
-    String channel;
-    if (settings["channel"].is<const char*>()) {
-        channel = settings["channel"].as<String>();
-    } else {
+    DriverChannel channel;
+    if (!settings["channel"].is<const char*>()) {
         _postman.sendError("E001", "Missing channel parameter", "bode", "channel", "", "Provide CH0, CH1, or CH2");
         return;
     }
+    if (!parseChannel(settings["channel"].as<const char*>(), channel)) {
+        _postman.sendError("E001", "Invalid channel", "bode", "channel", settings["channel"].as<const char*>(), 
+                          "Provide CH0, CH1, or CH2");
+        return;
+    }
     
     // Parse frequency range
     JsonObjectConst freq_range = settings["frequency_range"].as<JsonObjectConst>();
@@ -388,8 +818,24 @@ void DriverControl::handleBode(JsonObjectConst settings) {
         return;
     }
     
+    const char* method = settings["method"].is<const char*>() ? settings["method"].as<const char*>() : "stepped";
+    if (strcmp(method, "stepped") == 0) {
+        _bode_config.method = BODE_METHOD_STEPPED;
+    } else if (strcmp(method, "multisine") == 0) {
+        _bode_config.method = BODE_METHOD_MULTISINE;
+    } else if (strcmp(method, "chirp") == 0) {
+        _bode_config.method = BODE_METHOD_CHIRP;
+    } else {
+        _postman.sendError("E001", "Invalid Bode method", "bode", "method", method, 
+                          "Use stepped, multisine or chirp");
+        return;
+    }
+    _bode_config.averages = settings["averages"].is<int>() ? settings["averages"].as<int>() : 4;
+    _bode_config.offset = settings["offset"].is<float>() ? settings["offset"].as<float>() : output_voltage;
+    
     // Configure Bode measurement
     _bode_config.channel = channel;
+    _bode_config.driver = channelDriver(channel);
     _bode_config.freq_from = freq_from;
     _bode_config.freq_to = freq_to;
     _bode_config.points_per_decade = points_per_decade;
@@ -404,6 +850,13 @@ void DriverControl::handleBode(JsonObjectConst settings) {
         return;
     }
     
+    if (_bode_config.method != BODE_METHOD_STEPPED) {
+        if (!startBroadbandBode()) {
+            _current_mode = DRIVER_MODE_NONE;
+        }
+        return;
+    }
+    
     // Initialize measurement state
     _bode_buffer_count = 0;
     _bode_running = true;
@@ -416,30 +869,34 @@ void DriverControl::handleBode(JsonObjectConst settings) {
     _postman.sendResponse("bode", "success", "Bode measurement started", estimated_duration);
     
     Serial.printf("Bode measurement started: %s, %.1fHz-%.1fHz, %d points/decade, %d total points\n", 
-                  channel.c_str(), freq_from, freq_to, points_per_decade, _bode_config.total_points);
+                  channelName(channel), freq_from, freq_to, points_per_decade, _bode_config.total_points);
 }
 
 void DriverControl::handleStep(JsonObjectConst settings) {
     Serial.println("Handling Step Response command");
     
-    // Stop any existing Step measurement
+    // Stop any existing Step measurement (and Impulse, which shares the capture engine)
     stopStepMeasurement();
+    stopImpulseMeasurement();
     
-    _current_mode = "step";
+    _current_mode = DRIVER_MODE_STEP;
 
     // Parse settings according to API spec
-    String channel;
-    if (settings["channel"].is<const char*>()) {
-        channel = settings["channel"].as<String>();
-    } else {
+    DriverChannel channel;
+    if (!settings["channel"].is<const char*>()) {
         _postman.sendError("E001", "Missing channel parameter", "step", "channel", "", "Provide CH0, CH1, or CH2");
         return;
     }
+    if (!parseChannel(settings["channel"].as<const char*>(), channel)) {
+        _postman.sendError("E001", "Invalid channel", "step", "channel", settings["channel"].as<const char*>(), 
+                          "Provide CH0, CH1, or CH2");
+        return;
+    }
     
     float voltage = settings["voltage"].as<float>();
     float measurement_time = settings["measurement_time"].as<float>();
 
-    Serial.printf("Channel: %s, Voltage: %.2fV, Time: %.3fs\n", channel.c_str(), voltage, measurement_time);
+    Serial.printf("Channel: %s, Voltage: %.2fV, Time: %.3fs\n", channelName(channel), voltage, measurement_time);
 
     // Validate parameters according to API spec constraints
     if (voltage < 0 || voltage > 20) {
@@ -459,32 +916,48 @@ void DriverControl::handleStep(JsonObjectConst settings) {
     _step_config.voltage = voltage;
     _step_config.measurement_time = measurement_time;
     _step_config.total_points = STEP_DATA_POINTS;  // Fixed 200 points per API spec
-    _step_config.current_point = 0;
-    _step_config.time_step = measurement_time / (STEP_DATA_POINTS - 1);  // Time between samples
-    _step_config.start_time = 0;  // Will be set when measurement starts
     
-    // Initialize measurement state
-    _step_buffer_count = 0;
+    // Capture engine: response is read back on the stimulated channel
+    static const CaptureSource stimulus[CHANNEL_COUNT] = {
+        CAPTURE_SOURCE_SIGNAL_A, CAPTURE_SOURCE_SIGNAL_B, CAPTURE_SOURCE_POWER
+    };
+    if (!parseCaptureSettings(settings, "step", measurement_time, stimulus[channel])) {
+        return;
+    }
+    _capture_config.level = voltage;
+    _capture_config.pulse_us = 0;
+    _capture_config.stimulus = stimulus[channel];
+    _capture_config.source = _capture_config.stimulus;
+    _step_config.time_step = _capture_config.time_step_us / 1000000.0f;
+    
     _step_running = true;
-    _step_last_measurement = 0;
+    if (!startCaptureTask()) {
+        _step_running = false;
+        _current_mode = DRIVER_MODE_NONE;
+        _postman.sendError("E006", "Failed to start capture task", "step", "", "", "Retry the measurement");
+        return;
+    }
     
     // Calculate estimated duration
-    int estimated_duration = (int)(measurement_time + 2);  // measurement time + overhead
+    float cycle_s = (_capture_config.rest_us + (float)_capture_config.total_points * _capture_config.time_step_us) / 1000000.0f;
+    int estimated_duration = (int)(_capture_config.averages * cycle_s + 2);  // capture time + overhead
     
     // Send success response
     _postman.sendResponse("step", "success", "Step measurement started", estimated_duration);
 
-    Serial.printf("Step measurement started: %s, %.2fV, %.3fs, %d points\n", 
-                  channel.c_str(), voltage, measurement_time, _step_config.total_points);
+    Serial.printf("Step measurement started: %s, %.2fV, %.3fs, %d points, %d averages, %d pre-trigger\n", 
+                  channelName(channel), voltage, measurement_time, _step_config.total_points,
+                  _capture_config.averages, _capture_config.pre_points);
 }
 
 void DriverControl::handleImpulse(JsonObjectConst settings) {
     Serial.println("Handling Impulse Response command");
     
-    // Stop any existing Impulse measurement
+    // Stop any existing Impulse measurement (and Step, which shares the capture engine)
     stopImpulseMeasurement();
+    stopStepMeasurement();
     
-    _current_mode = "impulse";
+    _current_mode = DRIVER_MODE_IMPULSE;
 
     // Parse settings according to API spec
     float voltage = settings["voltage"].as<float>();
@@ -517,685 +990,4838 @@ void DriverControl::handleImpulse(JsonObjectConst settings) {
     _impulse_config.duration_us = duration_us;
     _impulse_config.measurement_time = measurement_time;
     _impulse_config.total_points = IMPULSE_DATA_POINTS;  // Fixed 200 points
-    _impulse_config.current_point = 0;
-    _impulse_config.time_step = measurement_time / (IMPULSE_DATA_POINTS - 1);
-    _impulse_config.start_time = 0;  // Will be set when measurement starts
-    _impulse_config.impulse_applied = false;
     
-    // Initialize measurement state
-    _impulse_buffer_count = 0;
+    // Capture engine: impulse on CH2 (power channel), response read back on the same output
+    if (!parseCaptureSettings(settings, "impulse", measurement_time, CAPTURE_SOURCE_POWER)) {
+        return;
+    }
+    _capture_config.level = voltage;
+    _capture_config.pulse_us = duration_us;
+    _capture_config.stimulus = CAPTURE_SOURCE_POWER;
+    _capture_config.source = CAPTURE_SOURCE_POWER;
+    _impulse_config.time_step = _capture_config.time_step_us / 1000000.0f;
+    
     _impulse_running = true;
-    _impulse_last_measurement = 0;
+    if (!startCaptureTask()) {
+        _impulse_running = false;
+        _current_mode = DRIVER_MODE_NONE;
+        _postman.sendError("E006", "Failed to start capture task", "impulse", "", "", "Retry the measurement");
+        return;
+    }
     
     // Calculate estimated duration
-    int estimated_duration = (int)(measurement_time + 1);  // measurement time + overhead
+    float cycle_s = (_capture_config.rest_us + (float)_capture_config.total_points * _capture_config.time_step_us) / 1000000.0f;
+    int estimated_duration = (int)(_capture_config.averages * cycle_s + 1);  // capture time + overhead
     
     // Send success response
     _postman.sendResponse("impulse", "success", "Impulse measurement started", estimated_duration);
 
-    Serial.printf("Impulse measurement started: %.2fV, %dus, %.3fs, %d points\n", 
-                  voltage, duration_us, measurement_time, _impulse_config.total_points);
+    Serial.printf("Impulse measurement started: %.2fV, %dus, %.3fs, %d points, %d averages, %d pre-trigger\n", 
+                  voltage, duration_us, measurement_time, _impulse_config.total_points,
+                  _capture_config.averages, _capture_config.pre_points);
 }
 
-void DriverControl::handleTestbed(JsonObjectConst settings) {
-    Serial.println("Handling Testbed command");
-
-    if (settings["action"].is<const char*>() && strcmp(settings["action"].as<const char*>(), "stop") == 0) {
-        Serial.println("Stopping Testbed mode");
-        _current_mode = "none";  // Reset mode when stopping
-        // TODO: Add logic to stop continuous monitoring
-        _postman.sendResponse("testbed", "success", "Testbed mode stopped");
-        return;
-    }
-
-    _current_mode = "testbed";  // Set current mode
-    float target_voltage = settings["target_voltage"].as<float>();
-    float current_limit = settings["current_limit"].as<float>();
-    bool continuous_monitoring = settings["continuous_monitoring"].as<bool>();
-    int update_interval_ms = settings["update_interval_ms"].as<int>();
-
-    Serial.printf("Target Voltage: %.2fV, Current Limit: %.2fA, Continuous: %d, Interval: %dms\n",
-                  target_voltage, current_limit, continuous_monitoring, update_interval_ms);
-
-    // Validate parameters
-    if (target_voltage < 0 || target_voltage > 20 || current_limit < 0 || current_limit > 3 || update_interval_ms < 50 || update_interval_ms > 1000) {
-        _postman.sendError("E001", "Parameter out of range", "testbed", "voltage/current/interval", "", "Check constraints");
+void DriverControl::handleScope(JsonObjectConst settings) {
+    Serial.println("Handling Scope command");
+    
+    // Stop any existing Scope session
+    stopScope();
+    if (_scope_task_handle != NULL) {
+        // The old task timed out stopping and still owns the buffers
+        _postman.sendError("E006", "Previous scope session still stopping", "scope", "", "", "Retry in a moment");
         return;
     }
-
-    // Apply power settings
-    _io.setPowerVoltage(target_voltage);
-    _io.setPowerCurrent(current_limit);
-    _io.updateAllDACs();
-
-    // Optional Signal DAC outputs (channels 0 and 1) in volts after amplifier
-    // Accepts either object: {"ch0": <V>, "ch1": <V>} or array: [<V0>, <V1>]
-    if (settings["signal"].is<JsonObjectConst>()) {
-        JsonObjectConst sig = settings["signal"].as<JsonObjectConst>();
-        bool ok = true;
-        if (sig["ch0"].is<float>()) {
-            ok &= _io.setSignalVoltage(SIGNAL_CHANNEL_A, sig["ch0"].as<float>());
-        }
-        if (sig["ch1"].is<float>()) {
-            ok &= _io.setSignalVoltage(SIGNAL_CHANNEL_B, sig["ch1"].as<float>());
-        }
-        _io.updateAllDACs();
-        if (!ok) {
-            String rangeStr = String("0-") + String(_io.getSignalVoltageRange(), 2) + "V";
-            _postman.sendError("E001", "Signal voltage out of range", "testbed", "signal", "", rangeStr.c_str());
-            return;
-        }
-    } else if (settings["signal"].is<JsonArrayConst>()) {
-        JsonArrayConst sig = settings["signal"].as<JsonArrayConst>();
-        bool ok = true;
-        if (sig.size() > 0 && sig[0].is<float>()) {
-            ok &= _io.setSignalVoltage(SIGNAL_CHANNEL_A, sig[0].as<float>());
-        }
-        if (sig.size() > 1 && sig[1].is<float>()) {
-            ok &= _io.setSignalVoltage(SIGNAL_CHANNEL_B, sig[1].as<float>());
-        }
-        _io.updateAllDACs();
-        if (!ok) {
-            String rangeStr = String("0-") + String(_io.getSignalVoltageRange(), 2) + "V";
-            _postman.sendError("E001", "Signal voltage out of range", "testbed", "signal", "", rangeStr.c_str());
-            return;
-        }
-    }
-
-    // Optional DA per-pin configuration/output
-    if (settings["da"].is<JsonArrayConst>()) {
-        JsonArrayConst daCfg = settings["da"].as<JsonArrayConst>();
-        for (uint8_t i = 0; i < daCfg.size() && i < 4; ++i) {
-            JsonObjectConst ch = daCfg[i];
-            const char* mode = ch["mode"].as<const char*>(); // "digital"|"analog"
-            float value_v = NAN;
-            if (ch["value"].is<float>()) value_v = ch["value"].as<float>();
-            // Legacy support: level 0/1
-            if (isnan(value_v) && ch["level"].is<int>()) value_v = (ch["level"].as<int>() != 0) ? 3.3f : 0.0f;
-            if (mode && strcmp(mode, "analog") == 0) {
-                if (isnan(value_v)) value_v = 0.0f;
-                _io.analogWriteDAVoltage(i, value_v);
-                _testbed_da_value_v[i] = value_v;
-            } else if (mode && strcmp(mode, "digital") == 0) {
-                bool high = (!isnan(value_v) && value_v >= 1.65f);
-                _io.digitalWriteDA(i, high);
-                _testbed_da_value_v[i] = high ? 3.3f : 0.0f;
+    
+    _current_mode = DRIVER_MODE_SCOPE;
+    ScopeConfig& cfg = _scope_config;
+    
+    // Channels: up to two of CH0/CH1 (signal ADC) and VOUT/IOUT (power feedback pins)
+    cfg.channel_count = 0;
+    if (settings["channels"].is<JsonArrayConst>()) {
+        for (JsonVariantConst ch : settings["channels"].as<JsonArrayConst>()) {
+            if (cfg.channel_count >= SCOPE_MAX_CHANNELS) {
+                _postman.sendError("E001", "Too many scope channels", "scope", "channels", "", 
+                                  "Select at most 2 channels");
+                _current_mode = DRIVER_MODE_NONE;
+                return;
             }
-        }
-    }
-
-    // Optional DB per-pin configuration/output
-    if (settings["db"].is<JsonArrayConst>()) {
-        JsonArrayConst dbCfg = settings["db"].as<JsonArrayConst>();
-        for (uint8_t i = 0; i < dbCfg.size() && i < 4; ++i) {
-            JsonObjectConst ch = dbCfg[i];
-            const char* mode = ch["mode"].as<const char*>(); // "digital"|"analog"
-            float value_v = NAN;
-            if (ch["value"].is<float>()) value_v = ch["value"].as<float>();
-            if (isnan(value_v) && ch["level"].is<int>()) value_v = (ch["level"].as<int>() != 0) ? 3.3f : 0.0f;
-            if (mode && strcmp(mode, "analog") == 0) {
-                if (isnan(value_v)) value_v = 0.0f;
-                _io.analogWriteDBVoltage(i, value_v);
-                _testbed_db_value_v[i] = value_v;
-            } else if (mode && strcmp(mode, "digital") == 0) {
-                bool high = (!isnan(value_v) && value_v >= 1.65f);
-                _io.digitalWriteDB(i, high);
-                _testbed_db_value_v[i] = high ? 3.3f : 0.0f;
+            const char* name = ch.is<const char*>() ? ch.as<const char*>() : "";
+            if (!parseScopeSource(name, cfg.sources[cfg.channel_count])) {
+                _postman.sendError("E001", "Invalid scope channel", "scope", "channels", name, 
+                                  "Use CH0, CH1, VOUT or IOUT");
+                _current_mode = DRIVER_MODE_NONE;
+                return;
             }
+            cfg.channel_count++;
         }
     }
-
-    // Start/stop streaming
-    _testbed_running = continuous_monitoring;
-    _testbed_update_interval = update_interval_ms;
-    _testbed_last_update = 0;
-
-    _postman.sendResponse("testbed", "success", "Testbed mode activated");
-}
-
-void DriverControl::handleControlSystem(JsonObjectConst settings) {
-    Serial.println("Handling Control System command");
-    _current_mode = "control_system";  // Set current mode
+    if (cfg.channel_count == 0) {
+        cfg.sources[0] = CAPTURE_SOURCE_SIGNAL_A;
+        cfg.channel_count = 1;
+    }
     
-    const char* cs_mode = settings["cs_mode"].as<const char*>();
+    float timebase = settings["timebase"].is<float>() ? settings["timebase"].as<float>() : 0.1f;
+    int record_length = settings["record_length"].is<int>() ? settings["record_length"].as<int>() : 2000;
+    float pre_trigger = settings["pre_trigger"].is<float>() ? settings["pre_trigger"].as<float>() : 10.0f;
+    int display_width = settings["display_width"].is<int>() ? settings["display_width"].as<int>() : 500;
     
-    if (strcmp(cs_mode, "controller") == 0) {
-        handleControllerMode(settings);
-    } else if (strcmp(cs_mode, "system") == 0) {
-        handleSystemMode(settings);
-    } else {
-        _postman.sendError("E004", "Invalid control system mode", "control_system", "cs_mode", cs_mode, "Use 'controller' or 'system'");
+    if (record_length < 100 || record_length > SCOPE_MAX_RECORD) {
+        _postman.sendError("E006", "Record length out of range", "scope", "record_length", "", 
+                          "Record length must be 100 to 16384 samples");
+        _current_mode = DRIVER_MODE_NONE;
         return;
     }
-}
-
-void DriverControl::handleControllerMode(JsonObjectConst settings) {
-    Serial.println("Control System - Controller Mode");
     
-    const char* controller_type = settings["cs_controller_type"].as<const char*>();
+    // ~30us per MCP3202 conversion on the 1MHz bus; the power feedback has a new value once per scan frame
+    uint32_t min_period_us = 0;
+    bool power_source = false;
+    for (int c = 0; c < cfg.channel_count; c++) {
+        if (cfg.sources[c] == CAPTURE_SOURCE_SIGNAL_A || cfg.sources[c] == CAPTURE_SOURCE_SIGNAL_B) {
+            min_period_us += 30;
+        } else {
+            power_source = true;
+        }
+    }
+    if (power_source) {
+        min_period_us = max(min_period_us, (uint32_t)FEEDBACK_FRAME_US);
+    }
+    uint32_t sample_period_us = (uint32_t)(timebase * 1000000.0f / record_length + 0.5f);
+    if (timebase <= 0.0f || timebase > 100.0f || sample_period_us < min_period_us) {
+        _postman.sendError("E001", "Timebase out of range", "scope", "timebase", "", 
+                          "Timebase / record_length must be at least 30us per signal channel and 500us with VOUT/IOUT, timebase at most 100s");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (pre_trigger < 0.0f || pre_trigger > 100.0f) {
+        _postman.sendError("E001", "Pre-trigger out of range", "scope", "pre_trigger", "", 
+                          "Pre-trigger must be 0% to 100%");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (display_width < 16 || display_width > SCOPE_MAX_DISPLAY_WIDTH) {
+        _postman.sendError("E001", "Display width out of range", "scope", "display_width", "", 
+                          "Display width must be 16 to 1024");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (!parseEncoding(settings, "scope", cfg.encoding)) {
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    if (strcmp(controller_type, "pid") == 0) {
-        float kp = settings["cs_pid_kp"].as<float>();
-        float ki = settings["cs_pid_ki"].as<float>();
-        float kd = settings["cs_pid_kd"].as<float>();
-        
-        Serial.printf("PID Controller - Kp: %.3f, Ki: %.3f, Kd: %.3f\n", kp, ki, kd);
-        
-        // TODO: Implement PID controller logic
-        _postman.sendResponse("control_system", "success", "PID Controller configured (placeholder)");
+    cfg.record_length = record_length;
+    cfg.sample_period_us = sample_period_us;
+    cfg.pre_points = min((int)(record_length * pre_trigger / 100.0f + 0.5f), record_length - 1);
+    cfg.display_width = display_width;
+    
+    // Trigger
+    JsonObjectConst trigger = settings["trigger"].as<JsonObjectConst>();
+    const char* trigger_source = trigger["source"].is<const char*>() ? trigger["source"].as<const char*>() 
+                                                                      : captureSourceName(cfg.sources[0]);
+    String trigger_type = trigger["type"].is<const char*>() ? trigger["type"].as<String>() : "rising";
+    float trigger_level = trigger["level"].is<float>() ? trigger["level"].as<float>() : 0.0f;
+    float hysteresis = trigger["hysteresis"].is<float>() ? trigger["hysteresis"].as<float>() : 0.05f;
+    
+    cfg.trigger_channel = -1;
+    for (int c = 0; c < cfg.channel_count; c++) {
+        if (strcmp(captureSourceName(cfg.sources[c]), trigger_source) == 0) cfg.trigger_channel = c;
+    }
+    if (cfg.trigger_channel < 0) {
+        _postman.sendError("E001", "Trigger source not captured", "scope", "trigger.source", trigger_source, 
+                          "Trigger source must be one of the selected channels");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (trigger_type == "rising") {
+        cfg.trigger_type = SCOPE_TRIGGER_RISING;
+    } else if (trigger_type == "falling") {
+        cfg.trigger_type = SCOPE_TRIGGER_FALLING;
+    } else if (trigger_type == "level") {
+        cfg.trigger_type = SCOPE_TRIGGER_LEVEL;
     } else {
-        Serial.println("Controller type not implemented yet");
-        _postman.sendResponse("control_system", "success", "Controller mode activated (placeholder)");
+        _postman.sendError("E001", "Invalid trigger type", "scope", "trigger.type", trigger_type.c_str(), 
+                          "Use rising, falling or level");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
     }
-}
-
-void DriverControl::handleSystemMode(JsonObjectConst settings) {
-    Serial.println("Control System - System Mode");
     
-    // Stop any running control system
-    stopControlSystemTask();
+    // Compare in raw codes so the sampling loop never converts
+    float volts_per_code = captureRawToVoltage(cfg.sources[cfg.trigger_channel], 1.0f);
+    float level_code = trigger_level / volts_per_code;
+    cfg.trigger_code = (uint16_t)constrain(level_code, 0.0f, (float)ADC_MAX_VALUE);
+    cfg.hysteresis_code = (uint16_t)constrain(hysteresis / volts_per_code, 1.0f, (float)ADC_MAX_VALUE);
+    
+    // Arming
+    String arm = settings["arm"].is<const char*>() ? settings["arm"].as<String>() : "auto";
+    if (arm == "single") {
+        cfg.arm = SCOPE_ARM_SINGLE;
+    } else if (arm == "normal") {
+        cfg.arm = SCOPE_ARM_NORMAL;
+    } else if (arm == "auto") {
+        cfg.arm = SCOPE_ARM_AUTO;
+    } else {
+        _postman.sendError("E001", "Invalid arm mode", "scope", "arm", arm.c_str(), "Use single, normal or auto");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    cfg.auto_timeout_us = max((uint32_t)100000, 2 * cfg.sample_period_us * (uint32_t)record_length);
+    
+    // Two frame buffers (capture + held) and the decimated frame, in PSRAM when available
+    size_t frame_bytes = (size_t)record_length * cfg.channel_count * sizeof(uint16_t);
+    size_t display_bytes = (size_t)display_width * cfg.channel_count * sizeof(uint16_t);
+    _scope_buffers[0] = (uint16_t*)ps_malloc(frame_bytes);
+    _scope_buffers[1] = (uint16_t*)ps_malloc(frame_bytes);
+    _scope_min = (uint16_t*)ps_malloc(display_bytes);
+    _scope_max = (uint16_t*)ps_malloc(display_bytes);
+    if (!_scope_buffers[0] || !_scope_buffers[1] || !_scope_min || !_scope_max) {
+        freeScopeBuffers();
+        _postman.sendError("E006", "Not enough memory for scope record", "scope", "record_length", "", 
+                          "Reduce record_length or the number of channels");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    // Parse system model
-    JsonObjectConst system_model = settings["system_model"];
-    if (system_model.isNull()) {
-        _postman.sendError("E004", "Missing system_model", "control_system", "system_model", "", "Provide system model matrices");
+    _scope_capture_buffer = 0;
+    _scope_frame_held = false;
+    _scope_frame_ready = false;
+    _scope_frame_count = 0;
+    _scope_running = true;
+    _scope_capturing = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        scopeTaskWrapper,           // Task function
+        "ScopeTask",                // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_scope_task_handle,        // Task handle
+        1                           // Core 1 (separate from WiFi on core 0)
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create scope task!");
+        _scope_task_handle = NULL;
+        _scope_capturing = false;
+        _scope_running = false;
+        freeScopeBuffers();
+        _postman.sendError("E006", "Failed to start scope task", "scope", "", "", "Retry the command");
+        _current_mode = DRIVER_MODE_NONE;
         return;
     }
     
-    // Parse A matrix (2x2)
-    JsonArrayConst A_array = system_model["A"];
-    if (A_array.size() != 2) {
-        _postman.sendError("E004", "Invalid A matrix size", "control_system", "A", "", "A matrix must be 2x2");
+    _postman.sendResponse("scope", "success", "Scope armed");
+    
+    Serial.printf("Scope started: %d ch, %d samples @ %uus, pre-trigger %d, trigger %s %s %.3fV, arm %s\n", 
+                  cfg.channel_count, record_length, (unsigned)sample_period_us, cfg.pre_points,
+                  trigger_source, trigger_type.c_str(), trigger_level, arm.c_str());
+}
+
+void DriverControl::handleSpectrum(JsonObjectConst settings) {
+    Serial.println("Handling Spectrum command");
+    
+    // Stop any existing Spectrum session
+    stopSpectrum();
+    if (_spectrum_task_handle != NULL) {
+        // The old task timed out stopping and still owns the buffers
+        _postman.sendError("E006", "Previous spectrum session still stopping", "spectrum", "", "", "Retry in a moment");
         return;
     }
     
-    Matrix<2,2> A_matrix;
-    for (int i = 0; i < 2; i++) {
-        JsonArrayConst row = A_array[i];
-        if (row.size() != 2) {
-            _postman.sendError("E004", "Invalid A matrix row size", "control_system", "A", "", "A matrix must be 2x2");
-            return;
-        }
-        for (int j = 0; j < 2; j++) {
-            A_matrix(i, j) = row[j].as<float>();
-        }
+    _current_mode = DRIVER_MODE_SPECTRUM;
+    SpectrumConfig& cfg = _spectrum_config;
+    
+    const char* channel = settings["channel"].is<const char*>() ? settings["channel"].as<const char*>() : "CH0";
+    int fft_size = settings["fft_size"].is<int>() ? settings["fft_size"].as<int>() : 1024;
+    float sample_rate = settings["sample_rate"].is<float>() ? settings["sample_rate"].as<float>() : 10000.0f;
+    int averages = settings["averages"].is<int>() ? settings["averages"].as<int>() : 4;
+    int display_bins = settings["bins"].is<int>() ? settings["bins"].as<int>() : 64;
+    cfg.continuous = settings["continuous"].is<bool>() ? settings["continuous"].as<bool>() : true;
+    const char* window_name = settings["window"].is<const char*>() ? settings["window"].as<const char*>() : "hann";
+    
+    if (!parseScopeSource(channel, cfg.source)) {
+        _postman.sendError("E001", "Invalid spectrum channel", "spectrum", "channel", channel, 
+                          "Use CH0, CH1, VOUT or IOUT");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (fft_size < SPECTRAL_MIN_FFT_SIZE || fft_size > SPECTRAL_MAX_FFT_SIZE || (fft_size & (fft_size - 1)) != 0) {
+        _postman.sendError("E001", "FFT size out of range", "spectrum", "fft_size", "", 
+                          "FFT size must be a power of two from 64 to 4096");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
     }
     
-    // Parse B matrix (2x1)
-    JsonArrayConst B_array = system_model["B"];
-    if (B_array.size() != 2) {
-        _postman.sendError("E004", "Invalid B matrix size", "control_system", "B", "", "B matrix must be 2x1");
+    // Same limits as the scope: ~30us per signal ADC read, one power feedback value per scan frame
+    float max_rate = (cfg.source == CAPTURE_SOURCE_SIGNAL_A || cfg.source == CAPTURE_SOURCE_SIGNAL_B) 
+                     ? 33000.0f : (float)FEEDBACK_FRAME_RATE;
+    if (sample_rate < 10.0f || sample_rate > max_rate) {
+        _postman.sendError("E001", "Sample rate out of range", "spectrum", "sample_rate", "", 
+                          "Sample rate must be 10Hz to 33kHz (CH0/CH1) or 2kHz (VOUT/IOUT)");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (averages < 1 || averages > SPECTRUM_MAX_AVERAGES) {
+        _postman.sendError("E001", "Averages out of range", "spectrum", "averages", "", 
+                          "Averages must be 1 to 64");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (display_bins < 16 || display_bins > SPECTRUM_MAX_BINS || display_bins > fft_size / 2 + 1) {
+        _postman.sendError("E001", "Bin count out of range", "spectrum", "bins", "", 
+                          "Bins must be 16 to 512 and at most fft_size/2 + 1");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    SpectralWindow window;
+    if (!SpectrumAnalyzer::parseWindow(window_name, window)) {
+        _postman.sendError("E001", "Invalid window", "spectrum", "window", window_name, 
+                          "Use rectangular, hann, hamming, blackman or flattop");
+        _current_mode = DRIVER_MODE_NONE;
         return;
     }
     
-    Matrix<2,1> B_matrix;
-    for (int i = 0; i < 2; i++) {
-        JsonArrayConst row = B_array[i];
-        if (row.size() != 1) {
-            _postman.sendError("E004", "Invalid B matrix row size", "control_system", "B", "", "B matrix must be 2x1");
-            return;
-        }
-        B_matrix(i, 0) = row[0].as<float>();
+    cfg.fft_size = fft_size;
+    cfg.sample_period_us = (uint32_t)(1000000.0f / sample_rate + 0.5f);
+    cfg.sample_rate = 1000000.0f / cfg.sample_period_us;
+    cfg.averages = averages;
+    cfg.display_bins = display_bins;
+    
+    _spectrum_codes = (uint16_t*)malloc(fft_size * sizeof(uint16_t));
+    if (_spectrum_codes == nullptr || !_spectrum_analyzer.begin(fft_size, window)) {
+        free(_spectrum_codes);
+        _spectrum_codes = nullptr;
+        _postman.sendError("E006", "Not enough memory for FFT", "spectrum", "fft_size", "", "Reduce fft_size");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
     }
     
-    // Parse C matrix (2x2)
-    JsonArrayConst C_array = system_model["C"];
-    if (C_array.size() != 2) {
-        _postman.sendError("E004", "Invalid C matrix size", "control_system", "C", "", "C matrix must be 2x2");
+    _spectrum_update_count = 0;
+    _spectrum_ready = false;
+    _spectrum_running = true;
+    _spectrum_capturing = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        spectrumTaskWrapper,        // Task function
+        "SpectrumTask",             // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_spectrum_task_handle,     // Task handle
+        1                           // Core 1: capture and FFT stay off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create spectrum task!");
+        _spectrum_task_handle = NULL;
+        stopSpectrum();
+        _postman.sendError("E006", "Failed to start spectrum task", "spectrum", "", "", "Retry the command");
         return;
     }
     
-    Matrix<2,2> C_matrix;
-    for (int i = 0; i < 2; i++) {
-        JsonArrayConst row = C_array[i];
-        if (row.size() != 2) {
-            _postman.sendError("E004", "Invalid C matrix row size", "control_system", "C", "", "C matrix must be 2x2");
+    float block_time = fft_size / cfg.sample_rate;
+    int estimated_duration = (int)(averages * block_time + 1);
+    _postman.sendResponse("spectrum", "success", "Spectrum analyzer started", estimated_duration);
+    
+    Serial.printf("Spectrum started: %s, N=%d, fs=%.1fHz, %d averages, %s window, %d bins\n", 
+                  channel, fft_size, cfg.sample_rate, averages, window_name, display_bins);
+}
+
+void DriverControl::handleImpedance(JsonObjectConst settings) {
+    Serial.println("Handling Impedance command");
+    
+    // Stop any existing Impedance session
+    stopImpedance();
+    
+    _current_mode = DRIVER_MODE_IMPEDANCE;
+    ImpedanceConfig& cfg = _impedance_config;
+    
+    cfg.shunt_resistance = settings["shunt_resistance"].is<float>() ? settings["shunt_resistance"].as<float>() : 1.0f;
+    float amplitude = settings["amplitude"].is<float>() ? settings["amplitude"].as<float>() : 0.5f;
+    float offset = settings["offset"].is<float>() ? settings["offset"].as<float>() : amplitude + IMPEDANCE_BIAS_HEADROOM;
+    float integration_time = settings["integration_time"].is<float>() ? settings["integration_time"].as<float>() : 0.1f;
+    int min_cycles = settings["min_cycles"].is<int>() ? settings["min_cycles"].as<int>() : 4;
+    int settle_cycles = settings["settle_cycles"].is<int>() ? settings["settle_cycles"].as<int>() : 2;
+    const char* equivalent = settings["equivalent"].is<const char*>() ? settings["equivalent"].as<const char*>() : "series";
+    cfg.continuous = settings["continuous"].is<bool>() ? settings["continuous"].as<bool>() : false;
+    
+    // Either one frequency or a log sweep in the Bode format
+    float max_frequency = IMPEDANCE_MAX_RATE / IMPEDANCE_MIN_SAMPLES_PER_CYCLE;
+    if (settings["frequency"].is<float>()) {
+        cfg.freq_from = cfg.freq_to = settings["frequency"].as<float>();
+        cfg.points_per_decade = 1;
+    } else if (settings["frequency_range"].is<JsonObjectConst>()) {
+        JsonObjectConst freq_range = settings["frequency_range"].as<JsonObjectConst>();
+        cfg.freq_from = freq_range["from"].as<float>();
+        cfg.freq_to = freq_range["to"].as<float>();
+        cfg.points_per_decade = freq_range["points_per_decade"].as<int>();
+        if (cfg.points_per_decade < 1 || cfg.points_per_decade > 100 || cfg.freq_from >= cfg.freq_to) {
+            _postman.sendError("E001", "Invalid frequency range", "impedance", "frequency_range", "", 
+                              "Need from < to and 1 to 100 points per decade");
+            _current_mode = DRIVER_MODE_NONE;
             return;
         }
-        for (int j = 0; j < 2; j++) {
-            C_matrix(i, j) = row[j].as<float>();
-        }
+    } else {
+        _postman.sendError("E001", "Missing frequency", "impedance", "frequency", "", 
+                          "Provide frequency or frequency_range");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
     }
     
-    // Parse D matrix (2x1)
-    JsonArrayConst D_array = system_model["D"];
-    if (D_array.size() != 2) {
-        _postman.sendError("E004", "Invalid D matrix size", "control_system", "D", "", "D matrix must be 2x1");
+    // Range first (written so NaN fails too): the point count below takes the log of to / from
+    if (!(cfg.freq_from >= 1.0f && cfg.freq_to <= max_frequency)) {
+        _postman.sendError("E001", "Frequency out of range", "impedance", "frequency", "", 
+                          "Frequency must be 1Hz to 2.5kHz");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    cfg.total_points = (int)(log10f(cfg.freq_to / cfg.freq_from) * cfg.points_per_decade) + 1;   // 1 for a single frequency
+    if (cfg.total_points > 500) {
+        _postman.sendError("E006", "Too many measurement points", "impedance", "points", "", 
+                          "Maximum 500 measurement points allowed");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.shunt_resistance <= 0.0f) {
+        _postman.sendError("E001", "Invalid shunt resistance", "impedance", "shunt_resistance", "", 
+                          "Shunt resistance must be positive");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    float range = _io.getSignalVoltageRange();
+    if (amplitude <= 0.0f || offset - amplitude < 0.0f || offset + amplitude > range) {
+        String hint = "offset +/- amplitude must stay within 0V to " + String(range, 1) + "V";
+        _postman.sendError("E001", "Drive does not fit the output range", "impedance", "amplitude", "", hint.c_str());
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (integration_time < 0.001f || integration_time > 10.0f || min_cycles < 1 || min_cycles > 1000 || 
+        settle_cycles < 0 || settle_cycles > 100) {
+        _postman.sendError("E001", "Integration settings out of range", "impedance", "integration_time", "", 
+                          "integration_time 0.001 to 10s, min_cycles 1 to 1000, settle_cycles 0 to 100");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (strcmp(equivalent, "series") != 0 && strcmp(equivalent, "parallel") != 0) {
+        _postman.sendError("E001", "Invalid equivalent circuit", "impedance", "equivalent", equivalent, 
+                          "Use series or parallel");
+        _current_mode = DRIVER_MODE_NONE;
         return;
     }
     
-    Matrix<2,1> D_matrix;
-    for (int i = 0; i < 2; i++) {
-        JsonArrayConst row = D_array[i];
-        if (row.size() != 1) {
-            _postman.sendError("E004", "Invalid D matrix row size", "control_system", "D", "", "D matrix must be 2x1");
-            return;
-        }
-        D_matrix(i, 0) = row[0].as<float>();
+    cfg.amplitude = amplitude;
+    cfg.offset = offset;
+    cfg.integration_time = integration_time;
+    cfg.min_cycles = min_cycles;
+    cfg.settle_cycles = settle_cycles;
+    cfg.parallel = strcmp(equivalent, "parallel") == 0;
+    cfg.late_samples = 0;
+    cfg.published_points = 0;
+    
+    xQueueReset(_impedance_queue);
+    _impedance_running = true;
+    _impedance_measuring = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        impedanceTaskWrapper,       // Task function
+        "ImpedanceTask",            // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_impedance_task_handle,    // Task handle
+        1                           // Core 1: sample timing stays off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create impedance task!");
+        _impedance_task_handle = NULL;
+        stopImpedance();
+        _postman.sendError("E006", "Failed to start impedance task", "impedance", "", "", "Retry the command");
+        return;
     }
     
-    // Parse voltage ranges
-    JsonObjectConst input_range = system_model["input_voltage_range"];
-    JsonObjectConst output_range = system_model["output_voltage_range"];
+    float point_time = integration_time + (settle_cycles + min_cycles) / cfg.freq_from;
+    int estimated_duration = (int)(cfg.total_points * point_time + 1);
+    _postman.sendResponse("impedance", "success", "Impedance measurement started", estimated_duration);
     
-    _input_min_volts = input_range["min_volts"].as<float>();
-    _input_max_volts = input_range["max_volts"].as<float>();
-    _input_zero_offset = input_range["zero_offset"].as<float>();
+    Serial.printf("Impedance started: %.1fHz-%.1fHz, %d points, %.2fV +/- %.2fV, shunt %.3f Ohm, %s\n", 
+                  cfg.freq_from, cfg.freq_to, cfg.total_points, offset, amplitude, 
+                  cfg.shunt_resistance, equivalent);
+}
+
+void DriverControl::handleCurveTracer(JsonObjectConst settings) {
+    Serial.println("Handling Curve Tracer command");
     
-    _output_min_volts = output_range["min_volts"].as<float>();
-    _output_max_volts = output_range["max_volts"].as<float>();
-    _output_zero_offset = output_range["zero_offset"].as<float>();
+    // Stop any existing curve family
+    stopCurveTracer();
     
-    // Copy matrices to member variables and create StateSpaceControl objects
+    _current_mode = DRIVER_MODE_CURVE_TRACER;
+    CurveTracerConfig& cfg = _curve_config;
     
-    // Clean up existing objects
-    if (_simulation != nullptr) {
-        delete _simulation;
-        _simulation = nullptr;
-    }
-    if (_system_model != nullptr) {
-        delete _system_model;
-        _system_model = nullptr;
+    JsonObjectConst inner = settings["inner"].as<JsonObjectConst>();
+    JsonObjectConst outer = settings["outer"].as<JsonObjectConst>();
+    if (inner.isNull() || outer.isNull()) {
+        _postman.sendError("E001", "Missing sweep definition", "curve_tracer", "inner", "", 
+                          "Provide inner and outer sweep objects");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
     }
     
-    // Create new Model object
-    _system_model = new Model<2, 1, 2>();
-    _system_model->A = A_matrix;
-    _system_model->B = B_matrix;
-    _system_model->C = C_matrix;
-    _system_model->D = D_matrix;
+    const char* inner_channel = inner["channel"].is<const char*>() ? inner["channel"].as<const char*>() : "CH0";
+    const char* outer_channel = outer["channel"].is<const char*>() ? outer["channel"].as<const char*>() : "CH2";
+    if (!parseCurveOutput(inner_channel, cfg.inner_output) || cfg.inner_output == CURVE_OUTPUT_SIGNAL_B) {
+        _postman.sendError("E001", "Invalid inner channel", "curve_tracer", "inner.channel", inner_channel, 
+                          "Use CH0 (DUT + shunt on signal A) or CH2 (power output)");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (!parseCurveOutput(outer_channel, cfg.outer_output) || cfg.outer_output == cfg.inner_output) {
+        _postman.sendError("E001", "Invalid outer channel", "curve_tracer", "outer.channel", outer_channel, 
+                          "Use CH0, CH1 or CH2, different from the inner channel");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    // Create simulation object
-    _simulation = new Simulation<2, 1, 2>(*_system_model);
+    cfg.inner_start = inner["start"].as<float>();
+    cfg.inner_stop = inner["stop"].as<float>();
+    cfg.inner_points = inner["points"].is<int>() ? inner["points"].as<int>() : 50;
+    cfg.outer_start = outer["start"].as<float>();
+    cfg.outer_stop = outer["stop"].as<float>();
+    cfg.outer_steps = outer["steps"].is<int>() ? outer["steps"].as<int>() : 5;
+    
+    if (cfg.inner_points < 2 || cfg.inner_points > CURVE_MAX_POINTS || 
+        cfg.outer_steps < 1 || cfg.outer_steps > CURVE_MAX_CURVES) {
+        _postman.sendError("E006", "Too many curve points", "curve_tracer", "points", "", 
+                          "inner.points 2-200, outer.steps 1-16");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    // Initialize simulation state to zero
-    _simulation->x.Fill(0);
+    float inner_range = cfg.inner_output == CURVE_OUTPUT_POWER ? _io.getPowerVoltageRange() : _io.getSignalVoltageRange();
+    float outer_range = cfg.outer_output == CURVE_OUTPUT_POWER ? _io.getPowerVoltageRange() : _io.getSignalVoltageRange();
+    if (min(cfg.inner_start, cfg.inner_stop) < 0.0f || max(cfg.inner_start, cfg.inner_stop) > inner_range) {
+        String hint = "Inner sweep must stay within 0V to " + String(inner_range, 1) + "V";
+        _postman.sendError("E001", "Inner sweep out of range", "curve_tracer", "inner", "", hint.c_str());
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (min(cfg.outer_start, cfg.outer_stop) < 0.0f || max(cfg.outer_start, cfg.outer_stop) > outer_range) {
+        String hint = "Outer steps must stay within 0V to " + String(outer_range, 1) + "V";
+        _postman.sendError("E001", "Outer steps out of range", "curve_tracer", "outer", "", hint.c_str());
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    // Initialize data buffer
-    _buffer_write_index = 0;
-    _buffer_count = 0;
-    _last_data_send = millis();
+    cfg.shunt_resistance = settings["shunt_resistance"].is<float>() ? settings["shunt_resistance"].as<float>() : 1.0f;
+    cfg.series_resistance = settings["series_resistance"].is<float>() ? settings["series_resistance"].as<float>() : 0.0f;
+    cfg.current_limit = settings["current_limit"].is<float>() ? settings["current_limit"].as<float>() : 0.1f;
+    if (cfg.shunt_resistance <= 0.0f || cfg.series_resistance < 0.0f) {
+        _postman.sendError("E001", "Invalid resistance", "curve_tracer", "shunt_resistance", "", 
+                          "Shunt resistance must be positive, series resistance 0 (not measured) or positive");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.current_limit <= POWER_CURRENT_MIN || cfg.current_limit > POWER_CURRENT_MAX) {
+        _postman.sendError("E001", "Current limit out of range", "curve_tracer", "current_limit", "", 
+                          "Current limit must be above 0A and at most 3A");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    // Print parsed model
-    Serial.println("System Model Loaded:");
-    Serial.printf("A = [%.2f %.2f; %.2f %.2f]\n", _system_model->A(0,0), _system_model->A(0,1), _system_model->A(1,0), _system_model->A(1,1));
-    Serial.printf("B = [%.2f; %.2f]\n", _system_model->B(0,0), _system_model->B(1,0));
-    Serial.printf("C = [%.2f %.2f; %.2f %.2f]\n", _system_model->C(0,0), _system_model->C(0,1), _system_model->C(1,0), _system_model->C(1,1));
-    Serial.printf("D = [%.2f; %.2f]\n", _system_model->D(0,0), _system_model->D(1,0));
-    Serial.printf("Input range: %.2f-%.2fV (zero: %.2fV)\n", _input_min_volts, _input_max_volts, _input_zero_offset);
-    Serial.printf("Output range: %.2f-%.2fV (zero: %.2fV)\n", _output_min_volts, _output_max_volts, _output_zero_offset);
-    Serial.printf("Control frequency: %dHz (%.1fms period)\n", CONTROL_SYSTEM_FREQUENCY_HZ, _control_system_dt * 1000);
+    // One detector for the outer step and every inner point: successive readings must agree
+    cfg.settle_voltage_tolerance = 0.02f;
+    cfg.settle_current_tolerance = 0.0005f;
+    cfg.settle_relative = 0.01f;
+    cfg.settle_interval_us = 200;
+    cfg.settle_timeout_us = 20000;
+    if (settings["settle"].is<JsonObjectConst>()) {
+        JsonObjectConst settle = settings["settle"].as<JsonObjectConst>();
+        if (settle["voltage_tolerance"].is<float>()) cfg.settle_voltage_tolerance = settle["voltage_tolerance"].as<float>();
+        if (settle["current_tolerance"].is<float>()) cfg.settle_current_tolerance = settle["current_tolerance"].as<float>();
+        if (settle["relative_tolerance"].is<float>()) cfg.settle_relative = settle["relative_tolerance"].as<float>();
+        if (settle["interval_us"].is<int>()) cfg.settle_interval_us = settle["interval_us"].as<int>();
+        if (settle["timeout_ms"].is<float>()) cfg.settle_timeout_us = (uint32_t)(settle["timeout_ms"].as<float>() * 1000.0f);
+    }
+    if (cfg.settle_voltage_tolerance <= 0.0f || cfg.settle_current_tolerance <= 0.0f || cfg.settle_relative < 0.0f ||
+        cfg.settle_interval_us < 100 || cfg.settle_interval_us > 100000 || 
+        cfg.settle_timeout_us < cfg.settle_interval_us || cfg.settle_timeout_us > 1000000) {
+        _postman.sendError("E001", "Settle detector out of range", "curve_tracer", "settle", "", 
+                          "Positive tolerances, interval_us 100-100000, interval <= timeout_ms <= 1000");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
     
-    // Start the high-frequency control system task
-    startControlSystemTask();
+    // Optional pulsed inner sweep, same timing rules as the pulsed VA bias
+    cfg.pulsed = false;
+    if (settings["pulse"].is<JsonObjectConst>()) {
+        JsonObjectConst pulse = settings["pulse"].as<JsonObjectConst>();
+        int width_us = pulse["width_us"].is<int>() ? pulse["width_us"].as<int>() : 500;
+        int sample_delay_us = pulse["sample_delay_us"].is<int>() ? pulse["sample_delay_us"].as<int>() : width_us / 2;
+        int samples = pulse["samples"].is<int>() ? pulse["samples"].as<int>() : 4;
+        float duty_cycle = pulse["duty_cycle"].is<float>() ? pulse["duty_cycle"].as<float>() : 0.05f;
+        float idle_voltage = pulse["idle_voltage"].is<float>() ? pulse["idle_voltage"].as<float>() : 0.0f;
+        
+        const int US_PER_SAMPLE_PAIR = 60;
+        if (cfg.inner_output != CURVE_OUTPUT_SIGNAL_A) {
+            _postman.sendError("E001", "Pulsed sweep needs the signal output", "curve_tracer", "pulse", "", 
+                              "Pulses are only available with inner channel CH0");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        if (width_us < 100 || width_us > 10000 || samples < 1 || samples > VA_PULSE_MAX_SAMPLES ||
+            sample_delay_us < 50 || sample_delay_us + samples * US_PER_SAMPLE_PAIR >= width_us) {
+            _postman.sendError("E001", "Pulse timing out of range", "curve_tracer", "pulse", "", 
+                              "width_us 100-10000, samples 1-16, 50 <= sample_delay_us and sample window inside the pulse");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        if (duty_cycle < 0.001f || duty_cycle > 0.5f) {
+            _postman.sendError("E001", "Pulse duty cycle out of range", "curve_tracer", "pulse.duty_cycle", "", 
+                              "Duty cycle must be 0.001 to 0.5");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        if (width_us / duty_cycle > CURVE_MAX_PULSE_PERIOD_US) {
+            _postman.sendError("E001", "Pulse period too long", "curve_tracer", "pulse.duty_cycle", "", 
+                              "width_us / duty_cycle must be at most 1000000 (1s per point)");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        if (idle_voltage < 0.0f || idle_voltage > inner_range) {
+            _postman.sendError("E001", "Pulse idle voltage out of range", "curve_tracer", "pulse.idle_voltage", "", 
+                              "Idle voltage must be within the channel output range");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        cfg.pulsed = true;
+        cfg.pulse_width_us = width_us;
+        cfg.pulse_sample_delay_us = sample_delay_us;
+        cfg.pulse_samples = samples;
+        cfg.pulse_duty_cycle = duty_cycle;
+        cfg.pulse_idle_voltage = idle_voltage;
+    }
     
-    _postman.sendResponse("control_system", "success", "System model loaded and high-frequency simulation started");
-}
-
-void DriverControl::updateControlSystem() {
-    // Check if simulation is initialized
-    if (_simulation == nullptr) {
-        Serial.println("WARNING: Simulation not initialized");
+    cfg.unsettled_points = 0;
+    cfg.late_pulses = 0;
+    cfg.published_points = 0;
+    
+    xQueueReset(_curve_queue);
+    _curve_running = true;
+    _curve_measuring = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        curveTracerTaskWrapper,     // Task function
+        "CurveTracerTask",          // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_curve_task_handle,        // Task handle
+        1                           // Core 1: pulse timing stays off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create curve tracer task!");
+        _curve_task_handle = NULL;
+        stopCurveTracer();
+        _postman.sendError("E006", "Failed to start curve tracer task", "curve_tracer", "", "", "Retry the command");
         return;
     }
     
-    // Read input from ADC (Channel A) and convert to system value
-    float input_voltage = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-    float input_value = voltageToSystemValue(input_voltage);
+    float point_time = cfg.pulsed ? cfg.pulse_width_us / cfg.pulse_duty_cycle * 1e-6f 
+                                  : 3.0f * cfg.settle_interval_us * 1e-6f;
+    int estimated_duration = (int)(cfg.outer_steps * cfg.inner_points * point_time + 1);
+    _postman.sendResponse("curve_tracer", "success", "Curve tracer started", estimated_duration);
     
-    // Set control input for the simulation
-    _control_input(0) = input_value;
+    Serial.printf("Curve tracer started: inner %s %.2fV-%.2fV x%d, outer %s %.2fV-%.2fV x%d, %s\n", 
+                  channelName((DriverChannel)cfg.inner_output), cfg.inner_start, cfg.inner_stop, cfg.inner_points, 
+                  channelName((DriverChannel)cfg.outer_output), cfg.outer_start, cfg.outer_stop, cfg.outer_steps, 
+                  cfg.pulsed ? "pulsed" : "fast");
+}
+
+void DriverControl::handleSequence(JsonObjectConst settings) {
+    Serial.println("Handling Sequence command");
     
-    // Use StateSpaceControl library's simulation step function
-    _system_output = _simulation->step(_control_input, _control_system_dt);
+    // Any sequence command stops a running table first: rows are never edited while executing
+    stopSequence();
     
-    // Convert outputs to voltages and set DACs
-    float output1_voltage = systemValueToVoltage(_system_output(0));
-    float output2_voltage = systemValueToVoltage(_system_output(1));
+    _current_mode = DRIVER_MODE_SEQUENCE;
+    SequenceConfig& cfg = _sequence_config;
     
-    // Set signal outputs
-    _io.setSignalVoltage(SIGNAL_CHANNEL_A, output1_voltage);
-    _io.setSignalVoltage(SIGNAL_CHANNEL_B, output2_voltage);
-    _io.updateAllDACs();
+    bool append = settings["append"].is<bool>() ? settings["append"].as<bool>() : false;
+    bool start = settings["start"].is<bool>() ? settings["start"].as<bool>() : true;
+    bool capture = settings["capture"].is<bool>() ? settings["capture"].as<bool>() : false;
     
-    // Store data in buffer (thread-safe)
-    if (xSemaphoreTake(_data_mutex, pdMS_TO_TICKS(5)) == pdTRUE) {
-        _data_buffer[_buffer_write_index].timestamp = millis();
-        _data_buffer[_buffer_write_index].input_value = input_value;
-        _data_buffer[_buffer_write_index].state_x1 = _simulation->x(0);  // Access simulation state
-        _data_buffer[_buffer_write_index].state_x2 = _simulation->x(1);  // Access simulation state
-        _data_buffer[_buffer_write_index].output_y1 = _system_output(0);
-        _data_buffer[_buffer_write_index].output_y2 = _system_output(1);
-        
-        _buffer_write_index = (_buffer_write_index + 1) % CONTROL_SYSTEM_BUFFER_SIZE;
-        if (_buffer_count < CONTROL_SYSTEM_BUFFER_SIZE) {
-            _buffer_count++;
+    if (_sequence_rows == nullptr) {
+        _sequence_rows = (SequenceRow*)ps_malloc(SEQUENCE_MAX_ROWS * sizeof(SequenceRow));
+        if (_sequence_rows == nullptr) {
+            _postman.sendError("E006", "Not enough memory for sequence table", "sequence", "rows", "", 
+                              "Retry after other modes are stopped");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
         }
-        
-        // Debug: Print every 100th sample to avoid flooding (reduced from 10th)
-        if (_buffer_write_index % 100 == 0) {
-            Serial.printf("Control system data stored: input=%.3f, buffer_count=%d\n",
-                         input_value, _buffer_count);
+    }
+    if (!append) {
+        cfg.rows = 0;
+        cfg.known_mask = 0;
+        cfg.digital_mask = 0;
+        cfg.captures = 0;
+    }
+    
+    // Rows are converted to codes and GPIO masks here, once
+    if (settings["rows"].is<JsonArrayConst>()) {
+        if (!parseSequenceRows(settings["rows"].as<JsonArrayConst>(), capture)) {
+            _current_mode = DRIVER_MODE_NONE;
+            return;
         }
-        
-        xSemaphoreGive(_data_mutex);
+    }
+    
+    if (!start) {
+        _current_mode = DRIVER_MODE_NONE;
+        String message = "Sequence table loaded: " + String(cfg.rows) + " rows";
+        _postman.sendResponse("sequence", "success", message.c_str());
+        Serial.printf("Sequence table loaded: %d rows, %d captures per pass\n", cfg.rows, cfg.captures);
+        return;
+    }
+    
+    if (cfg.rows == 0) {
+        _postman.sendError("E001", "Sequence table is empty", "sequence", "rows", "", 
+                          "Upload rows before starting");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    if (!parseEncoding(settings, "sequence", cfg.encoding)) {
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    const SequenceRow& first = _sequence_rows[0];
+    const SequenceRow& last = _sequence_rows[cfg.rows - 1];
+    cfg.repeat = settings["repeat"].is<int>() ? settings["repeat"].as<int>() : 1;
+    if (cfg.repeat < 0 || cfg.repeat > 1000000) {
+        _postman.sendError("E001", "Repeat count out of range", "sequence", "repeat", "", 
+                          "Use 1 to 1000000 passes, or 0 to repeat until stopped");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.repeat == 1) {
+        cfg.period_us = last.t_us + SEQUENCE_MIN_STEP_US;
     } else {
-        Serial.println("WARNING: Failed to take mutex for data storage");
+        if (!settings["period_ms"].is<float>()) {
+            _postman.sendError("E001", "Missing sequence period", "sequence", "period_ms", "", 
+                              "Repeating sequences need period_ms");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        float period_ms = settings["period_ms"].as<float>();
+        // The wrap from the last row to the next pass's first row obeys the same spacing
+        if (period_ms <= 0.0f || period_ms > 3600000.0f ||
+            (int64_t)(period_ms * 1000.0f) - last.t_us + first.t_us < SEQUENCE_MIN_STEP_US) {
+            _postman.sendError("E001", "Sequence period too short", "sequence", "period_ms", "", 
+                              "period_ms must leave at least 0.5ms between the last row and the next pass");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        cfg.period_us = (uint32_t)(period_ms * 1000.0f);
     }
-}
-
-float DriverControl::voltageToSystemValue(float voltage) {
-    // Map voltage to system value using the configured range
-    // voltage range [min_volts, max_volts] maps to system range [-scale, +scale]
-    // where zero_offset corresponds to 0 in system coordinates
     
-    float voltage_range = _input_max_volts - _input_min_volts;
-    float voltage_normalized = (voltage - _input_zero_offset) / (voltage_range / 2.0);
+    // Lines the table drives become outputs now, so the first edge only changes levels
+    for (uint8_t i = 0; i < 4; ++i) {
+        if (cfg.digital_mask & (1 << i)) _io.configureDA(i, OUTPUT);
+        if (cfg.digital_mask & (1 << (i + 4))) _io.configureDB(i, OUTPUT);
+    }
     
-    return voltage_normalized;
-}
-
-float DriverControl::systemValueToVoltage(float value) {
-    // Map system value to voltage using the configured range
-    float voltage_range = _output_max_volts - _output_min_volts;
-    float voltage = _output_zero_offset + value * (voltage_range / 2.0);
+    cfg.late_rows = 0;
+    cfg.dropped_samples = 0;
+    cfg.max_jitter_us = 0;
+    cfg.published_samples = 0;
+    
+    xQueueReset(_sequence_queue);
+    _sequence_running = true;
+    _sequence_executing = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        sequenceTaskWrapper,        // Task function
+        "SequenceTask",             // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_sequence_task_handle,     // Task handle
+        1                           // Core 1: row timing stays off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create sequence task!");
+        _sequence_task_handle = NULL;
+        stopSequence();
+        _postman.sendError("E006", "Failed to start sequence task", "sequence", "", "", "Retry the command");
+        return;
+    }
     
-    // Clamp to valid range
-    if (voltage < _output_min_volts) voltage = _output_min_volts;
-    if (voltage > _output_max_volts) voltage = _output_max_volts;
+    int estimated_duration = cfg.repeat == 0 ? 0 : (int)((float)cfg.period_us * cfg.repeat / 1000000.0f + 1);
+    _postman.sendResponse("sequence", "success", "Sequence started", estimated_duration);
     
-    return voltage;
-}
-
-float DriverControl::roundTo3Decimals(float value) {
-    // Round to 3 decimal places for voltage display
-    return round(value * 1000.0) / 1000.0;
-}
-
-float DriverControl::roundTo6Decimals(float value) {
-    // Round to 6 decimal places for high-precision current measurements
-    return round(value * 1000000.0) / 1000000.0;
+    Serial.printf("Sequence started: %d rows, %d captures, period %.3fms, %d passes\n", 
+                  cfg.rows, cfg.captures, cfg.period_us / 1000.0f, cfg.repeat);
 }
 
-// VA characteristics helper functions
-
-bool DriverControl::isValidVAChannel(const String& channel, const String& mode_type) {
-    // All channels support both CV and CC modes
-    if ((channel == "CH0" || channel == "CH1" || channel == "CH2") && 
-        (mode_type == "CV" || mode_type == "CC")) {
-        return true;
+void DriverControl::handleRecipe(JsonObjectConst settings) {
+    Serial.println("Handling Recipe command");
+    
+    // Stop any running recipe
+    stopRecipe();
+    
+    _current_mode = DRIVER_MODE_RECIPE;
+    
+    const char* bytecode = settings["bytecode"].is<const char*>() ? settings["bytecode"].as<const char*>() : nullptr;
+    if (bytecode == nullptr) {
+        _postman.sendError("E001", "Missing recipe bytecode", "recipe", "bytecode", "", 
+                          "Compile the recipe with recipe_compiler.py");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
     }
-    return false;
-}
-
-void DriverControl::performVAMeasurement() {
-    if (!_va_running || _va_config.current_step >= _va_config.total_steps) {
-        stopVAMeasurement();
+    float timeout_s = settings["timeout_s"].is<float>() ? settings["timeout_s"].as<float>() : 60.0f;
+    if (timeout_s < 0.1f || timeout_s > 3600.0f) {
+        _postman.sendError("E001", "Recipe timeout out of range", "recipe", "timeout_s", "", 
+                          "Timeout must be 0.1 to 3600 seconds");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    // Base64 image -> bytecode, validated once by the VM
+    uint8_t* image = (uint8_t*)malloc(RECIPE_MAX_IMAGE);
+    if (image == nullptr) {
+        _postman.sendError("E006", "Not enough memory for recipe", "recipe", "bytecode", "", "Retry the command");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    size_t image_length = 0;
+    int decoded = mbedtls_base64_decode(image, RECIPE_MAX_IMAGE, &image_length, 
+                                        (const unsigned char*)bytecode, strlen(bytecode));
+    String error;
+    bool loaded = decoded == 0 && _recipe_vm.load(image, image_length, error);
+    free(image);
+    if (!loaded) {
+        if (decoded == MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL) {
+            error = "Image larger than " + String(RECIPE_MAX_IMAGE) + " bytes";
+        } else if (decoded != 0) {
+            error = "Bytecode is not valid base64";
+        }
+        _postman.sendError("E004", "Recipe rejected", "recipe", "bytecode", error.c_str(), 
+                          "Recompile the recipe with recipe_compiler.py");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    strlcpy(_recipe_name, settings["name"].is<const char*>() ? settings["name"].as<const char*>() : "recipe",
+            sizeof(_recipe_name));
+    _recipe_timeout_ms = (uint32_t)(timeout_s * 1000.0f);
+    
+    xQueueReset(_recipe_queue);
+    _recipe_running = true;
+    _recipe_executing = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        recipeTaskWrapper,          // Task function
+        "RecipeTask",               // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_recipe_task_handle,       // Task handle
+        1                           // Core 1: recipe timing stays off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create recipe task!");
+        _recipe_task_handle = NULL;
+        stopRecipe();
+        _postman.sendError("E006", "Failed to start recipe task", "recipe", "", "", "Retry the command");
+        return;
+    }
+    
+    _postman.sendResponse("recipe", "success", "Recipe started", (int)(timeout_s + 0.5f));
+    
+    Serial.printf("Recipe started: %s, %u byte image, timeout %.1fs\n", 
+                  _recipe_name, (unsigned)image_length, timeout_s);
+}
+
+void DriverControl::handleLogger(JsonObjectConst settings) {
+    Serial.println("Handling Logger command");
+    
+    // Stop any running logger (its partial chunk is written first)
+    stopLogger();
+    if (_logger_sample_task_handle != NULL || _logger_write_task_handle != NULL) {
+        // The old task timed out stopping and still owns the buffers
+        _postman.sendError("E006", "Previous logger session still stopping", "logger", "", "", "Retry in a moment");
+        return;
+    }
+    
+    _current_mode = DRIVER_MODE_LOGGER;
+    
+    LoggerConfig cfg;
+    cfg.rate = settings["rate"].is<float>() ? settings["rate"].as<float>() : 10.0f;
+    cfg.decimation = settings["decimation"].is<int>() ? settings["decimation"].as<int>() : 1;
+    cfg.duration = settings["duration"].is<float>() ? settings["duration"].as<float>() : 0.0f;
+    cfg.wrap = settings["wrap"].is<bool>() ? settings["wrap"].as<bool>() : false;
+    
+    if (cfg.rate < 0.01f || cfg.rate > LOGGER_MAX_RATE) {
+        _postman.sendError("E001", "Logger rate out of range", "logger", "rate", String(cfg.rate).c_str(), 
+                          "Rate must be 0.01 to 1000 samples per second");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.decimation < 1 || cfg.decimation > LOGGER_MAX_DECIMATION) {
+        _postman.sendError("E001", "Logger decimation out of range", "logger", "decimation", String(cfg.decimation).c_str(), 
+                          "Decimation must be 1 to 60000 samples per record");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.duration < 0.0f) {
+        _postman.sendError("E001", "Logger duration out of range", "logger", "duration", String(cfg.duration).c_str(), 
+                          "Duration must be positive seconds, or 0 to log until stopped");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    cfg.sample_period_us = (uint32_t)(1000000.0f / cfg.rate + 0.5f);
+    cfg.record_size = (cfg.decimation > 1 ? 3 : 1) * LOGGER_CHANNELS * sizeof(int16_t);
+    cfg.records_per_chunk = FLASH_LOGGER_PAYLOAD_SIZE / cfg.record_size;
+    
+    uint8_t flags = cfg.decimation > 1 ? FLASH_LOGGER_FLAG_DECIMATED : 0;
+    if (!_flash_logger.startSession(cfg.record_size, LOGGER_CHANNELS, flags, 
+                                    cfg.sample_period_us * (uint32_t)cfg.decimation, cfg.wrap)) {
+        _postman.sendError("E002", "Logger partition not available", "logger", "", "", 
+                          "Flash the firmware with the current partitions.csv");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    // Chunk buffers cycle between the sampler and the writer through the free/ready queues
+    for (uint8_t i = 0; i < LOGGER_BUFFER_CHUNKS; ++i) {
+        _logger_buffers[i] = (uint8_t*)malloc(FLASH_LOGGER_CHUNK_SIZE);
+        if (_logger_buffers[i] == nullptr) {
+            _flash_logger.endSession();
+            freeLoggerBuffers();
+            _postman.sendError("E006", "Not enough memory for logger buffers", "logger", "", "", "Retry the command");
+            _current_mode = DRIVER_MODE_NONE;
+            return;
+        }
+        xQueueSend(_logger_free_queue, &i, 0);
+    }
+    
+    if (_logger_timer == NULL) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &DriverControl::loggerTimerCallback;
+        timer_args.arg = this;
+        timer_args.name = "logger";
+        esp_timer_create(&timer_args, &_logger_timer);
+    }
+    
+    _logger_config = cfg;
+    _logger_flash_error = false;
+    _logger_samples = 0;
+    _logger_missed_samples = 0;
+    _logger_dropped_records = 0;
+    for (int i = 0; i < LOGGER_CHANNELS; ++i) { _logger_latest[i] = 0; }
+    _logger_start_ms = 0;
+    _logger_last_status_ms = millis();
+    _logger_running = true;
+    _logger_sampling = true;
+    _logger_writing = true;
+    
+    BaseType_t write_result = xTaskCreatePinnedToCore(
+        loggerWriteTaskWrapper,     // Task function
+        "LoggerWriteTask",          // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        1,                          // Priority (background: flash writes wait behind everything else)
+        &_logger_write_task_handle, // Task handle
+        0                           // Core 0; a flash write still stalls the cache on both cores (late samples are counted as missed)
+    );
+    BaseType_t sample_result = pdFAIL;
+    if (write_result == pdPASS) {
+        sample_result = xTaskCreatePinnedToCore(
+            loggerSampleTaskWrapper,     // Task function
+            "LoggerSampleTask",          // Task name
+            4096,                        // Stack size
+            this,                        // Parameter passed to task
+            3,                           // Priority (above loop() on the same core)
+            &_logger_sample_task_handle, // Task handle
+            1                            // Core 1: sample timing stays off the WiFi core
+        );
+    }
+    if (write_result != pdPASS || sample_result != pdPASS) {
+        Serial.println("ERROR: Failed to create logger tasks!");
+        if (write_result != pdPASS) _logger_write_task_handle = NULL;
+        _logger_sample_task_handle = NULL;
+        _logger_sampling = false;
+        stopLogger();
+        _postman.sendError("E006", "Failed to start logger tasks", "logger", "", "", "Retry the command");
+        return;
+    }
+    
+    // Expected run time: the duration, or until the partition fills up
+    float record_period_s = cfg.sample_period_us * cfg.decimation / 1000000.0f;
+    float capacity_s = (float)_flash_logger.getCapacityChunks() * cfg.records_per_chunk * record_period_s;
+    float estimated_duration = cfg.duration > 0.0f ? cfg.duration : (cfg.wrap ? 0.0f : capacity_s);
+    if (!cfg.wrap && estimated_duration > capacity_s) {
+        estimated_duration = capacity_s;
+    }
+    _postman.sendResponse("logger", "success", "Logger started", (int)(estimated_duration + 0.5f));
+    
+    Serial.printf("Logger started: session %u, %.2f Hz, decimation %d, %u-byte records, %.0fs flash capacity%s\n", 
+                  (unsigned)_flash_logger.getSession(), cfg.rate, cfg.decimation, cfg.record_size, capacity_s, 
+                  cfg.wrap ? " (wrapping)" : "");
+}
+
+void DriverControl::handleProtection(JsonObjectConst settings) {
+    Serial.println("Handling Protection command");
+    
+    bool enabled = settings["enabled"].is<bool>() ? settings["enabled"].as<bool>() : true;
+    if (!enabled) {
+        _io.stopProtection();
+        _postman.sendResponse("protection", "success", "Protection disarmed");
+        return;
+    }
+    
+    ProtectionConfig cfg;
+    cfg.ovp_voltage = settings["ovp_voltage"].is<float>() ? settings["ovp_voltage"].as<float>() : 0.0f;
+    cfg.ocp_current = settings["ocp_current"].is<float>() ? settings["ocp_current"].as<float>() : 0.0f;
+    cfg.gout_voltage = settings["gout_voltage"].is<float>() ? settings["gout_voltage"].as<float>() : 0.0f;
+    int debounce = settings["debounce_samples"].is<int>() ? settings["debounce_samples"].as<int>() : 3;
+    
+    // Thresholds must lie inside what the feedback ADC can see, or they could never trip
+    float voltage_span = _io.powerVoltageFromRaw(ADC_MAX_VALUE);
+    float current_span = _io.powerCurrentFromRaw(ADC_MAX_VALUE);
+    if (cfg.ovp_voltage < 0.0f || cfg.ovp_voltage >= voltage_span) {
+        _postman.sendError("E001", "OVP threshold out of range", "protection", "ovp_voltage", String(cfg.ovp_voltage).c_str(), 
+                          ("Threshold must be 0 (off) or below " + String(voltage_span, 2) + "V").c_str());
+        return;
+    }
+    if (cfg.ocp_current < 0.0f || cfg.ocp_current >= current_span) {
+        _postman.sendError("E001", "OCP threshold out of range", "protection", "ocp_current", String(cfg.ocp_current).c_str(), 
+                          ("Threshold must be 0 (off) or below " + String(current_span, 2) + "A").c_str());
+        return;
+    }
+    if (cfg.gout_voltage < 0.0f || cfg.gout_voltage >= voltage_span) {
+        _postman.sendError("E001", "Ground threshold out of range", "protection", "gout_voltage", String(cfg.gout_voltage).c_str(), 
+                          ("Threshold must be 0 (off) or below " + String(voltage_span, 2) + "V").c_str());
+        return;
+    }
+    if (cfg.ovp_voltage == 0.0f && cfg.ocp_current == 0.0f && cfg.gout_voltage == 0.0f) {
+        _postman.sendError("E001", "No protection threshold set", "protection", "ovp_voltage/ocp_current/gout_voltage", "", 
+                          "Set at least one threshold, or enabled: false to disarm");
+        return;
+    }
+    if (debounce < 1 || debounce > PROTECTION_MAX_DEBOUNCE) {
+        _postman.sendError("E001", "Debounce out of range", "protection", "debounce_samples", String(debounce).c_str(), 
+                          "Debounce must be 1 to 64 conversions");
+        return;
+    }
+    cfg.debounce = (uint16_t)debounce;
+    
+    if (!_io.startProtection(cfg)) {
+        _postman.sendError("E002", "Protection ADC scan failed to start", "protection", "", "", "Retry the command or reboot the device");
+        return;
+    }
+    
+    _postman.sendResponse("protection", "success", _io.isPowerTripped() ? "Protection armed (power output still tripped)" : "Protection armed");
+}
+
+void DriverControl::handleProtectionReset() {
+    Serial.println("Handling Protection reset");
+    
+    if (!_io.isPowerTripped()) {
+        _postman.sendResponse("protection", "success", "Power output not tripped");
+        return;
+    }
+    _io.clearPowerTrip();
+    _postman.sendResponse("protection", "success", "Trip cleared, power output stays at 0V until set again");
+    _postman.sendStatus("ready", "protection");
+}
+
+void DriverControl::handleCalibration(JsonObjectConst settings) {
+    Serial.println("Handling Calibration command");
+    
+    // Stop any existing calibration run
+    stopCalibration();
+    
+    _current_mode = DRIVER_MODE_CALIBRATION;
+    CalibrationConfig& cfg = _calibration_config;
+    
+    for (int i = 0; i < CAL_MAPS; i++) {
+        cfg.maps[i] = false;
+    }
+    if (settings["channels"].is<JsonArrayConst>()) {
+        for (JsonVariantConst item : settings["channels"].as<JsonArrayConst>()) {
+            const char* name = item.is<const char*>() ? item.as<const char*>() : "";
+            int map = 0;
+            while (map < CAL_MAPS && strcmp(name, CalibrationEngine::mapName((CalibrationMap)map)) != 0) {
+                map++;
+            }
+            if (map == CAL_MAPS) {
+                _postman.sendError("E001", "Invalid calibration channel", "calibration", "channels", name, 
+                                  "Use signal_a, signal_b, power, input_a or input_b");
+                _current_mode = DRIVER_MODE_NONE;
+                return;
+            }
+            cfg.maps[map] = true;
+        }
+    } else {
+        // The inputs need a loopback cable, so they are only calibrated on request
+        cfg.maps[CAL_SIGNAL_DAC_A] = true;
+        cfg.maps[CAL_SIGNAL_DAC_B] = true;
+        cfg.maps[CAL_POWER_DAC] = true;
+    }
+    cfg.points = settings["points"].is<int>() ? settings["points"].as<int>() : 9;
+    cfg.settle_ms = settings["settle_ms"].is<int>() ? settings["settle_ms"].as<int>() : 20;
+    cfg.power_max_voltage = settings["power_max_voltage"].is<float>() ? settings["power_max_voltage"].as<float>() : 5.0f;
+    cfg.current_limit = settings["current_limit"].is<float>() ? settings["current_limit"].as<float>() : 0.1f;
+    cfg.piecewise = settings["piecewise"].is<bool>() ? settings["piecewise"].as<bool>() : true;
+    cfg.save = settings["save"].is<bool>() ? settings["save"].as<bool>() : true;
+    
+    bool any = false;
+    for (int i = 0; i < CAL_MAPS; i++) {
+        any = any || cfg.maps[i];
+    }
+    if (!any) {
+        _postman.sendError("E001", "No calibration channel selected", "calibration", "channels", "", 
+                          "Use signal_a, signal_b, power, input_a or input_b");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.points < CALIBRATION_MIN_POINTS || cfg.points > CALIBRATION_MAX_POINTS || 
+        cfg.settle_ms < 1 || cfg.settle_ms > 1000) {
+        _postman.sendError("E001", "Sweep settings out of range", "calibration", "points", "", 
+                          "points 3 to 17, settle_ms 1 to 1000");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    float range = _io.getPowerVoltageRange();
+    if (cfg.power_max_voltage < 1.0f || cfg.power_max_voltage > range || 
+        cfg.current_limit <= 0.0f || cfg.current_limit > POWER_CURRENT_MAX) {
+        String hint = "power_max_voltage 1V to " + String(range, 1) + "V, current_limit above 0A up to " + 
+                      String(POWER_CURRENT_MAX, 1) + "A";
+        _postman.sendError("E001", "Power sweep settings out of range", "calibration", "power_max_voltage", "", 
+                          hint.c_str());
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    // Every reading comes from the feedback scan
+    if (!_io.isFeedbackScanRunning()) {
+        _postman.sendError("E002", "Feedback scan not running", "calibration", "", "", 
+                          "The calibration measures on the FB_* feedback scan started by PocKETlab I/O");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    if (cfg.maps[CAL_POWER_DAC] && _io.isPowerTripped()) {
+        _postman.sendError("E002", "Power output tripped", "calibration", "power", "", 
+                          "Clear the trip with the protection reset action first");
+        _current_mode = DRIVER_MODE_NONE;
+        return;
+    }
+    
+    for (int i = 0; i < CAL_MAPS; i++) {
+        _calibration_status[i] = CAL_RUN_UNCHANGED;
+    }
+    _calibration_result = _io.getCalibration();
+    _calibration_error = nullptr;
+    _calibration_done = false;
+    _calibration_start_ms = millis();
+    _calibration_running = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        calibrationTaskWrapper,     // Task function
+        "CalibrationTask",          // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_calibration_task_handle,  // Task handle
+        1                           // Core 1
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create calibration task!");
+        _calibration_task_handle = NULL;
+        stopCalibration();
+        _postman.sendError("E006", "Failed to start calibration task", "calibration", "", "", "Retry the command");
+        return;
+    }
+    
+    bool signal = cfg.maps[CAL_SIGNAL_DAC_A] || cfg.maps[CAL_SIGNAL_DAC_B] || 
+                  cfg.maps[CAL_SIGNAL_ADC_A] || cfg.maps[CAL_SIGNAL_ADC_B];
+    int sweeps = (signal ? 1 : 0) + (cfg.maps[CAL_POWER_DAC] ? 1 : 0);
+    int estimated_duration = (int)(sweeps * cfg.points * (cfg.settle_ms + CALIBRATION_AVERAGE) / 1000 + 1);
+    _postman.sendResponse("calibration", "success", "Calibration started", estimated_duration);
+    
+    Serial.printf("Calibration started: %d points, settle %lu ms, power up to %.2fV at %.3fA, %s\n", 
+                  cfg.points, (unsigned long)cfg.settle_ms, cfg.power_max_voltage, cfg.current_limit, 
+                  cfg.piecewise ? "piecewise" : "linear");
+}
+
+void DriverControl::handleCalibrationReset() {
+    Serial.println("Handling Calibration reset");
+    
+    stopCalibration();
+    _io.resetCalibration(true);
+    _postman.sendResponse("calibration", "success", "Nominal scaling restored, stored calibration erased");
+}
+
+void DriverControl::handleTestbed(JsonObjectConst settings) {
+    Serial.println("Handling Testbed command");
+
+    if (settings["action"].is<const char*>() && strcmp(settings["action"].as<const char*>(), "stop") == 0) {
+        Serial.println("Stopping Testbed mode");
+        stopPowerRegulation();
+        _testbed_running = false;
+        stopTestbedScan();
+        _current_mode = DRIVER_MODE_NONE;  // Reset mode when stopping
+        _postman.sendResponse("testbed", "success", "Testbed mode stopped");
+        return;
+    }
+
+    _current_mode = DRIVER_MODE_TESTBED;  // Set current mode
+    float target_voltage = settings["target_voltage"].as<float>();
+    float current_limit = settings["current_limit"].as<float>();
+    bool continuous_monitoring = settings["continuous_monitoring"].as<bool>();
+    int update_interval_ms = settings["update_interval_ms"].as<int>();
+
+    Serial.printf("Target Voltage: %.2fV, Current Limit: %.2fA, Continuous: %d, Interval: %dms\n",
+                  target_voltage, current_limit, continuous_monitoring, update_interval_ms);
+
+    // Validate parameters
+    if (target_voltage < 0 || target_voltage > 20 || current_limit < 0 || current_limit > 3 || update_interval_ms < 50 || update_interval_ms > 1000) {
+        _postman.sendError("E001", "Parameter out of range", "testbed", "voltage/current/interval", "", "Check constraints");
+        return;
+    }
+
+    // Every output of the command goes into one transaction: it is checked as a whole before
+    // anything moves, then committed with one DAC batch and a single LDAC pulse
+    OutputTransaction tx;
+    tx.setPowerVoltage(target_voltage);
+    // While protection holds the power output off only a non-zero voltage is an error;
+    // the current limit stays at the zero the trip wrote
+    tx.setPowerCurrent(_io.isPowerTripped() && target_voltage == 0.0f ? 0.0f : current_limit);
+
+    // Optional Signal DAC outputs (channels 0 and 1) in volts after amplifier
+    // Accepts either object: {"ch0": <V>, "ch1": <V>} or array: [<V0>, <V1>]
+    JsonVariantConst signal = settings["signal"];
+    bool signalArray = signal.is<JsonArrayConst>();
+    JsonVariantConst sig0 = signalArray ? signal[0] : signal["ch0"];
+    JsonVariantConst sig1 = signalArray ? signal[1] : signal["ch1"];
+    if (sig0.is<float>()) {
+        tx.setSignalVoltage(SIGNAL_CHANNEL_A, sig0.as<float>());
+    }
+    if (sig1.is<float>()) {
+        tx.setSignalVoltage(SIGNAL_CHANNEL_B, sig1.as<float>());
+    }
+
+    // Optional DA/DB per-pin outputs
+    const char* pinGroups[] = {"da", "db"};
+    for (uint8_t group = 0; group < 2; ++group) {
+        JsonArrayConst pinCfg = settings[pinGroups[group]].as<JsonArrayConst>();
+        for (uint8_t i = 0; i < pinCfg.size() && i < 4; ++i) {
+            JsonObjectConst ch = pinCfg[i];
+            const char* mode = ch["mode"].as<const char*>(); // "digital"|"analog"
+            float value_v = NAN;
+            if (ch["value"].is<float>()) value_v = ch["value"].as<float>();
+            // Legacy support: level 0/1
+            if (isnan(value_v) && ch["level"].is<int>()) value_v = (ch["level"].as<int>() != 0) ? 3.3f : 0.0f;
+            OutputPinMode pin_mode = OUTPUT_PIN_KEEP;
+            if (mode && strcmp(mode, "analog") == 0) {
+                pin_mode = OUTPUT_PIN_ANALOG;
+                if (isnan(value_v)) value_v = 0.0f;
+            } else if (mode && strcmp(mode, "digital") == 0) {
+                pin_mode = OUTPUT_PIN_DIGITAL;
+                value_v = (!isnan(value_v) && value_v >= OUTPUT_DIGITAL_THRESHOLD) ? 3.3f : 0.0f;
+            }
+            if (group == 0) {
+                tx.setDA(i, pin_mode, value_v);
+            } else {
+                tx.setDB(i, pin_mode, value_v);
+            }
+        }
+    }
+
+    if (!_io.validateOutputs(tx)) {
+        sendTestbedOutputError(tx);
+        return;
+    }
+
+    // Optional closed-loop regulation: trims the power DAC from FB_VOUT, CC from FB_IOUT.
+    // The analog current limiter stays programmed to current_limit as the backstop.
+    JsonVariantConst regulation = settings["regulation"];
+    bool regulate = regulation.is<bool>() ? regulation.as<bool>() : 
+                    (regulation.is<JsonObjectConst>() && 
+                     (regulation["enabled"].is<bool>() ? regulation["enabled"].as<bool>() : true));
+    RegulationConfig regulation_config;
+    if (regulate && !parseRegulationSettings(regulation, target_voltage, current_limit, regulation_config)) {
+        return;
+    }
+
+    // A new setpoint restarts regulation from the open-loop setting
+    stopPowerRegulation();
+    
+    if (!_io.commitOutputs(tx)) {
+        sendTestbedOutputError(tx);
+        return;
+    }
+    for (uint8_t p = 0; p < OUTPUT_PINS; ++p) {
+        if (tx.pin_mode[p] == OUTPUT_PIN_KEEP) continue;
+        if (p < 4) {
+            _testbed_da_value_v[p] = tx.pin_value[p];
+        } else {
+            _testbed_db_value_v[p - 4] = tx.pin_value[p];
+        }
+    }
+    Serial.printf("Testbed outputs committed in %lu us\n", (unsigned long)tx.commit_us);
+
+    if (regulate) {
+        _regulation_config = regulation_config;
+        if (!startPowerRegulation()) {
+            _postman.sendError("E006", "Failed to start regulation task", "testbed", "regulation", "", "Retry the command");
+            return;
+        }
+    }
+
+    // Start/stop streaming
+    _testbed_running = continuous_monitoring;
+    _testbed_update_interval = update_interval_ms;
+    _testbed_last_update = 0;
+    stopTestbedScan();
+    if (continuous_monitoring) {
+        startTestbedScan(1000.0f / (float)update_interval_ms);
+    }
+
+    _postman.sendResponse("testbed", "success", "Testbed mode activated");
+}
+
+// Subscribe the testbed readings at the publish rate. DA pins set by the testbed report their set
+// value, so only the free ones are read (reading a DA pin claims it as an analog input).
+void DriverControl::startTestbedScan(float rate_hz) {
+    const ScanSource sources[] = {SCAN_POWER_VOLTAGE, SCAN_POWER_CURRENT, SCAN_SIGNAL_A, SCAN_SIGNAL_B};
+    for (ScanSource source : sources) {
+        _testbed_scan[source] = _scan.subscribe(source, rate_hz);
+    }
+    for (uint8_t i = 0; i < 4; ++i) {
+        if (isnan(_testbed_da_value_v[i])) {
+            _testbed_scan[SCAN_DA0 + i] = _scan.subscribe((ScanSource)(SCAN_DA0 + i), rate_hz);
+        }
+    }
+}
+
+void DriverControl::stopTestbedScan() {
+    for (int s = 0; s < SCAN_SOURCES; ++s) {
+        if (_testbed_scan[s] >= 0) {
+            _scan.unsubscribe(_testbed_scan[s]);
+            _testbed_scan[s] = -1;
+        }
+    }
+}
+
+// A rejected output transaction leaves every output as it was; name the value that failed
+void DriverControl::sendTestbedOutputError(const OutputTransaction& tx) {
+    static const char* dacFields[OUTPUT_DACS] = {"target_voltage", "current_limit", "signal.ch0", "signal.ch1"};
+    char field[16] = "outputs";
+    if (tx.error_output >= 0 && tx.error_output < OUTPUT_DACS) {
+        snprintf(field, sizeof(field), "%s", dacFields[tx.error_output]);
+    } else if (tx.error_output >= OUTPUT_DACS) {
+        int pin = tx.error_output - OUTPUT_DACS;
+        snprintf(field, sizeof(field), "%s[%d]", pin < 4 ? "da" : "db", pin % 4);
+    }
+    String value = tx.error_output >= 0 ? String(tx.error_value, 3) : String("");
+    
+    if (tx.error == OUTPUT_ERROR_RANGE) {
+        String range = String(tx.error_min, 2) + "-" + String(tx.error_max, 2) + "; no output was changed";
+        _postman.sendError("E001", tx.message, "testbed", field, value.c_str(), range.c_str());
+    } else if (tx.error == OUTPUT_ERROR_TRIPPED) {
+        _postman.sendError("E002", "Power output tripped by protection", "testbed", field, value.c_str(), 
+                          "Clear the fault, then send protection action 'reset'; no output was changed");
+    } else {
+        _postman.sendError("E002", tx.message, "testbed", field, "", "Check the outputs and retry the command");
+    }
+}
+
+float DriverControl::testbedReading(ScanSource source) {
+    float value = _scan.getLatest(_testbed_scan[source]);
+    if (isnan(value)) {
+        // No sample yet (first publish) or no subscription: convert once
+        value = _scan.readNow(source);
+    }
+    return value;
+}
+
+void DriverControl::handleControlSystem(JsonObjectConst settings) {
+    Serial.println("Handling Control System command");
+    _current_mode = DRIVER_MODE_CONTROL_SYSTEM;  // Set current mode
+    
+    const char* cs_mode = settings["cs_mode"].as<const char*>();
+    
+    // Identification drives a signal DAC; any new control system command ends it
+    stopIdentification();
+    _current_mode = DRIVER_MODE_CONTROL_SYSTEM;
+    
+    if (strcmp(cs_mode, "controller") == 0) {
+        handleControllerMode(settings);
+    } else if (strcmp(cs_mode, "system") == 0) {
+        handleSystemMode(settings);
+    } else if (strcmp(cs_mode, "identify") == 0) {
+        handleIdentifyMode(settings);
+    } else {
+        _postman.sendError("E004", "Invalid control system mode", "control_system", "cs_mode", cs_mode, "Use 'controller', 'system' or 'identify'");
+        return;
+    }
+}
+
+void DriverControl::handleControllerMode(JsonObjectConst settings) {
+    Serial.println("Control System - Controller Mode");
+    
+    const char* controller_type = settings["cs_controller_type"].as<const char*>();
+    
+    if (strcmp(controller_type, "pid") == 0) {
+        float kp = settings["cs_pid_kp"].as<float>();
+        float ki = settings["cs_pid_ki"].as<float>();
+        float kd = settings["cs_pid_kd"].as<float>();
+        
+        Serial.printf("PID Controller - Kp: %.3f, Ki: %.3f, Kd: %.3f\n", kp, ki, kd);
+        
+        // TODO: Implement PID controller logic
+        _postman.sendResponse("control_system", "success", "PID Controller configured (placeholder)");
+    } else {
+        Serial.println("Controller type not implemented yet");
+        _postman.sendResponse("control_system", "success", "Controller mode activated (placeholder)");
+    }
+}
+
+void DriverControl::handleSystemMode(JsonObjectConst settings) {
+    Serial.println("Control System - System Mode");
+    
+    // Stop any running control system
+    stopControlSystemTask();
+    
+    // Parse system model
+    JsonObjectConst system_model = settings["system_model"];
+    if (system_model.isNull()) {
+        _postman.sendError("E004", "Missing system_model", "control_system", "system_model", "", "Provide system model matrices");
+        return;
+    }
+    
+    // Parse A matrix (2x2)
+    JsonArrayConst A_array = system_model["A"];
+    if (A_array.size() != 2) {
+        _postman.sendError("E004", "Invalid A matrix size", "control_system", "A", "", "A matrix must be 2x2");
+        return;
+    }
+    
+    Matrix<2,2> A_matrix;
+    for (int i = 0; i < 2; i++) {
+        JsonArrayConst row = A_array[i];
+        if (row.size() != 2) {
+            _postman.sendError("E004", "Invalid A matrix row size", "control_system", "A", "", "A matrix must be 2x2");
+            return;
+        }
+        for (int j = 0; j < 2; j++) {
+            A_matrix(i, j) = row[j].as<float>();
+        }
+    }
+    
+    // Parse B matrix (2x1)
+    JsonArrayConst B_array = system_model["B"];
+    if (B_array.size() != 2) {
+        _postman.sendError("E004", "Invalid B matrix size", "control_system", "B", "", "B matrix must be 2x1");
+        return;
+    }
+    
+    Matrix<2,1> B_matrix;
+    for (int i = 0; i < 2; i++) {
+        JsonArrayConst row = B_array[i];
+        if (row.size() != 1) {
+            _postman.sendError("E004", "Invalid B matrix row size", "control_system", "B", "", "B matrix must be 2x1");
+            return;
+        }
+        B_matrix(i, 0) = row[0].as<float>();
+    }
+    
+    // Parse C matrix (2x2)
+    JsonArrayConst C_array = system_model["C"];
+    if (C_array.size() != 2) {
+        _postman.sendError("E004", "Invalid C matrix size", "control_system", "C", "", "C matrix must be 2x2");
+        return;
+    }
+    
+    Matrix<2,2> C_matrix;
+    for (int i = 0; i < 2; i++) {
+        JsonArrayConst row = C_array[i];
+        if (row.size() != 2) {
+            _postman.sendError("E004", "Invalid C matrix row size", "control_system", "C", "", "C matrix must be 2x2");
+            return;
+        }
+        for (int j = 0; j < 2; j++) {
+            C_matrix(i, j) = row[j].as<float>();
+        }
+    }
+    
+    // Parse D matrix (2x1)
+    JsonArrayConst D_array = system_model["D"];
+    if (D_array.size() != 2) {
+        _postman.sendError("E004", "Invalid D matrix size", "control_system", "D", "", "D matrix must be 2x1");
+        return;
+    }
+    
+    Matrix<2,1> D_matrix;
+    for (int i = 0; i < 2; i++) {
+        JsonArrayConst row = D_array[i];
+        if (row.size() != 1) {
+            _postman.sendError("E004", "Invalid D matrix row size", "control_system", "D", "", "D matrix must be 2x1");
+            return;
+        }
+        D_matrix(i, 0) = row[0].as<float>();
+    }
+    
+    // Parse voltage ranges
+    JsonObjectConst input_range = system_model["input_voltage_range"];
+    JsonObjectConst output_range = system_model["output_voltage_range"];
+    
+    _input_min_volts = input_range["min_volts"].as<float>();
+    _input_max_volts = input_range["max_volts"].as<float>();
+    _input_zero_offset = input_range["zero_offset"].as<float>();
+    
+    _output_min_volts = output_range["min_volts"].as<float>();
+    _output_max_volts = output_range["max_volts"].as<float>();
+    _output_zero_offset = output_range["zero_offset"].as<float>();
+    
+    // Copy matrices to member variables and create StateSpaceControl objects
+    
+    // Clean up existing objects
+    if (_simulation != nullptr) {
+        delete _simulation;
+        _simulation = nullptr;
+    }
+    if (_system_model != nullptr) {
+        delete _system_model;
+        _system_model = nullptr;
+    }
+    
+    // Create new Model object
+    _system_model = new Model<2, 1, 2>();
+    _system_model->A = A_matrix;
+    _system_model->B = B_matrix;
+    _system_model->C = C_matrix;
+    _system_model->D = D_matrix;
+    
+    // Create simulation object
+    _simulation = new Simulation<2, 1, 2>(*_system_model);
+    
+    // Initialize simulation state to zero
+    _simulation->x.Fill(0);
+    
+    // Initialize data buffer
+    _buffer_write_index = 0;
+    _buffer_count = 0;
+    _last_data_send = millis();
+    
+    // Print parsed model
+    Serial.println("System Model Loaded:");
+    Serial.printf("A = [%.2f %.2f; %.2f %.2f]\n", _system_model->A(0,0), _system_model->A(0,1), _system_model->A(1,0), _system_model->A(1,1));
+    Serial.printf("B = [%.2f; %.2f]\n", _system_model->B(0,0), _system_model->B(1,0));
+    Serial.printf("C = [%.2f %.2f; %.2f %.2f]\n", _system_model->C(0,0), _system_model->C(0,1), _system_model->C(1,0), _system_model->C(1,1));
+    Serial.printf("D = [%.2f; %.2f]\n", _system_model->D(0,0), _system_model->D(1,0));
+    Serial.printf("Input range: %.2f-%.2fV (zero: %.2fV)\n", _input_min_volts, _input_max_volts, _input_zero_offset);
+    Serial.printf("Output range: %.2f-%.2fV (zero: %.2fV)\n", _output_min_volts, _output_max_volts, _output_zero_offset);
+    Serial.printf("Control frequency: %dHz (%.1fms period)\n", CONTROL_SYSTEM_FREQUENCY_HZ, _control_system_dt * 1000);
+    
+    // Start the high-frequency control system task
+    startControlSystemTask();
+    
+    _postman.sendResponse("control_system", "success", "System model loaded and high-frequency simulation started");
+}
+
+void DriverControl::handleIdentifyMode(JsonObjectConst settings) {
+    Serial.println("Control System - Identify Mode");
+    
+    // The simulation also drives the signal DACs
+    stopControlSystemTask();
+    _current_mode = DRIVER_MODE_CONTROL_SYSTEM;
+    
+    JsonObjectConst identification = settings["identification"];
+    IdentifyConfig& cfg = _identify_config;
+    
+    const char* excitation = identification["excitation"].is<const char*>() ? identification["excitation"].as<const char*>() : "prbs";
+    const char* excitation_name = identification["excitation_channel"].is<const char*>() ? identification["excitation_channel"].as<const char*>() : "CH0";
+    const char* response_name = identification["response_channel"].is<const char*>() ? identification["response_channel"].as<const char*>() : "CH1";
+    float amplitude = identification["amplitude"].is<float>() ? identification["amplitude"].as<float>() : 1.0f;
+    float offset = identification["offset"].is<float>() ? identification["offset"].as<float>() : amplitude;
+    float sample_time_ms = identification["sample_time_ms"].is<float>() ? identification["sample_time_ms"].as<float>() : 1000.0f / CONTROL_SYSTEM_FREQUENCY_HZ;
+    int samples = identification["samples"].is<int>() ? identification["samples"].as<int>() : 2000;
+    float settle_time = identification["settle_time"].is<float>() ? identification["settle_time"].as<float>() : 0.5f;
+    int prbs_order = identification["prbs_order"].is<int>() ? identification["prbs_order"].as<int>() : 9;
+    int prbs_hold = identification["prbs_hold"].is<int>() ? identification["prbs_hold"].as<int>() : 1;
+    float sample_rate = 1000.0f / sample_time_ms;
+    float chirp_to = identification["chirp_to"].is<float>() ? identification["chirp_to"].as<float>() : 0.2f * sample_rate;
+    float chirp_from = identification["chirp_from"].is<float>() ? identification["chirp_from"].as<float>() : chirp_to / 100.0f;
+    float forgetting = identification["forgetting_factor"].is<float>() ? identification["forgetting_factor"].as<float>() : 1.0f;
+    cfg.apply = identification["apply"].is<bool>() ? identification["apply"].as<bool>() : false;
+    
+    if (strcmp(excitation, "prbs") == 0) {
+        cfg.excitation = IDENTIFY_EXCITATION_PRBS;
+    } else if (strcmp(excitation, "chirp") == 0) {
+        cfg.excitation = IDENTIFY_EXCITATION_CHIRP;
+    } else {
+        _postman.sendError("E001", "Invalid excitation", "control_system", "excitation", excitation, "Use prbs or chirp");
+        return;
+    }
+    DriverChannel excitation_channel, response_channel;
+    if (!parseChannel(excitation_name, excitation_channel) || excitation_channel == CHANNEL_CH2 || 
+        !parseChannel(response_name, response_channel) || response_channel == CHANNEL_CH2) {
+        _postman.sendError("E001", "Invalid identification channel", "control_system", "excitation_channel", "", 
+                          "excitation_channel and response_channel must be CH0 or CH1");
+        return;
+    }
+    cfg.excitation_channel = (excitation_channel == CHANNEL_CH1) ? SIGNAL_CHANNEL_B : SIGNAL_CHANNEL_A;
+    cfg.response_channel = (response_channel == CHANNEL_CH1) ? SIGNAL_CHANNEL_B : SIGNAL_CHANNEL_A;
+    
+    float range = _io.getSignalVoltageRange();
+    if (amplitude <= 0.0f || offset - amplitude < 0.0f || offset + amplitude > range) {
+        String hint = "offset +/- amplitude must stay within 0V to " + String(range, 1) + "V";
+        _postman.sendError("E001", "Excitation does not fit the output range", "control_system", "amplitude", "", hint.c_str());
+        return;
+    }
+    if (sample_time_ms < 1.0f || sample_time_ms > 100.0f) {
+        _postman.sendError("E001", "Sample time out of range", "control_system", "sample_time_ms", "", 
+                          "Sample time must be 1 to 100ms");
+        return;
+    }
+    if (samples < 100 || samples > IDENTIFY_MAX_SAMPLES) {
+        _postman.sendError("E001", "Sample count out of range", "control_system", "samples", "", 
+                          "Samples must be 100 to 60000");
+        return;
+    }
+    if (settle_time < 0.0f || settle_time > 10.0f) {
+        _postman.sendError("E001", "Settle time out of range", "control_system", "settle_time", "", 
+                          "Settle time must be 0 to 10s");
+        return;
+    }
+    if (prbs_order < 5 || prbs_order > 16 || prbs_hold < 1 || prbs_hold > 100) {
+        _postman.sendError("E001", "PRBS settings out of range", "control_system", "prbs_order", "", 
+                          "prbs_order must be 5 to 16, prbs_hold 1 to 100");
+        return;
+    }
+    if (chirp_from <= 0.0f || chirp_from >= chirp_to || chirp_to > 0.5f * sample_rate) {
+        _postman.sendError("E001", "Chirp range out of bounds", "control_system", "chirp_from", "", 
+                          "Need 0 < chirp_from < chirp_to <= half the sample rate");
+        return;
+    }
+    if (forgetting < 0.9f || forgetting > 1.0f) {
+        _postman.sendError("E001", "Forgetting factor out of range", "control_system", "forgetting_factor", "", 
+                          "Forgetting factor must be 0.9 to 1.0");
+        return;
+    }
+    
+    cfg.offset = offset;
+    cfg.amplitude = amplitude;
+    cfg.sample_period_us = (uint32_t)(sample_time_ms * 1000.0f + 0.5f);
+    cfg.samples = samples;
+    cfg.settle_samples = (int)(settle_time * 1000000.0f / cfg.sample_period_us);
+    cfg.prbs_order = prbs_order;
+    cfg.prbs_hold = prbs_hold;
+    cfg.chirp_from = chirp_from;
+    cfg.chirp_to = chirp_to;
+    cfg.forgetting = forgetting;
+    cfg.completed_samples = 0;
+    cfg.late_samples = 0;
+    
+    // Uninformative prior: zero parameters, large P
+    _identify_theta.Fill(0);
+    _identify_P.Fill(0);
+    for (int i = 0; i < IDENTIFY_PARAMETERS; i++) {
+        _identify_P(i, i) = 100.0f;
+    }
+    _identify_y_ref = 0.0f;
+    _identify_y_min = INFINITY;
+    _identify_y_max = -INFINITY;
+    _identify_error_sq = 0.0;
+    _identify_y_sum = 0.0;
+    _identify_y_sq = 0.0;
+    _identify_error_count = 0;
+    _identify_last_progress = millis();
+    _identify_done = false;
+    _identify_running = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        identifyTaskWrapper,        // Task function
+        "IdentifyTask",             // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        3,                          // Priority (above loop() on the same core)
+        &_identify_task_handle,     // Task handle
+        1                           // Core 1: sample timing stays off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create identification task!");
+        _identify_task_handle = NULL;
+        stopIdentification();
+        _postman.sendError("E006", "Failed to start identification task", "control_system", "", "", "Retry the command");
+        return;
+    }
+    
+    int estimated_duration = (int)((cfg.settle_samples + samples) * (float)cfg.sample_period_us / 1000000.0f + 1);
+    _postman.sendResponse("control_system", "success", "System identification started", estimated_duration);
+    
+    Serial.printf("Identification started: %s on %s -> %s, %.2fV +/- %.2fV, %d samples @ %.1fms\n", 
+                  excitation, channelName(excitation_channel), channelName(response_channel), offset, amplitude, 
+                  samples, sample_time_ms);
+}
+
+void DriverControl::updateControlSystem() {
+    // Check if simulation is initialized
+    if (_simulation == nullptr) {
+        Serial.println("WARNING: Simulation not initialized");
+        return;
+    }
+    
+    // Read input from ADC (Channel A) and convert to system value
+    float input_voltage = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+    float input_value = voltageToSystemValue(input_voltage);
+    
+    // Set control input for the simulation
+    _control_input(0) = input_value;
+    
+    // Use StateSpaceControl library's simulation step function
+    _system_output = _simulation->step(_control_input, _control_system_dt);
+    
+    // Convert outputs to voltages and set DACs
+    float output1_voltage = systemValueToVoltage(_system_output(0));
+    float output2_voltage = systemValueToVoltage(_system_output(1));
+    
+    // Set signal outputs
+    _io.setSignalVoltage(SIGNAL_CHANNEL_A, output1_voltage);
+    _io.setSignalVoltage(SIGNAL_CHANNEL_B, output2_voltage);
+    _io.updateAllDACs();
+    
+    // Store data in buffer (thread-safe)
+    if (xSemaphoreTake(_data_mutex, pdMS_TO_TICKS(5)) == pdTRUE) {
+        _data_buffer[_buffer_write_index].timestamp = millis();
+        _data_buffer[_buffer_write_index].input_value = input_value;
+        _data_buffer[_buffer_write_index].state_x1 = _simulation->x(0);  // Access simulation state
+        _data_buffer[_buffer_write_index].state_x2 = _simulation->x(1);  // Access simulation state
+        _data_buffer[_buffer_write_index].output_y1 = _system_output(0);
+        _data_buffer[_buffer_write_index].output_y2 = _system_output(1);
+        
+        _buffer_write_index = (_buffer_write_index + 1) % CONTROL_SYSTEM_BUFFER_SIZE;
+        if (_buffer_count < CONTROL_SYSTEM_BUFFER_SIZE) {
+            _buffer_count++;
+        }
+        
+        // Debug: Print every 100th sample to avoid flooding (reduced from 10th)
+        if (_buffer_write_index % 100 == 0) {
+            Serial.printf("Control system data stored: input=%.3f, buffer_count=%d\n",
+                         input_value, _buffer_count);
+        }
+        
+        xSemaphoreGive(_data_mutex);
+    } else {
+        Serial.println("WARNING: Failed to take mutex for data storage");
+    }
+}
+
+float DriverControl::voltageToSystemValue(float voltage) {
+    // Map voltage to system value using the configured range
+    // voltage range [min_volts, max_volts] maps to system range [-scale, +scale]
+    // where zero_offset corresponds to 0 in system coordinates
+    
+    float voltage_range = _input_max_volts - _input_min_volts;
+    float voltage_normalized = (voltage - _input_zero_offset) / (voltage_range / 2.0);
+    
+    return voltage_normalized;
+}
+
+float DriverControl::systemValueToVoltage(float value) {
+    // Map system value to voltage using the configured range
+    float voltage_range = _output_max_volts - _output_min_volts;
+    float voltage = _output_zero_offset + value * (voltage_range / 2.0);
+    
+    // Clamp to valid range
+    if (voltage < _output_min_volts) voltage = _output_min_volts;
+    if (voltage > _output_max_volts) voltage = _output_max_volts;
+    
+    return voltage;
+}
+
+float DriverControl::roundTo3Decimals(float value) {
+    // Round to 3 decimal places for voltage display
+    return round(value * 1000.0) / 1000.0;
+}
+
+float DriverControl::roundTo6Decimals(float value) {
+    // Round to 6 decimal places for high-precision current measurements
+    return round(value * 1000000.0) / 1000000.0;
+}
+
+bool DriverControl::parseEncoding(JsonObjectConst settings, const char* mode, DataEncoding& encoding) {
+    const char* name = settings["encoding"].is<const char*>() ? settings["encoding"].as<const char*>() : "volts";
+    if (strcmp(name, "volts") == 0) {
+        encoding = DATA_ENCODING_VOLTS;
+    } else if (strcmp(name, "raw") == 0) {
+        encoding = DATA_ENCODING_RAW;
+    } else {
+        _postman.sendError("E001", "Invalid encoding", mode, "encoding", name, "Use volts or raw");
+        return false;
+    }
+    return true;
+}
+
+void DriverControl::addRawScale(JsonObject scales, const char* name, CaptureSource source, uint8_t fraction_bits) {
+    JsonObject scale = scales[name].to<JsonObject>();
+    if (source == CAPTURE_SOURCE_SIGNAL_A || source == CAPTURE_SOURCE_SIGNAL_B) {
+        const CalibrationCoefficients& conv =
+            _io.getConversion(source == CAPTURE_SOURCE_SIGNAL_B ? CAL_SIGNAL_ADC_B : CAL_SIGNAL_ADC_A);
+        if (conv.piecewise) {
+            // value = (v + correction(v)) * scale + offset, the correction nodes converted from
+            // 1/16 LSB to value units and interpolated linearly every correction_step
+            const float unit = (float)(1 << fraction_bits) / CAL_PWL_FRACTION;
+            scale["scale"] = conv.volts_gain / (float)(1 << fraction_bits);
+            scale["offset"] = conv.volts_offset;
+            scale["correction_step"] = (1 << CAL_PWL_SHIFT) << fraction_bits;
+            JsonArray nodes = scale["correction"].to<JsonArray>();
+            for (int i = 0; i < CAL_PWL_POINTS; i++) {
+                nodes.add(conv.pwl[i] * unit);
+            }
+            return;
+        }
+    }
+    // Straight line through the conversion: value = code * scale + offset
+    float offset = captureRawToVoltage(source, 0.0f);
+    scale["scale"] = (captureRawToVoltage(source, 1.0f) - offset) / (float)(1 << fraction_bits);
+    scale["offset"] = offset;
+}
+
+bool DriverControl::parseChannel(const char* name, DriverChannel& channel) {
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (strcmp(name, kChannelNames[i]) == 0) {
+            channel = (DriverChannel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* DriverControl::channelName(DriverChannel channel) {
+    return channel < CHANNEL_COUNT ? kChannelNames[channel] : "?";
+}
+
+const ChannelDriver* DriverControl::channelDriver(DriverChannel channel) {
+    return &kChannelDrivers[channel < CHANNEL_COUNT ? channel : CHANNEL_CH0];
+}
+
+const char* DriverControl::modeName(DriverMode mode) {
+    return mode < DRIVER_MODES ? kModeNames[mode] : "none";
+}
+
+bool DriverControl::waitForTaskExit(TaskHandle_t& handle, const char* name) {
+    // The task has been told to stop through its running flag; it exits at its next check and
+    // clears its handle. It is never deleted from here: a task blocked in a bus batch would
+    // leave the bus owner writing into its freed stack, and one holding an I/O mutex would
+    // leave it taken for good. Tasks sleep in short slices, so the timeout only keeps loop()
+    // alive if one is stuck.
+    if (handle == NULL || handle == xTaskGetCurrentTaskHandle()) {
+        return true;
+    }
+    uint32_t elapsed_ms = 0;
+    while (handle != NULL) {
+        if (elapsed_ms >= TASK_STOP_TIMEOUT_MS) {
+            Serial.printf("ERROR: %s task did not stop within %lu ms, left to exit on its own\n", 
+                          name, (unsigned long)elapsed_ms);
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+        elapsed_ms += 10;
+        if (elapsed_ms % TASK_STOP_WARNING_MS == 0) {
+            Serial.printf("WARNING: %s task still stopping after %lu ms\n", name, (unsigned long)elapsed_ms);
+        }
+    }
+    return true;
+}
+
+// VA characteristics helper functions
+
+void DriverControl::stageVAOutputVoltage(float output_voltage) {
+    // Write the drive channel's DAC input register; the output follows on the next LDAC pulse
+    _va_config.drive->stage(_io, output_voltage);
+}
+
+void DriverControl::applyVAOutputVoltage(float output_voltage) {
+    stageVAOutputVoltage(output_voltage);
+    _io.updateAllDACs();
+}
+
+bool DriverControl::fireVAPulse(float output_voltage, int samples, float& device_voltage, float& current) {
+    uint16_t raw_a[VA_PULSE_MAX_SAMPLES];
+    uint16_t raw_b[VA_PULSE_MAX_SAMPLES];
+    if (samples > VA_PULSE_MAX_SAMPLES) samples = VA_PULSE_MAX_SAMPLES;
+    
+    // Leading edge latches the bias now, the trailing edge comes from the hardware timer
+    stageVAOutputVoltage(output_voltage);
+    int64_t t_start = _io.startLatchPulse(_va_config.pulse_width_us);
+    
+    // Stage the idle level for the trailing edge while waiting for the sample point
+    stageVAOutputVoltage(_va_config.pulse_idle_voltage);
+    
+    int64_t t_sample = t_start + _va_config.pulse_sample_delay_us;
+    if (esp_timer_get_time() > t_sample) {
+        _va_config.pulse_late_count++;
+    }
+    while (esp_timer_get_time() < t_sample) {
+        // Busy-wait: the delay is far below the scheduler tick
+    }
+    _io.readSignalBurst(raw_a, raw_b, samples);
+    
+    bool completed = _io.waitLatchPulse(_va_config.pulse_width_us / 1000 + 10);
+    if (!completed) {
+        _va_config.pulse_timeout_count++;  // Trailing edge never fired: the bias may have stayed on
+    }
+    
+    // Average codes before converting
+    uint32_t sum_a = 0, sum_b = 0;
+    for (int i = 0; i < samples; i++) {
+        sum_a += raw_a[i];
+        sum_b += raw_b[i];
+    }
+    float voltage_a = _io.signalVoltageFromRaw((float)sum_a / samples);
+    float voltage_b = _io.signalVoltageFromRaw((float)sum_b / samples, SIGNAL_CHANNEL_B);
+    device_voltage = voltage_a - voltage_b;
+    current = voltage_b / _va_config.shunt_resistance;   // Pulses are CH0/CH1 only (handleVA)
+    
+    // Idle until the next period so the DUT dissipates pulse_duty_cycle of the bias power.
+    // Sleep in slices so a stop request is seen, busy-wait the last 2ms.
+    int64_t t_next = t_start + (int64_t)(_va_config.pulse_width_us / _va_config.pulse_duty_cycle);
+    int64_t remaining_us = t_next - esp_timer_get_time();
+    while (_va_running && remaining_us > 3000) {
+        vTaskDelay(pdMS_TO_TICKS(min(remaining_us - 2000, (int64_t)50000) / 1000));
+        remaining_us = t_next - esp_timer_get_time();
+    }
+    while (_va_running && esp_timer_get_time() < t_next) {
+    }
+    
+    return completed;
+}
+
+float DriverControl::evaluateVAOutputVoltage(float output_voltage) {
+    const int SETTLE_MS = 10;  // Settling time after each DAC update
+    const int EVAL_SAMPLES = 2;  // Short average, the final point uses the full RMS measurement
+    
+    if (_va_config.pulsed) {
+        float device_voltage, current;
+        fireVAPulse(output_voltage, _va_config.pulse_samples, device_voltage, current);
+        return device_voltage;
+    }
+    
+    applyVAOutputVoltage(output_voltage);
+    delay(SETTLE_MS);
+    
+    float device_voltage_sum = 0.0f;
+    for (int i = 0; i < EVAL_SAMPLES; i++) {
+        float voltage_a = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+        float voltage_b = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+        device_voltage_sum += voltage_a - voltage_b;
+    }
+    return device_voltage_sum / EVAL_SAMPLES;
+}
+
+bool DriverControl::solveCVOutputVoltage(float target_device_voltage, float& device_voltage) {
+    const int MAX_DAC_UPDATES = 8;  // Hard limit, typically converges in 2-4
+    const float DEVICE_VOLTAGE_TOLERANCE = 0.02f;  // 20mV tolerance for device voltage
+    const float MIN_SLOPE = 0.02f;  // Below this the DUT barely responds, treat the estimate as bogus
+    const float MAX_SLOPE = 2.0f;   // Device voltage cannot rise much faster than the drive
+    const float MIN_OUTPUT_STEP = 0.005f;  // Do not re-evaluate points closer than ~1 DAC LSB after gain
+    
+    float max_output = _va_config.max_output_voltage;
+    
+    // Warm start: extrapolate from the previous point using the local slope
+    float output_voltage;
+    if (_va_config.cv_has_history) {
+        output_voltage = _va_config.output_voltage +
+                         (target_device_voltage - _va_config.last_device_voltage) / _va_config.cv_slope;
+    } else {
+        output_voltage = target_device_voltage / _va_config.cv_slope;
+    }
+    
+    // Bracket: lo has device voltage below target, hi above (valid while the DUT is monotonic)
+    bool have_lo = false, have_hi = false;
+    float lo_v = 0.0f, hi_v = 0.0f;
+    bool have_prev = false;
+    float prev_v = 0.0f, prev_dev = 0.0f;
+    float best_v = _va_config.output_voltage, best_dev = 0.0f, best_err = INFINITY;
+    float last_dev = 0.0f;
+    bool reached = false;
+    
+    _va_config.solver_iterations = 0;
+    for (int iter = 0; iter < MAX_DAC_UPDATES; iter++) {
+        if (output_voltage < 0.0f) output_voltage = 0.0f;
+        if (output_voltage > max_output) output_voltage = max_output;
+        
+        float dev = evaluateVAOutputVoltage(output_voltage);
+        float err = dev - target_device_voltage;
+        last_dev = dev;
+        _va_config.solver_iterations++;
+        
+        if (fabs(err) < best_err) {
+            best_err = fabs(err);
+            best_v = output_voltage;
+            best_dev = dev;
+        }
+        if (fabs(err) <= DEVICE_VOLTAGE_TOLERANCE) {
+            reached = true;
+            break;
+        }
+        
+        // Output cap: the drive is at its limit and the device is still below target
+        if (err < 0 && output_voltage >= max_output) {
+            _va_config.capped = true;
+            break;
+        }
+        
+        // Tighten the bracket; a point that contradicts it means the DUT is non-monotonic here
+        bool consistent = true;
+        if (err < 0) {
+            if (have_hi && output_voltage >= hi_v) {
+                consistent = false;
+            } else if (!have_lo || output_voltage > lo_v) {
+                lo_v = output_voltage;
+                have_lo = true;
+            }
+        } else {
+            if (have_lo && output_voltage <= lo_v) {
+                consistent = false;
+            } else if (!have_hi || output_voltage < hi_v) {
+                hi_v = output_voltage;
+                have_hi = true;
+            }
+        }
+        
+        // Refresh the local slope from the last two evaluations (secant)
+        if (have_prev && fabs(output_voltage - prev_v) > MIN_OUTPUT_STEP) {
+            float slope = (dev - prev_dev) / (output_voltage - prev_v);
+            if (slope >= MIN_SLOPE && slope <= MAX_SLOPE) {
+                _va_config.cv_slope = slope;
+            } else {
+                consistent = false;
+            }
+        }
+        prev_v = output_voltage;
+        prev_dev = dev;
+        have_prev = true;
+        
+        // Newton step with the current slope estimate
+        float next_v = output_voltage - err / _va_config.cv_slope;
+        
+        if (have_lo && have_hi) {
+            // Fall back to bisection when the step leaves the bracket or the DUT misbehaves
+            if (!consistent || next_v <= lo_v || next_v >= hi_v) {
+                next_v = 0.5f * (lo_v + hi_v);
+            }
+            if (hi_v - lo_v < MIN_OUTPUT_STEP) {
+                break;  // Bracket collapsed to DAC resolution
+            }
+        } else if (have_lo) {
+            // Still below target: always move up, at least one resolution step
+            if (next_v < lo_v + MIN_OUTPUT_STEP) next_v = lo_v + MIN_OUTPUT_STEP;
+        } else if (have_hi) {
+            // Overshot from the warm start: always move down
+            if (next_v > hi_v - MIN_OUTPUT_STEP) next_v = hi_v - MIN_OUTPUT_STEP;
+            if (hi_v <= 0.0f) break;  // Already at 0V output
+        }
+        output_voltage = next_v;
+    }
+    
+    if (reached || _va_config.capped) {
+        device_voltage = last_dev;
+    } else {
+        // Out of updates: settle on the closest point seen
+        output_voltage = best_v;
+        device_voltage = best_dev;
+    }
+    _va_config.output_voltage = output_voltage;
+    
+    return reached;
+}
+
+bool DriverControl::selectAdaptiveVATarget(float& target, int& interval_index) {
+    interval_index = -1;
+    if (_va_adaptive_count >= _va_config.total_steps) {
+        return false;  // Point budget spent
+    }
+    
+    // Phase 1: coarse uniform grid, bottom up so the solver warm start stays local
+    if (_va_adaptive_grid_index < _va_config.initial_points) {
+        float grid_step = (_va_config.end_voltage - _va_config.start_voltage) / (_va_config.initial_points - 1);
+        float grid_target = _va_config.start_voltage + _va_adaptive_grid_index * grid_step;
+        if (grid_target <= _va_adaptive_limit + 1e-6f) {
+            target = grid_target;
+            return true;
+        }
+        _va_adaptive_grid_index = _va_config.initial_points;  // Rest of the grid is above the output cap
+    }
+    
+    if (_va_adaptive_count < 2) {
+        return false;
+    }
+    
+    // Phase 2: bisect the interval with the largest normalised chord length, weighted by how sharply
+    // the curve turns at its ends, so knees and fast dI/dV changes get the points
+    float i_min = _va_adaptive_points[0].current, i_max = i_min;
+    for (int i = 1; i < _va_adaptive_count; i++) {
+        i_min = min(i_min, _va_adaptive_points[i].current);
+        i_max = max(i_max, _va_adaptive_points[i].current);
+    }
+    float v_span = _va_config.end_voltage - _va_config.start_voltage;
+    float i_span = (i_max - i_min) > 1e-9f ? (i_max - i_min) : 1.0f;
+    
+    auto turning_angle = [&](int j) -> float {
+        if (j <= 0 || j >= _va_adaptive_count - 1) return 0.0f;
+        const VAAdaptivePoint& p0 = _va_adaptive_points[j - 1];
+        const VAAdaptivePoint& p1 = _va_adaptive_points[j];
+        const VAAdaptivePoint& p2 = _va_adaptive_points[j + 1];
+        float ax = (p1.voltage - p0.voltage) / v_span, ay = (p1.current - p0.current) / i_span;
+        float bx = (p2.voltage - p1.voltage) / v_span, by = (p2.current - p1.current) / i_span;
+        return atan2f(fabsf(ax * by - ay * bx), ax * bx + ay * by);
+    };
+    
+    float best_score = 0.0f;
+    for (int i = 0; i < _va_adaptive_count - 1; i++) {
+        const VAAdaptivePoint& left = _va_adaptive_points[i];
+        const VAAdaptivePoint& right = _va_adaptive_points[i + 1];
+        if (right.target - left.target < 2.0f * _va_config.step_voltage) {
+            continue;  // Already at the finest allowed spacing
+        }
+        float dx = (right.voltage - left.voltage) / v_span;
+        float dy = (right.current - left.current) / i_span;
+        float score = sqrtf(dx * dx + dy * dy) * (1.0f + (turning_angle(i) + turning_angle(i + 1)) / (float)M_PI);
+        if (score > best_score) {
+            best_score = score;
+            interval_index = i;
+        }
+    }
+    
+    if (interval_index < 0) {
+        return false;  // Curve resolved down to step_voltage everywhere
+    }
+    target = 0.5f * (_va_adaptive_points[interval_index].target + _va_adaptive_points[interval_index + 1].target);
+    return true;
+}
+
+void DriverControl::insertAdaptiveVAPoint(float target, float voltage, float current) {
+    if (_va_adaptive_count >= VA_ADAPTIVE_MAX_POINTS) {
+        return;
+    }
+    
+    int pos = _va_adaptive_count;
+    while (pos > 0 && _va_adaptive_points[pos - 1].target > target) {
+        _va_adaptive_points[pos] = _va_adaptive_points[pos - 1];
+        pos--;
+    }
+    _va_adaptive_points[pos].target = target;
+    _va_adaptive_points[pos].voltage = voltage;
+    _va_adaptive_points[pos].current = current;
+    _va_adaptive_points[pos].output_voltage = _va_config.output_voltage;
+    _va_adaptive_count++;
+}
+
+void DriverControl::performVAMeasurement() {
+    if (!_va_running || _va_config.current_step >= _va_config.total_steps) {
+        stopVAMeasurement();
         return;
     }
     
     float device_voltage, current;
     const int NUM_SAMPLES = 8;  // Increased sampling for better noise averaging
     const int SAMPLE_DELAY_MS = 2;  // Delay between samples
-    const float VOLTAGE_STEP_INCREMENT = 0.05f;  // Output voltage increment per iteration
-    const int MAX_ITERATIONS = 50;  // Max iterations to reach target device voltage
     const float DEVICE_VOLTAGE_TOLERANCE = 0.02f;  // 20mV tolerance for device voltage
     
-    if (_va_config.mode_type == "CV") {
-        // Constant Voltage mode: target is device voltage (V_A - V_B)
-        float target_device_voltage = _va_config.start_voltage + (_va_config.current_step * _va_config.step_voltage);
-        _va_config.target_device_voltage = target_device_voltage;
+    if (_va_config.mode_type == VA_MODE_CV) {
+        // Constant Voltage mode: target is device voltage (V_A - V_B)
+        float target_device_voltage = _va_config.start_voltage + (_va_config.current_step * _va_config.step_voltage);
+        
+        if (_va_config.adaptive) {
+            int interval_index;
+            if (!selectAdaptiveVATarget(target_device_voltage, interval_index)) {
+                stopVAMeasurement();
+                return;
+            }
+            if (interval_index >= 0) {
+                // Refining between two measured neighbours: warm-start from the left one and their chord
+                const VAAdaptivePoint& left = _va_adaptive_points[interval_index];
+                const VAAdaptivePoint& right = _va_adaptive_points[interval_index + 1];
+                _va_config.output_voltage = left.output_voltage;
+                _va_config.last_device_voltage = left.voltage;
+                _va_config.cv_has_history = true;
+                float d_out = right.output_voltage - left.output_voltage;
+                if (d_out > 0.005f) {
+                    float slope = (right.voltage - left.voltage) / d_out;
+                    if (slope >= 0.02f && slope <= 2.0f) _va_config.cv_slope = slope;
+                }
+            }
+            _va_config.capped = false;  // A cap only trims the adaptive range, it does not end the sweep
+        }
+        _va_config.target_device_voltage = target_device_voltage;
+        
+        // Closed-loop: bracketed secant search for the output voltage that gives the target device voltage
+        bool target_reached = solveCVOutputVoltage(target_device_voltage, device_voltage);
+        bool voltage_capped = !target_reached && _va_config.capped;
+        
+        if (_va_config.pulsed) {
+            // Final pulse: full burst average, the bias returns to idle afterwards
+            fireVAPulse(_va_config.output_voltage, _va_config.pulse_samples, device_voltage, current);
+        } else {
+            // Apply final output voltage and take averaged measurement
+            applyVAOutputVoltage(_va_config.output_voltage);
+            delay(20);  // Extra settling time for final measurement
+        
+            // Multi-sample measurement with RMS calculation for noise reduction
+            float voltage_a_sq_sum = 0.0f;
+            float voltage_b_sq_sum = 0.0f;
+            float power_current_sq_sum = 0.0f;
+        
+            // Discard first reading (may be noisy after DAC update)
+            _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+            _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+            delay(2);
+        
+            for (int i = 0; i < NUM_SAMPLES; i++) {
+                float va = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+                float vb = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+                voltage_a_sq_sum += va * va;
+                voltage_b_sq_sum += vb * vb;
+                if (_va_config.power_sense) {
+                    float pc = _io.readPowerCurrent();
+                    power_current_sq_sum += pc * pc;
+                }
+            
+                if (i < NUM_SAMPLES - 1) {
+                    delay(SAMPLE_DELAY_MS);
+                }
+            }
+        
+            // Calculate RMS values
+            float voltage_a = sqrt(voltage_a_sq_sum / NUM_SAMPLES);
+            float voltage_b = sqrt(voltage_b_sq_sum / NUM_SAMPLES);
+        
+            // Device voltage = V_A - V_B (voltage across the device under test)
+            device_voltage = voltage_a - voltage_b;
+        
+            // Current calculation: I = V_shunt / R_shunt
+            if (!_va_config.power_sense) {
+                current = voltage_b / _va_config.shunt_resistance;
+            } else {
+                current = sqrt(power_current_sq_sum / NUM_SAMPLES);  // RMS of power current
+            }
+        
+        }
+        
+        // If voltage was capped and we didn't reach target, end measurement early
+        if (voltage_capped && device_voltage < target_device_voltage - DEVICE_VOLTAGE_TOLERANCE) {
+            Serial.printf("VA measurement capped: output=%.2fV, device=%.3fV, target=%.3fV\n",
+                         _va_config.output_voltage, device_voltage, target_device_voltage);
+        }
+        
+        // Seed the next point's solver from this one
+        _va_config.last_device_voltage = device_voltage;
+        _va_config.cv_has_history = true;
+        
+    } else {
+        // Constant Current mode: adjust voltage to achieve target current
+        float target_current = _va_config.start_current + (_va_config.current_step * _va_config.step_current);
+        
+        // CC closed-loop control parameters
+        const float CC_GAIN = 0.5f;  // Proportional gain for current control
+        const int CC_ITERATIONS = 10;  // Max iterations to reach target current
+        const float CC_TOLERANCE = 0.01f;  // Current tolerance (1%)
+        
+        float measured_current = 0.0f;
+        
+        // Initialize output voltage on first step
+        if (_va_config.current_step == 0) {
+            _va_config.cc_output_voltage = target_current * _va_config.shunt_resistance;  // Initial estimate
+        }
+        
+        // Closed-loop iteration to achieve target current
+        for (int iter = 0; iter < CC_ITERATIONS; iter++) {
+            // Set the output voltage
+            if (_va_config.power_sense) {
+                _io.setPowerCurrent(target_current);  // CH2 has direct current control
+                _io.updateAllDACs();
+                break;  // No need for closed-loop on CH2
+            }
+            applyVAOutputVoltage(_va_config.cc_output_voltage);
+            
+            delay(5);  // Short settling time
+            
+            // Measure current
+            float voltage_b = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+            measured_current = voltage_b / _va_config.shunt_resistance;
+            
+            // Check if we're within tolerance
+            float current_error = target_current - measured_current;
+            if (abs(current_error) < CC_TOLERANCE * target_current) {
+                break;  // Close enough
+            }
+            
+            // Adjust output voltage based on error
+            _va_config.cc_output_voltage += current_error * _va_config.shunt_resistance * CC_GAIN;
+            
+            // Clamp output voltage to valid range
+            if (_va_config.cc_output_voltage < 0) _va_config.cc_output_voltage = 0;
+            if (_va_config.cc_output_voltage >= _va_config.max_output_voltage) {
+                _va_config.cc_output_voltage = _va_config.max_output_voltage;
+                _va_config.capped = true;
+                break;  // Can't go higher
+            }
+        }
+        
+        // Final measurement with RMS calculation
+        float voltage_a_sq_sum = 0.0f;
+        float voltage_b_sq_sum = 0.0f;
+        float power_current_sq_sum = 0.0f;
+        
+        for (int i = 0; i < NUM_SAMPLES; i++) {
+            float va = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+            float vb = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+            voltage_a_sq_sum += va * va;
+            voltage_b_sq_sum += vb * vb;
+            if (_va_config.power_sense) {
+                float pc = _io.readPowerCurrent();
+                power_current_sq_sum += pc * pc;
+            }
+            
+            if (i < NUM_SAMPLES - 1) {
+                delay(SAMPLE_DELAY_MS);
+            }
+        }
+        
+        // Calculate RMS values
+        float voltage_a = sqrt(voltage_a_sq_sum / NUM_SAMPLES);
+        float voltage_b = sqrt(voltage_b_sq_sum / NUM_SAMPLES);
+        
+        // Device voltage = V_A - V_B
+        device_voltage = voltage_a - voltage_b;
+        
+        // Current calculation
+        if (!_va_config.power_sense) {
+            current = voltage_b / _va_config.shunt_resistance;
+        } else {
+            current = sqrt(power_current_sq_sum / NUM_SAMPLES);  // RMS of power current
+        }
+    }
+    
+    // Calculate progress based on actual device voltage reached vs target range
+    float voltage_range = _va_config.end_voltage - _va_config.start_voltage;
+    float progress;
+    bool completed;
+    
+    if (_va_config.mode_type == VA_MODE_CV && _va_config.adaptive) {
+        // Adaptive: record the point, then finish when the budget is spent or nothing is left to refine
+        if (_va_config.capped) {
+            _va_adaptive_limit = _va_config.target_device_voltage;
+        }
+        insertAdaptiveVAPoint(_va_config.target_device_voltage, device_voltage, current);
+        if (_va_adaptive_grid_index < _va_config.initial_points) {
+            _va_adaptive_grid_index++;
+        }
+        
+        float next_target;
+        int next_interval;
+        progress = (float)_va_adaptive_count / _va_config.total_steps * 100.0f;
+        completed = !selectAdaptiveVATarget(next_target, next_interval);
+    } else if (_va_config.mode_type == VA_MODE_CV) {
+        // For CV mode, progress is based on device voltage achieved
+        progress = ((device_voltage - _va_config.start_voltage) / voltage_range) * 100.0f;
+        if (progress < 0) progress = 0;
+        if (progress > 100) progress = 100;
+        
+        // Completed if we reached end voltage OR if output is capped
+        completed = (device_voltage >= _va_config.end_voltage - 0.02f) || _va_config.capped;
+    } else {
+        // For CC mode, progress is based on step count
+        progress = (float)(_va_config.current_step + 1) / _va_config.total_steps * 100.0f;
+        completed = (_va_config.current_step + 1) >= _va_config.total_steps || _va_config.capped;
+    }
+    
+    // Store data point in buffer
+    if (_va_buffer_count < VA_BUFFER_SIZE) {
+        _va_data_buffer[_va_buffer_count].voltage = device_voltage;
+        _va_data_buffer[_va_buffer_count].current = current;
+        _va_data_buffer[_va_buffer_count].timestamp = millis();
+        _va_buffer_count++;
+    }
+    
+    // Send buffered data if buffer is full or measurement is completed, or every 10 measurements
+    if (_va_buffer_count >= VA_BUFFER_SIZE || completed || (_va_config.current_step % 10 == 9)) {
+        sendBufferedVAData(completed);
+    }
+    
+    // Move to next step
+    _va_config.current_step++;
+    
+    if (completed) {
+        Serial.println("VA measurement completed");
+        _va_running = false;
+        _current_mode = DRIVER_MODE_NONE;  // Reset mode when measurement completes
+    }
+}
+
+void DriverControl::sendVADataPoint(float voltage, float current, float progress, bool completed) {
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "va-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "va";
+    
+    // Create data array with single measurement point
+    JsonArray data_array = payload["data"].to<JsonArray>();
+    JsonObject data_point = data_array.add<JsonObject>();  // Use add<JsonObject>() to add object to array
+    data_point["voltage"] = roundTo3Decimals(voltage);
+    data_point["current"] = roundTo3Decimals(current);
+    
+    payload["progress"] = roundTo3Decimals(progress);
+    payload["completed"] = completed;
+    
+    _postman.publish("data", doc);
+    
+    Serial.printf("VA data: V=%.3f, I=%.3f, Progress=%.1f%%, Completed=%s\n", 
+                  voltage, current, progress, completed ? "true" : "false");
+}
+
+void DriverControl::sendBufferedVAData(bool completed) {
+    if (_va_buffer_count == 0) return;  // No data to send
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "va-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "va";
+    
+    // Create data array with all buffered measurement points
+    // Use high precision for current to avoid stair-stepping with small currents
+    JsonArray data_array = payload["data"].to<JsonArray>();
+    for (int i = 0; i < _va_buffer_count; i++) {
+        JsonObject data_point = data_array.add<JsonObject>();
+        data_point["voltage"] = roundTo6Decimals(_va_data_buffer[i].voltage);
+        data_point["current"] = roundTo6Decimals(_va_data_buffer[i].current);
+    }
+    
+    // Calculate progress based on current step
+    float progress = (float)(_va_config.current_step + 1) / _va_config.total_steps * 100.0f;
+    payload["progress"] = roundTo3Decimals(progress);
+    payload["completed"] = completed;
+    if (_va_config.adaptive) {
+        payload["sampling"] = "adaptive";  // Points arrive in measurement order, clients sort by voltage
+    }
+    if (_va_config.pulsed) {
+        JsonObject pulse = payload["pulse"].to<JsonObject>();
+        pulse["width_us"] = _va_config.pulse_width_us;
+        pulse["sample_delay_us"] = _va_config.pulse_sample_delay_us;
+        pulse["samples"] = _va_config.pulse_samples;
+        pulse["duty_cycle"] = _va_config.pulse_duty_cycle;
+        pulse["period_us"] = (int)(_va_config.pulse_width_us / _va_config.pulse_duty_cycle);
+        pulse["late_samples"] = _va_config.pulse_late_count;
+        pulse["timeouts"] = _va_config.pulse_timeout_count;
+    }
+    
+    _postman.publish("data", doc);
+    
+    Serial.printf("VA buffered data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
+                  _va_buffer_count, progress, completed ? "true" : "false");
+    
+    // Reset buffer
+    _va_buffer_count = 0;
+    _va_last_data_send = millis();
+}
+
+void DriverControl::stopVAMeasurement() {
+    if (_va_running) {
+        // Send any remaining buffered data before stopping
+        if (_va_buffer_count > 0) {
+            sendBufferedVAData(true);  // Mark as completed since we're stopping
+        }
+        
+        _va_running = false;
+        _current_mode = DRIVER_MODE_NONE;  // Reset mode when measurement stops
+        
+        // Clear buffer to prevent further data sending
+        _va_buffer_count = 0;
+        
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.setPowerVoltage(0.0);
+        _io.setPowerCurrent(0.0);  // Also reset current limit to 0
+ 
+        _io.updateAllDACs();
+        
+        Serial.println("VA measurement stopped and outputs reset");
+    }
+}
+
+void DriverControl::handleStopCommand(const char* mode) {
+    Serial.printf("Handling Stop command for mode: %s\n", mode);
+    
+    if (strcmp(mode, "control_system") == 0) {
+        // Stop the control system task and any identification run
+        stopIdentification();
+        stopControlSystemTask();
+        _postman.sendResponse("control_system", "success", "Control system stopped");
+        Serial.println("Control system stopped via MQTT command");
+    } else if (strcmp(mode, "va") == 0) {
+        // Stop VA measurement
+        stopVAMeasurement();
+        _postman.sendResponse("va", "success", "VA measurement stopped");
+        Serial.println("VA measurement stopped via MQTT command");
+    } else if (strcmp(mode, "bode") == 0) {
+        // Stop Bode measurement
+        stopBodeMeasurement();
+        _postman.sendResponse("bode", "success", "Bode measurement stopped");
+        Serial.println("Bode measurement stopped via MQTT command");
+    } else if (strcmp(mode, "step") == 0) {
+        // Stop Step measurement
+        stopStepMeasurement();
+        _postman.sendResponse("step", "success", "Step measurement stopped");
+        Serial.println("Step measurement stopped via MQTT command");
+    } else if (strcmp(mode, "impulse") == 0) {
+        // Stop Impulse measurement
+        stopImpulseMeasurement();
+        _postman.sendResponse("impulse", "success", "Impulse measurement stopped");
+        Serial.println("Impulse measurement stopped via MQTT command");
+    } else if (strcmp(mode, "scope") == 0) {
+        // Stop Scope
+        stopScope();
+        _postman.sendResponse("scope", "success", "Scope stopped");
+        Serial.println("Scope stopped via MQTT command");
+    } else if (strcmp(mode, "spectrum") == 0) {
+        // Stop Spectrum
+        stopSpectrum();
+        _postman.sendResponse("spectrum", "success", "Spectrum analyzer stopped");
+        Serial.println("Spectrum analyzer stopped via MQTT command");
+    } else if (strcmp(mode, "impedance") == 0) {
+        // Stop Impedance analyzer
+        stopImpedance();
+        _postman.sendResponse("impedance", "success", "Impedance measurement stopped");
+        Serial.println("Impedance measurement stopped via MQTT command");
+    } else if (strcmp(mode, "curve_tracer") == 0) {
+        // Stop Curve tracer
+        stopCurveTracer();
+        _postman.sendResponse("curve_tracer", "success", "Curve tracer stopped");
+        Serial.println("Curve tracer stopped via MQTT command");
+    } else if (strcmp(mode, "sequence") == 0) {
+        // Stop Sequence
+        stopSequence();
+        _postman.sendResponse("sequence", "success", "Sequence stopped");
+        Serial.println("Sequence stopped via MQTT command");
+    } else if (strcmp(mode, "recipe") == 0) {
+        // Stop Recipe
+        stopRecipe();
+        _postman.sendResponse("recipe", "success", "Recipe stopped");
+        Serial.println("Recipe stopped via MQTT command");
+    } else if (strcmp(mode, "logger") == 0) {
+        // Stop Data logger (the partial chunk is written first)
+        stopLogger();
+        _postman.sendResponse("logger", "success", "Logger stopped");
+        Serial.println("Logger stopped via MQTT command");
+    } else if (strcmp(mode, "protection") == 0) {
+        // Disarm the protection supervisor (a latched trip stays latched)
+        _io.stopProtection();
+        _postman.sendResponse("protection", "success", "Protection disarmed");
+        Serial.println("Protection disarmed via MQTT command");
+    } else if (strcmp(mode, "calibration") == 0) {
+        // Abort the sweep; the previous calibration stays in effect
+        stopCalibration();
+        _postman.sendResponse("calibration", "success", "Calibration stopped, previous table kept");
+        Serial.println("Calibration stopped via MQTT command");
+    } else if (strcmp(mode, "testbed") == 0) {
+        // Stop testbed mode
+        stopPowerRegulation();
+        _testbed_running = false;
+        stopTestbedScan();
+        _current_mode = DRIVER_MODE_NONE;
+        _postman.sendResponse("testbed", "success", "Testbed mode stopped");
+        Serial.println("Testbed mode stopped via MQTT command");
+    } else {
+        // Unknown mode
+        _postman.sendError("E005", "Invalid stop mode", "stop", "mode", mode, "Use 'control_system', 'va', 'bode', 'step', 'impulse', 'scope', 'spectrum', 'impedance', 'curve_tracer', 'sequence', 'recipe', 'logger', 'protection', 'calibration', or 'testbed'");
+        Serial.printf("Unknown stop mode: %s\n", mode);
+    }
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::controlSystemTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->controlSystemTask();
+}
+
+// High-frequency control system task
+void DriverControl::controlSystemTask() {
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    const TickType_t xFrequency = pdMS_TO_TICKS(1000 / CONTROL_SYSTEM_FREQUENCY_HZ); // 20ms for 50Hz
+    
+    Serial.printf("Control system task started at %dHz (stack size: %d bytes)\n", 
+                  CONTROL_SYSTEM_FREQUENCY_HZ, uxTaskGetStackHighWaterMark(NULL));
+    
+    int iteration = 0;
+    while (_control_system_running) {
+        // Monitor stack usage every 1000 iterations (every ~20 seconds at 50Hz)
+        if (iteration % 1000 == 0) {
+            UBaseType_t stackRemaining = uxTaskGetStackHighWaterMark(NULL);
+            Serial.printf("Control task iteration %d, stack remaining: %d bytes\n", iteration, stackRemaining);
+            
+            if (stackRemaining < 256) {
+                Serial.println("WARNING: Control system task stack running low!");
+            }
+        }
+        
+        // Update control system
+        updateControlSystem();
+        
+        iteration++;
+        
+        // Wait for next period (precise timing)
+        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+    }
+    
+    Serial.println("Control system task stopped");
+    _control_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+// Start the high-frequency control system task
+void DriverControl::startControlSystemTask() {
+    if (_control_task_handle == NULL) {
+        _control_system_running = true;
+        
+        BaseType_t result = xTaskCreatePinnedToCore(
+            controlSystemTaskWrapper,    // Task function
+            "ControlSystemTask",         // Task name
+            4096,                       // Stack size (4KB - reduced from 8KB)
+            this,                       // Parameter passed to task
+            1,                          // Priority (reduced from 2 to 1)
+            &_control_task_handle,      // Task handle
+            1                           // Core 1 (separate from WiFi/main loop on core 0)
+        );
+        
+        if (result != pdPASS) {
+            Serial.println("ERROR: Failed to create control system task!");
+            _control_system_running = false;
+            _current_mode = DRIVER_MODE_NONE;  // Reset mode on failure
+        } else {
+            Serial.println("Control system task created successfully");
+        }
+    }
+}
+
+// Stop the control system task
+void DriverControl::stopControlSystemTask() {
+    if (_control_task_handle != NULL) {
+        Serial.println("Stopping control system task...");
+        _control_system_running = false;
+        _current_mode = DRIVER_MODE_NONE;  // Reset mode when stopping
+        
+        // The task finishes its current iteration and clears its handle
+        waitForTaskExit(_control_task_handle, "Control system");
+        Serial.println("Control system task stopped");
+    } else {
+        Serial.println("Control system task was not running");
+    }
+}
+
+// Send buffered data via MQTT (called from main loop every 500ms)
+void DriverControl::sendBufferedData() {
+    Serial.printf("sendBufferedData called: buffer_count=%d, control_running=%d\n", _buffer_count, _control_system_running);
+    
+    // Send data if we have at least 5 samples (to avoid sending tiny batches)
+    if (_buffer_count < 5) return;
+    
+    // Take mutex to safely read buffer
+    if (xSemaphoreTake(_data_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
+        // ArduinoJson 7 automatically manages memory allocation
+        JsonDocument doc;
+        doc["type"] = "data";
+        doc["mode"] = "control_system";
+        
+        JsonObject payload = doc["payload"].to<JsonObject>();
+        payload["sample_count"] = _buffer_count;
+        payload["frequency_hz"] = CONTROL_SYSTEM_FREQUENCY_HZ;
+        payload["continuous"] = true;
+        
+        // Create arrays for batch data using modern ArduinoJson 7 syntax
+        JsonArray timestamps = payload["timestamps"].to<JsonArray>();
+        JsonArray inputs = payload["inputs"].to<JsonArray>();
+        JsonArray states_x1 = payload["states_x1"].to<JsonArray>();
+        JsonArray states_x2 = payload["states_x2"].to<JsonArray>();
+        JsonArray outputs_y1 = payload["outputs_y1"].to<JsonArray>();
+        JsonArray outputs_y2 = payload["outputs_y2"].to<JsonArray>();
+        
+        // Copy data from buffer
+        int read_start = (_buffer_write_index - _buffer_count + CONTROL_SYSTEM_BUFFER_SIZE) % CONTROL_SYSTEM_BUFFER_SIZE;
+        
+        for (int i = 0; i < _buffer_count; i++) {
+            int index = (read_start + i) % CONTROL_SYSTEM_BUFFER_SIZE;
+            
+            timestamps.add(_data_buffer[index].timestamp);
+            inputs.add(roundTo3Decimals(_data_buffer[index].input_value));
+            states_x1.add(roundTo3Decimals(_data_buffer[index].state_x1));
+            states_x2.add(roundTo3Decimals(_data_buffer[index].state_x2));
+            outputs_y1.add(roundTo3Decimals(_data_buffer[index].output_y1));
+            outputs_y2.add(roundTo3Decimals(_data_buffer[index].output_y2));
+        }
+        
+        // Reset buffer
+        _buffer_count = 0;
+        _buffer_write_index = 0;
+        
+        xSemaphoreGive(_data_mutex);
+        
+        // Debug: Check JSON size using measureJson (more memory efficient)
+        size_t json_size = measureJson(doc);
+        Serial.printf("JSON size: %d bytes, sending %d samples\n", json_size, timestamps.size());
+        
+        // Send data directly (no String conversion needed)
+        _postman.publish("data", doc);
+        
+        Serial.printf("Sent %d control system samples\n", timestamps.size());
+    }
+}
+
+// ============================================================================
+// System identification helper functions
+// ============================================================================
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::identifyTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->identifyTask();
+}
+
+void DriverControl::identifyTask() {
+    IdentifyConfig& cfg = _identify_config;
+    const int64_t dt_us = cfg.sample_period_us;
+    const int total = cfg.settle_samples + cfg.samples;
+    uint32_t lfsr = 1;
+    float y1 = 0.0f, y2 = 0.0f, u1 = 0.0f, u2 = 0.0f;
+    
+    Serial.printf("Identification task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    _io.setSignalVoltage(cfg.excitation_channel, cfg.offset);
+    _io.updateAllDACs();
+    
+    int64_t t_next = esp_timer_get_time();
+    for (int k = 0; k < total && _identify_running; k++) {
+        int64_t remaining_us = t_next - esp_timer_get_time();
+        if (remaining_us > 3000) {
+            vTaskDelay(pdMS_TO_TICKS((remaining_us - 2000) / 1000));
+        }
+        while (esp_timer_get_time() < t_next) {
+        }
+        if (k >= cfg.settle_samples && esp_timer_get_time() - t_next > dt_us) {
+            cfg.late_samples++;
+        }
+        t_next += dt_us;
+        if (k < cfg.settle_samples) {
+            continue;  // Plant settles at the operating point
+        }
+        
+        // y[n] responds to u[n-1]: read first, then update the excitation
+        const int n = k - cfg.settle_samples;
+        float y = _io.readSignalVoltage(cfg.response_channel);
+        if (n == 0) {
+            _identify_y_ref = y;
+        }
+        y -= _identify_y_ref;
+        if (n >= 2) {
+            Matrix<IDENTIFY_PARAMETERS, 1> phi;
+            phi(0) = y1;
+            phi(1) = y2;
+            phi(2) = u1;
+            phi(3) = u2;
+            phi(4) = 1.0f;
+            updateIdentification(phi, y);
+        }
+        _identify_y_min = min(_identify_y_min, y);
+        _identify_y_max = max(_identify_y_max, y);
+        
+        float u = identifyExcitation(n, lfsr);
+        _io.setSignalVoltage(cfg.excitation_channel, cfg.offset + u);
+        _io.updateAllDACs();
+        
+        y2 = y1;
+        y1 = y;
+        u2 = u1;
+        u1 = u;
+        cfg.completed_samples = n + 1;
+    }
+    
+    // Hold the operating point until loop() has published the model
+    _io.setSignalVoltage(cfg.excitation_channel, cfg.offset);
+    _io.updateAllDACs();
+    if (_identify_running) {
+        _identify_done = true;
+    }
+    
+    Serial.printf("Identification task stopped after %d samples, %d late\n", (int)cfg.completed_samples, cfg.late_samples);
+    _identify_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+float DriverControl::identifyExcitation(int sample, uint32_t& lfsr) {
+    const IdentifyConfig& cfg = _identify_config;
+    
+    if (cfg.excitation == IDENTIFY_EXCITATION_PRBS) {
+        // Galois LFSR feedback masks for maximal-length sequences, orders 5..16
+        static const uint16_t masks[] = {
+            0x0014, 0x0030, 0x0060, 0x00B8, 0x0110, 0x0240,
+            0x0500, 0x0E08, 0x1C80, 0x3802, 0x6000, 0xD008
+        };
+        if (sample % cfg.prbs_hold == 0) {
+            uint32_t lsb = lfsr & 1u;
+            lfsr >>= 1;
+            if (lsb) {
+                lfsr ^= masks[cfg.prbs_order - 5];
+            }
+        }
+        return (lfsr & 1u) ? cfg.amplitude : -cfg.amplitude;
+    }
+    
+    // Logarithmic chirp from chirp_from to chirp_to across the record
+    float duration = cfg.samples * (cfg.sample_period_us / 1000000.0f);
+    float t = sample * (cfg.sample_period_us / 1000000.0f);
+    float ratio = logf(cfg.chirp_to / cfg.chirp_from);
+    float phase = 2.0f * (float)M_PI * cfg.chirp_from * duration / ratio * (expf(ratio * t / duration) - 1.0f);
+    return cfg.amplitude * sinf(phase);
+}
+
+void DriverControl::updateIdentification(const Matrix<IDENTIFY_PARAMETERS, 1>& phi, float y) {
+    // Recursive least squares: constant memory whatever the record length
+    const float lambda = _identify_config.forgetting;
+    Matrix<IDENTIFY_PARAMETERS, 1> p_phi = _identify_P * phi;
+    float denom = lambda + (~phi * p_phi)(0, 0);
+    Matrix<IDENTIFY_PARAMETERS, 1> gain = p_phi * (1.0f / denom);
+    float error = y - (~phi * _identify_theta)(0, 0);
+    _identify_theta += gain * error;
+    _identify_P = (_identify_P - gain * ~p_phi) * (1.0f / lambda);
+    
+    // Keep P symmetric against float round-off
+    if ((_identify_config.completed_samples & 63) == 0) {
+        _identify_P = (_identify_P + ~_identify_P) * 0.5f;
+    }
+    
+    // One-step prediction error once the estimate has settled
+    if (_identify_config.completed_samples >= 10 * IDENTIFY_PARAMETERS) {
+        _identify_error_sq += (double)error * error;
+        _identify_y_sum += y;
+        _identify_y_sq += (double)y * y;
+        _identify_error_count++;
+    }
+}
+
+void DriverControl::performIdentifyPublish() {
+    if (_identify_done) {
+        publishIdentifiedModel();
+        return;
+    }
+    if (millis() - _identify_last_progress < 2000) {
+        return;
+    }
+    _identify_last_progress = millis();
+    
+    const IdentifyConfig& cfg = _identify_config;
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "cs-identify-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "control_system";
+    payload["cs_mode"] = "identify";
+    payload["samples"] = (int)cfg.completed_samples;
+    payload["progress"] = roundTo3Decimals(100.0f * cfg.completed_samples / cfg.samples);
+    payload["completed"] = false;
+    
+    _postman.publish("data", doc);
+}
+
+void DriverControl::publishIdentifiedModel() {
+    const IdentifyConfig& cfg = _identify_config;
+    const float dt = cfg.sample_period_us / 1000000.0f;
+    const float t0 = _identify_theta(0), t1 = _identify_theta(1);
+    const float b1 = _identify_theta(2), b2 = _identify_theta(3), bias = _identify_theta(4);
+    
+    // Operating point: the bias is the output offset at u = 0 (unless the plant integrates)
+    float static_den = 1.0f - t0 - t1;
+    float y0 = fabsf(static_den) > 1e-3f ? bias / static_den 
+                                         : (_identify_error_count > 0 ? (float)(_identify_y_sum / _identify_error_count) : 0.0f);
+    float y_half_range = 1.1f * max(_identify_y_max - y0, y0 - _identify_y_min);
+    if (!(y_half_range > 1e-3f)) {
+        _postman.sendError("E001", "Plant output did not respond", "control_system", "response_channel", "", 
+                          "Increase amplitude or check the response channel wiring");
+        stopIdentification();
+        return;
+    }
+    
+    // Model in system units: u = (V_in - offset) / amplitude, y = (V_out - zero) / half range
+    float input_scale = cfg.amplitude / y_half_range;
+    float bn1 = b1 * input_scale, bn2 = b2 * input_scale;
+    
+    double fit = 0.0;
+    if (_identify_error_count > 1) {
+        double variance = _identify_y_sq - _identify_y_sum * _identify_y_sum / _identify_error_count;
+        fit = variance > 0.0 ? 100.0 * (1.0 - sqrt(_identify_error_sq / variance)) : 0.0;
+    }
+    
+    // Discrete poles: z^2 - t0 z - t1 = 0
+    float disc = t0 * t0 + 4.0f * t1;
+    float pole_re[2], pole_im[2];
+    if (disc >= 0.0f) {
+        pole_re[0] = 0.5f * (t0 + sqrtf(disc));
+        pole_re[1] = 0.5f * (t0 - sqrtf(disc));
+        pole_im[0] = pole_im[1] = 0.0f;
+    } else {
+        pole_re[0] = pole_re[1] = 0.5f * t0;
+        pole_im[0] = 0.5f * sqrtf(-disc);
+        pole_im[1] = -pole_im[0];
+    }
+    bool stable = true;
+    for (int i = 0; i < 2; i++) {
+        stable = stable && (pole_re[i] * pole_re[i] + pole_im[i] * pole_im[i] < 1.0f);
+    }
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "cs-identify-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "control_system";
+    payload["cs_mode"] = "identify";
+    payload["samples"] = (int)cfg.completed_samples;
+    payload["progress"] = 100.0f;
+    payload["completed"] = true;
+    
+    JsonObject result = payload["identification"].to<JsonObject>();
+    result["excitation"] = cfg.excitation == IDENTIFY_EXCITATION_CHIRP ? "chirp" : "prbs";
+    result["sample_time_ms"] = roundTo3Decimals(dt * 1000.0f);
+    result["fit_percent"] = roundTo3Decimals((float)fit);
+    result["dc_gain"] = fabsf(static_den) > 1e-3f ? roundTo6Decimals((b1 + b2) / static_den) : 0.0f;
+    result["stable"] = stable;
+    result["late_samples"] = cfg.late_samples;
+    JsonObject discrete = result["discrete"].to<JsonObject>();   // y[k] + a1 y[k-1] + a2 y[k-2] = b1 u[k-1] + b2 u[k-2], volts
+    JsonArray a = discrete["a"].to<JsonArray>();
+    a.add(roundTo6Decimals(-t0));
+    a.add(roundTo6Decimals(-t1));
+    JsonArray b = discrete["b"].to<JsonArray>();
+    b.add(roundTo6Decimals(b1));
+    b.add(roundTo6Decimals(b2));
+    JsonArray poles = discrete["poles"].to<JsonArray>();
+    for (int i = 0; i < 2; i++) {
+        JsonArray pole = poles.add<JsonArray>();
+        pole.add(roundTo6Decimals(pole_re[i]));
+        pole.add(roundTo6Decimals(pole_im[i]));
+    }
+    
+    // Same shape handleSystemMode() accepts. Observer canonical form, converted with the
+    // forward-Euler relation the simulation integrates with: A = (Ad - I) / dt, B = Bd / dt
+    JsonObject settings = payload["settings"].to<JsonObject>();
+    settings["cs_mode"] = "system";
+    JsonObject model = settings["system_model"].to<JsonObject>();
+    JsonArray A = model["A"].to<JsonArray>();
+    JsonArray A0 = A.add<JsonArray>();
+    A0.add(roundTo6Decimals((t0 - 1.0f) / dt));
+    A0.add(roundTo6Decimals(1.0f / dt));
+    JsonArray A1 = A.add<JsonArray>();
+    A1.add(roundTo6Decimals(t1 / dt));
+    A1.add(roundTo6Decimals(-1.0f / dt));
+    JsonArray B = model["B"].to<JsonArray>();
+    B.add<JsonArray>().add(roundTo6Decimals(bn1 / dt));
+    B.add<JsonArray>().add(roundTo6Decimals(bn2 / dt));
+    JsonArray C = model["C"].to<JsonArray>();
+    JsonArray C0 = C.add<JsonArray>();
+    C0.add(1);
+    C0.add(0);
+    JsonArray C1 = C.add<JsonArray>();  // Second output unused
+    C1.add(0);
+    C1.add(0);
+    JsonArray D = model["D"].to<JsonArray>();
+    D.add<JsonArray>().add(0);
+    D.add<JsonArray>().add(0);
+    JsonObject input_range = model["input_voltage_range"].to<JsonObject>();
+    input_range["min_volts"] = roundTo3Decimals(cfg.offset - cfg.amplitude);
+    input_range["max_volts"] = roundTo3Decimals(cfg.offset + cfg.amplitude);
+    input_range["zero_offset"] = roundTo3Decimals(cfg.offset);
+    JsonObject output_range = model["output_voltage_range"].to<JsonObject>();
+    float zero = _identify_y_ref + y0;
+    output_range["min_volts"] = roundTo3Decimals(zero - y_half_range);
+    output_range["max_volts"] = roundTo3Decimals(zero + y_half_range);
+    output_range["zero_offset"] = roundTo3Decimals(zero);
+    
+    _postman.publish("data", doc);
+    
+    Serial.printf("Identified: a = [%.4f %.4f], b = [%.4f %.4f], fit %.1f%%, %s\n", 
+                  -t0, -t1, b1, b2, fit, stable ? "stable" : "UNSTABLE");
+    
+    bool apply = cfg.apply;
+    stopIdentification();
+    
+    // Hand the model straight to the simulation if requested
+    if (apply && stable) {
+        _current_mode = DRIVER_MODE_CONTROL_SYSTEM;
+        handleSystemMode(settings);
+    }
+}
+
+void DriverControl::stopIdentification() {
+    bool was_active = _identify_running || _identify_done;
+    _identify_running = false;
+    
+    if (_identify_task_handle != NULL) {
+        // The task exits at the next sample and clears its handle
+        waitForTaskExit(_identify_task_handle, "Identification");
+    }
+    _identify_done = false;
+    
+    if (was_active) {
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.updateAllDACs();
+        if (_current_mode == DRIVER_MODE_CONTROL_SYSTEM) {
+            _current_mode = DRIVER_MODE_NONE;
+        }
+        Serial.println("System identification stopped and outputs reset");
+    }
+}
+
+// ============================================================================
+// Impedance analyzer helper functions
+// ============================================================================
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::impedanceTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->impedanceTask();
+}
+
+void DriverControl::impedanceTask() {
+    const ImpedanceConfig& cfg = _impedance_config;
+    float decades = log10f(cfg.freq_to / cfg.freq_from);
+    
+    Serial.printf("Impedance task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    do {
+        for (int p = 0; p < cfg.total_points && _impedance_running; p++) {
+            float frequency = cfg.total_points > 1 
+                ? cfg.freq_from * powf(10.0f, decades * p / (cfg.total_points - 1)) : cfg.freq_from;
+            ImpedancePoint point;
+            if (!measureImpedancePoint(frequency, point)) {
+                break;
+            }
+            point.last = !cfg.continuous && p == cfg.total_points - 1;
+            
+            // loop() drains the queue; wait for room rather than drop a point
+            while (_impedance_running && xQueueSend(_impedance_queue, &point, pdMS_TO_TICKS(10)) != pdTRUE) {
+            }
+            vTaskDelay(1);  // Let loop() publish between points
+        }
+    } while (_impedance_running && cfg.continuous);
+    
+    _impedance_measuring = false;
+    _impedance_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+bool DriverControl::measureImpedancePoint(float frequency, ImpedancePoint& point) {
+    ImpedanceConfig& cfg = _impedance_config;
+    
+    // As many samples per cycle as the tick budget allows, with the cycle a whole number of ticks
+    int m = constrain((int)(IMPEDANCE_MAX_RATE / frequency), IMPEDANCE_MIN_SAMPLES_PER_CYCLE, IMPEDANCE_MAX_SAMPLES_PER_CYCLE);
+    uint32_t period_us = max((uint32_t)1, (uint32_t)(1000000.0f / (frequency * m) + 0.5f));
+    float actual = 1000000.0f / ((float)period_us * m);
+    
+    for (int i = 0; i < m; i++) {
+        float angle = 2.0f * (float)M_PI * i / m;
+        _impedance_cos[i] = cosf(angle);
+        _impedance_sin[i] = sinf(angle);
+        _impedance_codes[i] = _io.signalVoltageToCode(cfg.offset + cfg.amplitude * _impedance_cos[i], SIGNAL_CHANNEL_A);
+    }
+    
+    // Whole cycles only: the DC bias and the quadrature term then cancel exactly
+    int cycles = max(cfg.min_cycles, (int)ceilf(cfg.integration_time * actual));
+    double ia = 0.0, qa = 0.0, ib = 0.0, qb = 0.0;
+    int64_t burst_us = 0;
+    bool overload = false;
+    int64_t t_next = esp_timer_get_time();
+    
+    for (int c = 0; c < cfg.settle_cycles + cycles && _impedance_running; c++) {
+        int64_t cycle_burst_us = 0;
+        cfg.late_samples += playAndCapture(0, _impedance_codes, m, period_us, t_next,
+                                           _impedance_raw_a, _impedance_raw_b, cycle_burst_us, _impedance_running);
+        if (c < cfg.settle_cycles) {
+            continue;
+        }
+        
+        // Per-cycle sums stay short enough for float; the run total goes to double
+        float cycle_ia = 0.0f, cycle_qa = 0.0f, cycle_ib = 0.0f, cycle_qb = 0.0f;
+        for (int i = 0; i < m; i++) {
+            float a = _impedance_raw_a[i], b = _impedance_raw_b[i];
+            cycle_ia += a * _impedance_cos[i];
+            cycle_qa += a * _impedance_sin[i];
+            cycle_ib += b * _impedance_cos[i];
+            cycle_qb += b * _impedance_sin[i];
+            // A code on either rail means the input clipped (or the drive reached 0V)
+            overload = overload || _impedance_raw_a[i] == 0 || _impedance_raw_a[i] >= ADC_MAX_VALUE 
+                                || _impedance_raw_b[i] == 0 || _impedance_raw_b[i] >= ADC_MAX_VALUE;
+        }
+        ia += cycle_ia;
+        qa += cycle_qa;
+        ib += cycle_ib;
+        qb += cycle_qb;
+        burst_us += cycle_burst_us;
+    }
+    if (!_impedance_running) {
+        return false;
+    }
+    
+    // Phasors (peak volts): x = A cos(wt + phi) gives sum(x cos) - j sum(x sin) = N/2 A e^(j phi)
+    const int n = cycles * m;
+    // Only the gain of each input matters here: its offset cancels over whole cycles
+    const float lsb_a = _io.signalVoltageFromRaw(1.0f, SIGNAL_CHANNEL_A) - _io.signalVoltageFromRaw(0.0f, SIGNAL_CHANNEL_A);
+    const float lsb_b = _io.signalVoltageFromRaw(1.0f, SIGNAL_CHANNEL_B) - _io.signalVoltageFromRaw(0.0f, SIGNAL_CHANNEL_B);
+    const float scale_a = 2.0f * lsb_a / n;
+    const float scale_b = 2.0f * lsb_b / n;
+    float ar = scale_a * (float)ia, ai = -scale_a * (float)qa;
+    float br = scale_b * (float)ib, bi = -scale_b * (float)qb;
+    
+    // Channel B converts about half a burst after channel A: rotate it back
+    float w = 2.0f * (float)M_PI * actual;
+    float skew_s = 0.5f * (float)burst_us / n * 1e-6f;
+    float c = cosf(w * skew_s), s = sinf(w * skew_s);
+    float br_c = br * c + bi * s;
+    float bi_c = bi * c - br * s;
+    
+    // Z = (V_A - V_B) / (V_B / R_shunt)
+    float dr = ar - br_c, di = ai - bi_c;
+    float b_sq = br_c * br_c + bi_c * bi_c;
+    point.frequency = actual;
+    point.cycles = cycles;
+    point.overload = overload;
+    point.v_dut = sqrtf(dr * dr + di * di);
+    point.current = sqrtf(b_sq) / cfg.shunt_resistance;
+    point.low_current = sqrtf(b_sq) < 4.0f * lsb_b;
+    if (b_sq > 1e-12f) {
+        point.z_re = cfg.shunt_resistance * (dr * br_c + di * bi_c) / b_sq;
+        point.z_im = cfg.shunt_resistance * (di * br_c - dr * bi_c) / b_sq;
+    } else {
+        point.z_re = point.z_im = NAN;
+    }
+    return true;
+}
+
+void DriverControl::performImpedancePublish() {
+    ImpedancePoint points[IMPEDANCE_CHUNK_POINTS];
+    int count = 0;
+    while (count < IMPEDANCE_CHUNK_POINTS && xQueueReceive(_impedance_queue, &points[count], 0) == pdTRUE) {
+        count++;
+    }
+    if (count == 0) {
+        // Stopped early or a continuous run ended without a last point
+        if (!_impedance_measuring) {
+            stopImpedance();
+        }
+        return;
+    }
+    
+    ImpedanceConfig& cfg = _impedance_config;
+    bool completed = points[count - 1].last;
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "impedance-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "impedance";
+    payload["equivalent"] = cfg.parallel ? "parallel" : "series";
+    
+    JsonArray data_array = payload["data"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+        const ImpedancePoint& point = points[i];
+        JsonObject data_point = data_array.add<JsonObject>();
+        float w = 2.0f * (float)M_PI * point.frequency;
+        float magnitude = sqrtf(point.z_re * point.z_re + point.z_im * point.z_im);
+        
+        data_point["frequency"] = roundTo3Decimals(point.frequency);
+        data_point["impedance"] = magnitude;
+        data_point["phase"] = roundTo3Decimals(atan2f(point.z_im, point.z_re) * 180.0f / (float)M_PI);
+        data_point["esr"] = point.z_re;
+        data_point["reactance"] = point.z_im;
+        
+        if (cfg.parallel) {
+            // Y = 1/Z = G + jB: Rp = 1/G, inductive for B < 0
+            float mag_sq = magnitude * magnitude;
+            float g = point.z_re / mag_sq, b = -point.z_im / mag_sq;
+            data_point["resistance"] = 1.0f / g;
+            if (b < 0.0f) {
+                data_point["inductance"] = -1.0f / (w * b);
+            } else {
+                data_point["capacitance"] = b / w;
+            }
+        } else {
+            data_point["resistance"] = point.z_re;
+            if (point.z_im > 0.0f) {
+                data_point["inductance"] = point.z_im / w;
+            } else {
+                data_point["capacitance"] = -1.0f / (w * point.z_im);
+            }
+        }
+        data_point["q"] = roundTo3Decimals(fabsf(point.z_im) / point.z_re);
+        data_point["d"] = roundTo6Decimals(point.z_re / fabsf(point.z_im));
+        data_point["v_dut"] = roundTo3Decimals(point.v_dut);
+        data_point["current"] = roundTo6Decimals(point.current);
+        data_point["cycles"] = point.cycles;
+        if (point.overload) data_point["overload"] = true;
+        if (point.low_current) data_point["low_current"] = true;
+    }
+    
+    cfg.published_points += count;
+    float progress = cfg.continuous ? 100.0f 
+                                    : (float)min(cfg.published_points, cfg.total_points) / cfg.total_points * 100.0f;
+    payload["progress"] = roundTo3Decimals(progress);
+    payload["completed"] = completed;
+    if (completed) {
+        payload["late_samples"] = cfg.late_samples;
+    }
+    
+    _postman.publish("data", doc);
+    
+    if (completed) {
+        Serial.println("Impedance measurement completed");
+        stopImpedance();
+    }
+}
+
+void DriverControl::stopImpedance() {
+    if (_impedance_task_handle != NULL) {
+        _impedance_running = false;
+        
+        // The task exits at the next sample and clears its handle
+        waitForTaskExit(_impedance_task_handle, "Impedance");
+    }
+    
+    if (_impedance_running || _current_mode == DRIVER_MODE_IMPEDANCE) {
+        _current_mode = DRIVER_MODE_NONE;
+        
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.updateAllDACs();
+    }
+    _impedance_running = false;
+    _impedance_measuring = false;
+    xQueueReset(_impedance_queue);
+}
+
+// ============================================================================
+// Curve tracer helper functions
+// ============================================================================
+
+bool DriverControl::parseCurveOutput(const char* channel, CurveOutput& output) {
+    DriverChannel parsed;
+    if (!parseChannel(channel, parsed)) return false;
+    output = (CurveOutput)parsed;   // Curve outputs are numbered like the channels
+    return true;
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::curveTracerTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->curveTracerTask();
+}
+
+void DriverControl::curveTracerTask() {
+    CurveTracerConfig& cfg = _curve_config;
+    float inner_step = (cfg.inner_stop - cfg.inner_start) / (cfg.inner_points - 1);
+    float outer_step = cfg.outer_steps > 1 ? (cfg.outer_stop - cfg.outer_start) / (cfg.outer_steps - 1) : 0.0f;
+    
+    Serial.printf("Curve tracer task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    if (cfg.inner_output == CURVE_OUTPUT_POWER || cfg.outer_output == CURVE_OUTPUT_POWER) {
+        _io.setPowerCurrent(cfg.current_limit);
+    }
+    
+    for (int c = 0; c < cfg.outer_steps && _curve_running; c++) {
+        CurvePoint point;
+        point.curve = c;
+        point.outer_setpoint = cfg.outer_start + c * outer_step;
+        
+        // New bias and the first inner level go out on the same LDAC edge
+        float first = cfg.pulsed ? cfg.pulse_idle_voltage : cfg.inner_start;
+        stageCurveOutput(cfg.outer_output, point.outer_setpoint);
+        stageCurveOutput(cfg.inner_output, first);
+        _io.updateAllDACs();
+        float voltage, current;
+        if (!waitCurveSettle(voltage, current)) {
+            cfg.unsettled_points++;
+        }
+        measureCurveOuter(point.outer_setpoint, point.outer_voltage, point.outer_current);
+        
+        for (int p = 0; p < cfg.inner_points && _curve_running; p++) {
+            point.setpoint = cfg.inner_start + p * inner_step;
+            if (cfg.pulsed) {
+                fireCurvePulse(point.setpoint, point.voltage, point.current);
+                point.settled = true;
+            } else {
+                if (p > 0) {
+                    stageCurveOutput(cfg.inner_output, point.setpoint);
+                    _io.updateAllDACs();
+                }
+                point.settled = waitCurveSettle(point.voltage, point.current);
+                if (!point.settled) {
+                    cfg.unsettled_points++;
+                }
+            }
+            point.curve_end = p == cfg.inner_points - 1;
+            point.last = point.curve_end && c == cfg.outer_steps - 1;
+            
+            // loop() drains the queue; wait for room rather than drop a point
+            while (_curve_running && xQueueSend(_curve_queue, &point, pdMS_TO_TICKS(10)) != pdTRUE) {
+            }
+        }
+        vTaskDelay(1);  // Let loop() publish between curves
+    }
+    
+    // Leave the DUT unbiased between families
+    stageCurveOutput(cfg.inner_output, 0.0f);
+    stageCurveOutput(cfg.outer_output, 0.0f);
+    _io.updateAllDACs();
+    
+    _curve_measuring = false;
+    _curve_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::stageCurveOutput(CurveOutput output, float voltage) {
+    // Write the DAC input register only; the caller latches with updateAllDACs()
+    switch (output) {
+        case CURVE_OUTPUT_SIGNAL_A: _io.setSignalVoltage(SIGNAL_CHANNEL_A, voltage); break;
+        case CURVE_OUTPUT_SIGNAL_B: _io.setSignalVoltage(SIGNAL_CHANNEL_B, voltage); break;
+        case CURVE_OUTPUT_POWER:    _io.setPowerVoltage(voltage); break;
+    }
+}
+
+void DriverControl::measureCurveInner(float& voltage, float& current) {
+    const int SAMPLES = 4;
+    if (_curve_config.inner_output == CURVE_OUTPUT_POWER) {
+        // A new scan frame per reading: the filtered value would lag and repeat between settle checks
+        float voltage_raw = 0.0f, current_raw = 0.0f;
+        _io.readPowerFeedbackFresh(&voltage_raw, &current_raw);
+        voltage = _io.powerVoltageFromRaw(voltage_raw);
+        current = _io.powerCurrentFromRaw(current_raw);
+        return;
+    }
+    
+    // DUT between A and B, shunt from B to ground
+    uint16_t raw_a[SAMPLES], raw_b[SAMPLES];
+    _io.readSignalBurst(raw_a, raw_b, SAMPLES);
+    uint32_t sum_a = 0, sum_b = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        sum_a += raw_a[i];
+        sum_b += raw_b[i];
+    }
+    float voltage_a = _io.signalVoltageFromRaw((float)sum_a / SAMPLES);
+    float voltage_b = _io.signalVoltageFromRaw((float)sum_b / SAMPLES, SIGNAL_CHANNEL_B);
+    voltage = voltage_a - voltage_b;
+    current = voltage_b / _curve_config.shunt_resistance;
+}
+
+void DriverControl::measureCurveOuter(float setpoint, float& voltage, float& current) {
+    const CurveTracerConfig& cfg = _curve_config;
+    voltage = NAN;
+    current = NAN;
+    switch (cfg.outer_output) {
+        case CURVE_OUTPUT_POWER:
+            voltage = _io.readPowerVoltage();
+            current = _io.readPowerCurrent();
+            return;
+        case CURVE_OUTPUT_SIGNAL_A:
+            // Signal ADCs are free only while the power output is swept
+            if (cfg.inner_output == CURVE_OUTPUT_POWER) voltage = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+            break;
+        case CURVE_OUTPUT_SIGNAL_B:
+            if (cfg.inner_output == CURVE_OUTPUT_POWER) voltage = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+            break;
+    }
+    // Drive through a known resistor (base/gate resistor) gives the outer current
+    if (!isnan(voltage) && cfg.series_resistance > 0.0f) {
+        current = (setpoint - voltage) / cfg.series_resistance;
+    }
+}
+
+bool DriverControl::waitCurveSettle(float& voltage, float& current) {
+    const CurveTracerConfig& cfg = _curve_config;
+    int64_t t_start = esp_timer_get_time();
+    int64_t t_next = t_start + cfg.settle_interval_us;
+    float last_voltage, last_current;
+    measureCurveInner(last_voltage, last_current);
+    
+    while (_curve_running) {
+        int64_t remaining_us = t_next - esp_timer_get_time();
+        if (remaining_us > 3000) {
+            vTaskDelay(pdMS_TO_TICKS((remaining_us - 2000) / 1000));
+        }
+        while (esp_timer_get_time() < t_next) {
+            // Busy-wait: the interval is below the scheduler tick
+        }
+        t_next += cfg.settle_interval_us;
+        
+        measureCurveInner(voltage, current);
+        bool voltage_ok = fabsf(voltage - last_voltage) <= cfg.settle_voltage_tolerance + cfg.settle_relative * fabsf(voltage);
+        bool current_ok = fabsf(current - last_current) <= cfg.settle_current_tolerance + cfg.settle_relative * fabsf(current);
+        if (voltage_ok && current_ok) {
+            // Report the mean of the two agreeing readings
+            voltage = 0.5f * (voltage + last_voltage);
+            current = 0.5f * (current + last_current);
+            return true;
+        }
+        if (esp_timer_get_time() - t_start >= cfg.settle_timeout_us) {
+            return false;
+        }
+        last_voltage = voltage;
+        last_current = current;
+    }
+    voltage = last_voltage;
+    current = last_current;
+    return false;
+}
+
+void DriverControl::fireCurvePulse(float level, float& voltage, float& current) {
+    CurveTracerConfig& cfg = _curve_config;
+    uint16_t raw_a[VA_PULSE_MAX_SAMPLES];
+    uint16_t raw_b[VA_PULSE_MAX_SAMPLES];
+    
+    // Leading edge latches the inner level now, the trailing edge comes from the hardware timer.
+    // The outer DAC keeps its staged code, so re-latching it does not move the bias.
+    stageCurveOutput(cfg.inner_output, level);
+    int64_t t_start = _io.startLatchPulse(cfg.pulse_width_us);
+    stageCurveOutput(cfg.inner_output, cfg.pulse_idle_voltage);
+    
+    int64_t t_sample = t_start + cfg.pulse_sample_delay_us;
+    if (esp_timer_get_time() > t_sample) {
+        cfg.late_pulses++;
+    }
+    while (esp_timer_get_time() < t_sample) {
+        // Busy-wait: the delay is far below the scheduler tick
+    }
+    _io.readSignalBurst(raw_a, raw_b, cfg.pulse_samples);
+    if (!_io.waitLatchPulse(cfg.pulse_width_us / 1000 + 10)) {
+        cfg.late_pulses++;
+    }
+    
+    uint32_t sum_a = 0, sum_b = 0;
+    for (int i = 0; i < cfg.pulse_samples; i++) {
+        sum_a += raw_a[i];
+        sum_b += raw_b[i];
+    }
+    float voltage_a = _io.signalVoltageFromRaw((float)sum_a / cfg.pulse_samples);
+    float voltage_b = _io.signalVoltageFromRaw((float)sum_b / cfg.pulse_samples, SIGNAL_CHANNEL_B);
+    voltage = voltage_a - voltage_b;
+    current = voltage_b / cfg.shunt_resistance;
+    
+    // Idle until the next period so the DUT dissipates pulse_duty_cycle of the pulse power.
+    // Sleep in slices so a stop request is seen, busy-wait the last 2ms.
+    int64_t t_next = t_start + (int64_t)(cfg.pulse_width_us / cfg.pulse_duty_cycle);
+    int64_t remaining_us = t_next - esp_timer_get_time();
+    while (_curve_running && remaining_us > 3000) {
+        vTaskDelay(pdMS_TO_TICKS(min(remaining_us - 2000, (int64_t)50000) / 1000));
+        remaining_us = t_next - esp_timer_get_time();
+    }
+    while (_curve_running && esp_timer_get_time() < t_next) {
+    }
+}
+
+void DriverControl::performCurveTracerPublish() {
+    // One message never mixes curves, so every curve arrives as its own series
+    CurvePoint points[CURVE_CHUNK_POINTS];
+    int count = 0;
+    while (count < CURVE_CHUNK_POINTS && xQueuePeek(_curve_queue, &points[count], 0) == pdTRUE) {
+        if (count > 0 && points[count].curve != points[0].curve) {
+            break;
+        }
+        xQueueReceive(_curve_queue, &points[count], 0);
+        count++;
+        if (points[count - 1].curve_end) {
+            break;
+        }
+    }
+    if (count == 0) {
+        // Stopped before the family was complete
+        if (!_curve_measuring) {
+            stopCurveTracer();
+        }
+        return;
+    }
+    
+    CurveTracerConfig& cfg = _curve_config;
+    const CurvePoint& first = points[0];
+    bool curve_completed = points[count - 1].curve_end;
+    bool completed = points[count - 1].last;
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "curve-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "curve_tracer";
+    payload["curve"] = first.curve;
+    
+    JsonObject outer = payload["outer"].to<JsonObject>();
+    outer["channel"] = channelName((DriverChannel)cfg.outer_output);
+    outer["setpoint"] = roundTo3Decimals(first.outer_setpoint);
+    if (!isnan(first.outer_voltage)) outer["voltage"] = roundTo3Decimals(first.outer_voltage);
+    if (!isnan(first.outer_current)) outer["current"] = roundTo6Decimals(first.outer_current);
+    
+    JsonArray data_array = payload["data"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+        JsonObject data_point = data_array.add<JsonObject>();
+        data_point["setpoint"] = roundTo3Decimals(points[i].setpoint);
+        data_point["voltage"] = roundTo3Decimals(points[i].voltage);
+        data_point["current"] = roundTo6Decimals(points[i].current);
+        if (!points[i].settled) data_point["settled"] = false;
+    }
+    
+    cfg.published_points += count;
+    int total_points = cfg.outer_steps * cfg.inner_points;
+    payload["curve_completed"] = curve_completed;
+    payload["progress"] = roundTo3Decimals((float)min(cfg.published_points, total_points) / total_points * 100.0f);
+    payload["completed"] = completed;
+    if (completed) {
+        payload["unsettled_points"] = cfg.unsettled_points;
+        if (cfg.pulsed) payload["late_pulses"] = cfg.late_pulses;
+    }
+    
+    _postman.publish("data", doc);
+    
+    if (completed) {
+        Serial.println("Curve tracer completed");
+        stopCurveTracer();
+    }
+}
+
+void DriverControl::stopCurveTracer() {
+    if (_curve_task_handle != NULL) {
+        _curve_running = false;
+        
+        // The task exits at the next point and clears its handle
+        waitForTaskExit(_curve_task_handle, "Curve tracer");
+    }
+    
+    if (_curve_running || _current_mode == DRIVER_MODE_CURVE_TRACER) {
+        _current_mode = DRIVER_MODE_NONE;
+        
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.setPowerVoltage(0.0);
+        _io.updateAllDACs();
+    }
+    _curve_running = false;
+    _curve_measuring = false;
+    xQueueReset(_curve_queue);
+}
+
+// ============================================================================
+// Sequence helper functions
+// ============================================================================
+
+bool DriverControl::parseSequenceRows(JsonArrayConst rows, bool default_capture) {
+    SequenceConfig& cfg = _sequence_config;
+    static const char* const output_keys[4] = {"signal_a", "signal_b", "power_voltage", "current_limit"};
+    
+    if (cfg.rows + (int)rows.size() > SEQUENCE_MAX_ROWS) {
+        _postman.sendError("E006", "Too many sequence rows", "sequence", "rows", "", 
+                          "Maximum 1024 rows per table");
+        return false;
+    }
+    
+    // Work on copies so a rejected upload leaves the loaded table as it was
+    uint16_t codes[4];
+    memcpy(codes, cfg.codes, sizeof(codes));
+    uint8_t known_mask = cfg.known_mask;
+    uint8_t digital_mask = cfg.digital_mask;
+    int captures = cfg.captures;
+    int64_t previous_t = cfg.rows > 0 ? (int64_t)_sequence_rows[cfg.rows - 1].t_us : -1;
+    
+    const float ranges[4] = {_io.getSignalVoltageRange(), _io.getSignalVoltageRange(), 
+                             _io.getPowerVoltageRange(), _io.getPowerCurrentRange()};
+    int index = cfg.rows;
+    for (JsonObjectConst item : rows) {
+        SequenceRow& row = _sequence_rows[index];
+        String position = String(index);
+        
+        int64_t t_us = item["t_us"].is<uint32_t>() ? (int64_t)item["t_us"].as<uint32_t>() 
+                                                    : (int64_t)(item["t_ms"].as<float>() * 1000.0f + 0.5f);
+        if (t_us < 0 || t_us > 3600000000LL || (previous_t >= 0 && t_us - previous_t < SEQUENCE_MIN_STEP_US)) {
+            _postman.sendError("E001", "Sequence row time out of order", "sequence", "rows", position.c_str(), 
+                              "Row times must increase by at least 0.5ms, within one hour");
+            return false;
+        }
+        row.t_us = (uint32_t)t_us;
+        previous_t = t_us;
         
-        // Closed-loop: adjust output voltage until device voltage reaches target
-        bool target_reached = false;
-        bool voltage_capped = false;
+        row.dac_mask = 0;
+        for (int n = 0; n < 4; n++) {
+            if (!item[output_keys[n]].is<float>()) {
+                row.codes[n] = codes[n];  // Held: not written
+                continue;
+            }
+            float value = item[output_keys[n]].as<float>();
+            if (value < 0.0f || value > ranges[n]) {
+                String hint = String(output_keys[n]) + " must be within 0 to " + String(ranges[n], 2);
+                _postman.sendError("E001", "Sequence setpoint out of range", "sequence", output_keys[n], 
+                                  position.c_str(), hint.c_str());
+                return false;
+            }
+            uint16_t code = n < 2 ? _io.signalVoltageToCode(value, (SignalChannel)n) 
+                          : n == 2 ? _io.powerVoltageToCode(value) : _io.powerCurrentToCode(value);
+            // Unchanged codes cost nothing at run time; the first write of an output always goes out
+            if (code != codes[n] || !(known_mask & (1 << n))) {
+                row.dac_mask |= 1 << n;
+            }
+            row.codes[n] = code;
+            codes[n] = code;
+            known_mask |= 1 << n;
+        }
+        
+        row.gpio_set[0] = row.gpio_set[1] = 0;
+        row.gpio_clear[0] = row.gpio_clear[1] = 0;
+        const char* const bank_keys[2] = {"da", "db"};
+        for (int bank = 0; bank < 2; bank++) {
+            JsonArrayConst levels = item[bank_keys[bank]].as<JsonArrayConst>();
+            for (int i = 0; i < 4 && i < (int)levels.size(); i++) {
+                if (levels[i].isNull()) {
+                    continue;  // Line not driven by this row
+                }
+                int pin = PocKETlabIO::outputPin(bank * 4 + i);
+                int word = pin < 32 ? 0 : 1;
+                uint32_t bit = 1UL << (pin & 31);
+                if (levels[i].as<int>() != 0) {
+                    row.gpio_set[word] |= bit;
+                } else {
+                    row.gpio_clear[word] |= bit;
+                }
+                digital_mask |= 1 << (bank * 4 + i);
+            }
+        }
+        
+        row.capture = item["capture"].is<bool>() ? item["capture"].as<bool>() : default_capture;
+        if (row.capture) captures++;
+        index++;
+    }
+    
+    cfg.rows = index;
+    memcpy(cfg.codes, codes, sizeof(codes));
+    cfg.known_mask = known_mask;
+    cfg.digital_mask = digital_mask;
+    cfg.captures = captures;
+    return true;
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::sequenceTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->sequenceTask();
+}
+
+void DriverControl::sequenceTask() {
+    SequenceConfig& cfg = _sequence_config;
+    const int64_t ARM_AHEAD_US = 50000;  // Sleep in slices until the edge is this close, so stop stays responsive
+    
+    Serial.printf("Sequence task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    int64_t t_start = esp_timer_get_time() + SEQUENCE_MIN_STEP_US;  // Room to stage the first row
+    for (uint32_t pass = 0; _sequence_running && (cfg.repeat == 0 || pass < (uint32_t)cfg.repeat); pass++) {
+        int64_t t_pass = t_start + (int64_t)pass * cfg.period_us;
         
-        for (int iter = 0; iter < MAX_ITERATIONS && !target_reached && !voltage_capped; iter++) {
-            // Set the voltage on the appropriate drive channel
-            if (_va_config.channel == "CH0" || _va_config.channel == "CH1") {
-                _io.setSignalVoltage(SIGNAL_CHANNEL_A, _va_config.output_voltage);
-            } else if (_va_config.channel == "CH2") {
-                _io.setPowerVoltage(_va_config.output_voltage);
+        for (int r = 0; r < cfg.rows && _sequence_running; r++) {
+            const SequenceRow& row = _sequence_rows[r];
+            int64_t due = t_pass + row.t_us;
+            
+            while (_sequence_running && due - esp_timer_get_time() > ARM_AHEAD_US) {
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+            if (!_sequence_running) {
+                break;
+            }
+            
+            // Input registers only; the timed edge latches all of them together with the DA/DB lines
+            if (row.dac_mask & 0x01) _io.writeRawDAC(0, SIGNAL_CHANNEL_A, row.codes[0]);
+            if (row.dac_mask & 0x02) _io.writeRawDAC(0, SIGNAL_CHANNEL_B, row.codes[1]);
+            if (row.dac_mask & 0x04) _io.writeRawDAC(1, 0, row.codes[2]);
+            if (row.dac_mask & 0x08) _io.writeRawDAC(1, 1, row.codes[3]);
+            _io.stageLatchGpio(row.gpio_set[0], row.gpio_clear[0], row.gpio_set[1], row.gpio_clear[1]);
+            
+            int64_t now = esp_timer_get_time();
+            if (now >= due) {
+                cfg.late_rows++;
+            }
+            _io.scheduleLatchAt(due);
+            uint32_t timeout_ms = (uint32_t)(max(due - now, (int64_t)0) / 1000) + 10;
+            if (!_io.waitLatchPulse(timeout_ms)) {
+                cfg.late_rows++;
+                continue;
+            }
+            int64_t latched = _io.getLastTimedLatch();
+            int32_t jitter = (int32_t)(latched - due);
+            if (abs(jitter) > abs(cfg.max_jitter_us)) {
+                cfg.max_jitter_us = jitter;
+            }
+            
+            if (!row.capture) {
+                continue;
+            }
+            uint16_t raw_a[SEQUENCE_CAPTURE_SAMPLES], raw_b[SEQUENCE_CAPTURE_SAMPLES];
+            _io.readSignalBurst(raw_a, raw_b, SEQUENCE_CAPTURE_SAMPLES);
+            uint32_t sum_a = 0, sum_b = 0;
+            for (int i = 0; i < SEQUENCE_CAPTURE_SAMPLES; i++) {
+                sum_a += raw_a[i];
+                sum_b += raw_b[i];
+            }
+            SequenceSample sample;
+            sample.row = r;
+            sample.pass = pass;
+            sample.t_us = latched - t_start;
+            sample.jitter_us = jitter;
+            sample.raw_a = averageCode(sum_a, SEQUENCE_CAPTURE_SAMPLES);
+            sample.raw_b = averageCode(sum_b, SEQUENCE_CAPTURE_SAMPLES);
+            sample.power_voltage_raw = _io.readPowerVoltageRaw();
+            sample.power_current_raw = _io.readPowerCurrentRaw();
+            
+            // Never block here: the next row's deadline matters more than one reading
+            if (xQueueSend(_sequence_queue, &sample, 0) != pdTRUE) {
+                cfg.dropped_samples++;
             }
+        }
+    }
+    
+    _sequence_executing = false;
+    _sequence_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::performSequencePublish() {
+    SequenceSample samples[SEQUENCE_CHUNK_SAMPLES];
+    int count = 0;
+    while (count < SEQUENCE_CHUNK_SAMPLES && xQueueReceive(_sequence_queue, &samples[count], 0) == pdTRUE) {
+        count++;
+    }
+    // Completion is reported once the task has finished and every capture is out
+    bool completed = count == 0 && !_sequence_executing;
+    if (count == 0 && !completed) {
+        return;
+    }
+    
+    SequenceConfig& cfg = _sequence_config;
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "sequence-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "sequence";
+    
+    const bool raw = cfg.encoding == DATA_ENCODING_RAW;
+    const float q = 1.0f / (1 << RAW_FRACTION_BITS);
+    JsonArray data_array = payload["data"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+        const SequenceSample& sample = samples[i];
+        JsonObject data_point = data_array.add<JsonObject>();
+        data_point["row"] = sample.row;
+        data_point["pass"] = sample.pass;
+        data_point["t_us"] = sample.t_us;
+        data_point["jitter_us"] = sample.jitter_us;
+        if (raw) {
+            data_point["signal_a"] = sample.raw_a;
+            data_point["signal_b"] = sample.raw_b;
+            data_point["power_voltage"] = sample.power_voltage_raw;
+            data_point["power_current"] = sample.power_current_raw;
+        } else {
+            data_point["signal_a"] = roundTo3Decimals(_io.signalVoltageFromRaw(sample.raw_a * q));
+            data_point["signal_b"] = roundTo3Decimals(_io.signalVoltageFromRaw(sample.raw_b * q, SIGNAL_CHANNEL_B));
+            data_point["power_voltage"] = roundTo3Decimals(_io.powerVoltageFromRaw(sample.power_voltage_raw));
+            data_point["power_current"] = roundTo6Decimals(_io.powerCurrentFromRaw(sample.power_current_raw));
+        }
+    }
+    if (raw && count > 0) {
+        payload["encoding"] = "raw";
+        JsonObject scales = payload["scale"].to<JsonObject>();
+        addRawScale(scales, "signal_a", CAPTURE_SOURCE_SIGNAL_A, RAW_FRACTION_BITS);
+        addRawScale(scales, "signal_b", CAPTURE_SOURCE_SIGNAL_B, RAW_FRACTION_BITS);
+        addRawScale(scales, "power_voltage", CAPTURE_SOURCE_POWER, 0);
+        addRawScale(scales, "power_current", CAPTURE_SOURCE_POWER_CURRENT, 0);
+    }
+    
+    cfg.published_samples += count;
+    if (cfg.repeat > 0) {
+        int total = cfg.captures * cfg.repeat;
+        float progress = completed || total == 0 ? 100.0f : (float)min(cfg.published_samples, total) / total * 100.0f;
+        payload["progress"] = roundTo3Decimals(progress);
+    }
+    payload["completed"] = completed;
+    if (completed) {
+        payload["late_rows"] = cfg.late_rows;
+        payload["dropped_samples"] = cfg.dropped_samples;
+        payload["max_jitter_us"] = cfg.max_jitter_us;
+    }
+    
+    _postman.publish("data", doc);
+    
+    if (completed) {
+        Serial.println("Sequence completed");
+        stopSequence();
+    }
+}
+
+void DriverControl::stopSequence() {
+    if (_sequence_task_handle != NULL) {
+        _sequence_running = false;
+        
+        // The task sleeps in short slices between rows and exits at the next one
+        waitForTaskExit(_sequence_task_handle, "Sequence");
+    }
+    
+    if (_sequence_running || _current_mode == DRIVER_MODE_SEQUENCE) {
+        _current_mode = DRIVER_MODE_NONE;
+        
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.setPowerVoltage(0.0);
+        _io.updateAllDACs();
+        for (uint8_t i = 0; i < 4; ++i) {
+            if (_sequence_config.digital_mask & (1 << i)) _io.digitalWriteDA(i, false);
+            if (_sequence_config.digital_mask & (1 << (i + 4))) _io.digitalWriteDB(i, false);
+        }
+    }
+    _sequence_running = false;
+    _sequence_executing = false;
+    xQueueReset(_sequence_queue);
+}
+
+// ============================================================================
+// Recipe helper functions
+// ============================================================================
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::recipeTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->recipeTask();
+}
+
+void DriverControl::recipeTask() {
+    Serial.printf("Recipe task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    int64_t t_start = esp_timer_get_time();
+    _recipe_status = _recipe_vm.run(_recipe_running, _recipe_timeout_ms);
+    _recipe_duration_ms = (uint32_t)((esp_timer_get_time() - t_start) / 1000);
+    
+    _recipe_executing = false;
+    _recipe_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::performRecipePublish() {
+    RecipeResult results[RECIPE_CHUNK_RESULTS];
+    int count = 0;
+    while (count < RECIPE_CHUNK_RESULTS && xQueueReceive(_recipe_queue, &results[count], 0) == pdTRUE) {
+        count++;
+    }
+    // The summary goes out once the recipe has ended and every result is published
+    bool completed = count == 0 && !_recipe_executing;
+    if (count == 0 && !completed) {
+        return;
+    }
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "recipe-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "recipe";
+    payload["name"] = _recipe_name;
+    
+    JsonArray data_array = payload["data"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+        const RecipeResult& result = results[i];
+        JsonObject data_point = data_array.add<JsonObject>();
+        data_point["name"] = _recipe_vm.getString(result.name);
+        data_point["t_ms"] = roundTo3Decimals(result.t_us / 1000.0f);
+        if (result.kind == RECIPE_RESULT_ABORT) {
+            data_point["abort"] = true;
+            continue;
+        }
+        data_point["value"] = result.value;
+        if (result.kind == RECIPE_RESULT_CHECK) {
+            data_point["low"] = result.low;
+            data_point["high"] = result.high;
+            data_point["pass"] = result.pass;
+        }
+    }
+    
+    payload["completed"] = completed;
+    if (completed) {
+        payload["status"] = RecipeVM::statusName(_recipe_status);
+        payload["passed"] = _recipe_status == RECIPE_PASSED;
+        payload["checks"] = _recipe_vm.getChecks();
+        payload["failures"] = _recipe_vm.getFailures();
+        payload["duration_ms"] = _recipe_duration_ms;
+        payload["instructions"] = _recipe_vm.getInstructions();
+        if (_recipe_status == RECIPE_ERROR || _recipe_status == RECIPE_TIMEOUT) {
+            payload["error"] = _recipe_vm.getError();
+            payload["error_pc"] = _recipe_vm.getErrorPc();
+        }
+    }
+    
+    _postman.publish("data", doc);
+    
+    if (completed) {
+        Serial.printf("Recipe %s: %s (%d checks, %d failed, %lums)\n", _recipe_name, 
+                      RecipeVM::statusName(_recipe_status), _recipe_vm.getChecks(), _recipe_vm.getFailures(), 
+                      (unsigned long)_recipe_duration_ms);
+        stopRecipe();
+    }
+}
+
+void DriverControl::stopRecipe() {
+    if (_recipe_task_handle != NULL) {
+        _recipe_running = false;
+        
+        // The VM checks the flag between instructions and inside waits
+        waitForTaskExit(_recipe_task_handle, "Recipe");
+    }
+    
+    if (_recipe_running || _current_mode == DRIVER_MODE_RECIPE) {
+        _current_mode = DRIVER_MODE_NONE;
+        
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.setPowerVoltage(0.0);
+        _io.updateAllDACs();
+        uint8_t digital_mask = _recipe_vm.getDigitalMask();
+        for (uint8_t i = 0; i < 4; ++i) {
+            if (digital_mask & (1 << i)) _io.digitalWriteDA(i, false);
+            if (digital_mask & (1 << (i + 4))) _io.digitalWriteDB(i, false);
+        }
+    }
+    _recipe_running = false;
+    _recipe_executing = false;
+    xQueueReset(_recipe_queue);
+}
+
+// ============================================================================
+// Power protection helper functions
+// ============================================================================
+
+void DriverControl::performProtectionPublish() {
+    ProtectionTripInfo trip = _io.getLastTrip();
+    _protection_reported_trips = trip.count;
+    
+    // The power DAC is already at zero; the loop must not fight the trip
+    stopPowerRegulation();
+    
+    static const char* const causes[] = { "none", "ovp", "ocp", "gout" };
+    
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "protection-trip-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "protection";
+    payload["event"] = "trip";
+    payload["cause"] = causes[trip.cause];
+    payload["value"] = roundTo3Decimals(trip.value);
+    payload["threshold"] = roundTo3Decimals(trip.threshold);
+    payload["debounce_samples"] = _io.getProtectionConfig().debounce;
+    // First over-threshold conversion -> frame processed -> power DAC latched at zero
+    payload["latency_us"] = (uint32_t)(trip.zeroed_us - trip.first_over_us);
+    payload["detect_us"] = (uint32_t)(trip.detect_us - trip.first_over_us);
+    payload["zero_us"] = (uint32_t)(trip.zeroed_us - trip.detect_us);
+    payload["trips"] = trip.count;
+    payload["overruns"] = _io.getFeedbackOverruns();
+    
+    _postman.publish("data", doc);
+    _postman.sendStatus("fault", "protection");
+    
+    Serial.printf("PROTECTION TRIP (%s): %.3f over %.3f, output off %ld us after the first sample over\n", 
+                  causes[trip.cause], trip.value, trip.threshold, (long)(trip.zeroed_us - trip.first_over_us));
+}
+
+// ============================================================================
+// Board calibration helper functions
+// ============================================================================
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::calibrationTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->calibrationTask();
+}
+
+void DriverControl::calibrationTask() {
+    const CalibrationConfig& cfg = _calibration_config;
+    const int n = cfg.points;
+    float codes[CALIBRATION_MAX_POINTS];
+    float input_codes[2][CALIBRATION_MAX_POINTS];
+    float volts[CAL_MAPS][CALIBRATION_MAX_POINTS];
+    float feedback[3], input[2];
+    
+    Serial.printf("Calibration task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    // Signal sweep: both DACs step together. FB_AO/FB_A1 read each DAC ahead of the amplifier;
+    // looped-back inputs see the output, expected at the nominal amplifier gain.
+    bool loopback = cfg.maps[CAL_SIGNAL_ADC_A] || cfg.maps[CAL_SIGNAL_ADC_B];
+    if (cfg.maps[CAL_SIGNAL_DAC_A] || cfg.maps[CAL_SIGNAL_DAC_B] || loopback) {
+        int count = 0;
+        for (int p = 0; p < n && _calibration_running; p++) {
+            uint16_t code = CALIBRATION_MIN_CODE + (uint32_t)(DAC_MAX_VALUE - CALIBRATION_MIN_CODE) * p / (n - 1);
+            _io.writeRawDAC(0, 0, code);
+            _io.writeRawDAC(0, 1, code);
             _io.updateAllDACs();
-            
-            // Wait for voltage to settle
-            delay(10);
-            
-            // Measure device voltage
-            float voltage_a = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-            float voltage_b = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-            device_voltage = voltage_a - voltage_b;
-            
-            // Check if we've reached target device voltage
-            if (device_voltage >= target_device_voltage - DEVICE_VOLTAGE_TOLERANCE) {
-                target_reached = true;
-            } else {
-                // Increase output voltage
-                _va_config.output_voltage += VOLTAGE_STEP_INCREMENT;
-                
-                // Check if we've hit the maximum output voltage
-                if (_va_config.output_voltage >= _va_config.max_output_voltage) {
-                    _va_config.output_voltage = _va_config.max_output_voltage;
-                    voltage_capped = true;
-                    _va_config.capped = true;
-                }
+            if (!measureCalibrationPoint(feedback, input, loopback)) {
+                break;
             }
+            codes[p] = code;
+            volts[CAL_SIGNAL_DAC_A][p] = feedback[0];
+            volts[CAL_SIGNAL_DAC_B][p] = feedback[1];
+            input_codes[0][p] = input[0];
+            input_codes[1][p] = input[1];
+            volts[CAL_SIGNAL_ADC_A][p] = feedback[0] * SIGNAL_AMPLIFIER_GAIN;
+            volts[CAL_SIGNAL_ADC_B][p] = feedback[1] * SIGNAL_AMPLIFIER_GAIN;
+            count++;
         }
-        
-        // Apply final output voltage and take averaged measurement
-        if (_va_config.channel == "CH0" || _va_config.channel == "CH1") {
-            _io.setSignalVoltage(SIGNAL_CHANNEL_A, _va_config.output_voltage);
-        } else if (_va_config.channel == "CH2") {
-            _io.setPowerVoltage(_va_config.output_voltage);
-        }
+        _io.writeRawDAC(0, 0, 0);
+        _io.writeRawDAC(0, 1, 0);
         _io.updateAllDACs();
-        delay(20);  // Extra settling time for final measurement
-        
-        // Multi-sample measurement with RMS calculation for noise reduction
-        float voltage_a_sq_sum = 0.0f;
-        float voltage_b_sq_sum = 0.0f;
-        float power_current_sq_sum = 0.0f;
-        
-        // Discard first reading (may be noisy after DAC update)
-        _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-        _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-        delay(2);
         
-        for (int i = 0; i < NUM_SAMPLES; i++) {
-            float va = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-            float vb = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-            voltage_a_sq_sum += va * va;
-            voltage_b_sq_sum += vb * vb;
-            if (_va_config.channel == "CH2") {
-                float pc = _io.readPowerCurrent();
-                power_current_sq_sum += pc * pc;
+        if (count == n) {
+            if (cfg.maps[CAL_SIGNAL_DAC_A]) fitCalibrationMap(CAL_SIGNAL_DAC_A, codes, volts[CAL_SIGNAL_DAC_A], n);
+            if (cfg.maps[CAL_SIGNAL_DAC_B]) fitCalibrationMap(CAL_SIGNAL_DAC_B, codes, volts[CAL_SIGNAL_DAC_B], n);
+            if (cfg.maps[CAL_SIGNAL_ADC_A]) fitCalibrationMap(CAL_SIGNAL_ADC_A, input_codes[0], volts[CAL_SIGNAL_ADC_A], n);
+            if (cfg.maps[CAL_SIGNAL_ADC_B]) fitCalibrationMap(CAL_SIGNAL_ADC_B, input_codes[1], volts[CAL_SIGNAL_ADC_B], n);
+        }
+    }
+    
+    // Power sweep up to power_max_voltage (nominal scaling) with the current limit held low
+    if (cfg.maps[CAL_POWER_DAC] && _calibration_running) {
+        uint16_t top = (uint16_t)min((float)DAC_MAX_VALUE, cfg.power_max_voltage / _io.getNominalCalibrationGain(CAL_POWER_DAC));
+        int count = 0;
+        _io.setPowerCurrent(cfg.current_limit);
+        for (int p = 0; p < n && _calibration_running; p++) {
+            uint16_t code = CALIBRATION_MIN_CODE + (uint32_t)(top - CALIBRATION_MIN_CODE) * p / (n - 1);
+            _io.writeRawDAC(1, 0, code);
+            _io.updateAllDACs();
+            if (!measureCalibrationPoint(feedback, input, false)) {
+                break;
             }
-            
-            if (i < NUM_SAMPLES - 1) {
-                delay(SAMPLE_DELAY_MS);
+            if (_io.isPowerTripped()) {
+                _calibration_error = "Power output tripped during the sweep";
+                break;
             }
+            codes[p] = code;
+            volts[CAL_POWER_DAC][p] = feedback[2];
+            count++;
         }
+        _io.writeRawDAC(1, 0, 0);
+        _io.setPowerCurrent(0.0);
+        _io.updateAllDACs();
         
-        // Calculate RMS values
-        float voltage_a = sqrt(voltage_a_sq_sum / NUM_SAMPLES);
-        float voltage_b = sqrt(voltage_b_sq_sum / NUM_SAMPLES);
-        
-        // Device voltage = V_A - V_B (voltage across the device under test)
-        device_voltage = voltage_a - voltage_b;
+        if (count == n) {
+            fitCalibrationMap(CAL_POWER_DAC, codes, volts[CAL_POWER_DAC], n);
+        } else {
+            _calibration_status[CAL_POWER_DAC] = CAL_RUN_REJECTED;
+        }
+    }
+    
+    _calibration_done = true;
+    _calibration_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+bool DriverControl::measureCalibrationPoint(float* feedback, float* input, bool loopback) {
+    vTaskDelay(pdMS_TO_TICKS(_calibration_config.settle_ms));
+    
+    // Average the filtered feedback readings (and signal ADC bursts) over CALIBRATION_AVERAGE ms
+    float sum[3] = {0.0f, 0.0f, 0.0f};
+    uint32_t sum_a = 0, sum_b = 0;
+    uint16_t raw_a[CALIBRATION_AVERAGE], raw_b[CALIBRATION_AVERAGE];
+    for (int i = 0; i < CALIBRATION_AVERAGE && _calibration_running; i++) {
+        sum[0] += _io.readFeedbackVoltage(FEEDBACK_A0);
+        sum[1] += _io.readFeedbackVoltage(FEEDBACK_A1);
+        sum[2] += _io.powerVoltageFromRaw(_io.readFeedbackCode(FEEDBACK_VOUT));
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    if (!_calibration_running) {
+        return false;
+    }
+    if (loopback) {
+        if (_io.readSignalBurst(raw_a, raw_b, CALIBRATION_AVERAGE) != CALIBRATION_AVERAGE) {
+            _calibration_error = "Signal ADC read failed";
+            return false;
+        }
+        for (int i = 0; i < CALIBRATION_AVERAGE; i++) {
+            sum_a += raw_a[i];
+            sum_b += raw_b[i];
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        feedback[i] = sum[i] / CALIBRATION_AVERAGE;
+    }
+    input[0] = (float)sum_a / CALIBRATION_AVERAGE;
+    input[1] = (float)sum_b / CALIBRATION_AVERAGE;
+    return true;
+}
+
+void DriverControl::fitCalibrationMap(CalibrationMap map, const float* codes, const float* volts, int count) {
+    CalibrationEntry entry;
+    float nominal = _io.getNominalCalibrationGain(map);
+    if (CalibrationEngine::fit(codes, volts, count, _calibration_config.piecewise, entry) && 
+        fabsf(entry.gain / nominal - 1.0f) <= CALIBRATION_GAIN_TOLERANCE) {
+        _calibration_result.map[map] = entry;
+        _calibration_status[map] = CAL_RUN_CALIBRATED;
+    } else {
+        // A gain this far off means a missing loopback or a fault, not a board tolerance
+        _calibration_status[map] = CAL_RUN_REJECTED;
+    }
+}
+
+void DriverControl::performCalibrationPublish() {
+    bool applied = false;
+    for (int i = 0; i < CAL_MAPS; i++) {
+        applied = applied || _calibration_status[i] == CAL_RUN_CALIBRATED;
+    }
+    
+    // The conversions are only switched here, with the sweep task gone
+    bool saved = false;
+    if (applied) {
+        _io.setCalibration(_calibration_result);
+        saved = _calibration_config.save && _io.saveCalibration();
+    }
+    publishCalibration(true, saved);
+    
+    Serial.printf("Calibration completed in %lu ms%s%s\n", millis() - _calibration_start_ms, 
+                  saved ? ", saved to NVS" : "", _calibration_error ? " (ended early)" : "");
+    stopCalibration();
+}
+
+void DriverControl::publishCalibration(bool run_result, bool saved) {
+    JsonDocument doc;
+    
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    
+    doc["timestamp"] = timestamp;
+    doc["message_id"] = "calibration-data-" + String(millis());
+    doc["type"] = "data";
+    
+    JsonObject payload = doc["payload"].to<JsonObject>();
+    payload["mode"] = "calibration";
+    
+    const BoardCalibration& table = _io.getCalibration();
+    JsonArray maps = payload["maps"].to<JsonArray>();
+    for (int i = 0; i < CAL_MAPS; i++) {
+        CalibrationMap map = (CalibrationMap)i;
+        const CalibrationEntry& entry = table.map[i];
+        bool calibrated = _io.isCalibrated(map);
+        float nominal = _io.getNominalCalibrationGain(map);
         
-        // Current calculation: I = V_shunt / R_shunt
-        if (_va_config.channel == "CH0" || _va_config.channel == "CH1") {
-            current = voltage_b / _va_config.shunt_resistance;
+        JsonObject item = maps.add<JsonObject>();
+        item["map"] = CalibrationEngine::mapName(map);
+        if (run_result && _calibration_status[i] == CAL_RUN_REJECTED) {
+            item["status"] = "rejected";
         } else {
-            current = sqrt(power_current_sq_sum / NUM_SAMPLES);  // RMS of power current
+            item["status"] = calibrated ? "calibrated" : "nominal";
+        }
+        if (run_result) {
+            item["updated"] = _calibration_status[i] == CAL_RUN_CALIBRATED;
+        }
+        item["gain"] = calibrated ? entry.gain : nominal;
+        item["gain_error_pct"] = roundTo3Decimals(calibrated ? (entry.gain / nominal - 1.0f) * 100.0f : 0.0f);
+        item["offset"] = roundTo6Decimals(calibrated ? entry.offset : 0.0f);
+        item["residual_mv"] = roundTo3Decimals(calibrated ? entry.residual * 1000.0f : 0.0f);
+        item["points"] = entry.points;
+        item["piecewise"] = calibrated && entry.piecewise != 0;
+    }
+    
+    if (run_result) {
+        payload["completed"] = _calibration_error == nullptr;
+        if (_calibration_error) {
+            payload["error"] = _calibration_error;
         }
+        payload["saved"] = saved;
+        payload["duration_ms"] = (uint32_t)(millis() - _calibration_start_ms);
+    }
+    
+    _postman.publish("data", doc);
+}
+
+void DriverControl::stopCalibration() {
+    if (_calibration_task_handle != NULL) {
+        _calibration_running = false;
         
-        // If voltage was capped and we didn't reach target, end measurement early
-        if (voltage_capped && device_voltage < target_device_voltage - DEVICE_VOLTAGE_TOLERANCE) {
-            Serial.printf("VA measurement capped: output=%.2fV, device=%.3fV, target=%.3fV\n",
-                         _va_config.output_voltage, device_voltage, target_device_voltage);
+        // The task exits at the next reading and clears its handle
+        waitForTaskExit(_calibration_task_handle, "Calibration");
+    }
+    
+    if (_calibration_running || _current_mode == DRIVER_MODE_CALIBRATION) {
+        _current_mode = DRIVER_MODE_NONE;
+        
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.setPowerVoltage(0.0);
+        _io.setPowerCurrent(0.0);
+        _io.updateAllDACs();
+    }
+    _calibration_running = false;
+    _calibration_done = false;
+}
+
+// ============================================================================
+// Power regulation helper functions
+// ============================================================================
+
+bool DriverControl::parseRegulationSettings(JsonVariantConst settings, float target_voltage, float current_limit, RegulationConfig& config) {
+    RegulationConfig cfg;
+    cfg.target_voltage = target_voltage;
+    cfg.current_limit = current_limit;
+    cfg.rate = settings["rate"].is<float>() ? settings["rate"].as<float>() : 1000.0f;
+    cfg.kp = settings["kp"].is<float>() ? settings["kp"].as<float>() : 0.2f;
+    cfg.ki = settings["ki"].is<float>() ? settings["ki"].as<float>() : 50.0f;
+    cfg.ki_current = settings["ki_current"].is<float>() ? settings["ki_current"].as<float>() : 500.0f;
+    cfg.slew = settings["slew_v_per_ms"].is<float>() ? settings["slew_v_per_ms"].as<float>() * 1000.0f : 1000.0f;
+    cfg.max_trim = settings["max_trim"].is<float>() ? settings["max_trim"].as<float>() : 1.0f;
+    cfg.filter_hz = settings["filter_hz"].is<float>() ? settings["filter_hz"].as<float>() : 200.0f;
+    cfg.oversample = settings["oversample"].is<int>() ? settings["oversample"].as<int>() : 4;
+    
+    if (cfg.rate < REGULATION_MIN_RATE || cfg.rate > REGULATION_MAX_RATE) {
+        _postman.sendError("E001", "Regulation rate out of range", "testbed", "regulation.rate", String(cfg.rate).c_str(), 
+                          "Rate must be 1000 to 5000 Hz");
+        return false;
+    }
+    if (cfg.kp < 0.0f || cfg.ki < 0.0f || cfg.ki_current <= 0.0f || cfg.slew <= 0.0f || cfg.max_trim < 0.0f) {
+        _postman.sendError("E001", "Regulation gains out of range", "testbed", "regulation", "", 
+                          "kp, ki and max_trim must be >= 0; ki_current and slew_v_per_ms must be > 0");
+        return false;
+    }
+    if (cfg.filter_hz <= 0.0f || cfg.filter_hz > cfg.rate / 2.0f) {
+        _postman.sendError("E001", "Regulation filter out of range", "testbed", "regulation.filter_hz", String(cfg.filter_hz).c_str(), 
+                          "Filter corner must be above 0 and at most half the loop rate");
+        return false;
+    }
+    if (cfg.oversample < 1 || cfg.oversample > REGULATION_MAX_OVERSAMPLE) {
+        _postman.sendError("E001", "Regulation oversample out of range", "testbed", "regulation.oversample", String(cfg.oversample).c_str(), 
+                          "Oversample must be 1 to 16 conversions");
+        return false;
+    }
+    
+    config = cfg;
+    return true;
+}
+
+bool DriverControl::startPowerRegulation() {
+    if (_regulation_timer == NULL) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &DriverControl::regulationTimerCallback;
+        timer_args.arg = this;
+        timer_args.name = "regulation";
+        if (esp_timer_create(&timer_args, &_regulation_timer) != ESP_OK) {
+            return false;
+        }
+    }
+    
+    _regulation_command = _regulation_config.target_voltage;
+    _regulation_trim = 0.0f;
+    _regulation_cc = false;
+    _regulation_reported_cc = false;
+    _regulation_overruns = 0;
+    _regulation_running = true;
+    
+    BaseType_t result = xTaskCreatePinnedToCore(
+        regulationTaskWrapper,      // Task function
+        "RegulationTask",           // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        4,                          // Priority (above measurement tasks: the output must not sag while they run)
+        &_regulation_task_handle,   // Task handle
+        1                           // Core 1: loop timing stays off the WiFi core
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create regulation task!");
+        _regulation_task_handle = NULL;
+        _regulation_running = false;
+        return false;
+    }
+    
+    Serial.printf("Power regulation started: %.3fV, %.3fA limit, %.0f Hz\n", 
+                  _regulation_config.target_voltage, _regulation_config.current_limit, _regulation_config.rate);
+    return true;
+}
+
+// Loop clock: runs in the esp_timer task and only wakes the regulation task
+void DriverControl::regulationTimerCallback(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    if (instance->_regulation_task_handle != NULL) {
+        xTaskNotifyGive(instance->_regulation_task_handle);
+    }
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::regulationTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->regulationTask();
+}
+
+void DriverControl::regulationTask() {
+    Serial.printf("Regulation task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    const RegulationConfig& cfg = _regulation_config;
+    
+    const float dt = 1.0f / cfg.rate;
+    const float alpha = 1.0f - expf(-2.0f * (float)M_PI * cfg.filter_hz * dt);  // One-pole feedback filter
+    const float max_command = _io.getPowerVoltageRange();
+    const float step = cfg.slew * dt;
+    
+    float voltage_raw, current_raw;
+    _io.readPowerFeedbackFast(&voltage_raw, &current_raw, cfg.oversample);
+    float voltage = _io.powerVoltageFromRaw(voltage_raw);
+    float current = _io.powerCurrentFromRaw(current_raw);
+    
+    float command = constrain(cfg.target_voltage, 0.0f, max_command);  // Open-loop setting as the start
+    float cc_command = command;
+    float trim = 0.0f;
+    uint16_t last_code = _io.powerVoltageToCode(command);
+    
+    esp_timer_start_periodic(_regulation_timer, (uint64_t)(1000000.0f / cfg.rate + 0.5f));
+    
+    while (_regulation_running) {
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+        if (ticks == 0) {
+            continue;
+        }
+        if (ticks > 1) {
+            _regulation_overruns += ticks - 1;
         }
         
-    } else if (_va_config.mode_type == "CC") {
-        // Constant Current mode: adjust voltage to achieve target current
-        float target_current = _va_config.start_current + (_va_config.current_step * _va_config.step_current);
+        _io.readPowerFeedbackFast(&voltage_raw, &current_raw, cfg.oversample);
+        voltage += alpha * (_io.powerVoltageFromRaw(voltage_raw) - voltage);
+        current += alpha * (_io.powerCurrentFromRaw(current_raw) - current);
         
-        // CC closed-loop control parameters
-        const float CC_GAIN = 0.5f;  // Proportional gain for current control
-        const int CC_ITERATIONS = 10;  // Max iterations to reach target current
-        const float CC_TOLERANCE = 0.01f;  // Current tolerance (1%)
+        // CV branch: the target as feed-forward plus a PI trim for gain error and load
+        float error = cfg.target_voltage - voltage;
+        float cv_command = cfg.target_voltage + cfg.kp * error + trim;
         
-        float measured_current = 0.0f;
+        // CC branch: integrates the current-limit error. Capped at the CV command, so it cannot wind up
+        // while the current is below the limit; below the CV command it has taken over (CC)
+        cc_command += cfg.ki_current * dt * (cfg.current_limit - current);
+        if (cc_command > cv_command) cc_command = cv_command;
+        if (cc_command < 0.0f) cc_command = 0.0f;
+        bool cc = cc_command < cv_command;
         
-        // Initialize output voltage on first step
-        if (_va_config.current_step == 0) {
-            _va_config.cc_output_voltage = target_current * _va_config.shunt_resistance;  // Initial estimate
+        // The CV integrator holds while current-limited
+        if (!cc) {
+            trim = constrain(trim + cfg.ki * dt * error, -cfg.max_trim, cfg.max_trim);
         }
         
-        // Closed-loop iteration to achieve target current
-        for (int iter = 0; iter < CC_ITERATIONS; iter++) {
-            // Set the output voltage
-            if (_va_config.channel == "CH0" || _va_config.channel == "CH1") {
-                _io.setSignalVoltage(SIGNAL_CHANNEL_A, _va_config.cc_output_voltage);
-            } else if (_va_config.channel == "CH2") {
-                _io.setPowerCurrent(target_current);  // CH2 has direct current control
-                _io.updateAllDACs();
-                break;  // No need for closed-loop on CH2
-            }
+        // Rises are slew-limited; a drop (CC pulling back or a lower target) is applied at once
+        float wanted = cc ? cc_command : cv_command;
+        command = wanted > command + step ? command + step : wanted;
+        command = constrain(command, 0.0f, max_command);
+        
+        uint16_t code = _io.powerVoltageToCode(command);
+        if (code != last_code) {
+            _io.writeRawDAC(1, 0, code);
             _io.updateAllDACs();
-            
-            delay(5);  // Short settling time
-            
-            // Measure current
-            float voltage_b = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-            measured_current = voltage_b / _va_config.shunt_resistance;
-            
-            // Check if we're within tolerance
-            float current_error = target_current - measured_current;
-            if (abs(current_error) < CC_TOLERANCE * target_current) {
-                break;  // Close enough
-            }
-            
-            // Adjust output voltage based on error
-            _va_config.cc_output_voltage += current_error * _va_config.shunt_resistance * CC_GAIN;
-            
-            // Clamp output voltage to valid range
-            if (_va_config.cc_output_voltage < 0) _va_config.cc_output_voltage = 0;
-            if (_va_config.cc_output_voltage >= _va_config.max_output_voltage) {
-                _va_config.cc_output_voltage = _va_config.max_output_voltage;
-                _va_config.capped = true;
-                break;  // Can't go higher
-            }
+            last_code = code;
         }
         
-        // Final measurement with RMS calculation
-        float voltage_a_sq_sum = 0.0f;
-        float voltage_b_sq_sum = 0.0f;
-        float power_current_sq_sum = 0.0f;
+        _regulation_voltage = voltage;
+        _regulation_current = current;
+        _regulation_command = command;
+        _regulation_trim = trim;
+        _regulation_cc = cc;
+    }
+    esp_timer_stop(_regulation_timer);
+    
+    _regulation_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::stopPowerRegulation() {
+    if (_regulation_task_handle != NULL) {
+        _regulation_running = false;
         
-        for (int i = 0; i < NUM_SAMPLES; i++) {
-            float va = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-            float vb = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-            voltage_a_sq_sum += va * va;
-            voltage_b_sq_sum += vb * vb;
-            if (_va_config.channel == "CH2") {
-                float pc = _io.readPowerCurrent();
-                power_current_sq_sum += pc * pc;
+        // Wait for the task to finish its current tick
+        waitForTaskExit(_regulation_task_handle, "Regulation");
+        Serial.println("Power regulation stopped (power DAC holds the last setting)");
+    }
+    _regulation_running = false;
+    _regulation_cc = false;
+}
+
+// ============================================================================
+// Data logger helper functions
+// ============================================================================
+
+// Sample clock: runs in the esp_timer task and only wakes the sampler
+void DriverControl::loggerTimerCallback(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    if (instance->_logger_sample_task_handle != NULL) {
+        xTaskNotifyGive(instance->_logger_sample_task_handle);
+    }
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::loggerSampleTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->loggerSampleTask();
+}
+
+void DriverControl::loggerSampleTask() {
+    Serial.printf("Logger sample task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    const LoggerConfig& cfg = _logger_config;
+    
+    // Erase the sectors this run needs before the clock starts, so sampling rarely waits on an erase
+    uint32_t erase_chunks = _flash_logger.getCapacityChunks();
+    if (cfg.duration > 0.0f) {
+        double records = (double)cfg.duration * cfg.rate / cfg.decimation;
+        erase_chunks = (uint32_t)(records / cfg.records_per_chunk) + 2;
+    }
+    if (!_flash_logger.eraseAhead(erase_chunks, _logger_running)) {
+        _logger_flash_error = true;
+    }
+    
+    uint64_t total_samples = cfg.duration > 0.0f ? (uint64_t)((double)cfg.duration * cfg.rate + 0.5) : 0;
+    uint64_t sample_index = 0;         // Sample clock ticks since the start, served or not
+    int64_t window = -1;               // Record the accumulated samples belong to
+    int32_t sum[LOGGER_CHANNELS];
+    int16_t low[LOGGER_CHANNELS];
+    int16_t high[LOGGER_CHANNELS];
+    int count = 0;
+    
+    int buffer = -1;                   // Chunk buffer being filled
+    LoggerBlock block = {};
+    
+    // Records inside a chunk are consecutive, so a gap (missed ticks) starts a new chunk
+    auto emit_record = [&](uint32_t record) {
+        if (buffer >= 0 && (block.record_count == cfg.records_per_chunk || 
+                            record != block.first_record + block.record_count)) {
+            xQueueSend(_logger_ready_queue, &block, 0);
+            buffer = -1;
+        }
+        if (buffer < 0) {
+            uint8_t free_buffer;
+            if (xQueueReceive(_logger_free_queue, &free_buffer, 0) != pdTRUE) {
+                _logger_dropped_records++;
+                return;
             }
-            
-            if (i < NUM_SAMPLES - 1) {
-                delay(SAMPLE_DELAY_MS);
+            buffer = free_buffer;
+            block.buffer = free_buffer;
+            block.first_record = record;
+            block.record_count = 0;
+            memset(_logger_buffers[buffer], 0xFF, FLASH_LOGGER_CHUNK_SIZE);
+        }
+        
+        int16_t* out = (int16_t*)(_logger_buffers[buffer] + FLASH_LOGGER_HEADER_SIZE + 
+                                  (size_t)block.record_count * cfg.record_size);
+        for (int ch = 0; ch < LOGGER_CHANNELS; ++ch) {
+            int32_t mean = sum[ch] >= 0 ? (sum[ch] + count / 2) / count : (sum[ch] - count / 2) / count;
+            out[ch] = (int16_t)mean;
+            _logger_latest[ch] = (int16_t)mean;
+            if (cfg.decimation > 1) {
+                out[LOGGER_CHANNELS + ch] = low[ch];
+                out[2 * LOGGER_CHANNELS + ch] = high[ch];
             }
         }
+        block.record_count++;
+    };
+    
+    _logger_start_ms = millis();
+    if (_logger_running) {
+        esp_timer_start_periodic(_logger_timer, cfg.sample_period_us);
+    }
+    
+    while (_logger_running && !_logger_flash_error && !_flash_logger.isFull()) {
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        if (ticks == 0) {
+            continue;
+        }
+        _logger_missed_samples += ticks - 1;
+        sample_index += ticks;
         
-        // Calculate RMS values
-        float voltage_a = sqrt(voltage_a_sq_sum / NUM_SAMPLES);
-        float voltage_b = sqrt(voltage_b_sq_sum / NUM_SAMPLES);
+        int16_t values[LOGGER_CHANNELS];
+        uint16_t raw_a = 0, raw_b = 0;
+        values[0] = (int16_t)_io.readPowerVoltageRaw();
+        values[1] = (int16_t)_io.readPowerCurrentRaw();
+        _io.readSignalBurst(&raw_a, &raw_b, 1);
+        values[2] = (int16_t)raw_a;
+        values[3] = (int16_t)raw_b;
+        values[4] = (int16_t)constrain(roundf(_io.readTemperature() * 100.0f), -32768.0f, 32767.0f);
+        _logger_samples++;
         
-        // Device voltage = V_A - V_B
-        device_voltage = voltage_a - voltage_b;
+        int64_t record = (int64_t)((sample_index - 1) / cfg.decimation);
+        if (record != window) {
+            if (count > 0) {
+                emit_record((uint32_t)window);  // Window cut short by missed ticks
+            }
+            window = record;
+            count = 0;
+        }
+        for (int ch = 0; ch < LOGGER_CHANNELS; ++ch) {
+            if (count == 0) {
+                sum[ch] = 0;
+                low[ch] = values[ch];
+                high[ch] = values[ch];
+            }
+            sum[ch] += values[ch];
+            if (values[ch] < low[ch]) low[ch] = values[ch];
+            if (values[ch] > high[ch]) high[ch] = values[ch];
+        }
+        count++;
+        if ((sample_index % cfg.decimation) == 0) {
+            emit_record((uint32_t)window);
+            window = -1;
+            count = 0;
+        }
         
-        // Current calculation
-        if (_va_config.channel == "CH0" || _va_config.channel == "CH1") {
-            current = voltage_b / _va_config.shunt_resistance;
-        } else {
-            current = sqrt(power_current_sq_sum / NUM_SAMPLES);  // RMS of power current
+        if (total_samples > 0 && sample_index >= total_samples) {
+            break;
         }
     }
+    esp_timer_stop(_logger_timer);
     
-    // Calculate progress based on actual device voltage reached vs target range
-    float voltage_range = _va_config.end_voltage - _va_config.start_voltage;
-    float progress;
-    bool completed;
-    
-    if (_va_config.mode_type == "CV") {
-        // For CV mode, progress is based on device voltage achieved
-        progress = ((device_voltage - _va_config.start_voltage) / voltage_range) * 100.0f;
-        if (progress < 0) progress = 0;
-        if (progress > 100) progress = 100;
-        
-        // Completed if we reached end voltage OR if output is capped
-        completed = (device_voltage >= _va_config.end_voltage - 0.02f) || _va_config.capped;
-    } else {
-        // For CC mode, progress is based on step count
-        progress = (float)(_va_config.current_step + 1) / _va_config.total_steps * 100.0f;
-        completed = (_va_config.current_step + 1) >= _va_config.total_steps || _va_config.capped;
+    // Hand the partial chunk to the writer, or give back an empty buffer
+    if (buffer >= 0) {
+        if (block.record_count > 0) {
+            xQueueSend(_logger_ready_queue, &block, 0);
+        } else {
+            uint8_t empty_buffer = (uint8_t)buffer;
+            xQueueSend(_logger_free_queue, &empty_buffer, 0);
+        }
     }
     
-    // Store data point in buffer
-    if (_va_buffer_count < VA_BUFFER_SIZE) {
-        _va_data_buffer[_va_buffer_count].voltage = device_voltage;
-        _va_data_buffer[_va_buffer_count].current = current;
-        _va_data_buffer[_va_buffer_count].timestamp = millis();
-        _va_buffer_count++;
+    Serial.printf("Logger sample task finished: %lu samples, %lu missed, %lu records dropped\n", 
+                  (unsigned long)_logger_samples, (unsigned long)_logger_missed_samples, 
+                  (unsigned long)_logger_dropped_records);
+    _logger_sampling = false;
+    _logger_sample_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::loggerWriteTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->loggerWriteTask();
+}
+
+void DriverControl::loggerWriteTask() {
+    Serial.printf("Logger write task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    // One whole chunk per flash write; runs until the sampler is done and every chunk is stored
+    LoggerBlock block;
+    while (true) {
+        if (xQueueReceive(_logger_ready_queue, &block, pdMS_TO_TICKS(50)) != pdTRUE) {
+            if (!_logger_sampling && uxQueueMessagesWaiting(_logger_ready_queue) == 0) {
+                break;
+            }
+            continue;
+        }
+        if (!_logger_flash_error && 
+            !_flash_logger.writeChunk(_logger_buffers[block.buffer], block.first_record, block.record_count) && 
+            !_flash_logger.isFull()) {
+            _logger_flash_error = true;
+        }
+        xQueueSend(_logger_free_queue, &block.buffer, 0);
     }
+    _flash_logger.endSession();
     
-    // Send buffered data if buffer is full or measurement is completed, or every 10 measurements
-    if (_va_buffer_count >= VA_BUFFER_SIZE || completed || (_va_config.current_step % 10 == 9)) {
-        sendBufferedVAData(completed);
+    _logger_writing = false;
+    _logger_write_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::performLoggerPublish() {
+    bool completed = !_logger_sampling && !_logger_writing;
+    if (!completed && millis() - _logger_last_status_ms < LOGGER_STATUS_INTERVAL_MS) {
+        return;
     }
+    _logger_last_status_ms = millis();
     
-    // Move to next step
-    _va_config.current_step++;
+    const LoggerConfig& cfg = _logger_config;
     
-    if (completed) {
-        Serial.println("VA measurement completed");
-        _va_running = false;
-        _current_mode = "none";  // Reset mode when measurement completes
-    }
-}
-
-void DriverControl::sendVADataPoint(float voltage, float current, float progress, bool completed) {
     JsonDocument doc;
     
     char timestamp[30];
     snprintf(timestamp, sizeof(timestamp), "%lu", millis());
     
     doc["timestamp"] = timestamp;
-    doc["message_id"] = "va-data-" + String(millis());
+    doc["message_id"] = "logger-data-" + String(millis());
     doc["type"] = "data";
     
     JsonObject payload = doc["payload"].to<JsonObject>();
-    payload["mode"] = "va";
+    payload["mode"] = "logger";
+    payload["session"] = _flash_logger.getSession();
+    if (completed) {
+        payload["state"] = _logger_flash_error ? "error" : (_flash_logger.isFull() ? "full" : "completed");
+    } else {
+        payload["state"] = _logger_start_ms == 0 ? "erasing" : "logging";
+    }
+    payload["elapsed_s"] = _logger_start_ms == 0 ? 0.0f : roundTo3Decimals((millis() - _logger_start_ms) / 1000.0f);
+    payload["samples"] = (uint32_t)_logger_samples;
+    payload["records"] = _flash_logger.getRecordCount();
+    payload["chunks"] = _flash_logger.getChunksWritten();
+    payload["capacity_chunks"] = _flash_logger.getCapacityChunks();
+    payload["missed_samples"] = (uint32_t)_logger_missed_samples;
+    payload["dropped_records"] = (uint32_t)_logger_dropped_records;
+    if (cfg.duration > 0.0f && _logger_start_ms != 0) {
+        float progress = (millis() - _logger_start_ms) / (cfg.duration * 10.0f);
+        payload["progress"] = roundTo3Decimals(completed ? 100.0f : (progress > 100.0f ? 100.0f : progress));
+    }
     
-    // Create data array with single measurement point
-    JsonArray data_array = payload["data"].to<JsonArray>();
-    JsonObject data_point = data_array.add<JsonObject>();  // Use add<JsonObject>() to add object to array
-    data_point["voltage"] = roundTo3Decimals(voltage);
-    data_point["current"] = roundTo3Decimals(current);
+    // Newest record (means), scaled to engineering units
+    JsonObject latest = payload["latest"].to<JsonObject>();
+    latest["power_voltage"] = roundTo3Decimals(_io.powerVoltageFromRaw(_logger_latest[0]));
+    latest["power_current"] = roundTo6Decimals(_io.powerCurrentFromRaw(_logger_latest[1]));
+    latest["signal_a"] = roundTo3Decimals(_io.signalVoltageFromRaw(_logger_latest[2]));
+    latest["signal_b"] = roundTo3Decimals(_io.signalVoltageFromRaw(_logger_latest[3], SIGNAL_CHANNEL_B));
+    latest["temperature"] = _logger_latest[4] / 100.0f;
     
-    payload["progress"] = roundTo3Decimals(progress);
     payload["completed"] = completed;
+    if (completed) {
+        payload["download"] = "/logger/data";
+    }
     
     _postman.publish("data", doc);
     
-    Serial.printf("VA data: V=%.3f, I=%.3f, Progress=%.1f%%, Completed=%s\n", 
-                  voltage, current, progress, completed ? "true" : "false");
+    if (completed) {
+        Serial.printf("Logger session %u finished: %lu records in %lu chunks\n", (unsigned)_flash_logger.getSession(), 
+                      (unsigned long)_flash_logger.getRecordCount(), (unsigned long)_flash_logger.getChunksWritten());
+        stopLogger();
+    }
 }
 
-void DriverControl::sendBufferedVAData(bool completed) {
-    if (_va_buffer_count == 0) return;  // No data to send
+void DriverControl::stopLogger() {
+    if (_logger_sample_task_handle != NULL || _logger_write_task_handle != NULL) {
+        _logger_running = false;
+        
+        // The sampler hands over its partial chunk and the writer stores it; an erase step in
+        // progress can hold the flash for a few hundred milliseconds
+        bool stopped = waitForTaskExit(_logger_sample_task_handle, "Logger sample");
+        stopped = waitForTaskExit(_logger_write_task_handle, "Logger write") && stopped;
+        if (stopped) {
+            _flash_logger.endSession();
+        }
+    }
+    
+    if (_logger_running || _current_mode == DRIVER_MODE_LOGGER) {
+        _current_mode = DRIVER_MODE_NONE;
+    }
+    _logger_running = false;
+    _logger_sampling = false;
+    _logger_writing = false;
+    xQueueReset(_logger_free_queue);
+    xQueueReset(_logger_ready_queue);
+    freeLoggerBuffers();
+}
+
+void DriverControl::freeLoggerBuffers() {
+    for (int i = 0; i < LOGGER_BUFFER_CHUNKS; ++i) {
+        free(_logger_buffers[i]);
+        _logger_buffers[i] = nullptr;
+    }
+}
+
+void DriverControl::handleLoggerData(WebServer& server) {
+    _flash_logger.handleDataRequest(server);
+}
+
+void DriverControl::handleLoggerIndex(WebServer& server) {
+    if (!_flash_logger.begin()) {
+        server.send(503, "text/plain", "Logger partition not found");
+        return;
+    }
+    
+    JsonDocument doc;
+    doc["session"] = _flash_logger.getSession();
+    doc["active"] = _flash_logger.isActive();
+    doc["chunk_size"] = FLASH_LOGGER_CHUNK_SIZE;
+    doc["header_size"] = FLASH_LOGGER_HEADER_SIZE;
+    doc["capacity_chunks"] = _flash_logger.getCapacityChunks();
+    doc["chunks_written"] = _flash_logger.getChunksWritten();
+    doc["records"] = _flash_logger.getRecordCount();
+    doc["record_size"] = _flash_logger.getRecordSize();
+    doc["record_period_us"] = _flash_logger.getRecordPeriodUs();
+    bool decimated = (_flash_logger.getFlags() & FLASH_LOGGER_FLAG_DECIMATED) != 0;
+    doc["decimated"] = decimated;
+    
+    // Record layout: int16 per channel for each field, fields one after another
+    JsonArray fields = doc["fields"].to<JsonArray>();
+    fields.add(decimated ? "mean" : "value");
+    if (decimated) {
+        fields.add("min");
+        fields.add("max");
+    }
+    const char* names[LOGGER_CHANNELS] = {"power_voltage", "power_current", "signal_a", "signal_b", "temperature"};
+    const char* units[LOGGER_CHANNELS] = {"V", "A", "V", "V", "degC"};
+    // Signal inputs carry the board calibration line (offset included)
+    float offsets[LOGGER_CHANNELS] = {0.0f, 0.0f, _io.signalVoltageFromRaw(0.0f, SIGNAL_CHANNEL_A),
+                                      _io.signalVoltageFromRaw(0.0f, SIGNAL_CHANNEL_B), 0.0f};
+    float scales[LOGGER_CHANNELS] = {_io.powerVoltageFromRaw(1.0f), _io.powerCurrentFromRaw(1.0f), 
+                                     _io.signalVoltageFromRaw(1.0f, SIGNAL_CHANNEL_A) - offsets[2],
+                                     _io.signalVoltageFromRaw(1.0f, SIGNAL_CHANNEL_B) - offsets[3], 0.01f};
+    JsonArray channels = doc["channels"].to<JsonArray>();
+    for (int ch = 0; ch < LOGGER_CHANNELS; ++ch) {
+        JsonObject channel = channels.add<JsonObject>();
+        channel["name"] = names[ch];
+        channel["unit"] = units[ch];
+        channel["scale"] = scales[ch];
+        channel["offset"] = offsets[ch];
+    }
+    
+    // Chunk index in download order: [first_record, record_count], chunk i starts at byte i * chunk_size
+    JsonArray chunks = doc["chunks"].to<JsonArray>();
+    FlashLoggerChunkHeader header;
+    for (uint32_t i = 0; i < _flash_logger.getChunkCount(); ++i) {
+        JsonArray entry = chunks.add<JsonArray>();
+        if (_flash_logger.readChunkHeader(i, header)) {
+            entry.add((uint32_t)header.first_record);
+            entry.add((uint16_t)header.record_count);
+        }
+    }
+    
+    String body;
+    serializeJson(doc, body);
+    server.send(200, "application/json", body);
+}
+
+// ============================================================================
+// Bode characteristics helper functions
+// ============================================================================
+
+int DriverControl::calculateTotalBodePoints() {
+    // Calculate number of decades
+    float decades = log10(_bode_config.freq_to / _bode_config.freq_from);
+    return (int)(decades * _bode_config.points_per_decade) + 1;
+}
+
+float DriverControl::calculateBodeFrequency(int point_index) {
+    // Calculate frequency for logarithmic spacing
+    float decades = log10(_bode_config.freq_to / _bode_config.freq_from);
+    float fraction = (float)point_index / (_bode_config.total_points - 1);
+    return _bode_config.freq_from * pow(10, fraction * decades);
+}
+
+void DriverControl::performBodeMeasurement() {
+    if (!_bode_running || _bode_config.current_point >= _bode_config.total_points) {
+        stopBodeMeasurement();
+        return;
+    }
+    
+    // Calculate current frequency
+    float frequency = calculateBodeFrequency(_bode_config.current_point);
+    
+    // Set the output signal at the current frequency
+    // For actual implementation, this would generate a sine wave at this frequency
+    // and measure the input/output amplitude and phase difference
+    
+    // Set output voltage amplitude on appropriate channel
+    _bode_config.driver->stage(_io, _bode_config.output_voltage);
+    _io.updateAllDACs();
+    
+    // Wait for system to settle at this frequency
+    // In a real implementation, we'd generate a sine wave and perform FFT or
+    // synchronous detection to measure gain and phase
+    delay(10);
+    
+    // Measure response - placeholder implementation
+    // In real implementation: apply sine wave, measure output, calculate gain/phase
+    float input_amplitude = _bode_config.output_voltage;
+    float output_amplitude = _bode_config.driver->read(_io);
+    
+    // Calculate gain in dB (simplified - real implementation needs proper signal analysis)
+    float gain_db = 20.0 * log10(output_amplitude / input_amplitude + 0.001);  // Add small value to avoid log(0)
+    
+    // Phase calculation would require time-domain analysis or synchronous detection
+    // For now, use a placeholder that simulates typical first-order system behavior
+    float phase_deg = -atan(frequency / 100.0) * 180.0 / M_PI;  // Placeholder phase
+    
+    // Store data point in buffer
+    if (_bode_buffer_count < BODE_BUFFER_SIZE) {
+        _bode_data_buffer[_bode_buffer_count].frequency = frequency;
+        _bode_data_buffer[_bode_buffer_count].gain = gain_db;
+        _bode_data_buffer[_bode_buffer_count].phase = phase_deg;
+        _bode_data_buffer[_bode_buffer_count].coherence = -1.0f;
+        _bode_buffer_count++;
+    }
+    
+    // Calculate progress
+    float progress = (float)(_bode_config.current_point + 1) / _bode_config.total_points * 100.0f;
+    bool completed = (_bode_config.current_point + 1) >= _bode_config.total_points;
+    
+    // Send buffered data if buffer is full or measurement is completed
+    if (_bode_buffer_count >= BODE_BUFFER_SIZE || completed) {
+        sendBufferedBodeData(completed);
+    }
+    
+    // Move to next frequency point
+    _bode_config.current_point++;
+    
+    if (completed) {
+        Serial.println("Bode measurement completed");
+        _bode_running = false;
+        _current_mode = DRIVER_MODE_NONE;
+    }
+}
+
+void DriverControl::sendBufferedBodeData(bool completed) {
+    if (_bode_buffer_count == 0) return;
     
     JsonDocument doc;
     
@@ -1203,349 +5829,897 @@ void DriverControl::sendBufferedVAData(bool completed) {
     snprintf(timestamp, sizeof(timestamp), "%lu", millis());
     
     doc["timestamp"] = timestamp;
-    doc["message_id"] = "va-data-" + String(millis());
+    doc["message_id"] = "bode-data-" + String(millis());
     doc["type"] = "data";
     
     JsonObject payload = doc["payload"].to<JsonObject>();
-    payload["mode"] = "va";
+    payload["mode"] = "bode";
     
     // Create data array with all buffered measurement points
-    // Use high precision for current to avoid stair-stepping with small currents
     JsonArray data_array = payload["data"].to<JsonArray>();
-    for (int i = 0; i < _va_buffer_count; i++) {
+    for (int i = 0; i < _bode_buffer_count; i++) {
         JsonObject data_point = data_array.add<JsonObject>();
-        data_point["voltage"] = roundTo6Decimals(_va_data_buffer[i].voltage);
-        data_point["current"] = roundTo6Decimals(_va_data_buffer[i].current);
+        data_point["frequency"] = roundTo3Decimals(_bode_data_buffer[i].frequency);
+        data_point["gain"] = roundTo3Decimals(_bode_data_buffer[i].gain);
+        data_point["phase"] = roundTo3Decimals(_bode_data_buffer[i].phase);
+        if (_bode_data_buffer[i].coherence >= 0.0f) {
+            data_point["coherence"] = roundTo3Decimals(_bode_data_buffer[i].coherence);
+        }
     }
     
-    // Calculate progress based on current step
-    float progress = (float)(_va_config.current_step + 1) / _va_config.total_steps * 100.0f;
+    float progress = (float)(_bode_config.current_point + 1) / _bode_config.total_points * 100.0f;
     payload["progress"] = roundTo3Decimals(progress);
     payload["completed"] = completed;
     
+    if (_bode_config.method != BODE_METHOD_STEPPED) {
+        payload["method"] = _bode_config.method == BODE_METHOD_CHIRP ? "chirp" : "multisine";
+        if (completed) {
+            payload["sample_rate"] = roundTo3Decimals(_bode_config.sample_rate);
+            payload["fft_size"] = _bode_config.fft_size;
+            payload["averages"] = (int)_bode_analyzed;
+            payload["crest_factor"] = roundTo3Decimals(_bode_config.crest_factor);
+            payload["skew_us"] = roundTo3Decimals(_bode_config.skew_us);
+            payload["late_samples"] = _bode_config.late_samples;
+        }
+    }
+    
     _postman.publish("data", doc);
     
-    Serial.printf("VA buffered data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
-                  _va_buffer_count, progress, completed ? "true" : "false");
+    Serial.printf("Bode buffered data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
+                  _bode_buffer_count, progress, completed ? "true" : "false");
     
     // Reset buffer
-    _va_buffer_count = 0;
-    _va_last_data_send = millis();
+    _bode_buffer_count = 0;
 }
 
-void DriverControl::stopVAMeasurement() {
-    if (_va_running) {
-        // Send any remaining buffered data before stopping
-        if (_va_buffer_count > 0) {
-            sendBufferedVAData(true);  // Mark as completed since we're stopping
+void DriverControl::stopBodeMeasurement() {
+    bool was_running = _bode_running;
+    _bode_running = false;
+    
+    // Broadband tasks exit at the next sample or queue timeout and clear their handles;
+    // buffers of a task that is still running are released by the next stop
+    bool stopped = waitForTaskExit(_bode_task_handle, "Bode stimulus");
+    stopped = waitForTaskExit(_bode_analysis_handle, "Bode analysis") && stopped;
+    if (stopped) {
+        freeBodeBuffers();
+    }
+    
+    if (was_running) {
+        // Send any remaining buffered data
+        if (_bode_buffer_count > 0) {
+            sendBufferedBodeData(true);
         }
         
-        _va_running = false;
-        _current_mode = "none";  // Reset mode when measurement stops
-        
-        // Clear buffer to prevent further data sending
-        _va_buffer_count = 0;
+        _current_mode = DRIVER_MODE_NONE;
+        _bode_buffer_count = 0;
         
         // Reset outputs to safe values
         _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
         _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
         _io.setPowerVoltage(0.0);
-        _io.setPowerCurrent(0.0);  // Also reset current limit to 0
- 
         _io.updateAllDACs();
         
-        Serial.println("VA measurement stopped and outputs reset");
+        Serial.println("Bode measurement stopped and outputs reset");
     }
 }
 
-void DriverControl::handleStopCommand(const char* mode) {
-    Serial.printf("Handling Stop command for mode: %s\n", mode);
+// ============================================================================
+// Broadband Bode helper functions
+// ============================================================================
+
+bool DriverControl::startBroadbandBode() {
+    BodeMeasurementConfig& cfg = _bode_config;
+    const char* method_name = cfg.method == BODE_METHOD_CHIRP ? "chirp" : "multisine";
+    
+    // X is read back on the driven channel's ADC, Y on the other one
+    if (cfg.channel == CHANNEL_CH2) {
+        _postman.sendError("E001", "Broadband methods need a signal channel", "bode", "channel", channelName(cfg.channel), 
+                          "Use CH0 or CH1, or method 'stepped' for CH2");
+        return false;
+    }
+    // Four samples per period at the top frequency, within the per-tick budget
+    if (cfg.freq_to > BODE_BROADBAND_MAX_RATE / BODE_BROADBAND_SAMPLES_PER_PERIOD) {
+        _postman.sendError("E001", "Frequency range out of bounds", "bode", "frequency_range", "", 
+                          "Broadband methods reach 2.5kHz; use method 'stepped' above that");
+        return false;
+    }
+    if (cfg.averages < 1 || cfg.averages > BODE_BROADBAND_MAX_AVERAGES) {
+        _postman.sendError("E001", "Averages out of range", "bode", "averages", "", "Averages must be 1 to 64");
+        return false;
+    }
+    float range = _io.getSignalVoltageRange();
+    if (cfg.offset - cfg.output_voltage < 0.0f || cfg.offset + cfg.output_voltage > range) {
+        String hint = "offset +/- output_voltage must stay within 0V to " + String(range, 1) + "V";
+        _postman.sendError("E001", "Stimulus does not fit the output range", "bode", "offset", "", hint.c_str());
+        return false;
+    }
     
-    if (strcmp(mode, "control_system") == 0) {
-        // Stop the control system task
-        stopControlSystemTask();
-        _postman.sendResponse("control_system", "success", "Control system stopped");
-        Serial.println("Control system stopped via MQTT command");
-    } else if (strcmp(mode, "va") == 0) {
-        // Stop VA measurement
-        stopVAMeasurement();
-        _postman.sendResponse("va", "success", "VA measurement stopped");
-        Serial.println("VA measurement stopped via MQTT command");
-    } else if (strcmp(mode, "bode") == 0) {
-        // Stop Bode measurement
+    float rate = min(BODE_BROADBAND_MAX_RATE, BODE_BROADBAND_SAMPLES_PER_PERIOD * cfg.freq_to);
+    cfg.sample_period_us = (uint32_t)(1000000.0f / rate + 0.5f);
+    cfg.sample_rate = 1000000.0f / cfg.sample_period_us;
+    
+    // Bin spacing of at most half the lowest frequency keeps the bottom of the range resolved
+    int n = SPECTRAL_MIN_FFT_SIZE;
+    while (n < SPECTRAL_MAX_FFT_SIZE && cfg.sample_rate / n > cfg.freq_from / 2.0f) {
+        n *= 2;
+    }
+    if (cfg.sample_rate / n > cfg.freq_from / 2.0f) {
+        _postman.sendError("E001", "Frequency range too wide for one stimulus period", "bode", "frequency_range", "", 
+                          "Broadband methods cover to/from up to 512; use method 'stepped' for wider ranges");
+        return false;
+    }
+    cfg.fft_size = n;
+    
+    _bode_codes = (uint16_t*)ps_malloc(n * sizeof(uint16_t));
+    _bode_raw[0] = (uint16_t*)ps_malloc(2 * n * sizeof(uint16_t));
+    _bode_raw[1] = (uint16_t*)ps_malloc(2 * n * sizeof(uint16_t));
+    _bode_block = (float*)malloc(n * sizeof(float));
+    _bode_spectrum_x = (float*)malloc((n + 2) * sizeof(float));
+    _bode_spectrum_y = (float*)malloc((n + 2) * sizeof(float));
+    _bode_points = (BodeBroadbandPoint*)malloc(BODE_MAX_POINTS * sizeof(BodeBroadbandPoint));
+    _bode_results = (BodeMeasurementData*)malloc(BODE_MAX_POINTS * sizeof(BodeMeasurementData));
+    // Integer periods of a periodic stimulus: no leakage, so no window
+    if (!_bode_codes || !_bode_raw[0] || !_bode_raw[1] || !_bode_block || !_bode_spectrum_x || 
+        !_bode_spectrum_y || !_bode_points || !_bode_results || !_bode_analyzer.begin(n, WINDOW_RECTANGULAR)) {
+        freeBodeBuffers();
+        _postman.sendError("E006", "Not enough memory for broadband Bode", "bode", "frequency_range", "", 
+                          "Narrow the frequency range");
+        return false;
+    }
+    
+    cfg.total_points = selectBroadbandBodeBins();
+    buildBodeStimulus();
+    
+    cfg.current_point = 0;
+    cfg.late_samples = 0;
+    cfg.overruns = 0;
+    cfg.skew_us = 0.0f;
+    _bode_buffer_count = 0;
+    _bode_analyzed = 0;
+    _bode_results_ready = false;
+    xQueueReset(_bode_free_queue);
+    xQueueReset(_bode_ready_queue);
+    for (uint8_t i = 0; i < 2; i++) {
+        xQueueSend(_bode_free_queue, &i, 0);
+    }
+    _bode_running = true;
+    
+    BaseType_t analysis = xTaskCreatePinnedToCore(
+        bodeAnalysisTaskWrapper,    // Task function
+        "BodeAnalysis",             // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        2,                          // Priority
+        &_bode_analysis_handle,     // Task handle
+        0                           // Core 0: FFTs run while core 1 keeps the stimulus going
+    );
+    BaseType_t stimulus = pdFAIL;
+    if (analysis == pdPASS) {
+        stimulus = xTaskCreatePinnedToCore(
+            bodeTaskWrapper,            // Task function
+            "BodeStimulus",             // Task name
+            4096,                       // Stack size
+            this,                       // Parameter passed to task
+            3,                          // Priority (above loop() on the same core)
+            &_bode_task_handle,         // Task handle
+            1                           // Core 1: sample timing stays off the WiFi core
+        );
+    }
+    if (analysis != pdPASS || stimulus != pdPASS) {
+        Serial.println("ERROR: Failed to create Bode tasks!");
+        if (analysis != pdPASS) _bode_analysis_handle = NULL;
+        _bode_task_handle = NULL;
         stopBodeMeasurement();
-        _postman.sendResponse("bode", "success", "Bode measurement stopped");
-        Serial.println("Bode measurement stopped via MQTT command");
-    } else if (strcmp(mode, "step") == 0) {
-        // Stop Step measurement
-        stopStepMeasurement();
-        _postman.sendResponse("step", "success", "Step measurement stopped");
-        Serial.println("Step measurement stopped via MQTT command");
-    } else if (strcmp(mode, "impulse") == 0) {
-        // Stop Impulse measurement
-        stopImpulseMeasurement();
-        _postman.sendResponse("impulse", "success", "Impulse measurement stopped");
-        Serial.println("Impulse measurement stopped via MQTT command");
-    } else if (strcmp(mode, "testbed") == 0) {
-        // Stop testbed mode
-        _testbed_running = false;
-        _current_mode = "none";
-        _postman.sendResponse("testbed", "success", "Testbed mode stopped");
-        Serial.println("Testbed mode stopped via MQTT command");
+        _postman.sendError("E006", "Failed to start Bode tasks", "bode", "", "", "Retry the command");
+        return false;
+    }
+    
+    float period_s = n / cfg.sample_rate;
+    int estimated_duration = (int)((cfg.averages + 1) * period_s + 1);
+    _postman.sendResponse("bode", "success", "Bode measurement started", estimated_duration);
+    
+    Serial.printf("Bode %s started: %s, %.1fHz-%.1fHz, %d points, N=%d @ %.1fHz, %d averages, crest factor %.2f\n", 
+                  method_name, channelName(cfg.channel), cfg.freq_from, cfg.freq_to, cfg.total_points, 
+                  n, cfg.sample_rate, cfg.averages, cfg.crest_factor);
+    return true;
+}
+
+int DriverControl::selectBroadbandBodeBins() {
+    // Log-spaced points snapped to FFT bins; neighbours that land on the same bin collapse
+    const float df = _bode_config.sample_rate / _bode_config.fft_size;
+    const int last_bin = _bode_config.fft_size / 2 - 1;
+    int requested = min(calculateTotalBodePoints(), BODE_MAX_POINTS);
+    int count = 0;
+    for (int i = 0; i < requested; i++) {
+        float frequency = requested > 1 ? calculateBodeFrequency(i) : _bode_config.freq_from;
+        int bin = constrain((int)(frequency / df + 0.5f), 1, last_bin);
+        if (count > 0 && bin <= _bode_points[count - 1].bin) {
+            continue;
+        }
+        BodeBroadbandPoint& point = _bode_points[count++];
+        point.bin = bin;
+        point.gxx = point.gyy = point.gxy_re = point.gxy_im = 0.0f;
+    }
+    return count;
+}
+
+void DriverControl::buildBodeStimulus() {
+    BodeMeasurementConfig& cfg = _bode_config;
+    const int n = cfg.fft_size;
+    const int tones = cfg.total_points;
+    float* wave = _bode_block;  // Free until the first period is analysed
+    
+    if (cfg.method == BODE_METHOD_MULTISINE) {
+        // Schroeder phases phi_k = -pi k (k - 1) / K keep the crest factor low
+        memset(wave, 0, n * sizeof(float));
+        for (int t = 0; t < tones; t++) {
+            float phase = -(float)M_PI * t * (t + 1) / tones;
+            float step = 2.0f * (float)M_PI * _bode_points[t].bin / n;
+            // Rotate a phasor instead of calling cosf() for every sample of every tone
+            float re = cosf(phase), im = sinf(phase);
+            float rot_re = cosf(step), rot_im = sinf(step);
+            for (int i = 0; i < n; i++) {
+                wave[i] += re;
+                float next_re = re * rot_re - im * rot_im;
+                im = re * rot_im + im * rot_re;
+                re = next_re;
+            }
+        }
     } else {
-        // Unknown mode
-        _postman.sendError("E005", "Invalid stop mode", "stop", "mode", mode, "Use 'control_system', 'va', 'bode', 'step', 'impulse', or 'testbed'");
-        Serial.printf("Unknown stop mode: %s\n", mode);
+        // Logarithmic chirp across the selected bins, one sweep per period
+        const float df = cfg.sample_rate / n;
+        float f1 = _bode_points[0].bin * df;
+        float f2 = _bode_points[tones - 1].bin * df;
+        float ratio = logf(f2 / f1);
+        float duration = n / cfg.sample_rate;
+        for (int i = 0; i < n; i++) {
+            float t = (float)i / n;
+            float phase = ratio > 1e-6f
+                ? 2.0f * (float)M_PI * f1 * duration / ratio * (expf(ratio * t) - 1.0f)
+                : 2.0f * (float)M_PI * f1 * duration * t;
+            wave[i] = sinf(phase);
+        }
+    }
+    
+    float peak = 0.0f, sum_sq = 0.0f;
+    for (int i = 0; i < n; i++) {
+        peak = max(peak, fabsf(wave[i]));
+        sum_sq += wave[i] * wave[i];
+    }
+    float rms = sqrtf(sum_sq / n);
+    cfg.crest_factor = rms > 0.0f ? peak / rms : 0.0f;
+    
+    float scale = peak > 0.0f ? cfg.output_voltage / peak : 0.0f;
+    const SignalChannel channel = (cfg.channel == CHANNEL_CH1) ? SIGNAL_CHANNEL_B : SIGNAL_CHANNEL_A;
+    for (int i = 0; i < n; i++) {
+        _bode_codes[i] = _io.signalVoltageToCode(cfg.offset + scale * wave[i], channel);
     }
 }
 
-// FreeRTOS task wrapper (static function)
-void DriverControl::controlSystemTaskWrapper(void* parameter) {
+int DriverControl::playAndCapture(uint8_t dac_channel, const uint16_t* codes, int count, uint32_t period_us,
+                                  int64_t& t_next, uint16_t* raw_a, uint16_t* raw_b, int64_t& burst_us,
+                                  volatile bool& running) {
+    // One DAC code out and one conversion per signal ADC per tick, on a grid that
+    // continues across calls so back-to-back periods stay phase-continuous
+    int late_samples = 0;
+    uint16_t discard_a, discard_b;
+    for (int i = 0; i < count && running; i++) {
+        int64_t remaining_us = t_next - esp_timer_get_time();
+        if (remaining_us > 3000) {
+            vTaskDelay(pdMS_TO_TICKS((remaining_us - 2000) / 1000));
+        }
+        while (esp_timer_get_time() < t_next) {
+        }
+        if (esp_timer_get_time() - t_next > (int64_t)period_us) {
+            late_samples++;
+        }
+        _io.writeRawDAC(0, dac_channel, codes[i]);
+        _io.updateAllDACs();
+        int64_t t_burst = esp_timer_get_time();
+        _io.readSignalBurst(raw_a ? &raw_a[i] : &discard_a, raw_b ? &raw_b[i] : &discard_b, 1);
+        burst_us += esp_timer_get_time() - t_burst;
+        t_next += period_us;
+    }
+    return late_samples;
+}
+
+// FreeRTOS task wrappers (static functions)
+void DriverControl::bodeTaskWrapper(void* parameter) {
     DriverControl* instance = static_cast<DriverControl*>(parameter);
-    instance->controlSystemTask();
+    instance->bodeTask();
 }
 
-// High-frequency control system task
-void DriverControl::controlSystemTask() {
-    TickType_t xLastWakeTime = xTaskGetTickCount();
-    const TickType_t xFrequency = pdMS_TO_TICKS(1000 / CONTROL_SYSTEM_FREQUENCY_HZ); // 20ms for 50Hz
-    
-    Serial.printf("Control system task started at %dHz (stack size: %d bytes)\n", 
-                  CONTROL_SYSTEM_FREQUENCY_HZ, uxTaskGetStackHighWaterMark(NULL));
-    
-    int iteration = 0;
-    while (_control_system_running) {
-        // Monitor stack usage every 1000 iterations (every ~20 seconds at 50Hz)
-        if (iteration % 1000 == 0) {
-            UBaseType_t stackRemaining = uxTaskGetStackHighWaterMark(NULL);
-            Serial.printf("Control task iteration %d, stack remaining: %d bytes\n", iteration, stackRemaining);
-            
-            if (stackRemaining < 256) {
-                Serial.println("WARNING: Control system task stack running low!");
+void DriverControl::bodeAnalysisTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->bodeAnalysisTask();
+}
+
+void DriverControl::bodeTask() {
+    BodeMeasurementConfig& cfg = _bode_config;
+    const int n = cfg.fft_size;
+    const uint8_t dac_channel = (cfg.channel == CHANNEL_CH1) ? 1 : 0;
+    int64_t t_next = esp_timer_get_time();
+    int64_t burst_us = 0;
+    int bursts = 0;
+    
+    Serial.printf("Bode stimulus task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    // The first period only settles the DUT; the rest are recorded into free slots
+    for (int p = 0; p <= cfg.averages && _bode_running; p++) {
+        uint8_t slot = 0;
+        uint16_t* x = nullptr;
+        uint16_t* y = nullptr;
+        if (p > 0) {
+            if (xQueueReceive(_bode_free_queue, &slot, 0) == pdTRUE) {
+                x = _bode_raw[slot];
+                y = x + n;
+            } else {
+                cfg.overruns++;  // Keep playing, this period is just not averaged
             }
         }
         
-        // Update control system
-        updateControlSystem();
-        
-        iteration++;
+        int64_t period_burst_us = 0;
+        cfg.late_samples += playAndCapture(dac_channel, _bode_codes, n, cfg.sample_period_us, t_next,
+                                           dac_channel == 0 ? x : y, dac_channel == 0 ? y : x,
+                                           period_burst_us, _bode_running);
+        if (x != nullptr && _bode_running) {
+            burst_us += period_burst_us;
+            bursts += n;
+            xQueueSend(_bode_ready_queue, &slot, 0);  // Room for both slots, cannot fail
+        }
+    }
+    
+    // Both slots come back once the last recorded period is analysed
+    while (_bode_running && uxQueueMessagesWaiting(_bode_free_queue) < 2) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    
+    if (_bode_running) {
+        // Channel B converts about half a burst after channel A
+        float delay_us = bursts > 0 ? 0.5f * (float)burst_us / bursts : 0.0f;
+        cfg.skew_us = (dac_channel == 0) ? delay_us : -delay_us;
+        finishBroadbandBode();
+        _bode_results_ready = true;
         
-        // Wait for next period (precise timing)
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        if (cfg.late_samples > 0 || cfg.overruns > 0) {
+            Serial.printf("Bode: %d late samples, %d skipped periods\n", cfg.late_samples, cfg.overruns);
+        }
     }
     
-    Serial.println("Control system task stopped");
+    Serial.printf("Bode stimulus task stopped after %d analysed periods\n", (int)_bode_analyzed);
+    _bode_task_handle = NULL;
     vTaskDelete(NULL); // Delete this task
 }
 
-// Start the high-frequency control system task
-void DriverControl::startControlSystemTask() {
-    if (_control_task_handle == NULL) {
-        _control_system_running = true;
+void DriverControl::bodeAnalysisTask() {
+    const int n = _bode_config.fft_size;
+    const int points = _bode_config.total_points;
+    const SignalChannel x_channel = (_bode_config.channel == CHANNEL_CH1) ? SIGNAL_CHANNEL_B : SIGNAL_CHANNEL_A;
+    const SignalChannel y_channel = (x_channel == SIGNAL_CHANNEL_A) ? SIGNAL_CHANNEL_B : SIGNAL_CHANNEL_A;
+    
+    while (_bode_running && !_bode_results_ready) {
+        uint8_t slot;
+        if (xQueueReceive(_bode_ready_queue, &slot, pdMS_TO_TICKS(50)) != pdTRUE) {
+            continue;
+        }
         
-        BaseType_t result = xTaskCreatePinnedToCore(
-            controlSystemTaskWrapper,    // Task function
-            "ControlSystemTask",         // Task name
-            4096,                       // Stack size (4KB - reduced from 8KB)
-            this,                       // Parameter passed to task
-            1,                          // Priority (reduced from 2 to 1)
-            &_control_task_handle,      // Task handle
-            1                           // Core 1 (separate from WiFi/main loop on core 0)
-        );
+        // First block: the ADC channel matching the stimulus DAC (see bodeTask())
+        const uint16_t* raw = _bode_raw[slot];
+        for (int i = 0; i < n; i++) {
+            _bode_block[i] = _io.signalVoltageFromRaw(raw[i], x_channel);
+        }
+        _bode_analyzer.transform(_bode_block, _bode_spectrum_x);
+        for (int i = 0; i < n; i++) {
+            _bode_block[i] = _io.signalVoltageFromRaw(raw[n + i], y_channel);
+        }
+        _bode_analyzer.transform(_bode_block, _bode_spectrum_y);
         
-        if (result != pdPASS) {
-            Serial.println("ERROR: Failed to create control system task!");
-            _control_system_running = false;
-            _current_mode = "none";  // Reset mode on failure
-        } else {
-            Serial.println("Control system task created successfully");
+        // Auto- and cross-spectra at the excited bins
+        for (int p = 0; p < points; p++) {
+            BodeBroadbandPoint& point = _bode_points[p];
+            float xr = _bode_spectrum_x[2 * point.bin], xi = _bode_spectrum_x[2 * point.bin + 1];
+            float yr = _bode_spectrum_y[2 * point.bin], yi = _bode_spectrum_y[2 * point.bin + 1];
+            point.gxx += xr * xr + xi * xi;
+            point.gyy += yr * yr + yi * yi;
+            point.gxy_re += xr * yr + xi * yi;
+            point.gxy_im += xr * yi - xi * yr;
         }
+        _bode_analyzed++;
+        
+        // Returned only now so the stimulus task cannot finish before these sums are in
+        xQueueSend(_bode_free_queue, &slot, 0);
     }
+    
+    _bode_analysis_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
 }
 
-// Stop the control system task
-void DriverControl::stopControlSystemTask() {
-    if (_control_task_handle != NULL) {
-        Serial.println("Stopping control system task...");
-        _control_system_running = false;
-        _current_mode = "none";  // Reset mode when stopping
-        
-        // Wait for the task to actually terminate (with timeout)
-        int timeout_ms = 500;
-        int check_interval_ms = 10;
-        int elapsed_ms = 0;
+void DriverControl::finishBroadbandBode() {
+    const BodeMeasurementConfig& cfg = _bode_config;
+    const float df = cfg.sample_rate / cfg.fft_size;
+    
+    for (int p = 0; p < cfg.total_points; p++) {
+        const BodeBroadbandPoint& point = _bode_points[p];
+        BodeMeasurementData& result = _bode_results[p];
+        result.frequency = point.bin * df;
         
-        while (eTaskGetState(_control_task_handle) != eDeleted && elapsed_ms < timeout_ms) {
-            vTaskDelay(pdMS_TO_TICKS(check_interval_ms));
-            elapsed_ms += check_interval_ms;
-        }
+        // H1 = Gxy / Gxx, then undo the sampling skew between the two ADC channels
+        float hr = point.gxx > 0.0f ? point.gxy_re / point.gxx : 0.0f;
+        float hi = point.gxx > 0.0f ? point.gxy_im / point.gxx : 0.0f;
+        float w = 2.0f * (float)M_PI * result.frequency * cfg.skew_us * 1e-6f;
+        float c = cosf(w), s = sinf(w);
+        float cr = hr * c + hi * s;
+        float ci = hi * c - hr * s;
         
-        if (eTaskGetState(_control_task_handle) == eDeleted) {
-            Serial.println("Control system task terminated successfully");
-        } else {
-            Serial.println("WARNING: Control system task did not terminate within timeout, forcing deletion");
-            vTaskDelete(_control_task_handle);
-        }
+        float magnitude_sq = cr * cr + ci * ci;
+        result.gain = 10.0f * log10f(magnitude_sq > 1e-20f ? magnitude_sq : 1e-20f);
+        result.phase = atan2f(ci, cr) * 180.0f / (float)M_PI;
         
-        _control_task_handle = NULL;
-        Serial.println("Control system task stopped");
-    } else {
-        Serial.println("Control system task was not running");
+        float denom = point.gxx * point.gyy;
+        float cross_sq = point.gxy_re * point.gxy_re + point.gxy_im * point.gxy_im;
+        result.coherence = denom > 0.0f ? constrain(cross_sq / denom, 0.0f, 1.0f) : 0.0f;
     }
 }
 
-// Send buffered data via MQTT (called from main loop every 500ms)
-void DriverControl::sendBufferedData() {
-    Serial.printf("sendBufferedData called: buffer_count=%d, control_running=%d\n", _buffer_count, _control_system_running);
+void DriverControl::performBroadbandBodePublish() {
+    if (!_bode_results_ready) {
+        return;
+    }
     
-    // Send data if we have at least 5 samples (to avoid sending tiny batches)
-    if (_buffer_count < 5) return;
+    // All points are ready at once: send them back to back in buffer-sized chunks
+    BodeMeasurementConfig& cfg = _bode_config;
+    while (cfg.current_point < cfg.total_points) {
+        int count = min(BODE_BUFFER_SIZE, cfg.total_points - cfg.current_point);
+        for (int i = 0; i < count; i++) {
+            _bode_data_buffer[i] = _bode_results[cfg.current_point + i];
+        }
+        _bode_buffer_count = count;
+        cfg.current_point += count - 1;
+        sendBufferedBodeData(cfg.current_point + 1 >= cfg.total_points);
+        cfg.current_point++;
+    }
     
-    // Take mutex to safely read buffer
-    if (xSemaphoreTake(_data_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-        // ArduinoJson 7 automatically manages memory allocation
-        JsonDocument doc;
-        doc["type"] = "data";
-        doc["mode"] = "control_system";
-        
-        JsonObject payload = doc["payload"].to<JsonObject>();
-        payload["sample_count"] = _buffer_count;
-        payload["frequency_hz"] = CONTROL_SYSTEM_FREQUENCY_HZ;
-        payload["continuous"] = true;
+    Serial.println("Bode measurement completed");
+    stopBodeMeasurement();
+}
+
+void DriverControl::freeBodeBuffers() {
+    _bode_analyzer.end();
+    free(_bode_codes);
+    free(_bode_raw[0]);
+    free(_bode_raw[1]);
+    free(_bode_block);
+    free(_bode_spectrum_x);
+    free(_bode_spectrum_y);
+    free(_bode_points);
+    free(_bode_results);
+    _bode_codes = nullptr;
+    _bode_raw[0] = nullptr;
+    _bode_raw[1] = nullptr;
+    _bode_block = nullptr;
+    _bode_spectrum_x = nullptr;
+    _bode_spectrum_y = nullptr;
+    _bode_points = nullptr;
+    _bode_results = nullptr;
+    _bode_results_ready = false;
+}
+
+// ============================================================================
+// Step response helper functions
+// ============================================================================
+
+void DriverControl::stopStepMeasurement() {
+    if (_step_running) {
+        stopCaptureTask();
         
-        // Create arrays for batch data using modern ArduinoJson 7 syntax
-        JsonArray timestamps = payload["timestamps"].to<JsonArray>();
-        JsonArray inputs = payload["inputs"].to<JsonArray>();
-        JsonArray states_x1 = payload["states_x1"].to<JsonArray>();
-        JsonArray states_x2 = payload["states_x2"].to<JsonArray>();
-        JsonArray outputs_y1 = payload["outputs_y1"].to<JsonArray>();
-        JsonArray outputs_y2 = payload["outputs_y2"].to<JsonArray>();
+        // Send whatever has been averaged so far
+        if (_capture_done) {
+            publishCaptureRange(_capture_config.total_points);
+        }
         
-        // Copy data from buffer
-        int read_start = (_buffer_write_index - _buffer_count + CONTROL_SYSTEM_BUFFER_SIZE) % CONTROL_SYSTEM_BUFFER_SIZE;
+        _step_running = false;
+        _current_mode = DRIVER_MODE_NONE;
         
-        for (int i = 0; i < _buffer_count; i++) {
-            int index = (read_start + i) % CONTROL_SYSTEM_BUFFER_SIZE;
-            
-            timestamps.add(_data_buffer[index].timestamp);
-            inputs.add(roundTo3Decimals(_data_buffer[index].input_value));
-            states_x1.add(roundTo3Decimals(_data_buffer[index].state_x1));
-            states_x2.add(roundTo3Decimals(_data_buffer[index].state_x2));
-            outputs_y1.add(roundTo3Decimals(_data_buffer[index].output_y1));
-            outputs_y2.add(roundTo3Decimals(_data_buffer[index].output_y2));
-        }
+        // Reset outputs to safe values
+        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
+        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
+        _io.setPowerVoltage(0.0);
+        _io.updateAllDACs();
         
-        // Reset buffer
-        _buffer_count = 0;
-        _buffer_write_index = 0;
+        Serial.println("Step measurement stopped and outputs reset");
+    }
+}
+
+// ============================================================================
+// Impulse response helper functions
+// ============================================================================
+
+void DriverControl::stopImpulseMeasurement() {
+    if (_impulse_running) {
+        stopCaptureTask();
         
-        xSemaphoreGive(_data_mutex);
+        // Send whatever has been averaged so far
+        if (_capture_done) {
+            publishCaptureRange(_capture_config.total_points);
+        }
         
-        // Debug: Check JSON size using measureJson (more memory efficient)
-        size_t json_size = measureJson(doc);
-        Serial.printf("JSON size: %d bytes, sending %d samples\n", json_size, timestamps.size());
+        _impulse_running = false;
+        _current_mode = DRIVER_MODE_NONE;
         
-        // Send data directly (no String conversion needed)
-        _postman.publish("data", doc);
+        // Reset outputs to safe values
+        _io.setPowerVoltage(0.0);
+        _io.updateAllDACs();
         
-        Serial.printf("Sent %d control system samples\n", timestamps.size());
+        Serial.println("Impulse measurement stopped and outputs reset");
     }
 }
 
 // ============================================================================
-// Bode characteristics helper functions
+// Ensemble capture engine (step and impulse)
 // ============================================================================
 
-int DriverControl::calculateTotalBodePoints() {
-    // Calculate number of decades
-    float decades = log10(_bode_config.freq_to / _bode_config.freq_from);
-    return (int)(decades * _bode_config.points_per_decade) + 1;
+bool DriverControl::parseCaptureSettings(JsonObjectConst settings, const char* mode, float measurement_time, CaptureSource source) {
+    int averages = settings["averages"].is<int>() ? settings["averages"].as<int>() : 1;
+    float pre_trigger = settings["pre_trigger"].is<float>() ? settings["pre_trigger"].as<float>() : 0.0f;
+    float rest_time = settings["rest_time"].is<float>() ? settings["rest_time"].as<float>() : measurement_time;
+    
+    if (averages < 1 || averages > CAPTURE_MAX_AVERAGES) {
+        _postman.sendError("E001", "Averages out of range", mode, "averages", "", 
+                          "Averages must be 1 to 256");
+        return false;
+    }
+    if (pre_trigger < 0.0f || pre_trigger > 50.0f) {
+        _postman.sendError("E001", "Pre-trigger out of range", mode, "pre_trigger", "", 
+                          "Pre-trigger must be 0% to 50% of the record");
+        return false;
+    }
+    if (rest_time < 0.0f || rest_time > 10.0f) {
+        _postman.sendError("E001", "Rest time out of range", mode, "rest_time", "", 
+                          "Rest time must be 0s to 10s");
+        return false;
+    }
+    DataEncoding encoding;
+    if (!parseEncoding(settings, mode, encoding)) {
+        return false;
+    }
+    
+    // The record keeps its fixed length; pre-trigger points are taken from the front of it
+    // and measurement_time still spans the post-trigger part
+    int pre_points = (int)(CAPTURE_MAX_POINTS * pre_trigger / 100.0f + 0.5f);
+    int post_points = CAPTURE_MAX_POINTS - pre_points;
+    uint32_t time_step_us = (uint32_t)(measurement_time * 1000000.0f / (post_points - 1) + 0.5f);
+    if (time_step_us < 1) time_step_us = 1;
+    
+    // The power feedback only has a new value once per scan frame
+    if ((source == CAPTURE_SOURCE_POWER || source == CAPTURE_SOURCE_POWER_CURRENT) && time_step_us < FEEDBACK_FRAME_US) {
+        String hint = "The power output is sampled every " + String(FEEDBACK_FRAME_US) + "us: measurement_time at least " + 
+                      String(FEEDBACK_FRAME_US * (post_points - 1) / 1000000.0f, 3) + "s";
+        _postman.sendError("E001", "Measurement time too short for the power output", mode, "measurement_time", "", hint.c_str());
+        return false;
+    }
+    
+    CaptureConfig& cfg = _capture_config;
+    cfg.mode = mode;
+    cfg.encoding = encoding;
+    cfg.total_points = CAPTURE_MAX_POINTS;
+    cfg.pre_points = pre_points;
+    cfg.time_step_us = time_step_us;
+    cfg.rest_us = (uint32_t)(rest_time * 1000000.0f);
+    cfg.averages = averages;
+    cfg.completed_averages = 0;
+    cfg.late_samples = 0;
+    cfg.publish_index = 0;
+    return true;
 }
 
-float DriverControl::calculateBodeFrequency(int point_index) {
-    // Calculate frequency for logarithmic spacing
-    float decades = log10(_bode_config.freq_to / _bode_config.freq_from);
-    float fraction = (float)point_index / (_bode_config.total_points - 1);
-    return _bode_config.freq_from * pow(10, fraction * decades);
+// FreeRTOS task wrapper (static function)
+void DriverControl::captureTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->captureTask();
 }
 
-void DriverControl::performBodeMeasurement() {
-    if (!_bode_running || _bode_config.current_point >= _bode_config.total_points) {
-        stopBodeMeasurement();
-        return;
+bool DriverControl::startCaptureTask() {
+    if (_capture_task_handle != NULL) {
+        stopCaptureTask();
+        if (_capture_task_handle != NULL) {
+            return false;  // The previous capture has not let go of the buffers yet
+        }
     }
     
-    // Calculate current frequency
-    float frequency = calculateBodeFrequency(_bode_config.current_point);
+    memset(_capture_sum, 0, sizeof(_capture_sum));
+    memset(_capture_sum_sq, 0, sizeof(_capture_sum_sq));
     
-    // Set the output signal at the current frequency
-    // For actual implementation, this would generate a sine wave at this frequency
-    // and measure the input/output amplitude and phase difference
+    // Both ping-pong blocks start out free
+    xQueueReset(_capture_free_queue);
+    xQueueReset(_capture_ready_queue);
+    for (uint8_t i = 0; i < 2; i++) {
+        xQueueSend(_capture_free_queue, &i, 0);
+    }
+    _capture_stream_block = -1;
+    _capture_config.block_overruns = 0;
+    _capture_done = false;
+    _capture_running = true;
+    
+    // Above loop() on core 1 so sampling is not time-sliced with it; the task
+    // sleeps through rest periods and sample gaps longer than a tick
+    BaseType_t result = xTaskCreatePinnedToCore(
+        captureTaskWrapper,         // Task function
+        "CaptureTask",              // Task name
+        4096,                       // Stack size (buffers are class members)
+        this,                       // Parameter passed to task
+        3,                          // Priority
+        &_capture_task_handle,      // Task handle
+        1                           // Core 1 (separate from WiFi on core 0)
+    );
+    
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create capture task!");
+        _capture_running = false;
+        _capture_task_handle = NULL;
+        return false;
+    }
+    return true;
+}
+
+void DriverControl::stopCaptureTask() {
+    if (_capture_task_handle == NULL) {
+        return;
+    }
     
-    // Set output voltage amplitude on appropriate channel
-    if (_bode_config.channel == "CH0") {
-        _io.setSignalVoltage(SIGNAL_CHANNEL_A, _bode_config.output_voltage);
-    } else if (_bode_config.channel == "CH1") {
-        _io.setSignalVoltage(SIGNAL_CHANNEL_B, _bode_config.output_voltage);
-    } else if (_bode_config.channel == "CH2") {
-        _io.setPowerVoltage(_bode_config.output_voltage);
+    _capture_running = false;
+    
+    // The task exits at the next sample or rest check and clears its handle
+    waitForTaskExit(_capture_task_handle, "Capture");
+}
+
+uint16_t DriverControl::readCaptureRaw(CaptureSource source) {
+    switch (source) {
+        case CAPTURE_SOURCE_SIGNAL_A: return _io.readRawADC(SIGNAL_CHANNEL_A);
+        case CAPTURE_SOURCE_SIGNAL_B: return _io.readRawADC(SIGNAL_CHANNEL_B);
+        case CAPTURE_SOURCE_POWER_CURRENT: return _io.readPowerCurrentRaw();
+        default:                      return _io.readPowerVoltageRaw();
+    }
+}
+
+float DriverControl::captureRawToVoltage(CaptureSource source, float raw) const {
+    switch (source) {
+        case CAPTURE_SOURCE_POWER:         return _io.powerVoltageFromRaw(raw);
+        case CAPTURE_SOURCE_POWER_CURRENT: return _io.powerCurrentFromRaw(raw);
+        case CAPTURE_SOURCE_SIGNAL_B:      return _io.signalVoltageFromRaw(raw, SIGNAL_CHANNEL_B);
+        default:                           return _io.signalVoltageFromRaw(raw);
+    }
+}
+
+void DriverControl::stageCaptureOutput(float level) {
+    // Write the input register only; the output changes on the next LDAC edge
+    switch (_capture_config.stimulus) {
+        case CAPTURE_SOURCE_SIGNAL_A: _io.setSignalVoltage(SIGNAL_CHANNEL_A, level); break;
+        case CAPTURE_SOURCE_SIGNAL_B: _io.setSignalVoltage(SIGNAL_CHANNEL_B, level); break;
+        default:                      _io.setPowerVoltage(level); break;
+    }
+}
+
+bool DriverControl::waitCaptureSample(int64_t due_us) {
+    // Sleep through long gaps (up to the whole rest period) in slices so loop() keeps running
+    // and a stop request is seen, busy-wait the last 2ms
+    int64_t remaining_us = due_us - esp_timer_get_time();
+    while (_capture_running && remaining_us > 3000) {
+        vTaskDelay(pdMS_TO_TICKS(min(remaining_us - 2000, (int64_t)50000) / 1000));
+        remaining_us = due_us - esp_timer_get_time();
+    }
+    while (_capture_running && esp_timer_get_time() < due_us) {
+    }
+    if (!_capture_running) {
+        return false;
+    }
+    if (esp_timer_get_time() - due_us > (int64_t)_capture_config.time_step_us) {
+        _capture_config.late_samples++;
+    }
+    return true;
+}
+
+void DriverControl::streamCaptureSample(int index) {
+    // Never blocks: if loop() still holds both blocks the point is only kept in the
+    // record arrays and loop() publishes it from there when it catches up
+    if (_capture_stream_block < 0) {
+        uint8_t idx;
+        if (xQueueReceive(_capture_free_queue, &idx, 0) != pdTRUE) {
+            _capture_config.block_overruns++;
+            return;
+        }
+        _capture_stream_block = idx;
+        _capture_blocks[idx].first_index = index;
+        _capture_blocks[idx].count = 0;
+        _capture_blocks[idx].averages = _capture_config.averages;
     }
-    _io.updateAllDACs();
     
-    // Wait for system to settle at this frequency
-    // In a real implementation, we'd generate a sine wave and perform FFT or
-    // synchronous detection to measure gain and phase
-    delay(10);
+    CaptureBlock& block = _capture_blocks[_capture_stream_block];
+    block.sum[block.count] = _capture_sum[index];
+    block.time_us[block.count] = _capture_time_us[index];
+    block.count++;
     
-    // Measure response - placeholder implementation
-    // In real implementation: apply sine wave, measure output, calculate gain/phase
-    float input_amplitude = _bode_config.output_voltage;
-    float output_amplitude;
+    if (block.count == CAPTURE_CHUNK_POINTS || index == _capture_config.total_points - 1) {
+        uint8_t idx = (uint8_t)_capture_stream_block;
+        xQueueSend(_capture_ready_queue, &idx, 0);  // Room for both blocks, cannot fail
+        _capture_stream_block = -1;
+    }
+}
+
+void DriverControl::captureTask() {
+    CaptureConfig& cfg = _capture_config;
+    const int64_t dt_us = cfg.time_step_us;
+    const int post_points = cfg.total_points - cfg.pre_points;
+    const int RING_LEAD_SAMPLES = 8;  // Extra ring samples so wake-up jitter falls out of the record
     
-    if (_bode_config.channel == "CH0") {
-        output_amplitude = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-    } else if (_bode_config.channel == "CH1") {
-        output_amplitude = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-    } else {
-        output_amplitude = _io.readPowerVoltage();
+    Serial.printf("Capture task started: %d x %d points, dt=%uus\n", 
+                  cfg.averages, cfg.total_points, (unsigned)cfg.time_step_us);
+    
+    for (int rep = 0; rep < cfg.averages && _capture_running; rep++) {
+        bool final_pass = (rep == cfg.averages - 1);
+        
+        // Baseline before every trigger so each repetition starts from the same state
+        stageCaptureOutput(0.0f);
+        _io.updateAllDACs();
+        int64_t rest_end = esp_timer_get_time() + cfg.rest_us;
+        
+        // Fill the pre-trigger ring on the sample grid during the tail of the rest period
+        int64_t t_next = rest_end - (int64_t)(cfg.pre_points + RING_LEAD_SAMPLES) * dt_us;
+        if (t_next < esp_timer_get_time()) {
+            t_next = esp_timer_get_time();  // Rest shorter than the ring: extend it instead
+        }
+        int ring_head = 0;
+        int ring_fill = 0;
+        if (cfg.pre_points > 0) {
+            while (_capture_running && (t_next < rest_end || ring_fill < cfg.pre_points)) {
+                if (!waitCaptureSample(t_next)) break;
+                _capture_ring_time[ring_head] = esp_timer_get_time();
+                _capture_ring[ring_head] = readCaptureRaw(cfg.source);
+                ring_head = (ring_head + 1) % cfg.pre_points;
+                if (ring_fill < cfg.pre_points) ring_fill++;
+                t_next += dt_us;
+            }
+        } else {
+            t_next = rest_end;
+            waitCaptureSample(t_next - dt_us);
+        }
+        if (!_capture_running) break;
+        
+        // Stimulus edge from the hardware timer exactly on the next grid instant
+        stageCaptureOutput(cfg.level);
+        int64_t lead_us = t_next - esp_timer_get_time();
+        if (lead_us < 5) {
+            cfg.late_samples++;
+            lead_us = 5;
+        }
+        int64_t t_trigger = _io.scheduleLatch((uint32_t)lead_us);
+        
+        // Unroll the ring, oldest sample first, and accumulate it while the edge is pending
+        for (int i = 0; i < cfg.pre_points; i++) {
+            int slot = (ring_head + i) % cfg.pre_points;
+            uint32_t code = _capture_ring[slot];
+            _capture_shot[i] = code;
+            _capture_time_us[i] = (int32_t)(_capture_ring_time[slot] - t_trigger);
+            _capture_sum[i] += code;
+            _capture_sum_sq[i] += (uint64_t)code * code;
+        }
+        
+        if (cfg.pulse_us > 0) {
+            // Trailing edge: stage the baseline once the leading edge has latched the level
+            if (!_io.waitLatchPulse(lead_us / 1000 + 10)) {
+                cfg.late_samples++;
+            }
+            stageCaptureOutput(0.0f);
+            int64_t trailing_us = t_trigger + cfg.pulse_us - esp_timer_get_time();
+            if (trailing_us >= 5) {
+                _io.scheduleLatch((uint32_t)trailing_us);
+            } else {
+                _io.updateAllDACs();  // Shorter than the DAC write itself
+            }
+        }
+        
+        if (final_pass) {
+            for (int i = 0; i < cfg.pre_points; i++) {
+                streamCaptureSample(i);
+            }
+        }
+        
+        // Post-trigger samples on the same grid, accumulated as they arrive so the
+        // final repetition can be streamed point by point
+        int taken = cfg.pre_points;
+        for (int i = 0; i < post_points; i++) {
+            if (!waitCaptureSample(t_trigger + (int64_t)i * dt_us)) break;
+            int index = cfg.pre_points + i;
+            int64_t t_sample = esp_timer_get_time();
+            uint32_t code = readCaptureRaw(cfg.source);
+            _capture_shot[index] = code;
+            _capture_time_us[index] = (int32_t)(t_sample - t_trigger);
+            _capture_sum[index] += code;
+            _capture_sum_sq[index] += (uint64_t)code * code;
+            taken = index + 1;
+            if (final_pass) {
+                streamCaptureSample(index);
+            }
+        }
+        _io.waitLatchPulse(10);  // Collect the pending edge, if any
+        
+        if (!_capture_running) {
+            // Take the unfinished repetition back out so the sums hold whole repetitions
+            for (int i = 0; i < taken; i++) {
+                _capture_sum[i] -= _capture_shot[i];
+                _capture_sum_sq[i] -= (uint64_t)_capture_shot[i] * _capture_shot[i];
+            }
+            break;
+        }
+        cfg.completed_averages = rep + 1;
     }
     
-    // Calculate gain in dB (simplified - real implementation needs proper signal analysis)
-    float gain_db = 20.0 * log10(output_amplitude / input_amplitude + 0.001);  // Add small value to avoid log(0)
+    stageCaptureOutput(0.0f);
+    _io.updateAllDACs();
     
-    // Phase calculation would require time-domain analysis or synchronous detection
-    // For now, use a placeholder that simulates typical first-order system behavior
-    float phase_deg = -atan(frequency / 100.0) * 180.0 / M_PI;  // Placeholder phase
+    Serial.printf("Capture task finished: %d averages, %d late samples, %d block overruns\n", 
+                  cfg.completed_averages, cfg.late_samples, cfg.block_overruns);
     
-    // Store data point in buffer
-    if (_bode_buffer_count < BODE_BUFFER_SIZE) {
-        _bode_data_buffer[_bode_buffer_count].frequency = frequency;
-        _bode_data_buffer[_bode_buffer_count].gain = gain_db;
-        _bode_data_buffer[_bode_buffer_count].phase = phase_deg;
-        _bode_buffer_count++;
+    _capture_done = true;
+    _capture_running = false;
+    _capture_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::performCapturePublish() {
+    // Consumer side of the ping-pong: serialise filled blocks, then hand them back
+    uint8_t idx;
+    while (xQueueReceive(_capture_ready_queue, &idx, 0) == pdTRUE) {
+        const CaptureBlock& block = _capture_blocks[idx];
+        if (block.first_index >= _capture_config.publish_index) {  // Else already sent from the arrays
+            publishCaptureRange(block.first_index);  // Points skipped by an overrun come first
+            int end = block.first_index + block.count;
+            sendCaptureData(block, end >= _capture_config.total_points);
+            _capture_config.publish_index = end;
+        }
+        xQueueSend(_capture_free_queue, &idx, 0);
     }
     
-    // Calculate progress
-    float progress = (float)(_bode_config.current_point + 1) / _bode_config.total_points * 100.0f;
-    bool completed = (_bode_config.current_point + 1) >= _bode_config.total_points;
-    
-    // Send buffered data if buffer is full or measurement is completed
-    if (_bode_buffer_count >= BODE_BUFFER_SIZE || completed) {
-        sendBufferedBodeData(completed);
+    if (!_capture_done) {
+        return;
     }
     
-    // Move to next frequency point
-    _bode_config.current_point++;
+    // Task finished: anything not streamed comes from the record arrays
+    publishCaptureRange(_capture_config.total_points);
+    if (_step_running) {
+        stopStepMeasurement();
+    } else {
+        stopImpulseMeasurement();
+    }
+}
+
+void DriverControl::publishCaptureRange(int end) {
+    CaptureConfig& cfg = _capture_config;
+    if (cfg.completed_averages == 0 && !_capture_running) {
+        cfg.publish_index = cfg.total_points;  // Stopped before a repetition finished
+        return;
+    }
     
-    if (completed) {
-        Serial.println("Bode measurement completed");
-        _bode_running = false;
-        _current_mode = "none";
+    // Only called for points the task has already written; sums there are final
+    CaptureBlock block;
+    while (cfg.publish_index < end) {
+        block.first_index = cfg.publish_index;
+        block.count = min(CAPTURE_CHUNK_POINTS, end - cfg.publish_index);
+        block.averages = _capture_running ? cfg.averages : cfg.completed_averages;
+        for (int i = 0; i < block.count; i++) {
+            block.sum[i] = _capture_sum[block.first_index + i];
+            block.time_us[i] = _capture_time_us[block.first_index + i];
+        }
+        cfg.publish_index += block.count;
+        sendCaptureData(block, cfg.publish_index >= cfg.total_points);
     }
 }
 
-void DriverControl::sendBufferedBodeData(bool completed) {
-    if (_bode_buffer_count == 0) return;
+void DriverControl::sendCaptureData(const CaptureBlock& block, bool completed) {
+    CaptureConfig& cfg = _capture_config;
+    int n = block.averages;
+    if (n == 0 || block.count == 0) {
+        return;
+    }
     
     JsonDocument doc;
     
@@ -1553,238 +6727,521 @@ void DriverControl::sendBufferedBodeData(bool completed) {
     snprintf(timestamp, sizeof(timestamp), "%lu", millis());
     
     doc["timestamp"] = timestamp;
-    doc["message_id"] = "bode-data-" + String(millis());
+    doc["message_id"] = String(cfg.mode) + "-data-" + String(millis());
     doc["type"] = "data";
     
     JsonObject payload = doc["payload"].to<JsonObject>();
-    payload["mode"] = "bode";
+    payload["mode"] = cfg.mode;
     
-    // Create data array with all buffered measurement points
+    // Averaged waveform; time is the measured sample time of the last repetition,
+    // relative to the stimulus edge (negative = pre-trigger)
+    const bool raw = cfg.encoding == DATA_ENCODING_RAW;
     JsonArray data_array = payload["data"].to<JsonArray>();
-    for (int i = 0; i < _bode_buffer_count; i++) {
+    for (int i = 0; i < block.count; i++) {
         JsonObject data_point = data_array.add<JsonObject>();
-        data_point["frequency"] = roundTo3Decimals(_bode_data_buffer[i].frequency);
-        data_point["gain"] = roundTo3Decimals(_bode_data_buffer[i].gain);
-        data_point["phase"] = roundTo3Decimals(_bode_data_buffer[i].phase);
+        data_point["time"] = block.time_us[i] / 1000000.0f;  // Keep full precision for time
+        if (raw) {
+            data_point["response"] = averageCode(block.sum[i], n);
+        } else {
+            data_point["response"] = roundTo3Decimals(captureRawToVoltage(cfg.source, (float)block.sum[i] / n));
+        }
+    }
+    if (raw) {
+        payload["encoding"] = "raw";
+        addRawScale(payload["scale"].to<JsonObject>(), "response", cfg.source, RAW_FRACTION_BITS);
     }
     
-    float progress = (float)(_bode_config.current_point + 1) / _bode_config.total_points * 100.0f;
+    payload["averages"] = n;
+    payload["pre_trigger_points"] = cfg.pre_points;
+    if (completed && n >= 2) {
+        // Per-shot noise from the spread across repetitions, pooled over all points
+        double var_sum = 0.0;
+        for (int i = 0; i < cfg.total_points; i++) {
+            double mean = (double)_capture_sum[i] / n;
+            double var = ((double)_capture_sum_sq[i] - mean * _capture_sum[i]) / (n - 1);
+            var_sum += var > 0.0 ? var : 0.0;
+        }
+        float noise_codes = sqrt(var_sum / cfg.total_points);
+        float noise_rms = captureRawToVoltage(cfg.source, noise_codes) - captureRawToVoltage(cfg.source, 0.0f);
+        payload["noise_rms"] = roundTo6Decimals(noise_rms);
+        payload["averaged_noise_rms"] = roundTo6Decimals(noise_rms / sqrt((float)n));
+    }
+    if (completed && cfg.late_samples > 0) {
+        payload["late_samples"] = cfg.late_samples;
+    }
+    
+    int end = block.first_index + block.count;
+    float progress = (float)end / cfg.total_points * 100.0f;
     payload["progress"] = roundTo3Decimals(progress);
     payload["completed"] = completed;
     
     _postman.publish("data", doc);
     
-    Serial.printf("Bode buffered data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
-                  _bode_buffer_count, progress, completed ? "true" : "false");
-    
-    // Reset buffer
-    _bode_buffer_count = 0;
+    Serial.printf("%s capture data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
+                  cfg.mode, block.count, progress, completed ? "true" : "false");
 }
 
-void DriverControl::stopBodeMeasurement() {
-    if (_bode_running) {
-        // Send any remaining buffered data
-        if (_bode_buffer_count > 0) {
-            sendBufferedBodeData(true);
+// ============================================================================
+// Oscilloscope helper functions
+// ============================================================================
+
+bool DriverControl::parseScopeSource(const char* name, CaptureSource& source) {
+    static const CaptureSource sources[] = {
+        CAPTURE_SOURCE_SIGNAL_A, CAPTURE_SOURCE_SIGNAL_B, CAPTURE_SOURCE_POWER, CAPTURE_SOURCE_POWER_CURRENT
+    };
+    for (CaptureSource candidate : sources) {
+        if (strcmp(name, captureSourceName(candidate)) == 0) {
+            source = candidate;
+            return true;
         }
-        
-        _bode_running = false;
-        _current_mode = "none";
-        _bode_buffer_count = 0;
-        
-        // Reset outputs to safe values
-        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
-        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
-        _io.setPowerVoltage(0.0);
-        _io.updateAllDACs();
-        
-        Serial.println("Bode measurement stopped and outputs reset");
     }
+    return false;
 }
 
-// ============================================================================
-// Step response helper functions
-// ============================================================================
+const char* DriverControl::captureSourceName(CaptureSource source) {
+    switch (source) {
+        case CAPTURE_SOURCE_SIGNAL_A:      return "CH0";
+        case CAPTURE_SOURCE_SIGNAL_B:      return "CH1";
+        case CAPTURE_SOURCE_POWER:         return "VOUT";
+        default:                           return "IOUT";
+    }
+}
+
+// FreeRTOS task wrapper (static function)
+void DriverControl::scopeTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->scopeTask();
+}
 
-void DriverControl::performStepMeasurement() {
-    // Initialize measurement on first call
-    if (_step_config.start_time == 0) {
-        _step_config.start_time = micros();
+void DriverControl::scopeTask() {
+    const ScopeConfig& cfg = _scope_config;
+    const int len = cfg.record_length;
+    const int nch = cfg.channel_count;
+    const int64_t dt_us = cfg.sample_period_us;
+    const int post_points = len - cfg.pre_points;  // Includes the trigger sample
+    
+    // While waiting for a trigger the task gives loop() a tick now and then; the ring is
+    // refilled afterwards so pre-trigger data is always contiguous
+    const int64_t yield_interval_us = max((int64_t)20000, cfg.pre_points * dt_us + 20000);
+    
+    Serial.printf("Scope task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    
+    while (_scope_running) {
+        uint16_t* ring = _scope_buffers[_scope_capture_buffer];
+        int write = 0;
+        int filled = 0;              // Contiguous samples since arming or the last yield
+        bool edge_armed = false;     // Signal has been on the far side of the hysteresis band
+        bool triggered = false;
+        bool forced = false;
+        int trigger_pos = 0;
+        int post_remaining = 0;
+        int64_t arm_time = esp_timer_get_time();
+        int64_t last_yield = arm_time;
+        int64_t t_next = arm_time;
         
-        // Apply step voltage to channel
-        if (_step_config.channel == "CH0") {
-            _io.setSignalVoltage(SIGNAL_CHANNEL_A, _step_config.voltage);
-        } else if (_step_config.channel == "CH1") {
-            _io.setSignalVoltage(SIGNAL_CHANNEL_B, _step_config.voltage);
-        } else if (_step_config.channel == "CH2") {
-            _io.setPowerVoltage(_step_config.voltage);
+        while (_scope_running) {
+            // Sleep through long gaps, busy-wait the last stretch
+            int64_t remaining_us = t_next - esp_timer_get_time();
+            if (remaining_us > 3000) {
+                vTaskDelay(pdMS_TO_TICKS((remaining_us - 2000) / 1000));
+                last_yield = esp_timer_get_time();
+            }
+            while (esp_timer_get_time() < t_next) {
+            }
+            
+            uint16_t* sample = &ring[write * nch];
+            for (int c = 0; c < nch; c++) {
+                sample[c] = readCaptureRaw(cfg.sources[c]);
+            }
+            
+            if (!triggered) {
+                uint16_t code = sample[cfg.trigger_channel];
+                bool fire = false;
+                switch (cfg.trigger_type) {
+                    case SCOPE_TRIGGER_RISING:
+                        if (code + cfg.hysteresis_code <= cfg.trigger_code) edge_armed = true;
+                        else if (edge_armed && code >= cfg.trigger_code) fire = true;
+                        break;
+                    case SCOPE_TRIGGER_FALLING:
+                        if (code >= cfg.trigger_code + cfg.hysteresis_code) edge_armed = true;
+                        else if (edge_armed && code <= cfg.trigger_code) fire = true;
+                        break;
+                    case SCOPE_TRIGGER_LEVEL:
+                        fire = code >= cfg.trigger_code;
+                        break;
+                }
+                if (filled < cfg.pre_points) {
+                    fire = false;  // Not enough history yet
+                } else if (!fire && cfg.arm == SCOPE_ARM_AUTO && 
+                           esp_timer_get_time() - arm_time > (int64_t)cfg.auto_timeout_us) {
+                    fire = true;
+                    forced = true;
+                }
+                if (fire) {
+                    triggered = true;
+                    trigger_pos = write;
+                    post_remaining = post_points - 1;
+                }
+            } else {
+                post_remaining--;
+            }
+            
+            write = (write + 1) % len;
+            filled++;
+            t_next += dt_us;
+            
+            if (triggered && post_remaining == 0) {
+                break;
+            }
+            
+            if (!triggered && esp_timer_get_time() - last_yield > yield_interval_us) {
+                vTaskDelay(1);
+                last_yield = esp_timer_get_time();
+                t_next = last_yield;
+                filled = 0;
+                edge_armed = false;
+            }
         }
-        _io.updateAllDACs();
+        if (!_scope_running) break;
         
-        Serial.println("Step voltage applied");
-    }
-    
-    // Calculate elapsed time in seconds
-    unsigned long elapsed_us = micros() - _step_config.start_time;
-    float elapsed_s = elapsed_us / 1000000.0f;
-    
-    // Check if it's time for next sample
-    float expected_time = _step_config.current_point * _step_config.time_step;
-    
-    if (elapsed_s >= expected_time && _step_config.current_point < _step_config.total_points) {
-        // Read response from the channel
-        float response;
-        if (_step_config.channel == "CH0") {
-            response = _io.readSignalVoltage(SIGNAL_CHANNEL_A);
-        } else if (_step_config.channel == "CH1") {
-            response = _io.readSignalVoltage(SIGNAL_CHANNEL_B);
-        } else {
-            response = _io.readPowerVoltage();
+        // Hand the frame over: the ring becomes the held frame, capture continues in the other buffer.
+        // If a fetch is still reading the held frame this one is dropped and the scope re-arms.
+        if (xSemaphoreTake(_data_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+            continue;
         }
+        _scope_frame_start = (trigger_pos - cfg.pre_points + len) % len;
+        _scope_frame_triggered = !forced;
+        _scope_capture_buffer ^= 1;
+        _scope_frame_held = true;
+        decimateScopeFrame();
+        xSemaphoreGive(_data_mutex);
+        _scope_frame_count++;
+        _scope_frame_ready = true;
         
-        // Store data point
-        if (_step_buffer_count < STEP_DATA_POINTS) {
-            _step_data_buffer[_step_buffer_count].time = elapsed_s;
-            _step_data_buffer[_step_buffer_count].response = response;
-            _step_buffer_count++;
+        if (cfg.arm == SCOPE_ARM_SINGLE) {
+            break;
         }
         
-        _step_config.current_point++;
-        
-        // Check if measurement is complete
-        if (_step_config.current_point >= _step_config.total_points) {
-            sendBufferedStepData(true);
-            stopStepMeasurement();
-            return;
+        // Re-arm once loop() has published the frame
+        while (_scope_running && _scope_frame_ready) {
+            vTaskDelay(pdMS_TO_TICKS(5));
         }
-        
-        // Send partial data every 50 points
-        if (_step_buffer_count >= 50) {
-            float progress = (float)_step_config.current_point / _step_config.total_points * 100.0f;
-            sendBufferedStepData(false);
+    }
+    
+    Serial.printf("Scope task stopped after %u frames\n", (unsigned)_scope_frame_count);
+    _scope_capturing = false;
+    _scope_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+void DriverControl::decimateScopeFrame() {
+    // Min/max per bucket keeps narrow glitches visible at any display width
+    const ScopeConfig& cfg = _scope_config;
+    const uint16_t* frame = _scope_buffers[_scope_capture_buffer ^ 1];
+    const int len = cfg.record_length;
+    const int nch = cfg.channel_count;
+    _scope_buckets = min(cfg.display_width, len);
+    
+    for (int b = 0; b < _scope_buckets; b++) {
+        int i0 = (int)((int64_t)b * len / _scope_buckets);
+        int i1 = (int)((int64_t)(b + 1) * len / _scope_buckets);
+        for (int c = 0; c < nch; c++) {
+            uint16_t lo = 0xFFFF, hi = 0;
+            for (int i = i0; i < i1; i++) {
+                uint16_t v = frame[((_scope_frame_start + i) % len) * nch + c];
+                if (v < lo) lo = v;
+                if (v > hi) hi = v;
+            }
+            _scope_min[b * nch + c] = lo;
+            _scope_max[b * nch + c] = hi;
         }
     }
 }
 
-void DriverControl::sendBufferedStepData(bool completed) {
-    if (_step_buffer_count == 0) return;
-    
-    JsonDocument doc;
+void DriverControl::performScopePublish() {
+    if (!_scope_frame_ready) {
+        // Single shot finished and published: leave the mode, keep the frame for fetch
+        if (!_scope_capturing && _scope_config.arm == SCOPE_ARM_SINGLE && _scope_frame_count > 0) {
+            _scope_running = false;
+            _current_mode = DRIVER_MODE_NONE;
+        }
+        return;
+    }
     
-    char timestamp[30];
-    snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+    const ScopeConfig& cfg = _scope_config;
+    const int nch = cfg.channel_count;
+    float bucket_period = (float)cfg.record_length / _scope_buckets * cfg.sample_period_us / 1000000.0f;
+    float time_origin = -cfg.pre_points * (cfg.sample_period_us / 1000000.0f);
     
-    doc["timestamp"] = timestamp;
-    doc["message_id"] = "step-data-" + String(millis());
-    doc["type"] = "data";
+    // Published in chunks to stay inside the MQTT message buffer
+    for (int offset = 0; offset < _scope_buckets; offset += SCOPE_CHUNK_BUCKETS) {
+        int end = min(offset + SCOPE_CHUNK_BUCKETS, _scope_buckets);
+        
+        JsonDocument doc;
+        
+        char timestamp[30];
+        snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+        
+        doc["timestamp"] = timestamp;
+        doc["message_id"] = "scope-data-" + String(millis());
+        doc["type"] = "data";
+        
+        JsonObject payload = doc["payload"].to<JsonObject>();
+        payload["mode"] = "scope";
+        payload["frame"] = _scope_frame_count;
+        payload["triggered"] = _scope_frame_triggered;
+        payload["sample_period"] = cfg.sample_period_us / 1000000.0f;
+        payload["bucket_period"] = bucket_period;
+        payload["time_start"] = time_origin + offset * bucket_period;  // Relative to the trigger
+        payload["offset"] = offset;
+        payload["buckets"] = _scope_buckets;
+        
+        const bool raw = cfg.encoding == DATA_ENCODING_RAW;
+        JsonObject data = payload["data"].to<JsonObject>();
+        for (int c = 0; c < nch; c++) {
+            JsonObject channel = data[captureSourceName(cfg.sources[c])].to<JsonObject>();
+            JsonArray min_array = channel["min"].to<JsonArray>();
+            JsonArray max_array = channel["max"].to<JsonArray>();
+            for (int b = offset; b < end; b++) {
+                if (raw) {
+                    min_array.add(_scope_min[b * nch + c]);
+                    max_array.add(_scope_max[b * nch + c]);
+                } else {
+                    min_array.add(roundTo3Decimals(captureRawToVoltage(cfg.sources[c], _scope_min[b * nch + c])));
+                    max_array.add(roundTo3Decimals(captureRawToVoltage(cfg.sources[c], _scope_max[b * nch + c])));
+                }
+            }
+        }
+        if (raw) {
+            payload["encoding"] = "raw";
+            JsonObject scales = payload["scale"].to<JsonObject>();
+            for (int c = 0; c < nch; c++) {
+                addRawScale(scales, captureSourceName(cfg.sources[c]), cfg.sources[c], 0);
+            }
+        }
+        payload["completed"] = (end == _scope_buckets);
+        
+        _postman.publish("data", doc);
+    }
     
-    JsonObject payload = doc["payload"].to<JsonObject>();
-    payload["mode"] = "step";
+    Serial.printf("Scope frame %u sent: %d buckets, %s\n", (unsigned)_scope_frame_count, _scope_buckets,
+                  _scope_frame_triggered ? "triggered" : "auto");
+    _scope_frame_ready = false;
+}
+
+void DriverControl::handleScopeFetch(JsonObjectConst settings) {
+    if (!_scope_frame_held || _scope_buffers[0] == nullptr) {
+        _postman.sendError("E001", "No scope frame captured", "scope", "action", "fetch", 
+                          "Start the scope and wait for a frame first");
+        return;
+    }
     
-    // Create data array with all buffered measurement points
-    JsonArray data_array = payload["data"].to<JsonArray>();
-    for (int i = 0; i < _step_buffer_count; i++) {
-        JsonObject data_point = data_array.add<JsonObject>();
-        data_point["time"] = _step_data_buffer[i].time;  // Keep full precision for time
-        data_point["response"] = roundTo3Decimals(_step_data_buffer[i].response);
+    const ScopeConfig& cfg = _scope_config;
+    const int len = cfg.record_length;
+    const int nch = cfg.channel_count;
+    int offset = settings["offset"].is<int>() ? settings["offset"].as<int>() : 0;
+    int count = settings["count"].is<int>() ? settings["count"].as<int>() : len;
+    if (offset < 0 || offset >= len || count < 1) {
+        _postman.sendError("E001", "Fetch range out of range", "scope", "offset", "", 
+                          "0 <= offset < record_length and count >= 1");
+        return;
     }
+    count = min(count, len - offset);
     
-    float progress = (float)_step_config.current_point / _step_config.total_points * 100.0f;
-    payload["progress"] = roundTo3Decimals(progress);
-    payload["completed"] = completed;
+    // The frame's own encoding unless the fetch asks for another
+    DataEncoding encoding = cfg.encoding;
+    if (settings["encoding"].is<const char*>() && !parseEncoding(settings, "scope", encoding)) {
+        return;
+    }
     
-    _postman.publish("data", doc);
+    // Hold the mutex so the task cannot swap the held frame mid-transfer
+    if (xSemaphoreTake(_data_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        _postman.sendError("E007", "Scope frame busy", "scope", "action", "fetch", "Retry the fetch");
+        return;
+    }
+    const uint16_t* frame = _scope_buffers[_scope_capture_buffer ^ 1];
+    float dt = cfg.sample_period_us / 1000000.0f;
     
-    Serial.printf("Step buffered data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
-                  _step_buffer_count, progress, completed ? "true" : "false");
+    for (int start = offset; start < offset + count; start += SCOPE_FETCH_CHUNK) {
+        int end = min(start + SCOPE_FETCH_CHUNK, offset + count);
+        
+        JsonDocument doc;
+        
+        char timestamp[30];
+        snprintf(timestamp, sizeof(timestamp), "%lu", millis());
+        
+        doc["timestamp"] = timestamp;
+        doc["message_id"] = "scope-fetch-" + String(millis());
+        doc["type"] = "data";
+        
+        JsonObject payload = doc["payload"].to<JsonObject>();
+        payload["mode"] = "scope";
+        payload["fetch"] = true;
+        payload["frame"] = _scope_frame_count;
+        payload["sample_period"] = dt;
+        payload["time_start"] = (start - cfg.pre_points) * dt;  // Relative to the trigger
+        payload["offset"] = start;
+        payload["record_length"] = len;
+        
+        JsonObject data = payload["data"].to<JsonObject>();
+        for (int c = 0; c < nch; c++) {
+            JsonArray samples = data[captureSourceName(cfg.sources[c])].to<JsonArray>();
+            for (int i = start; i < end; i++) {
+                uint16_t code = frame[((_scope_frame_start + i) % len) * nch + c];
+                if (encoding == DATA_ENCODING_RAW) {
+                    samples.add(code);
+                } else {
+                    samples.add(roundTo3Decimals(captureRawToVoltage(cfg.sources[c], code)));
+                }
+            }
+        }
+        if (encoding == DATA_ENCODING_RAW) {
+            payload["encoding"] = "raw";
+            JsonObject scales = payload["scale"].to<JsonObject>();
+            for (int c = 0; c < nch; c++) {
+                addRawScale(scales, captureSourceName(cfg.sources[c]), cfg.sources[c], 0);
+            }
+        }
+        payload["completed"] = (end == offset + count);
+        
+        _postman.publish("data", doc);
+    }
+    xSemaphoreGive(_data_mutex);
     
-    // Reset buffer
-    _step_buffer_count = 0;
+    Serial.printf("Scope fetch sent: samples %d-%d of frame %u\n", offset, offset + count - 1, (unsigned)_scope_frame_count);
 }
 
-void DriverControl::stopStepMeasurement() {
-    if (_step_running) {
-        // Send any remaining buffered data
-        if (_step_buffer_count > 0) {
-            sendBufferedStepData(true);
-        }
-        
-        _step_running = false;
-        _current_mode = "none";
-        _step_buffer_count = 0;
-        _step_config.start_time = 0;
-        
-        // Reset outputs to safe values
-        _io.setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
-        _io.setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
-        _io.setPowerVoltage(0.0);
-        _io.updateAllDACs();
+void DriverControl::stopScope() {
+    bool stopped = true;
+    if (_scope_task_handle != NULL) {
+        _scope_running = false;
         
-        Serial.println("Step measurement stopped and outputs reset");
+        // The task exits at the next sample and clears its handle
+        stopped = waitForTaskExit(_scope_task_handle, "Scope");
+    }
+    
+    if (_scope_running || _current_mode == DRIVER_MODE_SCOPE) {
+        _current_mode = DRIVER_MODE_NONE;
+    }
+    _scope_running = false;
+    _scope_capturing = false;
+    _scope_frame_ready = false;
+    if (stopped) {
+        freeScopeBuffers();
     }
 }
 
+void DriverControl::freeScopeBuffers() {
+    _scope_frame_held = false;
+    for (int i = 0; i < 2; i++) {
+        free(_scope_buffers[i]);
+        _scope_buffers[i] = nullptr;
+    }
+    free(_scope_min);
+    free(_scope_max);
+    _scope_min = nullptr;
+    _scope_max = nullptr;
+}
+
 // ============================================================================
-// Impulse response helper functions
+// Spectrum analyzer helper functions
 // ============================================================================
 
-void DriverControl::performImpulseMeasurement() {
-    // Initialize measurement on first call
-    if (_impulse_config.start_time == 0) {
-        _impulse_config.start_time = micros();
-        
-        // Apply impulse voltage to CH2 (power channel)
-        _io.setPowerVoltage(_impulse_config.voltage);
-        _io.updateAllDACs();
-        
-        // Wait for impulse duration
-        delayMicroseconds(_impulse_config.duration_us);
-        
-        // Remove impulse (set to 0V)
-        _io.setPowerVoltage(0.0);
-        _io.updateAllDACs();
-        
-        _impulse_config.impulse_applied = true;
-        Serial.printf("Impulse applied: %.2fV for %dus\n", 
-                      _impulse_config.voltage, _impulse_config.duration_us);
-    }
+// FreeRTOS task wrapper (static function)
+void DriverControl::spectrumTaskWrapper(void* parameter) {
+    DriverControl* instance = static_cast<DriverControl*>(parameter);
+    instance->spectrumTask();
+}
+
+void DriverControl::spectrumTask() {
+    const SpectrumConfig& cfg = _spectrum_config;
+    const int n = cfg.fft_size;
+    const int64_t dt_us = cfg.sample_period_us;
+    int late_samples = 0;
     
-    // Calculate elapsed time in seconds
-    unsigned long elapsed_us = micros() - _impulse_config.start_time;
-    float elapsed_s = elapsed_us / 1000000.0f;
+    Serial.printf("Spectrum task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
     
-    // Check if it's time for next sample
-    float expected_time = _impulse_config.current_point * _impulse_config.time_step;
+    // The timed loop only stores raw codes; they are converted to volts into the analyzer's
+    // own input buffer once the block is complete
+    uint16_t* codes = _spectrum_codes;
+    float* block = _spectrum_analyzer.inputBuffer();
     
-    if (elapsed_s >= expected_time && _impulse_config.current_point < _impulse_config.total_points) {
-        // Read response from power channel
-        float response = _io.readPowerVoltage();
+    while (_spectrum_running) {
+        _spectrum_analyzer.reset();
+        
+        for (int a = 0; a < cfg.averages && _spectrum_running; a++) {
+            // One contiguous block on the sample grid
+            int64_t t_next = esp_timer_get_time();
+            for (int i = 0; i < n && _spectrum_running; i++) {
+                int64_t remaining_us = t_next - esp_timer_get_time();
+                if (remaining_us > 3000) {
+                    vTaskDelay(pdMS_TO_TICKS((remaining_us - 2000) / 1000));
+                }
+                while (esp_timer_get_time() < t_next) {
+                }
+                if (esp_timer_get_time() - t_next > dt_us) {
+                    late_samples++;
+                }
+                codes[i] = readCaptureRaw(cfg.source);
+                t_next += dt_us;
+            }
+            if (!_spectrum_running) break;
+            
+            for (int i = 0; i < n; i++) {
+                block[i] = captureRawToVoltage(cfg.source, codes[i]);
+            }
+            _spectrum_analyzer.addBlock(block);
+            vTaskDelay(1);  // Let loop() run between blocks
+        }
+        if (!_spectrum_running) break;
         
-        // Store data point
-        if (_impulse_buffer_count < IMPULSE_DATA_POINTS) {
-            _impulse_data_buffer[_impulse_buffer_count].time = elapsed_s;
-            _impulse_data_buffer[_impulse_buffer_count].response = response;
-            _impulse_buffer_count++;
+        // Peak-hold reduction to the published bin count, then the single-tone metrics
+        const int bins = _spectrum_analyzer.getBinCount();
+        for (int d = 0; d < cfg.display_bins; d++) {
+            int k0 = d * bins / cfg.display_bins;
+            int k1 = (d + 1) * bins / cfg.display_bins;
+            float peak = -200.0f;
+            for (int k = k0; k < k1; k++) {
+                peak = max(peak, _spectrum_analyzer.getBinDb(k));
+            }
+            _spectrum_bins_db[d] = peak;
         }
+        _spectrum_metrics = _spectrum_analyzer.analyze(cfg.sample_rate);
+        _spectrum_update_count++;
+        _spectrum_ready = true;
         
-        _impulse_config.current_point++;
+        if (late_samples > 0) {
+            Serial.printf("Spectrum: %d late samples in update %u\n", late_samples, (unsigned)_spectrum_update_count);
+            late_samples = 0;
+        }
         
-        // Check if measurement is complete
-        if (_impulse_config.current_point >= _impulse_config.total_points) {
-            sendBufferedImpulseData(true);
-            stopImpulseMeasurement();
-            return;
+        if (!cfg.continuous) {
+            break;
         }
         
-        // Send partial data every 50 points
-        if (_impulse_buffer_count >= 50) {
-            sendBufferedImpulseData(false);
+        // Next update once loop() has published this one
+        while (_spectrum_running && _spectrum_ready) {
+            vTaskDelay(pdMS_TO_TICKS(5));
         }
     }
+    
+    Serial.printf("Spectrum task stopped after %u updates\n", (unsigned)_spectrum_update_count);
+    _spectrum_capturing = false;
+    _spectrum_task_handle = NULL;
+    vTaskDelete(NULL); // Delete this task
 }
 
-void DriverControl::sendBufferedImpulseData(bool completed) {
-    if (_impulse_buffer_count == 0) return;
+void DriverControl::performSpectrumPublish() {
+    if (!_spectrum_ready) {
+        // Single update finished and published: leave the mode
+        if (!_spectrum_capturing && _spectrum_update_count > 0) {
+            stopSpectrum();
+        }
+        return;
+    }
+    
+    const SpectrumConfig& cfg = _spectrum_config;
+    const int bins = _spectrum_analyzer.getBinCount();
     
     JsonDocument doc;
     
@@ -1792,55 +7249,62 @@ void DriverControl::sendBufferedImpulseData(bool completed) {
     snprintf(timestamp, sizeof(timestamp), "%lu", millis());
     
     doc["timestamp"] = timestamp;
-    doc["message_id"] = "impulse-data-" + String(millis());
+    doc["message_id"] = "spectrum-data-" + String(millis());
     doc["type"] = "data";
     
     JsonObject payload = doc["payload"].to<JsonObject>();
-    payload["mode"] = "impulse";
-    
-    // Create data array with all buffered measurement points
-    JsonArray data_array = payload["data"].to<JsonArray>();
-    for (int i = 0; i < _impulse_buffer_count; i++) {
-        JsonObject data_point = data_array.add<JsonObject>();
-        data_point["time"] = _impulse_data_buffer[i].time;  // Keep full precision for time
-        data_point["response"] = roundTo3Decimals(_impulse_data_buffer[i].response);
+    payload["mode"] = "spectrum";
+    payload["update"] = _spectrum_update_count;
+    payload["channel"] = captureSourceName(cfg.source);
+    payload["window"] = SpectrumAnalyzer::windowName(_spectrum_analyzer.getWindow());
+    payload["fft_size"] = cfg.fft_size;
+    payload["sample_rate"] = cfg.sample_rate;
+    payload["averages"] = _spectrum_analyzer.getAverages();
+    payload["bin_width"] = cfg.sample_rate / cfg.fft_size * ((float)bins / cfg.display_bins);  // Hz per published bin
+    
+    // dBV with one decimal keeps the update to a few hundred bytes
+    JsonArray bins_array = payload["bins_db"].to<JsonArray>();
+    for (int d = 0; d < cfg.display_bins; d++) {
+        bins_array.add(roundf(_spectrum_bins_db[d] * 10.0f) / 10.0f);
     }
     
-    float progress = (float)_impulse_config.current_point / _impulse_config.total_points * 100.0f;
-    payload["progress"] = roundTo3Decimals(progress);
-    payload["completed"] = completed;
+    payload["peak_frequency"] = roundTo3Decimals(_spectrum_metrics.peak_frequency);
+    payload["peak_dbv"] = roundf(_spectrum_metrics.peak_dbv * 100.0f) / 100.0f;
+    payload["snr_db"] = roundf(_spectrum_metrics.snr_db * 100.0f) / 100.0f;
+    payload["thd_db"] = roundf(_spectrum_metrics.thd_db * 100.0f) / 100.0f;
+    payload["thd_percent"] = roundTo3Decimals(_spectrum_metrics.thd_percent);
+    payload["noise_floor_dbv"] = roundf(_spectrum_metrics.noise_floor_dbv * 10.0f) / 10.0f;
+    payload["harmonics"] = _spectrum_metrics.harmonics;
+    payload["completed"] = !cfg.continuous;
     
     _postman.publish("data", doc);
     
-    Serial.printf("Impulse buffered data sent: %d points, Progress=%.1f%%, Completed=%s\n", 
-                  _impulse_buffer_count, progress, completed ? "true" : "false");
-    
-    // Reset buffer
-    _impulse_buffer_count = 0;
+    _spectrum_ready = false;
 }
 
-void DriverControl::stopImpulseMeasurement() {
-    if (_impulse_running) {
-        // Send any remaining buffered data
-        if (_impulse_buffer_count > 0) {
-            sendBufferedImpulseData(true);
-        }
-        
-        _impulse_running = false;
-        _current_mode = "none";
-        _impulse_buffer_count = 0;
-        _impulse_config.start_time = 0;
-        _impulse_config.impulse_applied = false;
+void DriverControl::stopSpectrum() {
+    bool stopped = true;
+    if (_spectrum_task_handle != NULL) {
+        _spectrum_running = false;
         
-        // Reset outputs to safe values
-        _io.setPowerVoltage(0.0);
-        _io.updateAllDACs();
-        
-        Serial.println("Impulse measurement stopped and outputs reset");
+        // The task exits at the next sample and clears its handle
+        stopped = waitForTaskExit(_spectrum_task_handle, "Spectrum");
+    }
+    
+    if (_spectrum_running || _current_mode == DRIVER_MODE_SPECTRUM) {
+        _current_mode = DRIVER_MODE_NONE;
+    }
+    _spectrum_running = false;
+    _spectrum_capturing = false;
+    _spectrum_ready = false;
+    if (stopped) {
+        _spectrum_analyzer.end();
+        free(_spectrum_codes);
+        _spectrum_codes = nullptr;
     }
 }
 
 // Status reporting
 const char* DriverControl::getCurrentMode() const {
-    return _current_mode.c_str();
+    return modeName(_current_mode);
 }
@@ -4,11 +4,17 @@
 #include <ArduinoJson.h>
 #include "postman_mqtt.h"
 #include "pocketlab_io.h"
+#include "spectral.h"
+#include "recipe_vm.h"
+#include "flash_logger.h"
+#include "scan_scheduler.h"
 #include <BasicLinearAlgebra.h>
 #include <StateSpaceControl.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>
 
 using namespace BLA;
 
@@ -16,9 +22,303 @@ using namespace BLA;
 #define CONTROL_SYSTEM_BUFFER_SIZE 20  // Store 20 samples (for ~1 second at 100Hz)
 #define CONTROL_SYSTEM_FREQUENCY_HZ 100  // 100Hz = 10ms period
 #define VA_BUFFER_SIZE 50  // Store up to 50 VA measurement points before sending
+#define VA_ADAPTIVE_MAX_POINTS 128  // Point budget ceiling for adaptive VA sweeps
+#define VA_PULSE_MAX_SAMPLES 16  // Burst ADC conversions per channel inside one pulse
 #define BODE_BUFFER_SIZE 20  // Store up to 20 Bode measurement points before sending
 #define STEP_DATA_POINTS 200  // Fixed 200 data points for step response
 #define IMPULSE_DATA_POINTS 200  // Fixed 200 data points for impulse response
+#define CAPTURE_MAX_POINTS 200  // Ensemble capture length (step and impulse)
+#define CAPTURE_MAX_AVERAGES 256  // Keeps 12-bit code sums well inside uint32
+#define CAPTURE_CHUNK_POINTS 50  // Points per published data message
+#define RAW_FRACTION_BITS 4  // Averaged codes are carried as Q12.4 (fits uint16)
+#define SCOPE_MAX_CHANNELS 2  // Sources sampled per scope tick
+#define SCOPE_MAX_RECORD 16384  // Samples per channel in one scope frame (PSRAM)
+#define SCOPE_MAX_DISPLAY_WIDTH 1024  // Min/max buckets per displayed frame
+#define SCOPE_CHUNK_BUCKETS 100  // Buckets per published data message
+#define SCOPE_FETCH_CHUNK 200  // Full-resolution samples per channel per message
+#define SPECTRUM_MAX_BINS 512  // Published (peak-hold) spectrum bins per update
+#define SPECTRUM_MAX_AVERAGES 64  // Power-averaged FFT blocks per update
+#define BODE_MAX_POINTS 500  // Frequency points per Bode measurement
+#define BODE_BROADBAND_MAX_RATE 10000.0f  // DAC write + two signal ADC reads per tick
+#define BODE_BROADBAND_SAMPLES_PER_PERIOD 4.0f  // At the top frequency; sets the highest 'to' (2.5kHz)
+#define BODE_BROADBAND_MAX_AVERAGES 64  // Measured stimulus periods per broadband run
+#define IMPEDANCE_MAX_RATE 10000.0f  // Same per-tick work as broadband Bode
+#define IMPEDANCE_MAX_SAMPLES_PER_CYCLE 256  // Sine table length at low frequencies
+#define IMPEDANCE_MIN_SAMPLES_PER_CYCLE 4  // Sets the top frequency at the tick budget
+#define IMPEDANCE_QUEUE_LENGTH 16  // Finished points waiting for loop()
+#define IMPEDANCE_CHUNK_POINTS 10  // Points per published data message
+#define IMPEDANCE_BIAS_HEADROOM 0.1f  // V between the sine trough and 0V with the default offset
+#define CURVE_MAX_CURVES 16  // Outer steps per curve family
+#define CURVE_MAX_POINTS 200  // Inner sweep points per curve
+#define CURVE_QUEUE_LENGTH 64  // Measured points waiting for loop()
+#define CURVE_CHUNK_POINTS 50  // Points per published data message
+#define CURVE_MAX_PULSE_PERIOD_US 1000000  // Pulsed points: width_us / duty_cycle
+#define VA_MAX_PULSE_PERIOD_US 1000000  // Pulsed VA bias: width_us / duty_cycle, waited on loop()
+#define TASK_STOP_WARNING_MS 1000  // Log a task that is slow to stop every this often
+#define TASK_STOP_TIMEOUT_MS 3000  // Stop requests give up waiting for the task after this
+#define SEQUENCE_MAX_ROWS 1024  // Setpoint rows in the sequence table (PSRAM)
+#define SEQUENCE_MIN_STEP_US 500  // Row spacing that leaves time to stage the next row and capture
+#define SEQUENCE_CAPTURE_SAMPLES 4  // Burst conversions per signal channel for a row capture
+#define SEQUENCE_QUEUE_LENGTH 64  // Captures waiting for loop()
+#define SEQUENCE_CHUNK_SAMPLES 32  // Captures per published data message
+#define RECIPE_QUEUE_LENGTH 32  // Results waiting for loop(); the recipe waits when full
+#define RECIPE_CHUNK_RESULTS 20  // Results per published data message
+#define RECIPE_NAME_LENGTH 32  // Including the terminator; longer names are cut
+#define LOGGER_CHANNELS 5  // Power voltage, power current, signal A, signal B, temperature
+#define LOGGER_MAX_RATE 1000.0f  // Samples per second (five conversions each)
+#define LOGGER_MAX_DECIMATION 60000  // Samples folded into one mean/min/max record
+#define LOGGER_BUFFER_CHUNKS 4  // Chunk buffers between the sampler and the flash writer
+#define LOGGER_STATUS_INTERVAL_MS 1000  // Progress message period while logging
+#define REGULATION_MIN_RATE 1000.0f  // Power regulation loop rate (Hz)
+#define REGULATION_MAX_RATE 5000.0f
+#define REGULATION_MAX_OVERSAMPLE 16  // ADC1 conversions per feedback reading
+#define PROTECTION_MAX_DEBOUNCE 64  // Consecutive over-threshold conversions (4 ms per channel)
+#define CALIBRATION_MIN_POINTS 3  // Sweep points per calibrated map
+#define CALIBRATION_MAX_POINTS 17
+#define CALIBRATION_MIN_CODE 200  // Sweeps start clear of the feedback ADC's dead zone near 0V
+#define CALIBRATION_AVERAGE 16  // Readings averaged per sweep point, 1 ms apart
+#define CALIBRATION_GAIN_TOLERANCE 0.1f  // Fits further than this from the nominal gain are rejected
+#define IDENTIFY_PARAMETERS 5  // Second-order ARX (a1, a2, b1, b2) plus a bias term
+#define IDENTIFY_MAX_SAMPLES 60000  // Streaming fit: only bounds the run time
+
+// Measurement mode DriverControl is in, reported by getCurrentMode()
+enum DriverMode : uint8_t {
+    DRIVER_MODE_NONE = 0,
+    DRIVER_MODE_VA,
+    DRIVER_MODE_BODE,
+    DRIVER_MODE_STEP,
+    DRIVER_MODE_IMPULSE,
+    DRIVER_MODE_TESTBED,
+    DRIVER_MODE_CONTROL_SYSTEM,
+    DRIVER_MODE_SCOPE,
+    DRIVER_MODE_SPECTRUM,
+    DRIVER_MODE_IMPEDANCE,
+    DRIVER_MODE_CURVE_TRACER,
+    DRIVER_MODE_SEQUENCE,
+    DRIVER_MODE_RECIPE,
+    DRIVER_MODE_LOGGER,
+    DRIVER_MODE_CALIBRATION,
+    DRIVER_MODES
+};
+
+// Output channels as commands name them: CH0/CH1 the signal outputs A/B, CH2 the power output
+enum DriverChannel : uint8_t {
+    CHANNEL_CH0 = 0,
+    CHANNEL_CH1,
+    CHANNEL_CH2,
+    CHANNEL_COUNT
+};
+
+// Drive and read-back of one output channel. Commands resolve their channel to one of these
+// once, so measurement loops call the output directly instead of comparing channel names.
+struct ChannelDriver {
+    void (*stage)(PocKETlabIO& io, float voltage);   // DAC input register only; the output follows on LDAC
+    float (*read)(PocKETlabIO& io);                  // Voltage measured at the output
+};
+
+// VA sweep regulation target
+enum VAModeType : uint8_t {
+    VA_MODE_CV,    // Constant device voltage (V_A - V_B)
+    VA_MODE_CC     // Constant current
+};
+
+// Impedance analyzer configuration (signal DAC A drives DUT + shunt, ADC A/B read both ends)
+struct ImpedanceConfig {
+    float shunt_resistance;    // Ohms, between V_B and ground
+    float amplitude;           // Peak drive amplitude in volts
+    float offset;              // DC bias the sine rides on
+    float freq_from;           // Hz; equal to freq_to for a single frequency
+    float freq_to;
+    int points_per_decade;
+    int total_points;
+    float integration_time;    // Minimum integration per point in seconds
+    int min_cycles;            // Never integrate fewer whole cycles than this
+    int settle_cycles;         // Played and discarded before integrating
+    bool parallel;             // Report the parallel instead of the series equivalent
+    bool continuous;           // Repeat until stopped
+    int late_samples;
+    int published_points;
+};
+
+// One measured frequency, handed from the impedance task to loop()
+struct ImpedancePoint {
+    float frequency;           // Actual drive frequency from the integer tick period
+    float z_re, z_im;          // Ohms
+    float v_dut;               // Amplitude across the DUT (V peak)
+    float current;             // Amplitude through the shunt (A peak)
+    int cycles;                // Whole cycles integrated
+    bool overload;             // An ADC code hit a rail
+    bool low_current;          // Shunt signal within a few codes of the noise floor
+    bool last;                 // Final point of a single (non-continuous) run
+};
+
+// Outputs the curve tracer can step or sweep
+enum CurveOutput {
+    CURVE_OUTPUT_SIGNAL_A,  // CH0: DUT + shunt topology, V_A - V_B and V_B / R_shunt
+    CURVE_OUTPUT_SIGNAL_B,  // CH1
+    CURVE_OUTPUT_POWER      // CH2: FB_VOUT / FB_IOUT
+};
+
+// Nested sweep: the outer output steps, the inner output sweeps one curve per step
+struct CurveTracerConfig {
+    CurveOutput inner_output;
+    CurveOutput outer_output;
+    float inner_start, inner_stop;
+    int inner_points;
+    float outer_start, outer_stop;
+    int outer_steps;
+    float shunt_resistance;        // Inner CH0: current = V_B / R_shunt
+    float series_resistance;       // Outer signal drive: current = (setpoint - sensed) / R, 0 = not measured
+    float current_limit;           // Power output compliance when CH2 is used
+    bool pulsed;                   // Inner points as hardware-timed pulses (inner CH0 only)
+    int pulse_width_us;
+    int pulse_sample_delay_us;
+    int pulse_samples;
+    float pulse_duty_cycle;
+    float pulse_idle_voltage;
+    float settle_voltage_tolerance; // Consecutive readings agree within abs + relative * value
+    float settle_current_tolerance;
+    float settle_relative;
+    uint32_t settle_interval_us;
+    uint32_t settle_timeout_us;
+    int unsettled_points;
+    int late_pulses;
+    int published_points;
+};
+
+// One inner sweep point, handed from the curve tracer task to loop()
+struct CurvePoint {
+    uint8_t curve;
+    bool curve_end;            // Last point of its curve
+    bool last;                 // Last point of the family
+    bool settled;              // False if the settle detector timed out
+    float outer_setpoint;
+    float outer_voltage;       // NAN when the outer output is not measured
+    float outer_current;
+    float setpoint;
+    float voltage;
+    float current;
+};
+
+// One sequence row, prebuilt at upload so executing it is a few register writes.
+// Codes index: signal A, signal B, power voltage, power current limit.
+struct SequenceRow {
+    uint32_t t_us;             // Offset from the start of the pass
+    uint16_t codes[4];         // DAC codes for the outputs set by this row
+    uint8_t dac_mask;          // Bit n set: codes[n] differs from the previous row and is written
+    bool capture;              // Read the ADCs right after this row latches
+    uint32_t gpio_set[2];      // DA/DB lines to raise and lower on the LDAC edge (GPIO0-31, GPIO32+)
+    uint32_t gpio_clear[2];
+};
+
+// Software power regulation (testbed): the power DAC is trimmed from FB_VOUT (CV) and
+// pulled back from FB_IOUT when the current limit is reached (CC)
+struct RegulationConfig {
+    float target_voltage;      // V
+    float current_limit;       // A
+    float rate;                // Loop rate (Hz)
+    float kp;                  // CV proportional gain (V/V)
+    float ki;                  // CV integral gain (1/s)
+    float ki_current;          // CC integral gain (V per A*s)
+    float slew;                // Command rise limit (V/s)
+    float max_trim;            // CV trim bound around the target (V)
+    float filter_hz;           // Feedback low-pass corner
+    int oversample;            // One-shot ADC conversions per reading (without the feedback scan)
+};
+
+// Data logger run. Records are raw codes per channel (temperature in 0.01 degC):
+// one sample each, or with decimation the mean, min and max of that many samples.
+struct LoggerConfig {
+    float rate;                // Samples per second
+    uint32_t sample_period_us;
+    int decimation;            // Samples per record
+    float duration;            // Seconds, 0 = until stopped
+    bool wrap;                 // Overwrite the oldest chunks instead of stopping when flash is full
+    uint8_t record_size;       // Bytes per record
+    int records_per_chunk;
+};
+
+// Board calibration run: the signal DACs and the power voltage DAC are swept and measured on the
+// feedback scan (FB_AO, FB_A1, FB_VOUT); the signal inputs against signal outputs looped back to them
+struct CalibrationConfig {
+    bool maps[CAL_MAPS];       // Conversions to calibrate
+    int points;                // Sweep points
+    uint32_t settle_ms;        // Wait after each step before averaging
+    float power_max_voltage;   // Top of the power sweep (V)
+    float current_limit;       // Power current limit during the sweep (A)
+    bool piecewise;            // Fit the piecewise-linear correction as well
+    bool save;                 // Store the result in NVS
+};
+
+// Outcome of a calibration run per map
+enum CalibrationRunStatus {
+    CAL_RUN_UNCHANGED = 0,     // Not part of the run
+    CAL_RUN_CALIBRATED,        // New fit applied
+    CAL_RUN_REJECTED           // Fit failed or out of tolerance, previous entry kept
+};
+
+// A filled chunk buffer handed from the logger sampler to the flash writer
+struct LoggerBlock {
+    uint8_t buffer;
+    uint16_t record_count;
+    uint32_t first_record;
+};
+
+// How stream modes publish samples: converted to volts/amps on the device, or as the raw
+// (or Q12.4 averaged) codes with a scale and offset per channel for the client to apply
+enum DataEncoding {
+    DATA_ENCODING_VOLTS,
+    DATA_ENCODING_RAW
+};
+
+// Readings taken after a row latched, handed from the sequence task to loop()
+struct SequenceSample {
+    uint16_t row;
+    uint32_t pass;
+    int64_t t_us;              // Actual latch time from the start of the run
+    int32_t jitter_us;         // Actual minus scheduled latch time
+    uint16_t raw_a, raw_b;     // Averaged signal ADC codes, Q12.4
+    uint16_t power_voltage_raw, power_current_raw;
+};
+
+struct SequenceConfig {
+    int rows;
+    uint32_t period_us;        // Pass length when repeating
+    int repeat;                // Passes, 0 = until stopped
+    uint16_t codes[4];         // Codes after the last loaded row, for change detection on append
+    uint8_t known_mask;        // Outputs some loaded row has set
+    uint8_t digital_mask;      // DA0-3 (bits 0-3) and DB0-3 (bits 4-7) driven by the table
+    int captures;              // Rows with capture in one pass
+    int late_rows;             // Rows staged after their due time
+    int dropped_samples;       // Captures lost to a full queue
+    int32_t max_jitter_us;
+    int published_samples;
+    DataEncoding encoding;
+};
+
+enum IdentifyExcitation {
+    IDENTIFY_EXCITATION_PRBS,  // Maximal-length LFSR sequence, +/- amplitude
+    IDENTIFY_EXCITATION_CHIRP  // Logarithmic sine sweep over the whole record
+};
+
+// System identification run (control_system, cs_mode "identify")
+struct IdentifyConfig {
+    IdentifyExcitation excitation;
+    SignalChannel excitation_channel;  // Signal DAC driving the plant
+    SignalChannel response_channel;    // Signal ADC reading the plant output
+    float offset;                      // Operating point the excitation is centred on
+    float amplitude;
+    uint32_t sample_period_us;
+    int samples;                       // Fitted samples after settling
+    int settle_samples;                // Held at offset before recording
+    int prbs_order;                    // LFSR length, period 2^order - 1
+    int prbs_hold;                     // Samples per PRBS bit
+    float chirp_from, chirp_to;        // Hz
+    float forgetting;                  // RLS forgetting factor (1 = none)
+    bool apply;                        // Load the model into system mode when done
+    volatile int completed_samples;
+    int late_samples;
+};
 
 struct ControlSystemData {
     unsigned long timestamp;
@@ -36,8 +336,10 @@ struct VAMeasurementData {
 
 // VA measurement configuration
 struct VAMeasurementConfig {
-    String channel;           // CH0, CH1, CH2
-    String mode_type;        // CV (Constant Voltage) or CC (Constant Current)
+    DriverChannel channel;    // CH0, CH1, CH2
+    VAModeType mode_type;     // CV (Constant Voltage) or CC (Constant Current)
+    const ChannelDriver* drive; // Output the sweep drives: signal A for CH0/CH1 (DUT + shunt), power for CH2
+    bool power_sense;         // CH2: current from FB_IOUT, otherwise V_B / shunt
     float start_voltage;      // Target start device voltage (V_A - V_B)
     float end_voltage;        // Target end device voltage (V_A - V_B)
     float step_voltage;       // Device voltage step size
@@ -52,6 +354,28 @@ struct VAMeasurementConfig {
     float max_output_voltage; // Maximum output voltage for the channel
     float target_device_voltage; // Current target device voltage
     bool capped;              // True if measurement ended due to output voltage limit
+    float cv_slope;           // Local dV_device/dV_out estimate used to warm-start the CV solver
+    float last_device_voltage; // Device voltage reached at the previous CV point
+    bool cv_has_history;      // True once a previous CV point can seed the solver
+    int solver_iterations;    // DAC updates spent on the last CV point
+    bool adaptive;            // Adaptive sampling: refine where the curve bends instead of a uniform grid
+    int initial_points;       // Adaptive: size of the coarse uniform grid measured first
+    bool pulsed;              // Pulsed I-V: bias only applied for pulse_width_us per DAC update
+    int pulse_width_us;       // Pulse width (hardware-timed LDAC edges)
+    int pulse_sample_delay_us; // Delay from the leading edge to the burst ADC read
+    int pulse_samples;        // Burst conversions per channel averaged inside the pulse
+    float pulse_duty_cycle;   // Pulse width / period, sets the idle time between pulses
+    float pulse_idle_voltage; // Output level between pulses
+    int pulse_late_count;     // Pulses where sampling could not start at the requested delay
+    int pulse_timeout_count;  // Pulses whose timed trailing edge was not confirmed
+};
+
+// Adaptive VA sweep point, kept sorted by target device voltage
+struct VAAdaptivePoint {
+    float target;             // Target device voltage
+    float voltage;            // Measured device voltage
+    float current;            // Measured current
+    float output_voltage;     // Drive voltage that produced it (warm start for neighbours)
 };
 
 // Bode measurement data point
@@ -59,58 +383,139 @@ struct BodeMeasurementData {
     float frequency;
     float gain;       // in dB
     float phase;      // in degrees
+    float coherence;  // 0..1 for broadband methods, negative when not measured
+};
+
+enum BodeMethod {
+    BODE_METHOD_STEPPED,      // One frequency at a time (default)
+    BODE_METHOD_MULTISINE,    // Schroeder-phased multisine on the selected bins
+    BODE_METHOD_CHIRP         // Periodic logarithmic chirp
 };
 
 // Bode measurement configuration
 struct BodeMeasurementConfig {
-    String channel;           // CH0, CH1, CH2
+    DriverChannel channel;    // CH0, CH1, CH2
+    const ChannelDriver* driver;
     float freq_from;          // Start frequency in Hz
     float freq_to;            // End frequency in Hz
     int points_per_decade;    // Number of measurement points per decade
     float output_voltage;     // Output signal amplitude
     int total_points;         // Total number of frequency points
     int current_point;        // Current measurement index
+    
+    // Broadband methods
+    BodeMethod method;
+    float offset;             // DC level the stimulus rides on
+    int averages;             // Measured periods (one more is played to settle)
+    int fft_size;             // Samples per stimulus period
+    uint32_t sample_period_us;
+    float sample_rate;        // Actual rate from the integer period
+    float crest_factor;       // Peak / rms of the stimulus
+    float skew_us;            // Y sampled this much after X (sign included)
+    int late_samples;
+    int overruns;             // Periods the analysis task could not take
 };
 
-// Step response measurement data point
-struct StepMeasurementData {
-    float time;
-    float response;
+// Excited FFT bin of a broadband Bode run and its cross-spectral sums
+struct BodeBroadbandPoint {
+    int bin;
+    float gxx;                // Sum of |X|^2
+    float gyy;                // Sum of |Y|^2
+    float gxy_re, gxy_im;     // Sum of conj(X) * Y
 };
 
 // Step response configuration
 struct StepMeasurementConfig {
-    String channel;           // CH0, CH1, CH2
+    DriverChannel channel;    // CH0, CH1, CH2
     float voltage;            // Step voltage
-    float measurement_time;   // Total measurement time in seconds
+    float measurement_time;   // Post-trigger time span in seconds
     int total_points;         // Fixed at 200
-    int current_point;        // Current measurement index
-    unsigned long start_time; // Measurement start timestamp
     float time_step;          // Time between measurements
 };
 
-// Impulse response measurement data point
-struct ImpulseMeasurementData {
-    float time;
-    float response;
-};
-
 // Impulse response configuration
 struct ImpulseMeasurementConfig {
     float voltage;            // Impulse voltage
     int duration_us;          // Impulse duration in microseconds
-    float measurement_time;   // Total measurement time in seconds
+    float measurement_time;   // Post-trigger time span in seconds
     int total_points;         // Fixed at 200
-    int current_point;        // Current measurement index
-    unsigned long start_time; // Measurement start timestamp
     float time_step;          // Time between measurements
-    bool impulse_applied;     // Whether impulse has been applied
+};
+
+// Signals the capture engine can record
+enum CaptureSource {
+    CAPTURE_SOURCE_SIGNAL_A,
+    CAPTURE_SOURCE_SIGNAL_B,
+    CAPTURE_SOURCE_POWER,         // Power output voltage (FB_VOUT)
+    CAPTURE_SOURCE_POWER_CURRENT  // Power output current (FB_IOUT)
+};
+
+// Ensemble-averaged capture shared by step and impulse responses.
+// Each repetition records pre_points of baseline before a hardware-timed stimulus edge
+// and the rest after it; raw codes are summed so the average is coherent to the LSB.
+struct CaptureConfig {
+    const char* mode;         // "step" or "impulse" for published data
+    CaptureSource source;     // Response signal
+    CaptureSource stimulus;   // Output the stimulus is applied to
+    float level;              // Stimulus level
+    uint32_t pulse_us;        // 0 = step, otherwise impulse width
+    int pre_points;           // Samples before the stimulus edge
+    int total_points;         // Pre + post samples
+    uint32_t time_step_us;    // Sample period
+    uint32_t rest_us;         // Baseline time before each trigger
+    int averages;             // Repetitions to accumulate
+    volatile int completed_averages;
+    volatile int late_samples; // Samples taken more than one period late
+    volatile int block_overruns; // Final-pass blocks skipped because both buffers were still queued
+    int publish_index;        // Next point loop() publishes
+    DataEncoding encoding;
+};
+
+// Scope trigger and arming
+enum ScopeTriggerType { SCOPE_TRIGGER_RISING, SCOPE_TRIGGER_FALLING, SCOPE_TRIGGER_LEVEL };
+enum ScopeArmMode { SCOPE_ARM_SINGLE, SCOPE_ARM_NORMAL, SCOPE_ARM_AUTO };
+
+// Oscilloscope configuration
+struct ScopeConfig {
+    int channel_count;
+    CaptureSource sources[SCOPE_MAX_CHANNELS];   // Channel names come from captureSourceName()
+    int record_length;         // Samples per channel
+    uint32_t sample_period_us;
+    int pre_points;            // Samples before the trigger point
+    int trigger_channel;       // Index into sources
+    ScopeTriggerType trigger_type;
+    uint16_t trigger_code;     // Trigger level in raw ADC codes
+    uint16_t hysteresis_code;  // Edge re-arm distance in codes
+    ScopeArmMode arm;
+    uint32_t auto_timeout_us;  // Auto mode: force a frame after this long without a trigger
+    int display_width;         // Buckets per displayed frame
+    DataEncoding encoding;
+};
+
+// Spectrum analyzer configuration
+struct SpectrumConfig {
+    CaptureSource source;
+    int fft_size;              // Samples per block (power of two)
+    uint32_t sample_period_us;
+    float sample_rate;         // Actual rate from the integer period
+    int averages;              // Blocks power-averaged per update
+    int display_bins;          // Peak-hold bins published per update
+    bool continuous;           // Keep updating until stopped
+};
+
+// Ping-pong block handed from the capture task to loop() during the final repetition
+struct CaptureBlock {
+    int first_index;                          // Record index of the first point
+    int count;                                // Points filled
+    int averages;                             // Repetitions contained in the sums
+    uint32_t sum[CAPTURE_CHUNK_POINTS];       // Accumulated raw codes
+    int32_t time_us[CAPTURE_CHUNK_POINTS];    // Sample timestamp relative to the stimulus edge
 };
 
 // Basic structure for Driver Control library
 class DriverControl {
 public:
-    DriverControl(PostmanMQTT& postman, PocKETlabIO& io);
+    DriverControl(PostmanMQTT& postman, PocKETlabIO& io, ScanScheduler& scan);
     ~DriverControl();
 
     void handleCommand(const JsonDocument& doc);
@@ -119,10 +524,15 @@ public:
     
     // Status reporting
     const char* getCurrentMode() const;
+    
+    // Data logger HTTP downloads (routes registered with NetMan)
+    void handleLoggerData(WebServer& server);
+    void handleLoggerIndex(WebServer& server);
 
 private:
     PostmanMQTT& _postman;
     PocKETlabIO& _io;
+    ScanScheduler& _scan;
     bool _testbed_running;
     unsigned long _testbed_last_update;
     int _testbed_update_interval;
@@ -142,6 +552,20 @@ private:
     volatile int _buffer_count;
     unsigned long _last_data_send;
     
+    // System identification: recursive least squares on a streaming ARX regression
+    IdentifyConfig _identify_config;
+    Matrix<IDENTIFY_PARAMETERS, 1> _identify_theta;                    // [-a1, -a2, b1, b2, bias]
+    Matrix<IDENTIFY_PARAMETERS, IDENTIFY_PARAMETERS> _identify_P;      // Inverse information matrix
+    float _identify_y_ref;                 // First response sample, subtracted from all others
+    float _identify_y_min, _identify_y_max;
+    double _identify_error_sq;             // One-step prediction errors after warm-up
+    double _identify_y_sum, _identify_y_sq;
+    int _identify_error_count;
+    unsigned long _identify_last_progress;
+    TaskHandle_t _identify_task_handle;
+    volatile bool _identify_running;
+    volatile bool _identify_done;
+    
     // State-space simulation using StateSpaceControl library
     Model<2, 1, 2>* _system_model;  // 2 states, 1 input, 2 outputs
     Simulation<2, 1, 2>* _simulation;
@@ -163,34 +587,181 @@ private:
     int _va_buffer_count;
     unsigned long _va_last_data_send;
     
+    // Adaptive VA sampling state
+    VAAdaptivePoint _va_adaptive_points[VA_ADAPTIVE_MAX_POINTS];
+    int _va_adaptive_count;
+    int _va_adaptive_grid_index;   // Next coarse grid point, == initial_points once refining
+    float _va_adaptive_limit;      // Highest reachable target (lowered when the output caps)
+    
     // Bode characteristics measurement
-    bool _bode_running;
+    volatile bool _bode_running;
     BodeMeasurementConfig _bode_config;
     BodeMeasurementData _bode_data_buffer[BODE_BUFFER_SIZE];
     int _bode_buffer_count;
     unsigned long _bode_last_measurement;
     int _bode_measurement_delay_ms;
     
+    // Broadband Bode: the stimulus task plays and records whole periods on core 1,
+    // the analysis task transforms them on core 0 while the next period plays
+    SpectrumAnalyzer _bode_analyzer;
+    uint16_t* _bode_codes;               // One stimulus period of DAC codes (PSRAM)
+    uint16_t* _bode_raw[2];              // Two period slots, X then Y codes (PSRAM)
+    float* _bode_block;                  // One channel of a period in volts
+    float* _bode_spectrum_x;             // N/2+1 complex bins each
+    float* _bode_spectrum_y;
+    BodeBroadbandPoint* _bode_points;
+    BodeMeasurementData* _bode_results;  // Finished points, published from loop()
+    QueueHandle_t _bode_free_queue;      // Period slots the stimulus task may fill
+    QueueHandle_t _bode_ready_queue;     // Recorded periods waiting for analysis
+    TaskHandle_t _bode_task_handle;
+    TaskHandle_t _bode_analysis_handle;
+    volatile int _bode_analyzed;         // Periods accumulated so far
+    volatile bool _bode_results_ready;
+    
     // Step response measurement
     bool _step_running;
     StepMeasurementConfig _step_config;
-    StepMeasurementData _step_data_buffer[STEP_DATA_POINTS];
-    int _step_buffer_count;
-    unsigned long _step_last_measurement;
     
     // Impulse response measurement
     bool _impulse_running;
     ImpulseMeasurementConfig _impulse_config;
-    ImpulseMeasurementData _impulse_data_buffer[IMPULSE_DATA_POINTS];
-    int _impulse_buffer_count;
-    unsigned long _impulse_last_measurement;
+    
+    // Ensemble capture engine (step/impulse), runs in its own task
+    CaptureConfig _capture_config;
+    uint32_t _capture_sum[CAPTURE_MAX_POINTS];      // Sum of raw codes per point
+    uint64_t _capture_sum_sq[CAPTURE_MAX_POINTS];   // Sum of squared codes for the noise estimate
+    uint16_t _capture_shot[CAPTURE_MAX_POINTS];     // Current repetition, oldest pre-trigger sample first
+    uint16_t _capture_ring[CAPTURE_MAX_POINTS];     // Pre-trigger ring
+    int64_t _capture_ring_time[CAPTURE_MAX_POINTS]; // esp_timer time of each ring sample
+    int32_t _capture_time_us[CAPTURE_MAX_POINTS];   // Last repetition's timestamps, relative to the edge
+    CaptureBlock _capture_blocks[2];
+    QueueHandle_t _capture_free_queue;              // Block indices the sampler may fill
+    QueueHandle_t _capture_ready_queue;             // Filled blocks waiting for loop()
+    int _capture_stream_block;                      // Block being filled, -1 if none
+    TaskHandle_t _capture_task_handle;
+    volatile bool _capture_running;
+    volatile bool _capture_done;
+    
+    // Oscilloscope: capture ring and held frame in PSRAM, swapped when a frame completes
+    bool _scope_running;
+    ScopeConfig _scope_config;
+    uint16_t* _scope_buffers[2];      // Interleaved samples, record_length * channel_count each
+    int _scope_capture_buffer;        // Buffer the task is writing
+    uint16_t* _scope_min;             // Decimated frame, display_width * channel_count
+    uint16_t* _scope_max;
+    int _scope_buckets;               // Buckets in the decimated frame
+    int _scope_frame_start;           // Ring index of the held frame's oldest sample
+    bool _scope_frame_held;           // A complete frame is available for fetch
+    bool _scope_frame_triggered;      // False if auto mode forced the frame
+    uint32_t _scope_frame_count;
+    volatile bool _scope_frame_ready; // Decimated frame waiting for loop()
+    volatile bool _scope_capturing;   // Scope task active
+    TaskHandle_t _scope_task_handle;
+    
+    // Spectrum analyzer: capture and FFT run in a task on core 1, loop() publishes results
+    bool _spectrum_running;
+    SpectrumConfig _spectrum_config;
+    SpectrumAnalyzer _spectrum_analyzer;
+    uint16_t* _spectrum_codes;                   // One block of raw codes; volts go to the analyzer's input buffer
+    float _spectrum_bins_db[SPECTRUM_MAX_BINS];  // Result of the last update
+    SpectralMetrics _spectrum_metrics;
+    uint32_t _spectrum_update_count;
+    volatile bool _spectrum_ready;               // Result waiting for loop()
+    volatile bool _spectrum_capturing;           // Spectrum task active
+    TaskHandle_t _spectrum_task_handle;
+    
+    // Impedance analyzer: I/Q demodulation in a task on core 1, points queued to loop()
+    volatile bool _impedance_running;
+    ImpedanceConfig _impedance_config;
+    uint16_t _impedance_codes[IMPEDANCE_MAX_SAMPLES_PER_CYCLE];   // One drive cycle of DAC codes
+    float _impedance_cos[IMPEDANCE_MAX_SAMPLES_PER_CYCLE];        // Reference phasor per tick
+    float _impedance_sin[IMPEDANCE_MAX_SAMPLES_PER_CYCLE];
+    uint16_t _impedance_raw_a[IMPEDANCE_MAX_SAMPLES_PER_CYCLE];   // One cycle of ADC codes
+    uint16_t _impedance_raw_b[IMPEDANCE_MAX_SAMPLES_PER_CYCLE];
+    QueueHandle_t _impedance_queue;
+    volatile bool _impedance_measuring;  // Impedance task active
+    TaskHandle_t _impedance_task_handle;
+    
+    // Curve tracer: nested sweep in a task on core 1, points queued to loop()
+    volatile bool _curve_running;
+    CurveTracerConfig _curve_config;
+    QueueHandle_t _curve_queue;
+    volatile bool _curve_measuring;  // Curve tracer task active
+    TaskHandle_t _curve_task_handle;
+    
+    // Sequence: prebuilt setpoint rows executed by the hardware latch timer
+    volatile bool _sequence_running;
+    SequenceConfig _sequence_config;
+    SequenceRow* _sequence_rows;  // SEQUENCE_MAX_ROWS rows, allocated on first upload
+    QueueHandle_t _sequence_queue;
+    volatile bool _sequence_executing;  // Sequence task active
+    TaskHandle_t _sequence_task_handle;
+    
+    // Recipe: bytecode test program run by the recipe VM in a task on core 1
+    RecipeVM _recipe_vm;
+    volatile bool _recipe_running;
+    volatile bool _recipe_executing;  // Recipe task active
+    TaskHandle_t _recipe_task_handle;
+    QueueHandle_t _recipe_queue;
+    char _recipe_name[RECIPE_NAME_LENGTH];
+    uint32_t _recipe_timeout_ms;
+    RecipeStatus _recipe_status;
+    uint32_t _recipe_duration_ms;
+    
+    // Power regulation: closed loop on FB_VOUT/FB_IOUT in a task on core 1 (testbed)
+    volatile bool _regulation_running;
+    RegulationConfig _regulation_config;
+    esp_timer_handle_t _regulation_timer;  // Loop clock, notifies the regulation task
+    TaskHandle_t _regulation_task_handle;
+    volatile float _regulation_voltage;    // Filtered feedback
+    volatile float _regulation_current;
+    volatile float _regulation_command;    // Output voltage the power DAC is set for
+    volatile float _regulation_trim;
+    volatile bool _regulation_cc;          // Current limit in control
+    bool _regulation_reported_cc;          // CV/CC state last announced by loop()
+    volatile uint32_t _regulation_overruns;
+    
+    // Power protection runs in PocKETlabIO; loop() reports each new trip once
+    uint32_t _protection_reported_trips;
+    
+    // Data logger: sampler task on core 1, flash writer task on core 0, loop() reports progress
+    volatile bool _logger_running;
+    volatile bool _logger_sampling;   // Sampler task active
+    volatile bool _logger_writing;    // Writer task active
+    volatile bool _logger_flash_error;
+    LoggerConfig _logger_config;
+    FlashLogger _flash_logger;
+    uint8_t* _logger_buffers[LOGGER_BUFFER_CHUNKS];
+    QueueHandle_t _logger_free_queue;
+    QueueHandle_t _logger_ready_queue;
+    esp_timer_handle_t _logger_timer;  // Sample clock, notifies the sampler task
+    TaskHandle_t _logger_sample_task_handle;
+    TaskHandle_t _logger_write_task_handle;
+    volatile uint32_t _logger_samples;
+    volatile uint32_t _logger_missed_samples;   // Sample ticks the sampler could not serve
+    volatile uint32_t _logger_dropped_records;  // Records lost because no chunk buffer was free
+    int16_t _logger_latest[LOGGER_CHANNELS];    // Last record (means)
+    unsigned long _logger_start_ms;
+    unsigned long _logger_last_status_ms;
+    
+    // Board calibration: sweep task on core 1, loop() applies, saves and publishes the result
+    volatile bool _calibration_running;
+    volatile bool _calibration_done;    // Task finished, result waiting for loop()
+    CalibrationConfig _calibration_config;
+    BoardCalibration _calibration_result;
+    uint8_t _calibration_status[CAL_MAPS];  // CalibrationRunStatus per map
+    const char* _calibration_error;     // Why the run ended early (nullptr = completed)
+    unsigned long _calibration_start_ms;
+    TaskHandle_t _calibration_task_handle;
     
     // Current mode tracking
-    String _current_mode;
+    DriverMode _current_mode;
 
     // Testbed per-pin last-set values (volts). NAN indicates 'not set' (use measured or default).
     float _testbed_da_value_v[4];
     float _testbed_db_value_v[4];
+    // Scan scheduler subscriptions of the testbed readings (-1 = none), indexed by ScanSource
+    int _testbed_scan[SCAN_SOURCES];
 
     void handleVA(JsonObjectConst settings);
     void handleBode(JsonObjectConst settings);
@@ -198,29 +769,74 @@ private:
     void handleImpulse(JsonObjectConst settings);
     void handleTestbed(JsonObjectConst settings);
     void handleControlSystem(JsonObjectConst settings);
+    void handleScope(JsonObjectConst settings);
+    void handleScopeFetch(JsonObjectConst settings);
+    void handleSpectrum(JsonObjectConst settings);
+    void handleImpedance(JsonObjectConst settings);
+    void handleCurveTracer(JsonObjectConst settings);
+    void handleSequence(JsonObjectConst settings);
+    void handleRecipe(JsonObjectConst settings);
+    void handleLogger(JsonObjectConst settings);
+    void handleProtection(JsonObjectConst settings);
+    void handleProtectionReset();
+    void handleCalibration(JsonObjectConst settings);
+    void handleCalibrationReset();
     void handleStopCommand(const char* mode);
     
     // Control system helpers
     void handleControllerMode(JsonObjectConst settings);
     void handleSystemMode(JsonObjectConst settings);
+    void handleIdentifyMode(JsonObjectConst settings);
     void updateControlSystem();
     float voltageToSystemValue(float voltage);
     float systemValueToVoltage(float value);
     float roundTo3Decimals(float value);  // Helper to round to 3 decimal places
     float roundTo6Decimals(float value);  // Helper to round to 6 decimal places for small currents
     
+    // Raw stream encoding: averaged codes in Q12.4 and the per-channel scale metadata
+    static uint16_t averageCode(uint32_t sum, uint32_t count) {
+        return (uint16_t)(((sum << RAW_FRACTION_BITS) + count / 2) / count);
+    }
+    bool parseEncoding(JsonObjectConst settings, const char* mode, DataEncoding& encoding);
+    void addRawScale(JsonObject scales, const char* name, CaptureSource source, uint8_t fraction_bits);
+    
+    // Wait for a task whose running flag was cleared to exit on its own. False after
+    // TASK_STOP_TIMEOUT_MS: the task is still running and its buffers must be left alone.
+    bool waitForTaskExit(TaskHandle_t& handle, const char* name);
+    
+    // Channel and mode names, resolved to the enums once per command
+    static bool parseChannel(const char* name, DriverChannel& channel);
+    static const char* channelName(DriverChannel channel);
+    static const ChannelDriver* channelDriver(DriverChannel channel);
+    static const char* modeName(DriverMode mode);
+    
     // FreeRTOS task functions
     static void controlSystemTaskWrapper(void* parameter);
     void controlSystemTask();
     void startControlSystemTask();
     void stopControlSystemTask();
     
+    // System identification helpers
+    static void identifyTaskWrapper(void* parameter);
+    void identifyTask();
+    float identifyExcitation(int sample, uint32_t& lfsr);
+    void updateIdentification(const Matrix<IDENTIFY_PARAMETERS, 1>& phi, float y);
+    void performIdentifyPublish();
+    void publishIdentifiedModel();
+    void stopIdentification();
+    
     // VA characteristics helpers
     void performVAMeasurement();
     void sendVADataPoint(float voltage, float current, float progress, bool completed);
     void sendBufferedVAData(bool completed);
     void stopVAMeasurement();
-    bool isValidVAChannel(const String& channel, const String& mode_type);
+    void stageVAOutputVoltage(float output_voltage);
+    void applyVAOutputVoltage(float output_voltage);
+    bool fireVAPulse(float output_voltage, int samples, float& device_voltage, float& current);
+    float evaluateVAOutputVoltage(float output_voltage);
+    bool solveCVOutputVoltage(float target_device_voltage, float& device_voltage);
+    bool selectAdaptiveVATarget(float& target, int& interval_index);
+    void insertAdaptiveVAPoint(float target, float voltage, float current);
     
     // Bode characteristics helpers
     void performBodeMeasurement();
@@ -228,16 +844,124 @@ private:
     void stopBodeMeasurement();
     float calculateBodeFrequency(int point_index);
     int calculateTotalBodePoints();
+    bool startBroadbandBode();
+    int selectBroadbandBodeBins();
+    void buildBodeStimulus();
+    static void bodeTaskWrapper(void* parameter);
+    void bodeTask();
+    static void bodeAnalysisTaskWrapper(void* parameter);
+    void bodeAnalysisTask();
+    void finishBroadbandBode();
+    void performBroadbandBodePublish();
+    void freeBodeBuffers();
+    int playAndCapture(uint8_t dac_channel, const uint16_t* codes, int count, uint32_t period_us,
+                       int64_t& t_next, uint16_t* raw_a, uint16_t* raw_b, int64_t& burst_us,
+                       volatile bool& running);
     
     // Step response helpers
-    void performStepMeasurement();
-    void sendBufferedStepData(bool completed);
     void stopStepMeasurement();
     
     // Impulse response helpers
-    void performImpulseMeasurement();
-    void sendBufferedImpulseData(bool completed);
     void stopImpulseMeasurement();
+    
+    // Ensemble capture helpers
+    bool parseCaptureSettings(JsonObjectConst settings, const char* mode, float measurement_time, CaptureSource source);
+    bool startCaptureTask();
+    void stopCaptureTask();
+    static void captureTaskWrapper(void* parameter);
+    void captureTask();
+    uint16_t readCaptureRaw(CaptureSource source);
+    float captureRawToVoltage(CaptureSource source, float raw) const;
+    void stageCaptureOutput(float level);
+    bool waitCaptureSample(int64_t due_us);
+    void streamCaptureSample(int index);
+    void performCapturePublish();
+    void publishCaptureRange(int end);
+    void sendCaptureData(const CaptureBlock& block, bool completed);
+    
+    // Oscilloscope helpers
+    bool parseScopeSource(const char* name, CaptureSource& source);
+    static const char* captureSourceName(CaptureSource source);   // CH0, CH1, VOUT, IOUT
+    static void scopeTaskWrapper(void* parameter);
+    void scopeTask();
+    void decimateScopeFrame();
+    void performScopePublish();
+    void stopScope();
+    void freeScopeBuffers();
+    
+    // Spectrum analyzer helpers
+    static void spectrumTaskWrapper(void* parameter);
+    void spectrumTask();
+    void performSpectrumPublish();
+    void stopSpectrum();
+    
+    // Impedance analyzer helpers
+    static void impedanceTaskWrapper(void* parameter);
+    void impedanceTask();
+    bool measureImpedancePoint(float frequency, ImpedancePoint& point);
+    void performImpedancePublish();
+    void stopImpedance();
+    
+    // Curve tracer helpers
+    bool parseCurveOutput(const char* channel, CurveOutput& output);
+    static void curveTracerTaskWrapper(void* parameter);
+    void curveTracerTask();
+    void stageCurveOutput(CurveOutput output, float voltage);
+    void measureCurveInner(float& voltage, float& current);
+    void measureCurveOuter(float setpoint, float& voltage, float& current);
+    bool waitCurveSettle(float& voltage, float& current);
+    void fireCurvePulse(float level, float& voltage, float& current);
+    void performCurveTracerPublish();
+    void stopCurveTracer();
+    
+    // Sequence helpers
+    bool parseSequenceRows(JsonArrayConst rows, bool default_capture);
+    static void sequenceTaskWrapper(void* parameter);
+    void sequenceTask();
+    void performSequencePublish();
+    void stopSequence();
+    
+    // Recipe helpers
+    static void recipeTaskWrapper(void* parameter);
+    void recipeTask();
+    void performRecipePublish();
+    void stopRecipe();
+    
+    // Power regulation helpers
+    bool parseRegulationSettings(JsonVariantConst settings, float target_voltage, float current_limit, RegulationConfig& config);
+    bool startPowerRegulation();
+    static void regulationTimerCallback(void* parameter);
+    static void regulationTaskWrapper(void* parameter);
+    void regulationTask();
+    void stopPowerRegulation();
+    
+    // Testbed readings from the scan scheduler
+    void startTestbedScan(float rate_hz);
+    void stopTestbedScan();
+    float testbedReading(ScanSource source);
+    void sendTestbedOutputError(const OutputTransaction& tx);
+    
+    // Power protection helpers
+    void performProtectionPublish();
+    
+    // Board calibration helpers
+    static void calibrationTaskWrapper(void* parameter);
+    void calibrationTask();
+    bool measureCalibrationPoint(float* feedback, float* input, bool loopback);
+    void fitCalibrationMap(CalibrationMap map, const float* codes, const float* volts, int count);
+    void publishCalibration(bool run_result, bool saved);
+    void performCalibrationPublish();
+    void stopCalibration();
+    
+    // Data logger helpers
+    static void loggerTimerCallback(void* parameter);
+    static void loggerSampleTaskWrapper(void* parameter);
+    void loggerSampleTask();
+    static void loggerWriteTaskWrapper(void* parameter);
+    void loggerWriteTask();
+    void performLoggerPublish();
+    void stopLogger();
+    void freeLoggerBuffers();
 };
 
 #endif // DRIVER_CONTROL_H
@@ -0,0 +1,299 @@
+#include "flash_logger.h"
+#include <esp_rom_crc.h>
+
+FlashLogger::FlashLogger()
+    : _partition(nullptr), _mutex(NULL), _capacity(0), _session(0), _active(false), _wrap(false), _full(false),
+      _record_size(0), _channels(0), _flags(0), _record_period_us(0), _written(0), _erased(0), _records(0) {
+}
+
+FlashLogger::~FlashLogger() {
+    if (_mutex != NULL) {
+        vSemaphoreDelete(_mutex);
+    }
+}
+
+bool FlashLogger::begin() {
+    if (_partition != nullptr) {
+        return true;
+    }
+    _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, FLASH_LOGGER_PARTITION_SUBTYPE,
+                                          FLASH_LOGGER_PARTITION_LABEL);
+    if (_partition == nullptr) {
+        Serial.println("FlashLogger: 'logger' partition not found (partition table out of date?)");
+        return false;
+    }
+    _capacity = _partition->size / FLASH_LOGGER_CHUNK_SIZE;
+    if (_mutex == NULL) {
+        _mutex = xSemaphoreCreateMutex();
+    }
+
+    _scan();
+    Serial.printf("FlashLogger: %u chunks at 0x%06x, session %u has %u chunks\n", (unsigned)_capacity,
+                  (unsigned)_partition->address, (unsigned)_session, (unsigned)getChunkCount());
+    return true;
+}
+
+// Rebuild the index of the newest session from the chunk headers, e.g. after a reboot
+void FlashLogger::_scan() {
+    FlashLoggerChunkHeader header;
+    uint32_t newest_sequence = 0;
+    bool found = false;
+
+    for (uint32_t slot = 0; slot < _capacity; slot++) {
+        if (esp_partition_read(_partition, (size_t)slot * FLASH_LOGGER_CHUNK_SIZE, &header, sizeof(header)) != ESP_OK) {
+            continue;
+        }
+        if (header.magic != FLASH_LOGGER_MAGIC || header.version != FLASH_LOGGER_VERSION) {
+            continue;
+        }
+        if (!found || header.session > _session ||
+            (header.session == _session && header.sequence > newest_sequence)) {
+            found = true;
+            _session = header.session;
+            newest_sequence = header.sequence;
+            _record_size = header.record_size;
+            _channels = header.channels;
+            _flags = header.flags;
+            _record_period_us = header.record_period_us;
+            _records = header.first_record + header.record_count;
+        }
+    }
+    if (!found) {
+        return;
+    }
+    _written = newest_sequence + 1;
+
+    // A power loss while writing leaves the newest chunk torn: drop it if its CRC does not match
+    uint8_t* chunk = (uint8_t*)malloc(FLASH_LOGGER_CHUNK_SIZE);
+    if (chunk != nullptr) {
+        if (esp_partition_read(_partition, _slotOffset(newest_sequence), chunk, FLASH_LOGGER_CHUNK_SIZE) == ESP_OK) {
+            const FlashLoggerChunkHeader* newest = (const FlashLoggerChunkHeader*)chunk;
+            if (newest->record_count * newest->record_size > FLASH_LOGGER_PAYLOAD_SIZE ||
+                _crc(chunk) != newest->crc32) {
+                Serial.printf("FlashLogger: dropping torn chunk %u of session %u\n",
+                              (unsigned)newest_sequence, (unsigned)_session);
+                _written = newest_sequence;
+                _records = newest->first_record;
+            }
+        }
+        free(chunk);
+    }
+}
+
+uint32_t FlashLogger::_crc(const uint8_t* chunk) {
+    const FlashLoggerChunkHeader* header = (const FlashLoggerChunkHeader*)chunk;
+    uint32_t crc = esp_rom_crc32_le(0, chunk, offsetof(FlashLoggerChunkHeader, crc32));
+    return esp_rom_crc32_le(crc, chunk + FLASH_LOGGER_HEADER_SIZE, (uint32_t)header->record_count * header->record_size);
+}
+
+uint32_t FlashLogger::getChunkCount() const {
+    return _written < _capacity ? _written : _capacity;
+}
+
+bool FlashLogger::startSession(uint8_t record_size, uint8_t channels, uint8_t flags, uint32_t record_period_us,
+                               bool wrap) {
+    if (!begin() || record_size == 0 || record_size > FLASH_LOGGER_PAYLOAD_SIZE) {
+        return false;
+    }
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _session++;
+    _active = true;
+    _wrap = wrap;
+    _full = false;
+    _record_size = record_size;
+    _channels = channels;
+    _flags = flags;
+    _record_period_us = record_period_us;
+    _written = 0;
+    _erased = 0;
+    _records = 0;
+    xSemaphoreGive(_mutex);
+    return true;
+}
+
+bool FlashLogger::_eraseFrom(uint32_t sequence, uint32_t chunks) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    esp_err_t err = esp_partition_erase_range(_partition, _slotOffset(sequence), (size_t)chunks * FLASH_LOGGER_CHUNK_SIZE);
+    if (err == ESP_OK) {
+        _erased = sequence + chunks;
+    }
+    xSemaphoreGive(_mutex);
+    return err == ESP_OK;
+}
+
+bool FlashLogger::eraseAhead(uint32_t chunks, volatile bool& running) {
+    if (!_active) {
+        return false;
+    }
+    // Never erase into chunks this session could still need to read back
+    uint32_t limit = _written + (chunks < _capacity ? chunks : _capacity);
+    if (!_wrap && limit > _capacity) {
+        limit = _capacity;
+    }
+
+    // Whole blocks where aligned so the flash can use block erases; the lock is released in between
+    const uint32_t step = FLASH_LOGGER_ERASE_STEP / FLASH_LOGGER_CHUNK_SIZE;
+    while (_erased < limit && running) {
+        uint32_t slot = _erased % _capacity;
+        uint32_t count = step - (slot % step);
+        if (count > limit - _erased) count = limit - _erased;
+        if (count > _capacity - slot) count = _capacity - slot;
+        if (!_eraseFrom(_erased, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FlashLogger::writeChunk(uint8_t* chunk, uint32_t first_record, uint16_t record_count) {
+    if (!_active || _full) {
+        return false;
+    }
+    if (!_wrap && _written >= _capacity) {
+        _full = true;
+        return false;
+    }
+    if ((size_t)record_count * _record_size > FLASH_LOGGER_PAYLOAD_SIZE) {
+        return false;
+    }
+
+    FlashLoggerChunkHeader* header = (FlashLoggerChunkHeader*)chunk;
+    header->magic = FLASH_LOGGER_MAGIC;
+    header->version = FLASH_LOGGER_VERSION;
+    header->flags = _flags;
+    header->record_size = _record_size;
+    header->channels = _channels;
+    header->session = _session;
+    header->sequence = _written;
+    header->first_record = first_record;
+    header->record_period_us = _record_period_us;
+    header->record_count = record_count;
+    header->reserved = 0xFFFF;
+    header->crc32 = _crc(chunk);
+
+    // Sector not erased ahead (wrapped around): erase just this one
+    if (_written >= _erased && !_eraseFrom(_written, 1)) {
+        return false;
+    }
+
+    // One write of the used 256-byte flash pages; a short final chunk leaves its tail erased (0xFF)
+    size_t length = FLASH_LOGGER_HEADER_SIZE + (size_t)record_count * _record_size;
+    length = (length + 255) & ~(size_t)255;
+    if (length > FLASH_LOGGER_CHUNK_SIZE) length = FLASH_LOGGER_CHUNK_SIZE;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    esp_err_t err = esp_partition_write(_partition, _slotOffset(_written), chunk, length);
+    if (err == ESP_OK) {
+        _written++;
+        _records = first_record + record_count;
+    }
+    xSemaphoreGive(_mutex);
+
+    if (err != ESP_OK) {
+        Serial.printf("FlashLogger: write of chunk %u failed (%d)\n", (unsigned)_written, err);
+        return false;
+    }
+    return true;
+}
+
+void FlashLogger::endSession() {
+    _active = false;
+}
+
+void FlashLogger::_readChunk(uint32_t sequence, size_t offset, uint8_t* dst, size_t length) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    // A chunk overwritten since the request started reads as erased, which the host skips
+    bool readable = sequence >= _firstSequence() && sequence < _written && sequence + _capacity >= _erased;
+    if (!readable || esp_partition_read(_partition, _slotOffset(sequence) + offset, dst, length) != ESP_OK) {
+        memset(dst, 0xFF, length);
+    }
+    xSemaphoreGive(_mutex);
+}
+
+bool FlashLogger::readChunkHeader(uint32_t index, FlashLoggerChunkHeader& header) {
+    if (!isReady()) {
+        return false;
+    }
+    _readChunk(_firstSequence() + index, 0, (uint8_t*)&header, sizeof(header));
+    return header.magic == FLASH_LOGGER_MAGIC && header.session == _session;
+}
+
+void FlashLogger::handleDataRequest(WebServer& server) {
+    if (!begin()) {
+        server.send(503, "text/plain", "Logger partition not found");
+        return;
+    }
+
+    // Snapshot of the session: the chunks readable right now, oldest first
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    uint32_t first = _firstSequence();
+    uint32_t chunks = getChunkCount();
+    uint32_t session = _session;
+    xSemaphoreGive(_mutex);
+
+    size_t total = (size_t)chunks * FLASH_LOGGER_CHUNK_SIZE;
+    if (total == 0) {
+        server.send(404, "text/plain", "No logger data");
+        return;
+    }
+
+    size_t start = 0;
+    size_t end = total - 1;
+    bool partial = false;
+    if (server.hasHeader("Range")) {
+        // bytes=a-b, bytes=a- or bytes=-n (one range only)
+        String range = server.header("Range");
+        int dash = range.indexOf('-');
+        bool valid = range.startsWith("bytes=") && dash > 0 && range.indexOf(',') < 0;
+        if (valid) {
+            String from = range.substring(6, dash);
+            String to = range.substring(dash + 1);
+            from.trim();
+            to.trim();
+            if (from.length() == 0) {
+                size_t suffix = (size_t)to.toInt();
+                valid = suffix > 0;
+                start = suffix < total ? total - suffix : 0;
+            } else {
+                start = (size_t)from.toInt();
+                if (to.length() > 0) {
+                    size_t last = (size_t)to.toInt();
+                    valid = last >= start;
+                    if (last < end) end = last;
+                }
+            }
+            valid = valid && start < total;
+        }
+        if (!valid) {
+            server.sendHeader("Content-Range", "bytes */" + String((unsigned long)total));
+            server.send(416, "text/plain", "Range not satisfiable");
+            return;
+        }
+        partial = true;
+    }
+
+    size_t length = end - start + 1;
+    server.sendHeader("Accept-Ranges", "bytes");
+    server.sendHeader("Content-Disposition", "attachment; filename=\"logger_session_" + String((unsigned long)session) + ".bin\"");
+    if (partial) {
+        server.sendHeader("Content-Range", "bytes " + String((unsigned long)start) + "-" + String((unsigned long)end) +
+                          "/" + String((unsigned long)total));
+    }
+    server.setContentLength(length);
+    server.send(partial ? 206 : 200, "application/octet-stream", "");
+
+    uint8_t buffer[1024];
+    size_t position = start;
+    while (position <= end) {
+        size_t offset = position % FLASH_LOGGER_CHUNK_SIZE;
+        size_t piece = FLASH_LOGGER_CHUNK_SIZE - offset;
+        if (piece > sizeof(buffer)) piece = sizeof(buffer);
+        if (piece > end - position + 1) piece = end - position + 1;
+        _readChunk(first + (uint32_t)(position / FLASH_LOGGER_CHUNK_SIZE), offset, buffer, piece);
+        server.sendContent((const char*)buffer, piece);
+        if (!server.client().connected()) {
+            break;
+        }
+        position += piece;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef FLASH_LOGGER_H
+#define FLASH_LOGGER_H
+
+#include <Arduino.h>
+#include <WebServer.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// Flash layout: the "logger" data partition is a ring of fixed-size chunks, one flash sector each
+#define FLASH_LOGGER_PARTITION_LABEL "logger"
+#define FLASH_LOGGER_PARTITION_SUBTYPE ((esp_partition_subtype_t)0x40)
+#define FLASH_LOGGER_CHUNK_SIZE 4096           // Erased and written as a unit (16 flash pages)
+#define FLASH_LOGGER_HEADER_SIZE 32
+#define FLASH_LOGGER_PAYLOAD_SIZE (FLASH_LOGGER_CHUNK_SIZE - FLASH_LOGGER_HEADER_SIZE)
+#define FLASH_LOGGER_MAGIC 0x474C4C50          // "PLLG"
+#define FLASH_LOGGER_VERSION 1
+#define FLASH_LOGGER_ERASE_STEP 65536          // Erase-ahead granularity (one flash block)
+
+// Chunk header flags
+#define FLASH_LOGGER_FLAG_DECIMATED 0x01       // Records hold mean, min and max per channel
+
+// Header at the start of every chunk. The CRC-32 (IEEE, as zlib.crc32) covers the
+// 28 header bytes before it followed by record_count * record_size payload bytes.
+struct __attribute__((packed)) FlashLoggerChunkHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint8_t record_size;         // Bytes per record
+    uint8_t channels;
+    uint32_t session;            // Increments with every logging session
+    uint32_t sequence;           // Chunk number within the session, from 0
+    uint32_t first_record;       // Session record index of the first record (time = index * period)
+    uint32_t record_period_us;
+    uint16_t record_count;
+    uint16_t reserved;
+    uint32_t crc32;
+};
+
+// Chunked, CRC-protected record storage in a dedicated flash partition.
+// One writer (the logger's writer task) appends whole chunks; HTTP handlers read the
+// newest session back as one byte stream of chunks, oldest first.
+class FlashLogger {
+public:
+    FlashLogger();
+    ~FlashLogger();
+
+    // Find the partition and index the newest session already in flash (safe to call again)
+    bool begin();
+    bool isReady() const { return _partition != nullptr; }
+    uint32_t getCapacityChunks() const { return _capacity; }
+
+    // Writer side. wrap = overwrite the oldest chunks when the partition is full.
+    bool startSession(uint8_t record_size, uint8_t channels, uint8_t flags, uint32_t record_period_us, bool wrap);
+    // Erase ahead of the writer so logging itself rarely waits for an erase; stops early when running clears
+    bool eraseAhead(uint32_t chunks, volatile bool& running);
+    // Fill in the header of a FLASH_LOGGER_CHUNK_SIZE buffer holding record_count records and write it.
+    // Returns false when the partition is full (no wrap) or the flash write failed.
+    bool writeChunk(uint8_t* chunk, uint32_t first_record, uint16_t record_count);
+    void endSession();
+    bool isFull() const { return _full; }
+
+    // Index of the newest session (active or finished)
+    uint32_t getSession() const { return _session; }
+    bool isActive() const { return _active; }
+    uint32_t getChunkCount() const;      // Chunks currently readable
+    uint32_t getChunksWritten() const { return _written; }
+    uint32_t getRecordCount() const { return _records; }  // Records written in the session
+    uint32_t getRecordPeriodUs() const { return _record_period_us; }
+    uint8_t getRecordSize() const { return _record_size; }
+    uint8_t getChannels() const { return _channels; }
+    uint8_t getFlags() const { return _flags; }
+
+    // Header of readable chunk index (0 = oldest); false if it is not a valid chunk of this session
+    bool readChunkHeader(uint32_t index, FlashLoggerChunkHeader& header);
+
+    // GET handler: the session as a stream of whole chunks, oldest first,
+    // or one byte range of that stream ("Range: bytes=a-b") answered with 206
+    void handleDataRequest(WebServer& server);
+
+private:
+    const esp_partition_t* _partition;
+    SemaphoreHandle_t _mutex;    // Index between the writer task and HTTP reads
+    uint32_t _capacity;          // Chunks in the partition
+
+    uint32_t _session;
+    bool _active;
+    bool _wrap;
+    bool _full;
+    uint8_t _record_size;
+    uint8_t _channels;
+    uint8_t _flags;
+    uint32_t _record_period_us;
+    uint32_t _written;           // Chunks written in this session (sequence of the next chunk)
+    uint32_t _erased;            // Sequence numbers below this have an erased sector waiting
+    uint32_t _records;
+
+    uint32_t _firstSequence() const { return _written > _capacity ? _written - _capacity : 0; }
+    size_t _slotOffset(uint32_t sequence) const { return (size_t)(sequence % _capacity) * FLASH_LOGGER_CHUNK_SIZE; }
+    bool _eraseFrom(uint32_t sequence, uint32_t chunks);
+    void _readChunk(uint32_t sequence, size_t offset, uint8_t* dst, size_t length);
+    void _scan();
+    static uint32_t _crc(const uint8_t* chunk);
+};
+
+#endif // FLASH_LOGGER_H
@@ -455,6 +455,11 @@ void NetMan::_setupWebServer() {
     Serial.print("NetMan: Setting up web server for mode ");
     Serial.println(_currentMode);
     
+    // Request headers the handlers read. WebServer only keeps headers it was asked to collect,
+    // so without Cookie _isAuthenticated() never sees the session set by /auth.
+    const char* headerKeys[] = {"Cookie", "Range"};
+    _server->collectHeaders(headerKeys, 2);
+    
     switch (_currentMode) {
         case MODE_STA:
             // In STA mode, use full UI if available, otherwise basic UI
@@ -475,6 +480,7 @@ void NetMan::_setupWebServer() {
             _setupFullWebServer();
             break;
     }
+    _setupRoutes();
     
     _server->begin();
     Serial.println("NetMan: Web server started");
@@ -1262,6 +1268,25 @@ void NetMan::_setupFullWebServer() {
     _server->onNotFound([this]() { _handleNotFound(); });
 }
 
+void NetMan::addRoute(const String& uri, HTTPMethod method, RouteHandler handler, bool authenticated) {
+    // Attached by _setupWebServer(), so call this before begin()
+    _routes.push_back({uri, method, handler, authenticated});
+}
+
+void NetMan::_setupRoutes() {
+    for (const NetManRoute& route : _routes) {
+        RouteHandler handler = route.handler;
+        bool authenticated = route.authenticated;
+        _server->on(route.uri, route.method, [this, handler, authenticated]() {
+            if (authenticated && !_isAuthenticated()) {
+                _server->send(401, "application/json", "{\"success\":false,\"message\":\"Authentication required\"}");
+                return;
+            }
+            handler(*_server);
+        });
+    }
+}
+
 void NetMan::_handleBasicRoot() {
     Serial.println("NetMan: Serving basic HTML interface");
     String html = _generateBasicHTML();
@@ -11,6 +11,7 @@
 #include <ArduinoOTA.h>
 #include <ESPmDNS.h>
 #include <vector>
+#include <functional>
 
 // Operation modes
 enum NetManMode {
@@ -39,6 +40,13 @@ struct ZipLocalFileHeader {
     uint16_t extraFieldLength;
 };
 
+struct NetManRoute {
+    String uri;
+    HTTPMethod method;
+    std::function<void(WebServer& server)> handler;
+    bool authenticated;        // Requires the admin login cookie
+};
+
 struct WiFiCredentials {
     String ssid;
     String password;
@@ -79,6 +87,11 @@ public:
     bool isMDNSEnabled();
     String getMDNSName();
     
+    // Extra HTTP routes (e.g. data downloads) served in every mode; register before begin().
+    // Authenticated routes answer 401 until the client has logged in through /auth.
+    typedef std::function<void(WebServer& server)> RouteHandler;
+    void addRoute(const String& uri, HTTPMethod method, RouteHandler handler, bool authenticated = true);
+    
     // New functionality
     bool hasWebUIFiles();
     NetManMode getCurrentMode();
@@ -128,6 +141,8 @@ private:
     void _setupWebServer();
     void _setupBasicWebServer();
     void _setupFullWebServer();
+    void _setupRoutes();
+    std::vector<NetManRoute> _routes;
     void _handleRoot();
     void _handleNetworks();
     void _handleAddNetwork();
@@ -0,0 +1,152 @@
+#ifndef BOARD_PROFILE_H
+#define BOARD_PROFILE_H
+
+#include <stdint.h>
+#include "../../include/pin_definitions.h"
+
+// Compile-time description of a PocKETlab board revision: references, front-end gains,
+// output ranges and the pins PocKETlabIO drives. One profile is selected per build with
+// -DPOCKETLAB_BOARD_REV=<n> (default 1), so every conversion constant, range check and pin
+// lookup is a constant, and a profile the firmware cannot drive fails to compile.
+
+// Revision 1: the current hardware (pin map in include/pin_definitions.h)
+struct BoardProfileRev1 {
+    static constexpr uint8_t revision = 1;
+    static constexpr const char* name = "PocKETlab rev 1";
+
+    // Converters: MCP3202 signal ADC referenced to 3.3 V, MCP4822 DACs on their 2.048 V reference
+    static constexpr float adc_reference = 3.3f;
+    static constexpr float dac_reference = 2.048f;
+
+    // Analog front end
+    static constexpr float signal_gain = 6.7f;            // Signal output amplifier (FB_AO/FB_A1 are before it)
+    static constexpr float power_gain = 6.6f;             // Power output amplifier and the FB_VOUT/FB_IOUT/FB_GOUT dividers
+    static constexpr float input_loss = 6.8f * 1.6663f;   // Signal input attenuator in front of the MCP3202
+    static constexpr float power_voltage_max = 20.0f;     // Supply rail
+    static constexpr float power_current_max = 3.0f;      // Current limit at DAC full scale
+
+    // SPI bus and LDAC
+    static constexpr int pin_spi_sck = PIN_SPI_SCK;
+    static constexpr int pin_spi_miso = PIN_SPI_MISO;
+    static constexpr int pin_spi_mosi = PIN_SPI_MOSI;
+    static constexpr int pin_cs_adc_signal = PIN_CS_ADC_SIGNAL;
+    static constexpr int pin_cs_dac_signal = PIN_CS_DAC_SIGNAL;
+    static constexpr int pin_cs_dac_power = PIN_CS_DAC_POWER;
+    static constexpr int pin_ldac = PIN_DAC_LDAC;
+
+    // Analog feedback and the temperature probe
+    static constexpr int pin_fb_vout = PIN_FB_VOUT;
+    static constexpr int pin_fb_iout = PIN_FB_IOUT;
+    static constexpr int pin_fb_gout = PIN_FB_GOUT;
+    static constexpr int pin_fb_a = PIN_FB_AO;
+    static constexpr int pin_fb_b = PIN_FB_A1;
+    static constexpr int pin_temp = PIN_TEMP_PROBE;
+
+    // DA lines (digital I/O, analog input, PWM) and DB lines (digital I/O, PWM)
+    static constexpr int pin_da0 = PIN_DA0;
+    static constexpr int pin_da1 = PIN_DA1;
+    static constexpr int pin_da2 = PIN_DA2;
+    static constexpr int pin_da3 = PIN_DA3;
+    static constexpr int pin_db0 = PIN_DB0;
+    static constexpr int pin_db1 = PIN_DB1;
+    static constexpr int pin_db2 = PIN_DB2;
+    static constexpr int pin_db3 = PIN_DB3;
+};
+
+// Revision 2 (not built yet): power amplifier sized for the full 20 V rail, lower signal
+// gain for a 10 V signal range, DB lines moved off the SPI monitor nets. The values are
+// placeholders until the hardware exists; the profile is checked like the real one.
+struct BoardProfileRev2 {
+    static constexpr uint8_t revision = 2;
+    static constexpr const char* name = "PocKETlab rev 2";
+
+    static constexpr float adc_reference = 3.3f;
+    static constexpr float dac_reference = 2.048f;
+
+    static constexpr float signal_gain = 4.9f;
+    static constexpr float power_gain = 9.7f;
+    static constexpr float input_loss = 4.0f * 1.6663f;
+    static constexpr float power_voltage_max = 20.0f;
+    static constexpr float power_current_max = 3.0f;
+
+    static constexpr int pin_spi_sck = 14;
+    static constexpr int pin_spi_miso = 13;
+    static constexpr int pin_spi_mosi = 12;
+    static constexpr int pin_cs_adc_signal = 16;
+    static constexpr int pin_cs_dac_signal = 18;
+    static constexpr int pin_cs_dac_power = 17;
+    static constexpr int pin_ldac = 11;
+
+    static constexpr int pin_fb_vout = 5;
+    static constexpr int pin_fb_iout = 4;
+    static constexpr int pin_fb_gout = 3;
+    static constexpr int pin_fb_a = 1;
+    static constexpr int pin_fb_b = 2;
+    static constexpr int pin_temp = 10;
+
+    static constexpr int pin_da0 = 6;
+    static constexpr int pin_da1 = 7;
+    static constexpr int pin_da2 = 8;
+    static constexpr int pin_da3 = 9;
+    static constexpr int pin_db0 = 39;
+    static constexpr int pin_db1 = 40;
+    static constexpr int pin_db2 = 41;
+    static constexpr int pin_db3 = 42;
+};
+
+// Pin list helpers for the checks below
+constexpr bool boardPinUnused(int) { return true; }
+template <typename... Pins>
+constexpr bool boardPinUnused(int pin, int first, Pins... rest) {
+    return pin != first && boardPinUnused(pin, rest...);
+}
+constexpr bool boardPinsDistinct() { return true; }
+template <typename... Pins>
+constexpr bool boardPinsDistinct(int first, Pins... rest) {
+    return boardPinUnused(first, rest...) && boardPinsDistinct(rest...);
+}
+constexpr bool boardAdc1Pins() { return true; }
+template <typename... Pins>
+constexpr bool boardAdc1Pins(int first, Pins... rest) {
+    return first >= 1 && first <= 10 && boardAdc1Pins(rest...);   // ESP32-S3 ADC1: GPIO1-10
+}
+
+// What PocKETlabIO and the drivers below it assume about a profile
+template <class P>
+struct BoardProfileCheck {
+    static_assert(P::dac_reference == 2.048f,
+                  "The DAC frames select the MCP4822 1x gain: dac_reference must be its internal 2.048 V");
+    static_assert(P::adc_reference > 0.0f && P::signal_gain > 0.0f && P::power_gain > 0.0f && P::input_loss > 0.0f,
+                  "References and front-end gains must be positive");
+    static_assert(P::power_current_max > 0.0f && P::dac_reference * P::power_gain <= P::power_voltage_max,
+                  "The power DAC full scale must stay within the supply rail");
+    static_assert(P::pin_ldac >= 0 && P::pin_ldac < 32,
+                  "LDAC is pulsed through the GPIO0-31 set/clear registers");
+    static_assert(boardAdc1Pins(P::pin_fb_vout, P::pin_fb_iout, P::pin_fb_gout, P::pin_fb_a, P::pin_fb_b,
+                                P::pin_da0, P::pin_da1, P::pin_da2, P::pin_da3, P::pin_temp),
+                  "Feedback, DA and temperature pins are sampled by the ADC1 DMA scan (GPIO1-10)");
+    static_assert(boardPinsDistinct(P::pin_spi_sck, P::pin_spi_miso, P::pin_spi_mosi, P::pin_cs_adc_signal,
+                                    P::pin_cs_dac_signal, P::pin_cs_dac_power, P::pin_ldac,
+                                    P::pin_fb_vout, P::pin_fb_iout, P::pin_fb_gout, P::pin_fb_a, P::pin_fb_b,
+                                    P::pin_temp, P::pin_da0, P::pin_da1, P::pin_da2, P::pin_da3,
+                                    P::pin_db0, P::pin_db1, P::pin_db2, P::pin_db3),
+                  "A GPIO is assigned twice in the board profile");
+    static constexpr bool valid = true;
+};
+
+#ifndef POCKETLAB_BOARD_REV
+#define POCKETLAB_BOARD_REV 1
+#endif
+
+#if POCKETLAB_BOARD_REV == 1
+typedef BoardProfileRev1 BoardProfile;
+#elif POCKETLAB_BOARD_REV == 2
+typedef BoardProfileRev2 BoardProfile;
+#else
+#error "Unknown POCKETLAB_BOARD_REV (1 or 2)"
+#endif
+
+static_assert(BoardProfileCheck<BoardProfile>::valid, "Board profile check");
+static_assert(BoardProfileCheck<BoardProfileRev2>::valid, "Board profile check");
+
+#endif // BOARD_PROFILE_H
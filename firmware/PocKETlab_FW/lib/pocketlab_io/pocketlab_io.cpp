@@ -1,11 +1,82 @@
 #include "pocketlab_io.h"
+#include <soc/gpio_struct.h>
+#include <driver/adc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Timed latch state shared with the timer ISR
+static volatile TaskHandle_t s_latchWaiter = NULL;
+static volatile int64_t s_latchFiredUs = 0;
+static volatile bool s_latchGpioPending = false;
+static volatile uint32_t s_latchGpio[4];  // set/clear GPIO0-31, set/clear GPIO32+
+
+// Pulse LDAC (active low) through the GPIO set/clear registers, fast enough for ISR use
+static inline void IRAM_ATTR pulseLDAC() {
+    GPIO.out_w1tc = BIT(BoardProfile::pin_ldac);
+    delayMicroseconds(1);  // MCP4822 needs >100ns LDAC low
+    GPIO.out_w1ts = BIT(BoardProfile::pin_ldac);
+}
+
+// Staged digital lines go out in the same microsecond as the DAC latch
+static inline void IRAM_ATTR applyLatchGpio() {
+    if (s_latchGpioPending) {
+        GPIO.out_w1ts = s_latchGpio[0];
+        GPIO.out_w1tc = s_latchGpio[1];
+        GPIO.out1_w1ts.val = s_latchGpio[2];
+        GPIO.out1_w1tc.val = s_latchGpio[3];
+        s_latchGpioPending = false;
+    }
+}
+
+static void IRAM_ATTR latchTimerISR() {
+    applyLatchGpio();
+    pulseLDAC();
+    s_latchFiredUs = esp_timer_get_time();
+    
+    BaseType_t woken = pdFALSE;
+    if (s_latchWaiter != NULL) {
+        vTaskNotifyGiveFromISR(s_latchWaiter, &woken);
+    }
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+// DA0-DA3, then DB0-DB3
+const int PocKETlabIO::kOutputPins[OUTPUT_PINS] = {
+    BoardProfile::pin_da0, BoardProfile::pin_da1, BoardProfile::pin_da2, BoardProfile::pin_da3,
+    BoardProfile::pin_db0, BoardProfile::pin_db1, BoardProfile::pin_db2, BoardProfile::pin_db3
+};
 
 PocKETlabIO::PocKETlabIO() 
-    : _signalADC(nullptr), _signalDAC(nullptr), _powerDAC(nullptr),
-      _adcRefVoltage(ADC_REFERENCE_VOLTAGE), _dacRefVoltage(DAC_REFERENCE_VOLTAGE),
-            _initialized(false), _spiSettings(1000000, MSBFIRST, SPI_MODE0) {
+    : _adcRefVoltage(ADC_REFERENCE_VOLTAGE), _dacRefVoltage(DAC_REFERENCE_VOLTAGE),
+            _initialized(false), _fastAdcReady(false),
+            _powerMutex(NULL), _powerTripped(false), _signalMutex(NULL), _scanRunning(false), _scanTaskHandle(NULL),
+            _scanFilterShift(FEEDBACK_FILTER_SHIFT), _scanFrames(0), _scanOverruns(0),
+            _adcCalType(ESP_ADC_CAL_VAL_DEFAULT_VREF), _adcCalReady(false), _protectArmed(false), _protectArmCount(0), _latchTimer(nullptr) {
         _ledc_initialized = false;
         for (int i = 0; i < 16; ++i) _ledc_channel_attached[i] = false;
+        for (int i = 0; i < 16; ++i) _scanSource[i] = -1;
+        for (int i = 0; i < FEEDBACK_SOURCES; ++i) {
+            _scanFrame[i] = 0.0f;
+            _scanFiltered[i] = 0.0f;
+        }
+        for (int i = 0; i < 4; ++i) _daAnalog[i] = false;
+        _pinOutput = 0;
+        _dacWrites = 0;
+        _dacWritesSkipped = 0;
+        _invalidateDacShadow();
+        memset(&_calibration, 0, sizeof(_calibration));
+        for (int i = 0; i < CAL_MAPS; ++i) {
+            _calibration.map[i] = CalibrationEngine::nominal(getNominalCalibrationGain((CalibrationMap)i));
+        }
+        _updateConversions();
+        _adcCal = esp_adc_cal_characteristics_t();
+        _protectConfig = ProtectionConfig();
+        _lastTrip = ProtectionTripInfo();
+        for (int i = 0; i < PROTECTION_CHANNELS; ++i) {
+            _protectLimit[i] = 0xFFFF;
+        }
 }
 
 bool PocKETlabIO::begin() {
@@ -13,55 +84,57 @@ bool PocKETlabIO::begin() {
         return true;
     }
     
-    // Initialize SPI
-    SPI.begin(PIN_SPI_SCK, PIN_SPI_MISO, PIN_SPI_MOSI);
-    
-    // Configure chip select pins
-    pinMode(PIN_CS_ADC_SIGNAL, OUTPUT);
-    pinMode(PIN_CS_DAC_SIGNAL, OUTPUT);
-    pinMode(PIN_CS_DAC_POWER, OUTPUT);
-    digitalWrite(PIN_CS_ADC_SIGNAL, HIGH);
-    digitalWrite(PIN_CS_DAC_SIGNAL, HIGH);
-    digitalWrite(PIN_CS_DAC_POWER, HIGH);
+    if (_powerMutex == NULL) {
+        _powerMutex = xSemaphoreCreateMutex();
+    }
+    if (_signalMutex == NULL) {
+        _signalMutex = xSemaphoreCreateMutex();
+    }
     
     // Configure LDAC pin for simultaneous DAC updates
-    pinMode(PIN_DAC_LDAC, OUTPUT);
-    digitalWrite(PIN_DAC_LDAC, HIGH); // LDAC is active low
+    pinMode(BoardProfile::pin_ldac, OUTPUT);
+    digitalWrite(BoardProfile::pin_ldac, HIGH); // LDAC is active low
+    
+    // SPI bus owner for the signal ADC (U8) and both DACs (U5, U6); the driver handles the chip selects
+    if (!_bus.begin(BoardProfile::pin_spi_sck, BoardProfile::pin_spi_miso, BoardProfile::pin_spi_mosi,
+                    BoardProfile::pin_cs_adc_signal, BoardProfile::pin_cs_dac_signal,
+                    BoardProfile::pin_cs_dac_power, BoardProfile::pin_ldac)) {
+        Serial.println("ERROR: SPI bus initialization failed");
+        return false;
+    }
     
     // Configure feedback pins as analog inputs
-    pinMode(PIN_FB_AO, INPUT);      // Signal A feedback
-    pinMode(PIN_FB_A1, INPUT);      // Signal B feedback  
-    pinMode(PIN_FB_GOUT, INPUT);    // Ground voltage feedback
-    pinMode(PIN_FB_IOUT, INPUT);    // Current feedback
-    pinMode(PIN_FB_VOUT, INPUT);    // Voltage feedback
-    pinMode(PIN_TEMP_PROBE, INPUT); // Temperature probe
-      // Initialize ADC (MCP3202)
-    _signalADC = new MCP3202(&SPI);
-    _signalADC->begin(PIN_CS_ADC_SIGNAL);
-    
-    // Initialize Signal DAC (MCP4822)
-    _signalDAC = new MCP4822(&SPI);
-    _signalDAC->begin(PIN_CS_DAC_SIGNAL);
-    
-    // Initialize Power DAC (MCP4822)
-    _powerDAC = new MCP4822(&SPI);
-    _powerDAC->begin(PIN_CS_DAC_POWER);
-      // Configure DACs for 1x gain (safer default, lower voltage range)
-    _signalDAC->setGain(1);  // 1x gain for 2.048V reference or full range
-    _powerDAC->setGain(1);   // 1x gain for 2.048V reference or full range
-    
-    // Set LDAC pin for both DACs if the library supports it
-    _signalDAC->setLatchPin(PIN_DAC_LDAC);
-    _powerDAC->setLatchPin(PIN_DAC_LDAC);
-    
-    // Set all outputs to zero initially
+    pinMode(BoardProfile::pin_fb_a, INPUT);      // Signal A feedback
+    pinMode(BoardProfile::pin_fb_b, INPUT);      // Signal B feedback
+    pinMode(BoardProfile::pin_fb_gout, INPUT);   // Ground voltage feedback
+    pinMode(BoardProfile::pin_fb_iout, INPUT);   // Current feedback
+    pinMode(BoardProfile::pin_fb_vout, INPUT);   // Voltage feedback
+    pinMode(BoardProfile::pin_temp, INPUT);      // Temperature probe
+    
+    // Per-board calibration, if this board has been through one
+    if (CalibrationEngine::load(_calibration)) {
+        _updateConversions();
+        Serial.println("Board calibration loaded from NVS");
+    }
+    
+    _initialized = true;
+    
+    // Set all outputs to zero initially (DAC writes use 1x gain: 2.048V full scale)
     setPowerVoltage(0.0);
     setPowerCurrent(0.0);
     setSignalVoltage(SIGNAL_CHANNEL_A, 0.0);
     setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
     updateAllDACs();
     
-    _initialized = true;
+    // Same width and attenuation as analogRead(); the curve comes from the eFuse where present
+    _adcCalType = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, FEEDBACK_DEFAULT_VREF, &_adcCal);
+    _adcCalReady = true;
+    
+    // Background ADC scan of the MCU analog pins; reads fall back to analogRead() without it
+    if (!_startFeedbackScan()) {
+        Serial.println("WARNING: Feedback scan not running, using one-shot ADC reads");
+    }
+    
     Serial.println("PocKETlab I/O initialized successfully");
     printStatus();
     
@@ -73,6 +146,8 @@ void PocKETlabIO::end() {
         return;
     }
     
+    _stopFeedbackScan();
+    
     // Set all outputs to safe values
     setPowerVoltage(0.0);
     setPowerCurrent(0.0);
@@ -80,13 +155,8 @@ void PocKETlabIO::end() {
     setSignalVoltage(SIGNAL_CHANNEL_B, 0.0);
     updateAllDACs();
     
-    // Clean up objects
-    delete _signalADC;
-    delete _signalDAC;
-    delete _powerDAC;
-    _signalADC = nullptr;
-    _signalDAC = nullptr;
-    _powerDAC = nullptr;
+    _bus.end();
+    _invalidateDacShadow();
     
     _initialized = false;
     Serial.println("PocKETlab I/O shutdown");
@@ -95,7 +165,7 @@ void PocKETlabIO::end() {
 // === Power Control Functions ===
 
 bool PocKETlabIO::setPowerVoltage(float voltage) {
-    if (!_initialized || !_powerDAC) {
+    if (!_initialized) {
         return false;
     }
     
@@ -108,17 +178,12 @@ bool PocKETlabIO::setPowerVoltage(float voltage) {
         return false;
     }
     
-    // Compensate for amplifier gain: DAC voltage = desired output / gain
-    float dacVoltage = voltage / POWER_AMPLIFIER_GAIN;
-    
-    // Convert voltage to DAC value
-    uint16_t dacValue = _voltageToRaw(dacVoltage, _dacRefVoltage, DAC_MAX_VALUE);
-    // Use channel A of power DAC for voltage control
-    return _powerDAC->write(dacValue, 0);
+    // Use channel A of power DAC for voltage control (amplifier gain and calibration in the conversion)
+    return _writePowerDAC(powerVoltageToCode(voltage), 0);
 }
 
 bool PocKETlabIO::setPowerCurrent(float current) {
-    if (!_initialized || !_powerDAC) {
+    if (!_initialized) {
         return false;
     }
     
@@ -133,25 +198,25 @@ bool PocKETlabIO::setPowerCurrent(float current) {
     float voltage = (current / POWER_CURRENT_MAX) * _dacRefVoltage;
     uint16_t dacValue = _voltageToRaw(voltage, _dacRefVoltage, DAC_MAX_VALUE);
       // Use channel B of power DAC for current control
-    return _powerDAC->write(dacValue, 1);
+    return _writePowerDAC(dacValue, 1);
 }
 
 float PocKETlabIO::readPowerVoltage() {
-    return _readAnalogPin(PIN_FB_VOUT) * POWER_AMPLIFIER_GAIN; // Compensate for amplifier gain
+    return _readAnalogPin(BoardProfile::pin_fb_vout) * POWER_AMPLIFIER_GAIN; // Compensate for amplifier gain
 }
 
 float PocKETlabIO::readPowerCurrent() {
-    return _readAnalogPin(PIN_FB_IOUT) * POWER_AMPLIFIER_GAIN; // Compensate for amplifier gain
+    return _readAnalogPin(BoardProfile::pin_fb_iout) * POWER_AMPLIFIER_GAIN; // Compensate for amplifier gain
 }
 
 float PocKETlabIO::readGroundVoltage() {
-    return _readAnalogPin(PIN_FB_GOUT) * POWER_AMPLIFIER_GAIN; // Compensate for amplifier gain
+    return _readAnalogPin(BoardProfile::pin_fb_gout) * POWER_AMPLIFIER_GAIN; // Compensate for amplifier gain
 }
 
 // === Signal Control Functions ===
 
 bool PocKETlabIO::setSignalVoltage(SignalChannel channel, float voltage) {
-    if (!_initialized || !_signalDAC) {
+    if (!_initialized) {
         return false;
     }
     
@@ -164,36 +229,30 @@ bool PocKETlabIO::setSignalVoltage(SignalChannel channel, float voltage) {
         return false;
     }
     
-    // Compensate for amplifier gain: DAC voltage = desired output / gain
-    float dacVoltage = voltage / SIGNAL_AMPLIFIER_GAIN;
-    
-    uint16_t dacValue = _voltageToRaw(dacVoltage, _dacRefVoltage, DAC_MAX_VALUE);
-    return _signalDAC->write(dacValue, channel);
+    // Amplifier gain and calibration are folded into the conversion
+    return _writeDAC(SPI_DEVICE_SIGNAL_DAC, channel, signalVoltageToCode(voltage, channel));
 }
 
 float PocKETlabIO::readSignalVoltage(SignalChannel channel) {
-    if (!_initialized || !_signalADC) {
+    if (!_initialized) {
         return 0.0;
     }
     
-    uint16_t rawValue = _signalADC->read(channel);
-    float adcVoltage = _rawToVoltage(rawValue, _adcRefVoltage, ADC_MAX_VALUE);
-    
-    // Compensate for input attenuator: actual input voltage = ADC reading / gain
-    return adcVoltage * ADC_INPUT_LOSS;
+    // Compensate for input attenuator (and calibration): actual input voltage = ADC reading / gain
+    return signalVoltageFromRaw(_readSignalADC(channel), channel);
 }
 
 float PocKETlabIO::readSignalVoltageRaw(SignalChannel channel) {
-    if (!_initialized || !_signalADC) {
+    if (!_initialized) {
         return 0.0;
     }
     
-    uint16_t rawValue = _signalADC->read(channel);
+    uint16_t rawValue = _readSignalADC(channel);
     return _rawToVoltage(rawValue, _adcRefVoltage, ADC_MAX_VALUE);
 }
 
 float PocKETlabIO::readSignalFeedback(SignalChannel channel) {
-    int pin = (channel == SIGNAL_CHANNEL_A) ? PIN_FB_AO : PIN_FB_A1;
+    int pin = (channel == SIGNAL_CHANNEL_A) ? BoardProfile::pin_fb_a : BoardProfile::pin_fb_b;
     return _readAnalogPin(pin);
 }
 
@@ -216,17 +275,18 @@ void PocKETlabIO::updateAllDACs() {
         return;
     }
     
-    // Trigger LDAC to update all DAC outputs simultaneously
-    _signalDAC->triggerLatch();
-    _powerDAC->triggerLatch();
+    // Trigger LDAC to update all DAC outputs simultaneously (both DACs share the pin)
+    SpiBatch batch;
+    batch.latchPending();
+    _bus.execute(batch);
 }
 
 uint16_t PocKETlabIO::readRawADC(uint8_t channel) {
-    if (!_initialized || !_signalADC || channel > 1) {
+    if (!_initialized || channel > 1) {
         return 0;
     }
     
-    return _signalADC->read(channel);
+    return _readSignalADC(channel);
 }
 
 bool PocKETlabIO::writeRawDAC(uint8_t dac, uint8_t channel, uint16_t value) {
@@ -234,20 +294,544 @@ bool PocKETlabIO::writeRawDAC(uint8_t dac, uint8_t channel, uint16_t value) {
         return false;
     }
     
-    MCP4822* targetDAC = nullptr;
     if (dac == 0) {
-        targetDAC = _signalDAC;
+        return _writeDAC(SPI_DEVICE_SIGNAL_DAC, channel, value);
     } else if (dac == 1) {
-        targetDAC = _powerDAC;
-    } else {
+        return _writePowerDAC(value, channel);
+    }
+    return false;
+}
+
+size_t PocKETlabIO::readSignalBurst(uint16_t* rawA, uint16_t* rawB, size_t count) {
+    if (!_initialized) {
+        return 0;
+    }
+    
+    // One batch for the whole burst: the conversions are queued back to back
+    SpiBatch batch;
+    batch.readADCBurst(rawA, rawB, count);
+    return _bus.execute(batch) ? count : 0;
+}
+
+float PocKETlabIO::signalVoltageFromRaw(float raw, SignalChannel channel) const {
+    return CalibrationEngine::toVolts(_conv[channel == SIGNAL_CHANNEL_B ? CAL_SIGNAL_ADC_B : CAL_SIGNAL_ADC_A], raw);
+}
+
+uint16_t PocKETlabIO::signalVoltageToCode(float voltage, SignalChannel channel) const {
+    return CalibrationEngine::toCode(_conv[channel == SIGNAL_CHANNEL_B ? CAL_SIGNAL_DAC_B : CAL_SIGNAL_DAC_A], voltage);
+}
+
+uint16_t PocKETlabIO::powerVoltageToCode(float voltage) const {
+    return CalibrationEngine::toCode(_conv[CAL_POWER_DAC], voltage);
+}
+
+uint16_t PocKETlabIO::powerCurrentToCode(float current) const {
+    float fraction = current / POWER_CURRENT_MAX;  // Same scaling as setPowerCurrent()
+    if (fraction < 0.0f) fraction = 0.0f;
+    if (fraction > 1.0f) fraction = 1.0f;
+    return (uint16_t)(fraction * (float)DAC_MAX_VALUE + 0.5f);
+}
+
+uint16_t PocKETlabIO::readPowerVoltageRaw() {
+    if (_scanRunning) {
+        return (uint16_t)(_scanFrame[FEEDBACK_VOUT] + 0.5f);  // Newest frame, no filter lag
+    }
+    return (uint16_t)(_linearize(analogRead(BoardProfile::pin_fb_vout)) + 0.5f);
+}
+
+float PocKETlabIO::powerVoltageFromRaw(float raw) const {
+    // Same scaling as _readAnalogPin() followed by the amplifier gain
+    return raw * 3.3f / 4095.0f * POWER_AMPLIFIER_GAIN;
+}
+
+uint16_t PocKETlabIO::readPowerCurrentRaw() {
+    if (_scanRunning) {
+        return (uint16_t)(_scanFrame[FEEDBACK_IOUT] + 0.5f);  // Newest frame, no filter lag
+    }
+    return (uint16_t)(_linearize(analogRead(BoardProfile::pin_fb_iout)) + 0.5f);
+}
+
+float PocKETlabIO::powerCurrentFromRaw(float raw) const {
+    return raw * 3.3f / 4095.0f * POWER_AMPLIFIER_GAIN;  // Matches readPowerCurrent()
+}
+
+void PocKETlabIO::readPowerFeedbackFast(float* voltageRaw, float* currentRaw, uint8_t samples) {
+    if (_scanRunning) {
+        // ADC1 belongs to the scan: its newest frame is already an 8-conversion average
+        if (voltageRaw) *voltageRaw = _scanFrame[FEEDBACK_VOUT];
+        if (currentRaw) *currentRaw = _scanFrame[FEEDBACK_IOUT];
+        return;
+    }
+    if (!_fastAdcReady) {
+        _prepareFastAdc();
+    }
+    if (samples == 0) {
+        samples = 1;
+    }
+    
+    adc1_channel_t voltageChannel = (adc1_channel_t)digitalPinToAnalogChannel(BoardProfile::pin_fb_vout);
+    adc1_channel_t currentChannel = (adc1_channel_t)digitalPinToAnalogChannel(BoardProfile::pin_fb_iout);
+    uint32_t voltageSum = 0;
+    uint32_t currentSum = 0;
+    for (uint8_t i = 0; i < samples; i++) {
+        if (voltageRaw) voltageSum += adc1_get_raw(voltageChannel);
+        if (currentRaw) currentSum += adc1_get_raw(currentChannel);
+    }
+    if (voltageRaw) *voltageRaw = _linearize((float)voltageSum / samples);
+    if (currentRaw) *currentRaw = _linearize((float)currentSum / samples);
+}
+
+bool PocKETlabIO::readPowerFeedbackFresh(float* voltageRaw, float* currentRaw) {
+    if (_scanRunning) {
+        // Busy-wait for the next frame: newer than anything an earlier call returned
+        uint32_t frames = _scanFrames;
+        int64_t t_timeout = esp_timer_get_time() + 2 * FEEDBACK_FRAME_US + 1000;
+        while (_scanFrames == frames) {
+            if (esp_timer_get_time() > t_timeout) {
+                return false;
+            }
+        }
+    }
+    readPowerFeedbackFast(voltageRaw, currentRaw, 8);   // Same conversion count as a scan frame
+    return true;
+}
+
+void PocKETlabIO::_prepareFastAdc() {
+    // Same width and attenuation as analogRead(), so codes match readPowerVoltageRaw()/readPowerCurrentRaw()
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten((adc1_channel_t)digitalPinToAnalogChannel(BoardProfile::pin_fb_vout), ADC_ATTEN_DB_11);
+    adc1_config_channel_atten((adc1_channel_t)digitalPinToAnalogChannel(BoardProfile::pin_fb_iout), ADC_ATTEN_DB_11);
+    _fastAdcReady = true;
+}
+
+// === Feedback scan ===
+
+// Pin of each FeedbackSource
+static const int kFeedbackPins[FEEDBACK_SOURCES] = {
+    BoardProfile::pin_fb_vout, BoardProfile::pin_fb_iout, BoardProfile::pin_fb_gout,
+    BoardProfile::pin_fb_a, BoardProfile::pin_fb_b,
+    BoardProfile::pin_da0, BoardProfile::pin_da1, BoardProfile::pin_da2, BoardProfile::pin_da3,
+    BoardProfile::pin_temp
+};
+
+// Scan pattern: the power feedback pins in every group, two slower pins after them
+static const uint8_t kFeedbackPattern[FEEDBACK_PATTERN_LENGTH] = {
+    FEEDBACK_VOUT, FEEDBACK_IOUT, FEEDBACK_GOUT, FEEDBACK_A0, FEEDBACK_A1,
+    FEEDBACK_VOUT, FEEDBACK_IOUT, FEEDBACK_GOUT, FEEDBACK_DA0, FEEDBACK_DA1,
+    FEEDBACK_VOUT, FEEDBACK_IOUT, FEEDBACK_GOUT, FEEDBACK_DA2, FEEDBACK_DA3,
+    FEEDBACK_VOUT, FEEDBACK_IOUT, FEEDBACK_GOUT, FEEDBACK_TEMP, FEEDBACK_A0
+};
+
+bool PocKETlabIO::_startFeedbackScan() {
+    adc_digi_pattern_config_t pattern[FEEDBACK_PATTERN_LENGTH] = {};
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; i++) _scanSource[i] = -1;
+    for (int i = 0; i < FEEDBACK_PATTERN_LENGTH; i++) {
+        int channel = digitalPinToAnalogChannel(kFeedbackPins[kFeedbackPattern[i]]);
+        pattern[i].atten = ADC_ATTEN_DB_11;
+        pattern[i].channel = channel;
+        pattern[i].unit = 0;  // ADC1
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        _scanSource[channel] = kFeedbackPattern[i];
+        mask |= BIT(channel);
+    }
+    
+    adc_digi_init_config_t init_config = {};
+    init_config.max_store_buf_size = FEEDBACK_FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES * 8;
+    init_config.conv_num_each_intr = FEEDBACK_FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES;
+    init_config.adc1_chan_mask = mask;
+    init_config.adc2_chan_mask = 0;
+    if (adc_digi_initialize(&init_config) != ESP_OK) {
+        Serial.println("ERROR: Feedback scan ADC DMA init failed");
+        return false;
+    }
+    
+    adc_digi_configuration_t digi_config = {};
+    digi_config.conv_limit_en = false;
+    digi_config.conv_limit_num = 250;
+    digi_config.pattern_num = FEEDBACK_PATTERN_LENGTH;
+    digi_config.adc_pattern = pattern;
+    digi_config.sample_freq_hz = FEEDBACK_SCAN_RATE;
+    digi_config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    digi_config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+    if (adc_digi_controller_configure(&digi_config) != ESP_OK) {
+        Serial.println("ERROR: Feedback scan configuration failed");
+        adc_digi_deinitialize();
         return false;
     }
+    for (int i = 0; i < 4; i++) _daAnalog[i] = true;  // adc_digi_initialize() set up every pad in the mask
     
-    if (!targetDAC) {
+    _scanFrames = 0;
+    _scanOverruns = 0;
+    _scanRunning = true;
+    BaseType_t result = xTaskCreatePinnedToCore(
+        _feedbackScanTaskWrapper,   // Task function
+        "FeedbackScanTask",         // Task name
+        4096,                       // Stack size
+        this,                       // Parameter passed to task
+        FEEDBACK_TASK_PRIORITY,     // Above every application task on core 1 (protection runs here)
+        &_scanTaskHandle,           // Task handle
+        1                           // Core 1
+    );
+    if (result != pdPASS) {
+        Serial.println("ERROR: Failed to create feedback scan task!");
+        _scanTaskHandle = NULL;
+        _scanRunning = false;
+        adc_digi_deinitialize();
         return false;
     }
     
-    return targetDAC->write(value, channel);
+    // The first frame seeds the filters; readers see it within a millisecond
+    int waited_ms = 0;
+    while (_scanFrames == 0 && waited_ms < 20) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+        waited_ms++;
+    }
+    
+    Serial.printf("Feedback scan running: %d kS/s over %d pins, calibration: %s\n", 
+                  FEEDBACK_SCAN_RATE / 1000, FEEDBACK_SOURCES, getFeedbackCalibration());
+    return true;
+}
+
+void PocKETlabIO::_stopFeedbackScan() {
+    if (_scanTaskHandle != NULL) {
+        _scanRunning = false;
+        
+        // The task returns within one read timeout (or after a trip it is executing). It is never
+        // deleted: inside _tripPower() it holds _powerMutex and waits on a bus batch.
+        int elapsed_ms = 0;
+        while (_scanTaskHandle != NULL) {
+            vTaskDelay(pdMS_TO_TICKS(5));
+            elapsed_ms += 5;
+            if (elapsed_ms % 1000 == 0) {
+                Serial.printf("WARNING: Feedback scan task still stopping after %d ms\n", elapsed_ms);
+            }
+        }
+        adc_digi_deinitialize();
+        _fastAdcReady = false;  // One-shot setup is redone after the DMA scan released ADC1
+    }
+    _scanRunning = false;
+    _protectArmed = false;  // Protection rides on the scan
+}
+
+float PocKETlabIO::readFeedbackCode(FeedbackSource source) const {
+    if (source >= FEEDBACK_SOURCES) {
+        return 0.0f;
+    }
+    return _scanFiltered[source];
+}
+
+float PocKETlabIO::readFeedbackVoltage(FeedbackSource source) const {
+    return readFeedbackCode(source) * 3.3f / 4095.0f;
+}
+
+void PocKETlabIO::setFeedbackFilter(uint8_t shift) {
+    _scanFilterShift = shift > 6 ? 6 : shift;
+}
+
+const char* PocKETlabIO::getFeedbackCalibration() const {
+    switch (_adcCalType) {
+        case ESP_ADC_CAL_VAL_EFUSE_TP_FIT: return "efuse_tp_fit";
+        case ESP_ADC_CAL_VAL_EFUSE_TP: return "efuse_tp";
+        case ESP_ADC_CAL_VAL_EFUSE_VREF: return "efuse_vref";
+        default: return "default_vref";
+    }
+}
+
+float PocKETlabIO::_linearize(float raw) const {
+    // Calibrated millivolts, interpolated for averaged (fractional) codes, as a 3.3 V full-scale code
+    if (!_adcCalReady) {
+        return raw;  // Before begin(): nominal scaling
+    }
+    if (raw <= 0.0f) {
+        return 0.0f;
+    }
+    uint32_t code = (uint32_t)raw;
+    if (code >= ADC_MAX_VALUE) {
+        return esp_adc_cal_raw_to_voltage(ADC_MAX_VALUE, &_adcCal) * 4095.0f / 3300.0f;
+    }
+    float low = (float)esp_adc_cal_raw_to_voltage(code, &_adcCal);
+    float high = (float)esp_adc_cal_raw_to_voltage(code + 1, &_adcCal);
+    return (low + (raw - code) * (high - low)) * 4095.0f / 3300.0f;
+}
+
+uint16_t PocKETlabIO::_rawLimit(float linear) const {
+    if (linear >= _linearize(ADC_MAX_VALUE)) {
+        return 0xFFFF;  // Beyond the ADC range: never reached
+    }
+    // The calibration curve is monotonic: binary search for the last code at or below it
+    int low = 0;
+    int high = ADC_MAX_VALUE;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (_linearize(mid) <= linear) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return (uint16_t)low;
+}
+
+int PocKETlabIO::_feedbackSource(int pin) const {
+    for (int i = 0; i < FEEDBACK_SOURCES; i++) {
+        if (kFeedbackPins[i] == pin) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void PocKETlabIO::_feedbackScanTaskWrapper(void* parameter) {
+    PocKETlabIO* instance = static_cast<PocKETlabIO*>(parameter);
+    instance->_feedbackScanTask();
+}
+
+void PocKETlabIO::_feedbackScanTask() {
+    uint8_t frame[FEEDBACK_FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES];
+    const float conversion_us = 1000000.0f / FEEDBACK_SCAN_RATE;
+    uint16_t over[PROTECTION_CHANNELS] = {0};
+    int64_t first_over[PROTECTION_CHANNELS] = {0};
+    uint32_t arm_count = _protectArmCount - 1;   // Forces a reset on the first armed frame
+    
+    // Conversion n was sampled at base_us + n * conversion_us (the DMA clock is steady);
+    // re-anchored to the arrival time whenever frames were lost or the estimate ran ahead
+    uint64_t conversions = 0;
+    int64_t base_us = esp_timer_get_time();
+    adc_digi_start();
+    
+    while (_scanRunning) {
+        uint32_t length = 0;
+        esp_err_t err = adc_digi_read_bytes(frame, sizeof(frame), &length, 20);
+        int64_t now = esp_timer_get_time();
+        if (err == ESP_ERR_TIMEOUT || length == 0) {
+            continue;
+        }
+        uint32_t results = length / SOC_ADC_DIGI_RESULT_BYTES;
+        if (err == ESP_ERR_INVALID_STATE) {
+            _scanOverruns++;  // DMA pool overflowed: this frame is good, older ones were dropped
+            base_us = now - (int64_t)((conversions + results) * conversion_us);
+        } else if (base_us + (int64_t)((conversions + results) * conversion_us) > now) {
+            base_us = now - (int64_t)((conversions + results) * conversion_us);
+        }
+        
+        // Protection settings are read once per frame, so re-arming never mixes old and new
+        const bool armed = _protectArmed && !_powerTripped;
+        const uint16_t debounce = _protectConfig.debounce;
+        if (armed && arm_count != _protectArmCount) {
+            // Armed, re-armed or trip cleared since the last frame: debounce starts from nothing
+            arm_count = _protectArmCount;
+            for (int source = 0; source < PROTECTION_CHANNELS; source++) {
+                over[source] = 0;
+                first_over[source] = 0;
+            }
+        }
+        
+        uint32_t sum[FEEDBACK_SOURCES] = {0};
+        uint16_t count[FEEDBACK_SOURCES] = {0};
+        for (uint32_t i = 0; i < results; i++) {
+            const adc_digi_output_data_t* result = (const adc_digi_output_data_t*)&frame[i * SOC_ADC_DIGI_RESULT_BYTES];
+            uint8_t channel = result->type2.channel;
+            if (channel >= 16 || _scanSource[channel] < 0) {
+                continue;  // Invalid entry
+            }
+            uint8_t source = _scanSource[channel];
+            uint16_t code = result->type2.data & 0x0FFF;
+            sum[source] += code;
+            count[source]++;
+            
+            if (source >= PROTECTION_CHANNELS || !armed) {
+                continue;
+            }
+            if (code > _protectLimit[source]) {
+                if (over[source] == 0) {
+                    first_over[source] = base_us + (int64_t)((conversions + i) * conversion_us);
+                }
+                if (++over[source] >= debounce && !_powerTripped) {
+                    _tripPower(source, code, first_over[source], now);
+                }
+            } else {
+                over[source] = 0;
+            }
+        }
+        conversions += results;
+        
+        // Per-frame averages, calibrated, then the frame-to-frame exponential average
+        const float weight = 1.0f / (float)(1 << _scanFilterShift);
+        for (int source = 0; source < FEEDBACK_SOURCES; source++) {
+            if (count[source] == 0) {
+                continue;
+            }
+            float linear = _linearize((float)sum[source] / count[source]);
+            _scanFrame[source] = linear;
+            _scanFiltered[source] = _scanFrames == 0 ? linear : _scanFiltered[source] + weight * (linear - _scanFiltered[source]);
+        }
+        _scanFrames++;
+    }
+    adc_digi_stop();
+    
+    _scanTaskHandle = NULL;
+    vTaskDelete(NULL); // Delete this task
+}
+
+// === Power protection ===
+
+bool PocKETlabIO::_writePowerDAC(uint16_t value, uint8_t channel) {
+    if (_powerMutex != NULL) {
+        xSemaphoreTake(_powerMutex, portMAX_DELAY);
+    }
+    // After a trip only zero may be written, so nothing can raise the output before it is cleared
+    bool result = (value == 0 || !_powerTripped) ? _writeDAC(SPI_DEVICE_POWER_DAC, channel, value) : false;
+    if (_powerMutex != NULL) {
+        xSemaphoreGive(_powerMutex);
+    }
+    return result;
+}
+
+bool PocKETlabIO::startProtection(const ProtectionConfig& config) {
+    if (!_scanRunning) {
+        return false;
+    }
+    _protectArmed = false;
+    
+    // Thresholds as raw ADC codes, so the scan compares integers: output value -> linearized
+    // code (inverse of _feedbackFromCode()) -> last raw code the calibration maps at or below it
+    const float limits[PROTECTION_CHANNELS] = { config.ovp_voltage, config.ocp_current, config.gout_voltage };
+    for (int i = 0; i < PROTECTION_CHANNELS; i++) {
+        _protectLimit[i] = limits[i] <= 0.0f ? 0xFFFF : _rawLimit(limits[i] / POWER_AMPLIFIER_GAIN / 3.3f * 4095.0f);
+    }
+    _protectConfig = config;
+    if (_protectConfig.debounce == 0) {
+        _protectConfig.debounce = 1;
+    }
+    _protectArmCount++;
+    _protectArmed = true;
+    
+    Serial.printf("Power protection armed: OVP %.2fV, OCP %.3fA, GOUT %.2fV, debounce %u\n",
+                  config.ovp_voltage, config.ocp_current, config.gout_voltage, _protectConfig.debounce);
+    return true;
+}
+
+void PocKETlabIO::stopProtection() {
+    if (_protectArmed) {
+        Serial.println("Power protection disarmed");
+    }
+    _protectArmed = false;
+}
+
+void PocKETlabIO::clearPowerTrip() {
+    if (_powerMutex != NULL) {
+        xSemaphoreTake(_powerMutex, portMAX_DELAY);
+    }
+    _protectArmCount++;
+    _powerTripped = false;
+    if (_powerMutex != NULL) {
+        xSemaphoreGive(_powerMutex);
+    }
+}
+
+void PocKETlabIO::_tripPower(uint8_t slot, uint16_t code, int64_t first_over_us, int64_t detect_us) {
+    // Both channels to zero (voltage and current limit) and latched at once, ahead of every
+    // batch already queued. LDAC is shared, so codes staged on the signal DAC are latched
+    // with it. The mutex wait is bounded by the one power DAC write that may be in flight.
+    xSemaphoreTake(_powerMutex, portMAX_DELAY);
+    _powerTripped = true;
+    SpiBatch batch;
+    batch.writeDAC(SPI_DEVICE_POWER_DAC, 0, 0);
+    batch.writeDAC(SPI_DEVICE_POWER_DAC, 1, 0);
+    batch.latch();
+    _trackBatch(batch, _bus.execute(batch, true));
+    xSemaphoreGive(_powerMutex);
+    int64_t zeroed_us = esp_timer_get_time();
+    
+    const float limits[PROTECTION_CHANNELS] = { _protectConfig.ovp_voltage, _protectConfig.ocp_current, _protectConfig.gout_voltage };
+    ProtectionTripInfo info;
+    info.cause = (ProtectionTrip)(slot + 1);
+    info.value = _feedbackFromCode(_linearize(code));
+    info.threshold = limits[slot];
+    info.first_over_us = first_over_us;
+    info.detect_us = detect_us;
+    info.zeroed_us = zeroed_us;
+    info.count = _lastTrip.count + 1;
+    _lastTrip = info;
+}
+
+void PocKETlabIO::_prepareLatchTimer(uint32_t delay_us) {
+    if (_latchTimer == nullptr) {
+        _latchTimer = timerBegin(LATCH_TIMER_NUM, LATCH_TIMER_DIVIDER, true);
+        timerAttachInterrupt(_latchTimer, &latchTimerISR, true);
+    }
+    
+    s_latchWaiter = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);  // Drop any stale notification
+    
+    timerAlarmDisable(_latchTimer);
+    timerWrite(_latchTimer, 0);
+    timerAlarmWrite(_latchTimer, delay_us, false);
+}
+
+int64_t PocKETlabIO::startLatchPulse(uint32_t width_us) {
+    if (!_initialized) {
+        return 0;
+    }
+    
+    // First edge and timer start back to back so the width is set by the timer
+    _prepareLatchTimer(width_us);
+    pulseLDAC();
+    int64_t start_us = esp_timer_get_time();
+    timerAlarmEnable(_latchTimer);
+    
+    return start_us;
+}
+
+int64_t PocKETlabIO::scheduleLatch(uint32_t delay_us) {
+    if (!_initialized) {
+        return 0;
+    }
+    
+    _prepareLatchTimer(delay_us);
+    int64_t due_us = esp_timer_get_time() + delay_us;
+    timerAlarmEnable(_latchTimer);
+    
+    return due_us;
+}
+
+int64_t PocKETlabIO::scheduleLatchAt(int64_t due_us) {
+    if (!_initialized) {
+        return 0;
+    }
+    
+    _prepareLatchTimer(1);
+    int64_t delay_us = due_us - esp_timer_get_time();
+    timerAlarmWrite(_latchTimer, delay_us > 1 ? (uint64_t)delay_us : 1, false);
+    timerAlarmEnable(_latchTimer);
+    
+    return delay_us > 1 ? due_us : esp_timer_get_time();
+}
+
+void PocKETlabIO::stageLatchGpio(uint32_t set_low, uint32_t clear_low, uint32_t set_high, uint32_t clear_high) {
+    // Only touched while no timed edge is armed, so the ISR never sees a half-written set
+    s_latchGpio[0] = set_low;
+    s_latchGpio[1] = clear_low;
+    s_latchGpio[2] = set_high;
+    s_latchGpio[3] = clear_high;
+    s_latchGpioPending = true;
+}
+
+bool PocKETlabIO::waitLatchPulse(uint32_t timeout_ms) {
+    bool fired = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0;
+    s_latchWaiter = NULL;
+    if (!fired && _latchTimer != nullptr) {
+        // Never leave the outputs on the pulse level
+        timerAlarmDisable(_latchTimer);
+        applyLatchGpio();
+        pulseLDAC();
+    }
+    return fired;
+}
+
+int64_t PocKETlabIO::getLastTimedLatch() const {
+    return s_latchFiredUs;
 }
 
 float PocKETlabIO::readTemperature() {
@@ -256,7 +840,7 @@ float PocKETlabIO::readTemperature() {
     }
     
     // Read temperature from NTC probe
-    float voltage = _readAnalogPin(PIN_TEMP_PROBE);
+    float voltage = _readAnalogPin(BoardProfile::pin_temp);
     
     // Convert voltage to temperature (this needs proper NTC calibration)
     // For now, return a placeholder calculation
@@ -267,10 +851,50 @@ float PocKETlabIO::readTemperature() {
 
 void PocKETlabIO::setADCReference(float voltage) {
     _adcRefVoltage = voltage;
+    _updateConversions();
 }
 
 void PocKETlabIO::setDACReference(float voltage) {
     _dacRefVoltage = voltage;
+    _updateConversions();
+}
+
+float PocKETlabIO::getNominalCalibrationGain(CalibrationMap map) const {
+    switch (map) {
+        case CAL_SIGNAL_DAC_A:
+        case CAL_SIGNAL_DAC_B: return _dacRefVoltage / (float)DAC_MAX_VALUE;   // Before the amplifier
+        case CAL_POWER_DAC:    return _dacRefVoltage * POWER_AMPLIFIER_GAIN / (float)DAC_MAX_VALUE;
+        default:               return _adcRefVoltage / (float)ADC_MAX_VALUE * ADC_INPUT_LOSS;
+    }
+}
+
+void PocKETlabIO::setCalibration(const BoardCalibration& calibration) {
+    _calibration = calibration;
+    _updateConversions();
+}
+
+bool PocKETlabIO::saveCalibration() {
+    return CalibrationEngine::save(_calibration);
+}
+
+void PocKETlabIO::resetCalibration(bool erase) {
+    for (int i = 0; i < CAL_MAPS; i++) {
+        _calibration.map[i] = CalibrationEngine::nominal(getNominalCalibrationGain((CalibrationMap)i));
+    }
+    _updateConversions();
+    if (erase) {
+        CalibrationEngine::erase();
+    }
+}
+
+void PocKETlabIO::_updateConversions() {
+    // The signal DAC maps end before the amplifier; its gain is applied on top (nominal)
+    for (int i = 0; i < CAL_MAPS; i++) {
+        CalibrationMap map = (CalibrationMap)i;
+        CalibrationEntry entry = isCalibrated(map) ? _calibration.map[i] : CalibrationEngine::nominal(getNominalCalibrationGain(map));
+        float scale = (map == CAL_SIGNAL_DAC_A || map == CAL_SIGNAL_DAC_B) ? SIGNAL_AMPLIFIER_GAIN : 1.0f;
+        _conv[i] = CalibrationEngine::coefficients(entry, scale);
+    }
 }
 
 void PocKETlabIO::printStatus() {
@@ -279,6 +903,7 @@ void PocKETlabIO::printStatus() {
         return;
     }
     Serial.println("=== PocKETlab I/O Status ===");
+    Serial.printf("Board: %s\n", BoardProfile::name);
     Serial.printf("ADC Reference: %.3fV\n", _adcRefVoltage);
     Serial.printf("DAC Reference: %.3fV\n", _dacRefVoltage);
     Serial.printf("Power Output Range: 0.0-%.1fV (after %.1fx amplifier)\n", 
@@ -320,6 +945,18 @@ void PocKETlabIO::printStatus() {
                   feedbackB, feedbackB * SIGNAL_AMPLIFIER_GAIN);
     
     Serial.printf("Temperature: %.1f°C\n", readTemperature());
+    Serial.printf("Feedback scan: %s, calibration %s, %lu frames, %lu lost\n", _scanRunning ? "running" : "off",
+                  getFeedbackCalibration(), (unsigned long)_scanFrames, (unsigned long)_scanOverruns);
+    Serial.printf("SPI bus: %lu batches, %lu transactions, %lu errors, queue peak %lu, %.1f%% busy\n",
+                  (unsigned long)_bus.getBatches(), (unsigned long)_bus.getTransactions(),
+                  (unsigned long)_bus.getErrors(), (unsigned long)_bus.getMaxQueued(), _bus.getUtilization() * 100.0f);
+    Serial.printf("DAC writes: %lu sent, %lu unchanged skipped, %lu latches skipped\n",
+                  (unsigned long)_dacWrites, (unsigned long)_dacWritesSkipped, (unsigned long)_bus.getLatchesSkipped());
+    Serial.print("Board calibration:");
+    for (int i = 0; i < CAL_MAPS; i++) {
+        Serial.printf(" %s=%s", CalibrationEngine::mapName((CalibrationMap)i), isCalibrated((CalibrationMap)i) ? "fit" : "nominal");
+    }
+    Serial.println();
     Serial.println("============================");
 }
 
@@ -341,11 +978,287 @@ bool PocKETlabIO::_validateVoltageRange(float voltage, float minV, float maxV) {
 }
 
 float PocKETlabIO::_readAnalogPin(int pin) {
-    // Use ESP32's built-in ADC for feedback pins
+    // Latest filtered scan value: no conversion here
+    int source = _feedbackSource(pin);
+    if (_scanRunning && source >= 0) {
+        return _scanFiltered[source] * 3.3f / 4095.0f;
+    }
+    
+    // Scan not running: one blocking conversion, corrected with the calibration curve
     uint16_t rawValue = analogRead(pin);
+    return _linearize(rawValue) * 3.3f / 4095.0f;
+}
+
+uint16_t PocKETlabIO::_readSignalADC(uint8_t channel) {
+    uint16_t raw = 0;
+    SpiBatch batch;
+    batch.readADC(channel, &raw);
+    _bus.execute(batch);
+    return raw;
+}
+
+bool PocKETlabIO::_writeDAC(SpiDevice dac, uint8_t channel, uint16_t value) {
+    // Power DAC callers hold _powerMutex; the signal DAC is locked here, so no other task can
+    // write the chip between the shadow compare and the shadow update
+    bool signal = dac == SPI_DEVICE_SIGNAL_DAC && _signalMutex != NULL;
+    if (signal) {
+        xSemaphoreTake(_signalMutex, portMAX_DELAY);
+    }
+    volatile uint16_t& shadow = _dacShadow[_shadowIndex(dac, channel)];
+    bool ok = true;
+    if (shadow == value) {
+        // The input register already holds it; a pending latch still applies it
+        _dacWritesSkipped++;
+    } else {
+        SpiBatch batch;
+        ok = batch.writeDAC(dac, channel, value) && _bus.execute(batch);
+        _dacWrites++;
+        shadow = ok ? value : DAC_SHADOW_UNKNOWN;
+    }
+    if (signal) {
+        xSemaphoreGive(_signalMutex);
+    }
+    return ok;
+}
+
+// Shadow registers follow every DAC write of a batch; a failed batch leaves its channels unknown
+void PocKETlabIO::_trackBatch(const SpiBatch& batch, bool ok) {
+    for (uint8_t i = 0; i < batch.size(); i++) {
+        const SpiOp& op = batch.op(i);
+        if (op.type == SPI_OP_DAC_WRITE) {
+            _dacShadow[_shadowIndex(op.device, op.channel)] = ok ? op.value : DAC_SHADOW_UNKNOWN;
+            _dacWrites++;
+        }
+    }
+}
+
+void PocKETlabIO::_invalidateDacShadow() {
+    for (int i = 0; i < 4; i++) {
+        _dacShadow[i] = DAC_SHADOW_UNKNOWN;
+    }
+}
+
+bool PocKETlabIO::executeBatch(SpiBatch& batch) {
+    if (!_initialized) {
+        return false;
+    }
+    bool power = false, signal = false;
+    for (uint8_t i = 0; i < batch.size(); i++) {
+        const SpiOp& op = batch.op(i);
+        if (op.type != SPI_OP_DAC_WRITE) continue;
+        if (op.device == SPI_DEVICE_POWER_DAC) {
+            if (op.value > DAC_MAX_VALUE) {
+                return false;
+            }
+            power = true;
+        } else {
+            signal = true;
+        }
+    }
+    _lockDACs(power, signal);
+    bool result = _executeLocked(batch);
+    _unlockDACs(power, signal);
+    return result;
+}
+
+// Always power before signal, the order _tripPower() and the power DAC writers follow
+void PocKETlabIO::_lockDACs(bool power, bool signal) {
+    if (power) {
+        xSemaphoreTake(_powerMutex, portMAX_DELAY);
+    }
+    if (signal) {
+        xSemaphoreTake(_signalMutex, portMAX_DELAY);
+    }
+}
+
+void PocKETlabIO::_unlockDACs(bool power, bool signal) {
+    if (signal) {
+        xSemaphoreGive(_signalMutex);
+    }
+    if (power) {
+        xSemaphoreGive(_powerMutex);
+    }
+}
+
+bool PocKETlabIO::_executeLocked(SpiBatch& batch) {
+    // Power DAC writes follow the protection rules of _writePowerDAC(): after a trip only zeros
+    for (uint8_t i = 0; i < batch.size() && _powerTripped; i++) {
+        const SpiOp& op = batch.op(i);
+        if (op.type == SPI_OP_DAC_WRITE && op.device == SPI_DEVICE_POWER_DAC && op.value != 0) {
+            return false;
+        }
+    }
+    bool ok = _bus.execute(batch);
+    _trackBatch(batch, ok);
+    return ok;
+}
+
+// === Output transactions ===
+
+void OutputTransaction::clear() {
+    for (int i = 0; i < OUTPUT_DACS; i++) {
+        dac_set[i] = false;
+        dac_value[i] = 0.0f;
+        dac_code[i] = 0;
+    }
+    for (int i = 0; i < OUTPUT_PINS; i++) {
+        pin_mode[i] = OUTPUT_PIN_KEEP;
+        pin_value[i] = 0.0f;
+        pin_duty[i] = 0;
+    }
+    for (int i = 0; i < 4; i++) gpio[i] = 0;
+    error = OUTPUT_OK;
+    message = nullptr;
+    error_output = -1;
+    error_value = 0.0f;
+    error_min = 0.0f;
+    error_max = 0.0f;
+    commit_us = 0;
+}
+
+bool OutputTransaction::isEmpty() const {
+    for (int i = 0; i < OUTPUT_DACS; i++) {
+        if (dac_set[i]) return false;
+    }
+    for (int i = 0; i < OUTPUT_PINS; i++) {
+        if (pin_mode[i] != OUTPUT_PIN_KEEP) return false;
+    }
+    return true;
+}
+
+void OutputTransaction::_setPin(uint8_t channel, uint8_t base, OutputPinMode mode, float voltage) {
+    if (channel > 3) return;
+    pin_mode[base + channel] = mode;
+    pin_value[base + channel] = voltage;
+}
+
+bool PocKETlabIO::_rejectOutput(OutputTransaction& tx, OutputError error, int8_t output,
+                                float value, float min, float max) {
+    static const char* messages[] = {"OK", "Output value out of range", "Power output latched off by protection",
+                                     "I/O not initialized", "SPI bus error"};
+    tx.error = error;
+    tx.message = messages[error];
+    tx.error_output = output;
+    tx.error_value = value;
+    tx.error_min = min;
+    tx.error_max = max;
+    return false;
+}
+
+bool PocKETlabIO::validateOutputs(OutputTransaction& tx) {
+    tx.error = OUTPUT_OK;
+    tx.message = nullptr;
+    tx.error_output = -1;
+    for (int i = 0; i < 4; i++) tx.gpio[i] = 0;
+    
+    const float minimum[OUTPUT_DACS] = {POWER_VOLTAGE_MIN, POWER_CURRENT_MIN, 0.0f, 0.0f};
+    // Same limits as setPowerVoltage()/setPowerCurrent()/setSignalVoltage()
+    const float maximum[OUTPUT_DACS] = {_dacRefVoltage * POWER_AMPLIFIER_GAIN, POWER_CURRENT_MAX,
+                                        _dacRefVoltage * SIGNAL_AMPLIFIER_GAIN, _dacRefVoltage * SIGNAL_AMPLIFIER_GAIN};
+    for (int i = 0; i < OUTPUT_DACS; i++) {
+        if (!tx.dac_set[i]) continue;
+        float v = tx.dac_value[i];
+        if (isnan(v) || v < minimum[i] || v > maximum[i]) {
+            return _rejectOutput(tx, OUTPUT_ERROR_RANGE, i, v, minimum[i], maximum[i]);
+        }
+        switch (i) {
+            case OUTPUT_POWER_VOLTAGE: tx.dac_code[i] = powerVoltageToCode(v); break;
+            case OUTPUT_POWER_CURRENT: tx.dac_code[i] = powerCurrentToCode(v); break;
+            default:                   tx.dac_code[i] = signalVoltageToCode(v, (SignalChannel)(i - OUTPUT_SIGNAL_A)); break;
+        }
+    }
     
-    // ESP32 ADC is 12-bit (0-4095) with default 3.3V reference
-    return (float)rawValue * 3.3f / 4095.0f;
+    // After a protection trip the power DAC only takes zeros (see executeBatch())
+    if (_powerTripped) {
+        for (int i = OUTPUT_POWER_VOLTAGE; i <= OUTPUT_POWER_CURRENT; i++) {
+            if (tx.dac_set[i] && tx.dac_code[i] != 0) {
+                return _rejectOutput(tx, OUTPUT_ERROR_TRIPPED, i, tx.dac_value[i], 0.0f, 0.0f);
+            }
+        }
+    }
+    
+    const uint32_t max_duty = (1u << PWM_OUTPUT_BITS) - 1u;
+    for (int p = 0; p < OUTPUT_PINS; p++) {
+        if (tx.pin_mode[p] == OUTPUT_PIN_KEEP) continue;
+        float v = tx.pin_value[p];
+        if (tx.pin_mode[p] == OUTPUT_PIN_ANALOG) {
+            if (isnan(v) || v < 0.0f || v > 3.3f) {
+                return _rejectOutput(tx, OUTPUT_ERROR_RANGE, OUTPUT_DACS + p, v, 0.0f, 3.3f);
+            }
+            tx.pin_duty[p] = (uint32_t)((v / 3.3f) * (float)max_duty + 0.5f);
+        } else {
+            int pin = _mapOutputPin(p);
+            bool high = v >= OUTPUT_DIGITAL_THRESHOLD;
+            uint8_t bank = pin < 32 ? 0 : 2;
+            tx.gpio[bank + (high ? 0 : 1)] |= BIT(pin % 32);
+        }
+    }
+    return true;
+}
+
+bool PocKETlabIO::commitOutputs(OutputTransaction& tx) {
+    if (!_initialized) {
+        return _rejectOutput(tx, OUTPUT_ERROR_NOT_READY, -1, 0.0f, 0.0f, 0.0f);
+    }
+    if (!validateOutputs(tx)) {
+        return false;
+    }
+    
+    // Lines that are not GPIO outputs yet take their new level first, so the latch only
+    // switches lines that were already driven. PWM channels are set up ahead of the commit.
+    for (int p = 0; p < OUTPUT_PINS; p++) {
+        int pin = _mapOutputPin(p);
+        bool driven = (_pinOutput & (1u << p)) && !_ledc_channel_attached[p];
+        if (tx.pin_mode[p] == OUTPUT_PIN_DIGITAL && !driven) {
+            if (_ledc_channel_attached[p]) {
+                ledcDetachPin(pin);  // LEDC channel p drives pin p (DA0-3 on 0-3, DB0-3 on 4-7)
+                _ledc_channel_attached[p] = false;
+            }
+            digitalWrite(pin, tx.pin_value[p] >= OUTPUT_DIGITAL_THRESHOLD ? HIGH : LOW);
+            pinMode(pin, OUTPUT);
+            if (p < 4) _daAnalog[p] = false;
+            _setPinOutput(p, true);
+        } else if (tx.pin_mode[p] == OUTPUT_PIN_ANALOG) {
+            _ensureLEDCSetup(p, /*timer*/ 0, PWM_OUTPUT_FREQUENCY, PWM_OUTPUT_BITS);
+        }
+    }
+    
+    // The DAC mutexes are held from the shadow compare to the shadow update, so a write from
+    // another task cannot slip in between and leave a skipped channel at the wrong code
+    SpiBatch batch;
+    const SpiDevice device[OUTPUT_DACS] = {SPI_DEVICE_POWER_DAC, SPI_DEVICE_POWER_DAC,
+                                           SPI_DEVICE_SIGNAL_DAC, SPI_DEVICE_SIGNAL_DAC};
+    bool power = tx.dac_set[0] || tx.dac_set[1];
+    bool signal = tx.dac_set[2] || tx.dac_set[3];
+    _lockDACs(power, signal);
+    for (int i = 0; i < OUTPUT_DACS; i++) {
+        if (!tx.dac_set[i]) continue;
+        if (_dacShadow[_shadowIndex(device[i], i & 0x01)] == tx.dac_code[i]) {
+            _dacWritesSkipped++;
+            continue;
+        }
+        batch.writeDAC(device[i], i & 0x01, tx.dac_code[i]);
+    }
+    batch.latchPending(tx.gpio);
+    
+    int64_t start = esp_timer_get_time();
+    bool ok = _executeLocked(batch);
+    _unlockDACs(power, signal);
+    if (!ok) {
+        // Only the bus (or a trip between validation and the batch) can fail here
+        return _rejectOutput(tx, _powerTripped ? OUTPUT_ERROR_TRIPPED : OUTPUT_ERROR_BUS,
+                             -1, 0.0f, 0.0f, 0.0f);
+    }
+    for (int p = 0; p < OUTPUT_PINS; p++) {
+        if (tx.pin_mode[p] != OUTPUT_PIN_ANALOG) continue;
+        // Duty first, so an attached pin never runs a stale duty
+        ledcWrite(p, tx.pin_duty[p]);
+        _attachLEDC(p, _mapOutputPin(p));
+        if (p < 4) _daAnalog[p] = false;
+        _setPinOutput(p, false);
+    }
+    tx.commit_us = (uint32_t)(esp_timer_get_time() - start);
+    return true;
 }
 
 float PocKETlabIO::_calculateTemperature(uint16_t rawADC) {
@@ -364,19 +1277,11 @@ float PocKETlabIO::_calculateTemperature(uint16_t rawADC) {
 
 // === DA channels (MCU-direct I/O) ===
 
-int PocKETlabIO::_mapDA(uint8_t channel) {
-    switch (channel) {
-        case 0: return PIN_DA0;
-        case 1: return PIN_DA1;
-        case 2: return PIN_DA2;
-        case 3: return PIN_DA3;
-        default: return -1;
-    }
-}
-
 void PocKETlabIO::configureDA(uint8_t channel, uint8_t mode, bool pullup) {
     int pin = _mapDA(channel);
     if (pin < 0) return;
+    _daAnalog[channel] = false;  // pinMode() takes the pad from the ADC
+    _setPinOutput(channel, mode == OUTPUT);
     if (mode == INPUT && pullup) {
         pinMode(pin, INPUT_PULLUP);
     } else {
@@ -387,6 +1292,8 @@ void PocKETlabIO::configureDA(uint8_t channel, uint8_t mode, bool pullup) {
 void PocKETlabIO::digitalWriteDA(uint8_t channel, bool level) {
     int pin = _mapDA(channel);
     if (pin < 0) return;
+    _daAnalog[channel] = false;
+    _setPinOutput(channel, true);
     pinMode(pin, OUTPUT); // ensure output
     digitalWrite(pin, level ? HIGH : LOW);
 }
@@ -394,6 +1301,8 @@ void PocKETlabIO::digitalWriteDA(uint8_t channel, bool level) {
 int PocKETlabIO::digitalReadDA(uint8_t channel) {
     int pin = _mapDA(channel);
     if (pin < 0) return 0;
+    _daAnalog[channel] = false;
+    _setPinOutput(channel, false);
     pinMode(pin, INPUT);
     return digitalRead(pin) == HIGH ? 1 : 0;
 }
@@ -401,31 +1310,34 @@ int PocKETlabIO::digitalReadDA(uint8_t channel) {
 float PocKETlabIO::analogReadDA(uint8_t channel) {
     int pin = _mapDA(channel);
     if (pin < 0) return 0.0f;
+    if (_scanRunning) {
+        // Reconnect a pad that GPIO/PWM use took over; the scan catches up within a frame
+        if (!_daAnalog[channel]) {
+            adc_gpio_init(ADC_UNIT_1, (adc_channel_t)digitalPinToAnalogChannel(pin));
+            _daAnalog[channel] = true;
+            _setPinOutput(channel, false);
+        }
+        return _readAnalogPin(pin);
+    }
+    _setPinOutput(channel, false);
     pinMode(pin, INPUT);
     uint16_t raw = analogRead(pin);
-    return (float)raw * 3.3f / 4095.0f; // Scale to voltage (assuming 3.3V ref)
+    return _linearize(raw) * 3.3f / 4095.0f; // Calibrated, 3.3V full scale
 }
 
 void PocKETlabIO::analogWriteDAVoltage(uint8_t channel, float voltage_v) {
     int pin = _mapDA(channel);
     if (pin < 0) return;
+    _daAnalog[channel] = false;
+    _setPinOutput(channel, false);
     _analogWriteVoltageLEDC(/*ledc_channel*/ channel, pin, voltage_v);
 }
 
-// === DB channels (GPIO33..36) ===
-int PocKETlabIO::_mapDB(uint8_t channel) {
-    switch (channel) {
-        case 0: return PIN_DB0;
-        case 1: return PIN_DB1;
-        case 2: return PIN_DB2;
-        case 3: return PIN_DB3;
-        default: return -1;
-    }
-}
-
+// === DB channels ===
 void PocKETlabIO::configureDB(uint8_t channel, uint8_t mode, bool pullup) {
     int pin = _mapDB(channel);
     if (pin < 0) return;
+    _setPinOutput(4 + channel, mode == OUTPUT);
     if (mode == INPUT && pullup) {
         pinMode(pin, INPUT_PULLUP);
     } else {
@@ -436,6 +1348,7 @@ void PocKETlabIO::configureDB(uint8_t channel, uint8_t mode, bool pullup) {
 void PocKETlabIO::digitalWriteDB(uint8_t channel, bool level) {
     int pin = _mapDB(channel);
     if (pin < 0) return;
+    _setPinOutput(4 + channel, true);
     pinMode(pin, OUTPUT);
     digitalWrite(pin, level ? HIGH : LOW);
 }
@@ -443,6 +1356,7 @@ void PocKETlabIO::digitalWriteDB(uint8_t channel, bool level) {
 int PocKETlabIO::digitalReadDB(uint8_t channel) {
     int pin = _mapDB(channel);
     if (pin < 0) return 0;
+    _setPinOutput(4 + channel, false);
     pinMode(pin, INPUT);
     return digitalRead(pin) == HIGH ? 1 : 0;
 }
@@ -452,6 +1366,7 @@ void PocKETlabIO::analogWriteDBVoltage(uint8_t channel, float voltage_v) {
     int ledc_ch = 4 + channel;
     int pin = _mapDB(channel);
     if (pin < 0) return;
+    _setPinOutput(4 + channel, false);
     _analogWriteVoltageLEDC((uint8_t)ledc_ch, pin, voltage_v);
 }
 
@@ -478,8 +1393,8 @@ void PocKETlabIO::_analogWriteVoltageLEDC(uint8_t ledc_channel, int pin, float v
     if (voltage_v < 0.0f) voltage_v = 0.0f;
     if (voltage_v > 3.3f) voltage_v = 3.3f;
     // Configure LEDC channel at 5kHz, 10-bit resolution
-    const uint32_t freq = 5000;
-    const uint8_t bits = 10;
+    const uint32_t freq = PWM_OUTPUT_FREQUENCY;
+    const uint8_t bits = PWM_OUTPUT_BITS;
     _ensureLEDCSetup(ledc_channel, /*timer*/ 0, freq, bits);
     _attachLEDC(ledc_channel, pin);
     uint32_t max_duty = (1u << bits) - 1u;
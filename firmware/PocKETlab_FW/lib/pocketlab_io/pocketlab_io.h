@@ -2,29 +2,43 @@
 #define POCKETLAB_IO_H
 
 #include <Arduino.h>
-#include <SPI.h>
-#include "MCP_ADC.h"
-#include "MCP_DAC.h"
-#include "../../include/pin_definitions.h"
+#include "spi_bus.h"
+#include "board_calibration.h"
+#include <esp_timer.h>
+#include <esp_adc_cal.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "board_profile.h"
 
 // ADC configuration
-#define ADC_REFERENCE_VOLTAGE 3.3f  // 3.3V reference
+#define ADC_REFERENCE_VOLTAGE BoardProfile::adc_reference
 #define ADC_MAX_VALUE 4095          // 12-bit ADC (2^12 - 1)
 
 // DAC configuration  
-#define DAC_REFERENCE_VOLTAGE 2.048f // 2.048V with 1x gain (safer default)
+#define DAC_REFERENCE_VOLTAGE BoardProfile::dac_reference  // 2.048V with 1x gain
 #define DAC_MAX_VALUE 4095           // 12-bit DAC (2^12 - 1)
+#define DAC_SHADOW_UNKNOWN 0xFFFF    // Shadow register state when the chip's input register is unknown
 
-// Signal path amplifier configuration
-#define SIGNAL_AMPLIFIER_GAIN 6.7f   // Op-amp gain on signal outputs
-#define SIGNAL_FEEDBACK_GAIN 1.0f    // FB_A0/A1 are 1:1 (before amplifier)
+// Hardware timer used for timed LDAC edges (1 MHz tick from the 80 MHz APB clock)
+#define LATCH_TIMER_NUM 0
+#define LATCH_TIMER_DIVIDER 80
 
-// ADC input attenuator configuration (MCP3202 inputs)
-#define ADC_DIVIDER_LOSS 1.6663
-#define ADC_INPUT_LOSS 6.8 * ADC_DIVIDER_LOSS  // Input voltage divider gain
+// Feedback scan: continuous (DMA) ADC1 conversions of every analog MCU pin
+#define FEEDBACK_SCAN_RATE 80000         // Conversions per second over the whole pattern
+#define FEEDBACK_PATTERN_LENGTH 20       // 4 groups: FB_VOUT, FB_IOUT, FB_GOUT + 2 slower pins
+#define FEEDBACK_FRAME_RESULTS 40        // Conversions per DMA frame: 2 patterns, 500 us
+#define FEEDBACK_FRAME_US (FEEDBACK_FRAME_RESULTS * 1000000 / FEEDBACK_SCAN_RATE)   // 500 us
+#define FEEDBACK_FRAME_RATE (FEEDBACK_SCAN_RATE / FEEDBACK_FRAME_RESULTS)           // 2 kHz: fastest power feedback sampling
+#define FEEDBACK_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define FEEDBACK_DEFAULT_VREF 1100       // mV, used only when the eFuse holds no calibration
+#define FEEDBACK_FILTER_SHIFT 2          // Default average over 2^shift frames
+#define PROTECTION_CHANNELS 3            // FB_VOUT, FB_IOUT, FB_GOUT (the first feedback sources)
 
-// Power amplifier configuration
-#define POWER_AMPLIFIER_GAIN 6.6f    // Op-amp gain on power outputs
+// Front-end gains of the selected board profile (board_profile.h)
+#define SIGNAL_AMPLIFIER_GAIN BoardProfile::signal_gain   // Op-amp gain on signal outputs
+#define SIGNAL_FEEDBACK_GAIN 1.0f                          // FB_A0/A1 are 1:1 (before amplifier)
+#define ADC_INPUT_LOSS BoardProfile::input_loss            // Input voltage divider gain (MCP3202 inputs)
+#define POWER_AMPLIFIER_GAIN BoardProfile::power_gain      // Op-amp gain on power outputs
 
 // Channel definitions for signal ADC/DAC
 enum SignalChannel {
@@ -32,11 +46,124 @@ enum SignalChannel {
     SIGNAL_CHANNEL_B = 1
 };
 
+// Pins of the feedback scan. Conversions per frame: 8 for the power feedback pins,
+// 4 for FB_AO, 2 for the others (16, 8 and 4 kS/s).
+enum FeedbackSource {
+    FEEDBACK_VOUT = 0,
+    FEEDBACK_IOUT,
+    FEEDBACK_GOUT,
+    FEEDBACK_A0,
+    FEEDBACK_A1,
+    FEEDBACK_DA0,
+    FEEDBACK_DA1,
+    FEEDBACK_DA2,
+    FEEDBACK_DA3,
+    FEEDBACK_TEMP,
+    FEEDBACK_SOURCES
+};
+
+// Power protection thresholds (engineering units, 0 = check off)
+struct ProtectionConfig {
+    float ovp_voltage;       // Output voltage (FB_VOUT), V
+    float ocp_current;       // Output current (FB_IOUT), A
+    float gout_voltage;      // Floating ground (FB_GOUT), V
+    uint16_t debounce;       // Consecutive conversions over a threshold before tripping
+};
+
+enum ProtectionTrip {
+    PROTECTION_TRIP_NONE = 0,
+    PROTECTION_TRIP_OVP,
+    PROTECTION_TRIP_OCP,
+    PROTECTION_TRIP_GOUT
+};
+
+// Latched trip record. Times are esp_timer microseconds; the sample time of the first
+// over-threshold conversion is derived from its position in the DMA stream.
+struct ProtectionTripInfo {
+    ProtectionTrip cause;
+    float value;             // Converted value of the conversion that tripped
+    float threshold;
+    int64_t first_over_us;   // First conversion of the debounced run
+    int64_t detect_us;       // Its DMA frame reached the protection task
+    int64_t zeroed_us;       // Power DAC zeroed and latched
+    uint32_t count;          // Trips since boot
+};
+
 // Power control ranges
 #define POWER_VOLTAGE_MIN 0.0f
-#define POWER_VOLTAGE_MAX 20.0f  // Assuming 20V max from power supply
+#define POWER_VOLTAGE_MAX BoardProfile::power_voltage_max
 #define POWER_CURRENT_MIN 0.0f
-#define POWER_CURRENT_MAX 3.0f   // Assuming 3A max current
+#define POWER_CURRENT_MAX BoardProfile::power_current_max
+
+// PWM (LEDC) outputs on the DA/DB lines: 0-3.3 V as duty cycle
+#define PWM_OUTPUT_FREQUENCY 5000
+#define PWM_OUTPUT_BITS 10
+#define OUTPUT_DIGITAL_THRESHOLD 1.65f   // A digital line set to at least this voltage is high
+
+// DAC setpoints of an output transaction
+enum OutputDac : uint8_t {
+    OUTPUT_POWER_VOLTAGE = 0,    // Power DAC channel 0
+    OUTPUT_POWER_CURRENT,        // Power DAC channel 1
+    OUTPUT_SIGNAL_A,             // Signal DAC channel 0
+    OUTPUT_SIGNAL_B,             // Signal DAC channel 1
+    OUTPUT_DACS
+};
+
+#define OUTPUT_PINS 8            // DA0-DA3, then DB0-DB3
+
+enum OutputPinMode : uint8_t {
+    OUTPUT_PIN_KEEP = 0,         // Not part of the transaction
+    OUTPUT_PIN_DIGITAL,
+    OUTPUT_PIN_ANALOG            // PWM
+};
+
+enum OutputError : uint8_t {
+    OUTPUT_OK = 0,
+    OUTPUT_ERROR_RANGE,          // A value outside its output's range
+    OUTPUT_ERROR_TRIPPED,        // Non-zero power setting while protection holds the output off
+    OUTPUT_ERROR_NOT_READY,      // I/O not initialized
+    OUTPUT_ERROR_BUS             // SPI bus failure during the commit
+};
+
+// A set of output setpoints applied all-or-nothing by PocKETlabIO::commitOutputs().
+// Staging only records values. Validation range-checks every value and converts it to a DAC
+// code, GPIO mask or PWM duty; a single bad value rejects the whole set before any output moves.
+struct OutputTransaction {
+    bool dac_set[OUTPUT_DACS];
+    float dac_value[OUTPUT_DACS];            // Final output voltage (V) or current limit (A)
+    OutputPinMode pin_mode[OUTPUT_PINS];
+    float pin_value[OUTPUT_PINS];            // V
+
+    // Filled in by validation
+    uint16_t dac_code[OUTPUT_DACS];
+    uint32_t pin_duty[OUTPUT_PINS];
+    uint32_t gpio[4];                        // set/clear GPIO0-31, set/clear GPIO32+
+    OutputError error;
+    const char* message;                     // Text for error (nullptr while valid)
+    int8_t error_output;                     // OutputDac, or OUTPUT_DACS + pin index; -1 = not one value
+    float error_value;
+    float error_min;
+    float error_max;
+
+    // Filled in by the commit: time from the DAC writes to the last PWM update
+    uint32_t commit_us;
+
+    OutputTransaction() { clear(); }
+    void clear();
+    bool isEmpty() const;
+
+    void setPowerVoltage(float voltage) { _setDac(OUTPUT_POWER_VOLTAGE, voltage); }
+    void setPowerCurrent(float current) { _setDac(OUTPUT_POWER_CURRENT, current); }
+    void setSignalVoltage(SignalChannel channel, float voltage) {
+        _setDac(channel == SIGNAL_CHANNEL_A ? OUTPUT_SIGNAL_A : OUTPUT_SIGNAL_B, voltage);
+    }
+    void setDA(uint8_t channel, OutputPinMode mode, float voltage) { _setPin(channel, 0, mode, voltage); }
+    void setDB(uint8_t channel, OutputPinMode mode, float voltage) { _setPin(channel, 4, mode, voltage); }
+
+private:
+    void _setDac(OutputDac dac, float value) { dac_set[dac] = true; dac_value[dac] = value; }
+    void _setPin(uint8_t channel, uint8_t base, OutputPinMode mode, float voltage);
+};
 
 class PocKETlabIO {
 public:
@@ -76,13 +203,118 @@ public:
     float getExpectedSignalOutput(SignalChannel channel);
     
     // === Advanced Control ===
-    // Simultaneous DAC update (using LDAC)
+    // Simultaneous DAC update (using LDAC). Pulses only when a DAC write has run since the last pulse.
     void updateAllDACs();
     
+    // DAC write coalescing: each channel has a shadow of its input register, and a write of the
+    // code it already holds sends no SPI frame
+    uint32_t getDacWrites() const { return _dacWrites; }                     // Frames sent
+    uint32_t getDacWritesSkipped() const { return _dacWritesSkipped; }       // Unchanged codes dropped
+    uint32_t getLatchesSkipped() const { return _bus.getLatchesSkipped(); }  // updateAllDACs() without pending writes
+    
     // Raw ADC/DAC access
     uint16_t readRawADC(uint8_t channel);
     bool writeRawDAC(uint8_t dac, uint8_t channel, uint16_t value);
     
+    // Burst read of both signal ADC channels (A,B interleaved) in one SPI transaction
+    // Either buffer may be nullptr to skip that channel. Returns the number of samples read.
+    size_t readSignalBurst(uint16_t* rawA, uint16_t* rawB, size_t count);
+    
+    // Run a batch of bus operations back to back, e.g. write both DACs, latch, then read the ADC.
+    // Power DAC writes obey the protection latch (after a trip the batch may only write zeros).
+    bool executeBatch(SpiBatch& batch);
+    
+    // === Output transactions ===
+    // Check a staged set of setpoints without touching the hardware: ranges, the power trip
+    // latch, conversion to codes. On failure tx.error/tx.message say why and tx.error_output which value.
+    bool validateOutputs(OutputTransaction& tx);
+    
+    // Validate, then apply everything at once: all DAC codes in one bus batch ending with a single
+    // LDAC pulse that also switches the digital lines (lines that were not outputs yet are driven
+    // to their new level just before), then the PWM duties. Nothing is written if validation fails.
+    bool commitOutputs(OutputTransaction& tx);
+    
+    // Convert a (possibly averaged) raw signal ADC code to input voltage (compensated for attenuator)
+    float signalVoltageFromRaw(float raw, SignalChannel channel = SIGNAL_CHANNEL_A) const;
+    
+    // Signal DAC code for a final output voltage (after the amplifier), as setSignalVoltage() writes it.
+    // For precomputed waveforms played with writeRawDAC() + updateAllDACs().
+    uint16_t signalVoltageToCode(float voltage, SignalChannel channel = SIGNAL_CHANNEL_A) const;
+    
+    // Power DAC codes for an output voltage and a current limit, as setPowerVoltage()/setPowerCurrent()
+    // write them (power DAC channel 0 and 1). All these conversions apply the board calibration.
+    uint16_t powerVoltageToCode(float voltage) const;
+    uint16_t powerCurrentToCode(float current) const;
+    
+    // Raw FB_VOUT/FB_IOUT codes from the internal ADC and their conversion to output values.
+    // While the scan runs the code is the newest frame, unfiltered: a new value every
+    // FEEDBACK_FRAME_US, so time-resolved callers must not sample faster than FEEDBACK_FRAME_RATE.
+    uint16_t readPowerVoltageRaw();
+    float powerVoltageFromRaw(float raw) const;
+    uint16_t readPowerCurrentRaw();
+    float powerCurrentFromRaw(float raw) const;
+    
+    // FB_VOUT/FB_IOUT codes for control loops: the newest scan frame (8 conversions each), without
+    // the frame-to-frame filter. Without the scan: samples ADC1 one-shot conversions, interleaved.
+    // Either pointer may be nullptr.
+    void readPowerFeedbackFast(float* voltageRaw, float* currentRaw, uint8_t samples);
+    
+    // Same codes as readPowerFeedbackFast(), but from a frame that completed after the call, so
+    // consecutive calls never return the same frame (settle checks). Waits up to two frames;
+    // false if the scan stalled. Without the scan: one-shot conversions.
+    bool readPowerFeedbackFresh(float* voltageRaw, float* currentRaw);
+    
+    // === Feedback scan ===
+    // Started by begin(). Conversions are corrected with the eFuse calibration and kept as
+    // linearized 12-bit codes (3.3 V full scale), so the *FromRaw() conversions apply unchanged.
+    // readPower*(), readGroundVoltage(), readSignalFeedback(), readTemperature() and analogReadDA()
+    // return the latest filtered value without touching the hardware (status and regulation; the
+    // filter lags by about 2^shift frames, so sampled data uses the Raw/Fast/Fresh reads).
+    bool isFeedbackScanRunning() const { return _scanRunning; }
+    float readFeedbackCode(FeedbackSource source) const;      // Filtered, linearized code
+    float readFeedbackVoltage(FeedbackSource source) const;   // Same as the pin voltage
+    void setFeedbackFilter(uint8_t shift);                    // Average over 2^shift frames (0-6)
+    uint32_t getFeedbackFrames() const { return _scanFrames; }
+    uint32_t getFeedbackOverruns() const { return _scanOverruns; }  // DMA frames lost
+    const char* getFeedbackCalibration() const;  // "efuse_tp_fit", "efuse_tp", "efuse_vref", "default_vref"
+    
+    // === Power protection ===
+    // Arms the threshold checks, made by the feedback scan task on every conversion of the
+    // power feedback pins. Calling it again replaces the thresholds.
+    bool startProtection(const ProtectionConfig& config);
+    void stopProtection();
+    bool isProtectionRunning() const { return _protectArmed; }
+    const ProtectionConfig& getProtectionConfig() const { return _protectConfig; }
+    
+    // A trip zeroes both power DAC channels and latches: further non-zero power DAC writes
+    // fail until clearPowerTrip(). Outputs stay at zero after clearing.
+    bool isPowerTripped() const { return _powerTripped; }
+    ProtectionTripInfo getLastTrip() const { return _lastTrip; }
+    void clearPowerTrip();
+    
+    // === Hardware-timed latch ===
+    // Pulses LDAC now and arms a one-shot hardware timer that pulses it again after width_us,
+    // so the time between the two output updates does not depend on task scheduling.
+    // Stage the next DAC codes between the two edges. Returns the esp_timer time of the first edge.
+    int64_t startLatchPulse(uint32_t width_us);
+    
+    // Arm the hardware timer for a single LDAC edge delay_us from now, without pulsing first.
+    // Returns the esp_timer time the edge is due at.
+    int64_t scheduleLatch(uint32_t delay_us);
+    
+    // Same as scheduleLatch() for an absolute esp_timer time; a time already past fires at once.
+    int64_t scheduleLatchAt(int64_t due_us);
+    
+    // GPIO set/clear masks (GPIO0-31 and GPIO32+) written by the next timed LDAC edge,
+    // so digital lines switch together with the DAC outputs. Applied once, then cleared.
+    void stageLatchGpio(uint32_t set_low, uint32_t clear_low, uint32_t set_high, uint32_t clear_high);
+    
+    // Block until the timed LDAC edge has fired. Returns false on timeout.
+    bool waitLatchPulse(uint32_t timeout_ms);
+    
+    // esp_timer time (us) at which the last timed LDAC edge fired
+    int64_t getLastTimedLatch() const;
+    
     // Temperature monitoring
     float readTemperature();  // From NTC probe on GPIO10
     
@@ -95,13 +327,27 @@ public:
     float getPowerCurrentRange() const { return POWER_CURRENT_MAX; }
     float getSignalVoltageRange() const { return DAC_REFERENCE_VOLTAGE * SIGNAL_AMPLIFIER_GAIN; }
     float getSignalInputRange() const { return ADC_REFERENCE_VOLTAGE * ADC_INPUT_LOSS; }
+    
+    // Per-board calibration of the signal DACs, power voltage DAC and signal ADC channels.
+    // begin() loads the table from NVS; maps without a fit use the nominal scaling.
+    const BoardCalibration& getCalibration() const { return _calibration; }
+    const CalibrationCoefficients& getConversion(CalibrationMap map) const { return _conv[map]; }   // As applied to codes
+    void setCalibration(const BoardCalibration& calibration);   // Applied at once, not saved
+    bool saveCalibration();
+    void resetCalibration(bool erase);                          // Back to nominal; erase also clears NVS
+    bool isCalibrated(CalibrationMap map) const { return map < CAL_MAPS && _calibration.map[map].points > 0; }
+    float getNominalCalibrationGain(CalibrationMap map) const;  // V per LSB of the nominal scaling
 
     // Status and diagnostics
     bool isInitialized() const { return _initialized; }
     void printStatus();
+    static const char* getBoardName() { return BoardProfile::name; }
+
+    // GPIO of an output line: 0..3 = DA0..DA3, 4..7 = DB0..DB3 (-1 outside)
+    static int outputPin(uint8_t pin) { return pin < OUTPUT_PINS ? kOutputPins[pin] : -1; }
 
     // === DA Channels (MCU-direct I/O) ===
-    // Channels: 0..3 map to PIN_DA0..PIN_DA3
+    // Channels: 0..3 map to the profile's DA0..DA3 pins
     // Capabilities: digital input/output, analog input (no analog output)
     void configureDA(uint8_t channel, uint8_t mode, bool pullup = false); // mode: INPUT/OUTPUT/INPUT_PULLUP
     void digitalWriteDA(uint8_t channel, bool level);
@@ -111,7 +357,7 @@ public:
     // Optional PWM-based analog-style write (0..3.3V mapped to duty cycle)
     void analogWriteDAVoltage(uint8_t channel, float voltage_v);
 
-    // === DB Channels (GPIO33..36) ===
+    // === DB Channels (GPIO33..36 on rev 1) ===
     // Exposed as general-purpose lines; allow digital I/O and PWM-based analog-style output
     void configureDB(uint8_t channel, uint8_t mode, bool pullup = false);
     void digitalWriteDB(uint8_t channel, bool level);
@@ -119,18 +365,18 @@ public:
     void analogWriteDBVoltage(uint8_t channel, float voltage_v);
 
 private:
-    // Hardware objects
-    MCP3202 *_signalADC;      // U8 - Signal ADC (MCP3202)
-    MCP4822 *_signalDAC;      // U5 - Signal DAC (MCP4822) 
-    MCP4822 *_powerDAC;       // U6 - Power DAC (MCP4822)
+    // Hardware: signal ADC (U8, MCP3202), signal DAC (U5) and power DAC (U6, MCP4822) on one SPI bus
+    SpiBus _bus;
     
     // Configuration
     float _adcRefVoltage;
     float _dacRefVoltage;
     bool _initialized;
     
-    // SPI settings
-    SPISettings _spiSettings;
+    // Board calibration and the conversion coefficients prepared from it
+    BoardCalibration _calibration;
+    CalibrationCoefficients _conv[CAL_MAPS];
+    void _updateConversions();
     
     // Internal helper functions
     float _rawToVoltage(uint16_t raw, float refVoltage, uint16_t maxValue);
@@ -139,13 +385,79 @@ private:
     
     // ADC reading helpers
     float _readAnalogPin(int pin);  // For feedback pins using built-in ADC
+    uint16_t _readSignalADC(uint8_t channel);      // Single MCP3202 conversion through the bus owner
+    bool _writeDAC(SpiDevice dac, uint8_t channel, uint16_t value);
+    
+    // DAC shadow registers: signal A/B, power voltage/current (last code written, DAC_SHADOW_UNKNOWN
+    // before the first write or after a failed one)
+    volatile uint16_t _dacShadow[4];
+    volatile uint32_t _dacWrites;
+    volatile uint32_t _dacWritesSkipped;
+    static uint8_t _shadowIndex(SpiDevice dac, uint8_t channel) { return (dac == SPI_DEVICE_POWER_DAC ? 2 : 0) + (channel & 0x01); }
+    void _trackBatch(const SpiBatch& batch, bool ok);
+    void _invalidateDacShadow();
+    
+    // One-shot feedback ADC path (used while the scan is not running)
+    bool _fastAdcReady;
+    void _prepareFastAdc();
+    
+    // Power DAC writes and the protection trip: the trip waits for at most one frame in flight
+    SemaphoreHandle_t _powerMutex;
+    volatile bool _powerTripped;
+    bool _writePowerDAC(uint16_t value, uint8_t channel);
+    
+    // Signal DAC shadow compare, write and shadow update as one step. Taken after _powerMutex.
+    SemaphoreHandle_t _signalMutex;
+    void _lockDACs(bool power, bool signal);
+    void _unlockDACs(bool power, bool signal);
+    bool _executeLocked(SpiBatch& batch);   // Caller holds the mutexes of the DACs the batch writes
+    
+    // Feedback scan
+    volatile bool _scanRunning;
+    TaskHandle_t _scanTaskHandle;
+    int8_t _scanSource[16];                          // ADC1 channel -> FeedbackSource, -1 = not scanned
+    volatile float _scanFrame[FEEDBACK_SOURCES];     // Newest frame averages (linearized codes)
+    volatile float _scanFiltered[FEEDBACK_SOURCES];
+    volatile uint8_t _scanFilterShift;
+    volatile uint32_t _scanFrames;
+    volatile uint32_t _scanOverruns;
+    bool _daAnalog[4];                               // DA pad connected to the ADC (not taken by GPIO/PWM)
+    uint8_t _pinOutput;                              // DA0-3/DB0-3 (bits 0-7) configured as GPIO outputs
+    void _setPinOutput(uint8_t pin, bool output) {
+        _pinOutput = output ? (_pinOutput | (1u << pin)) : (_pinOutput & ~(1u << pin));
+    }
+    esp_adc_cal_characteristics_t _adcCal;
+    esp_adc_cal_value_t _adcCalType;
+    bool _adcCalReady;
+    bool _startFeedbackScan();
+    void _stopFeedbackScan();
+    static void _feedbackScanTaskWrapper(void* parameter);
+    void _feedbackScanTask();
+    float _linearize(float raw) const;               // ADC code -> linearized code
+    uint16_t _rawLimit(float linear) const;          // Highest ADC code at or below a linearized code
+    int _feedbackSource(int pin) const;
+    
+    // Power protection, checked by the scan task
+    volatile bool _protectArmed;
+    volatile uint32_t _protectArmCount;              // Bumped on every arm and trip clear: the scan restarts its debounce
+    ProtectionConfig _protectConfig;
+    uint16_t _protectLimit[PROTECTION_CHANNELS];     // Thresholds as ADC codes
+    ProtectionTripInfo _lastTrip;
+    void _tripPower(uint8_t slot, uint16_t code, int64_t first_over_us, int64_t detect_us);
+    float _feedbackFromCode(float linear) const { return linear * 3.3f / 4095.0f * POWER_AMPLIFIER_GAIN; }
+    
+    // Hardware latch timer
+    hw_timer_t* _latchTimer;
+    void _prepareLatchTimer(uint32_t delay_us);
     
     // Temperature calculation helper
     float _calculateTemperature(uint16_t rawADC);
-    // DA channel helper
-    int _mapDA(uint8_t channel);
-    // DB channel helper
-    int _mapDB(uint8_t channel);
+    // DA/DB channel helpers: lookups in the profile's pin table
+    static const int kOutputPins[OUTPUT_PINS];
+    static int _mapDA(uint8_t channel) { return channel < 4 ? kOutputPins[channel] : -1; }
+    static int _mapDB(uint8_t channel) { return channel < 4 ? kOutputPins[4 + channel] : -1; }
+    static int _mapOutputPin(uint8_t pin) { return outputPin(pin); }
+    bool _rejectOutput(OutputTransaction& tx, OutputError error, int8_t output, float value, float min, float max);
 
     // PWM/LEDC helpers
     void _ensureLEDCSetup(uint8_t channel, uint8_t timer, uint32_t freq_hz, uint8_t resolution_bits);
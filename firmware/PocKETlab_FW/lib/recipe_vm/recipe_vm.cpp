@@ -0,0 +1,426 @@
+#include "recipe_vm.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+RecipeVM::RecipeVM(PocKETlabIO& io)
+    : _io(io), _emit(nullptr), _code_length(0), _string_count(0), _flag(false), _checks(0), _failures(0),
+      _instructions(0), _error_pc(0), _error(""), _digital_mask(0) {
+    memset(_reg, 0, sizeof(_reg));
+}
+
+int RecipeVM::_operandBytes(uint8_t opcode) {
+    switch (opcode) {
+        case RECIPE_OP_END:       return 0;
+        case RECIPE_OP_STAGE:     return 2;
+        case RECIPE_OP_LATCH:     return 0;
+        case RECIPE_OP_SET:       return 2;
+        case RECIPE_OP_DIGITAL:   return 2;
+        case RECIPE_OP_WAIT_US:   return 4;
+        case RECIPE_OP_MEASURE:   return 3;
+        case RECIPE_OP_SETTLE:    return 10;
+        case RECIPE_OP_LOAD:      return 5;
+        case RECIPE_OP_MOV:       return 2;
+        case RECIPE_OP_ADD:
+        case RECIPE_OP_SUB:
+        case RECIPE_OP_MUL:
+        case RECIPE_OP_DIV:       return 3;
+        case RECIPE_OP_CHECK:     return 10;
+        case RECIPE_OP_EMIT:      return 2;
+        case RECIPE_OP_JMP:
+        case RECIPE_OP_JMP_IF:
+        case RECIPE_OP_JMP_IFNOT: return 2;
+        case RECIPE_OP_DJNZ:      return 3;
+        case RECIPE_OP_JLT:       return 4;
+        case RECIPE_OP_ABORT:     return 1;
+        default:                  return -1;
+    }
+}
+
+bool RecipeVM::load(const uint8_t* image, size_t length, String& error) {
+    _code_length = 0;
+    _string_count = 0;
+
+    if (length < 6 || memcmp(image, "PLRB", 4) != 0) {
+        error = "Not a recipe image";
+        return false;
+    }
+    if (image[4] != RECIPE_VERSION) {
+        error = "Unsupported recipe version " + String(image[4]);
+        return false;
+    }
+    uint8_t strings = image[5];
+    if (strings > RECIPE_MAX_STRINGS) {
+        error = "Too many names (max " + String(RECIPE_MAX_STRINGS) + ")";
+        return false;
+    }
+
+    size_t offset = 6;
+    for (uint8_t i = 0; i < strings; i++) {
+        if (offset >= length) {
+            error = "Truncated string table";
+            return false;
+        }
+        uint8_t len = image[offset++];
+        if (len > RECIPE_MAX_STRING_LENGTH || offset + len > length) {
+            error = "Bad name " + String(i);
+            return false;
+        }
+        memcpy(_strings[i], &image[offset], len);
+        _strings[i][len] = '\0';
+        offset += len;
+    }
+
+    size_t code_length = length - offset;
+    if (code_length == 0 || code_length > RECIPE_MAX_CODE) {
+        error = "Code size must be 1 to " + String(RECIPE_MAX_CODE) + " bytes";
+        return false;
+    }
+    memcpy(_code, &image[offset], code_length);
+    _code_length = code_length;
+    _string_count = strings;
+
+    if (!_validate(error)) {
+        _code_length = 0;
+        _string_count = 0;
+        return false;
+    }
+    return true;
+}
+
+bool RecipeVM::_validate(String& error) {
+    // First pass: instruction boundaries, so jumps can only land on an opcode
+    static uint8_t starts[RECIPE_MAX_CODE / 8];
+    memset(starts, 0, sizeof(starts));
+    uint16_t pc = 0;
+    while (pc < _code_length) {
+        int operands = _operandBytes(_code[pc]);
+        if (operands < 0) {
+            error = "Unknown opcode at " + String(pc);
+            return false;
+        }
+        if (pc + 1 + operands > _code_length) {
+            error = "Truncated instruction at " + String(pc);
+            return false;
+        }
+        starts[pc >> 3] |= 1 << (pc & 7);
+        pc += 1 + operands;
+    }
+
+    // Second pass: operand ranges
+    for (pc = 0; pc < _code_length; pc += 1 + _operandBytes(_code[pc])) {
+        const uint8_t op = _code[pc];
+        const uint8_t* a = &_code[pc + 1];
+        bool ok = true;
+        uint16_t target = 0;
+        bool jumps = false;
+        switch (op) {
+            case RECIPE_OP_STAGE:
+            case RECIPE_OP_SET:
+                ok = a[0] < RECIPE_OUT_COUNT && a[1] < RECIPE_REGISTERS;
+                break;
+            case RECIPE_OP_DIGITAL:
+                ok = a[0] < 8 && a[1] <= 1;
+                break;
+            case RECIPE_OP_MEASURE:
+                ok = a[0] < RECIPE_REGISTERS && a[1] < RECIPE_IN_COUNT && a[2] >= 1 && a[2] <= RECIPE_MAX_SAMPLES;
+                break;
+            case RECIPE_OP_SETTLE:
+                ok = a[0] < RECIPE_REGISTERS && a[1] < RECIPE_IN_COUNT && _readF32(pc + 3) >= 0.0f &&
+                     _readU16(pc + 7) >= 50 && _readU16(pc + 9) >= 1;
+                break;
+            case RECIPE_OP_LOAD:
+                ok = a[0] < RECIPE_REGISTERS && !isnan(_readF32(pc + 2));
+                break;
+            case RECIPE_OP_MOV:
+                ok = a[0] < RECIPE_REGISTERS && a[1] < RECIPE_REGISTERS;
+                break;
+            case RECIPE_OP_ADD:
+            case RECIPE_OP_SUB:
+            case RECIPE_OP_MUL:
+            case RECIPE_OP_DIV:
+                ok = a[0] < RECIPE_REGISTERS && a[1] < RECIPE_REGISTERS && a[2] < RECIPE_REGISTERS;
+                break;
+            case RECIPE_OP_CHECK:
+                ok = a[0] < _string_count && a[1] < RECIPE_REGISTERS && _readF32(pc + 3) <= _readF32(pc + 7);
+                break;
+            case RECIPE_OP_EMIT:
+                ok = a[0] < _string_count && a[1] < RECIPE_REGISTERS;
+                break;
+            case RECIPE_OP_JMP:
+            case RECIPE_OP_JMP_IF:
+            case RECIPE_OP_JMP_IFNOT:
+                target = _readU16(pc + 1);
+                jumps = true;
+                break;
+            case RECIPE_OP_DJNZ:
+                ok = a[0] < RECIPE_REGISTERS;
+                target = _readU16(pc + 2);
+                jumps = true;
+                break;
+            case RECIPE_OP_JLT:
+                ok = a[0] < RECIPE_REGISTERS && a[1] < RECIPE_REGISTERS;
+                target = _readU16(pc + 3);
+                jumps = true;
+                break;
+            case RECIPE_OP_ABORT:
+                ok = a[0] < _string_count;
+                break;
+            default:
+                break;
+        }
+        // A jump to the very end is a valid way to finish
+        if (jumps && target != _code_length && (target > _code_length || !(starts[target >> 3] & (1 << (target & 7))))) {
+            error = "Bad jump target at " + String(pc);
+            return false;
+        }
+        if (!ok) {
+            error = "Operand out of range at " + String(pc);
+            return false;
+        }
+    }
+    return true;
+}
+
+float RecipeVM::_readF32(uint16_t pc) const {
+    float value;
+    memcpy(&value, &_code[pc], sizeof(value));  // Little-endian, unaligned
+    return value;
+}
+
+uint16_t RecipeVM::_readU16(uint16_t pc) const {
+    return (uint16_t)_code[pc] | ((uint16_t)_code[pc + 1] << 8);
+}
+
+uint32_t RecipeVM::_readU32(uint16_t pc) const {
+    return (uint32_t)_code[pc] | ((uint32_t)_code[pc + 1] << 8) |
+           ((uint32_t)_code[pc + 2] << 16) | ((uint32_t)_code[pc + 3] << 24);
+}
+
+const char* RecipeVM::getString(uint8_t id) const {
+    return id < _string_count ? _strings[id] : "";
+}
+
+bool RecipeVM::_stage(uint8_t output, float value) {
+    // The setters reject values outside the channel range
+    switch (output) {
+        case RECIPE_OUT_SIGNAL_A:       return _io.setSignalVoltage(SIGNAL_CHANNEL_A, value);
+        case RECIPE_OUT_SIGNAL_B:       return _io.setSignalVoltage(SIGNAL_CHANNEL_B, value);
+        case RECIPE_OUT_POWER_VOLTAGE:  return _io.setPowerVoltage(value);
+        case RECIPE_OUT_CURRENT_LIMIT:  return _io.setPowerCurrent(value);
+        default:                        return false;
+    }
+}
+
+float RecipeVM::_measure(uint8_t input, int samples) {
+    if (input <= RECIPE_IN_DEVICE_VOLTAGE) {
+        uint16_t raw_a[RECIPE_MAX_SAMPLES], raw_b[RECIPE_MAX_SAMPLES];
+        _io.readSignalBurst(raw_a, raw_b, samples);
+        uint32_t sum_a = 0, sum_b = 0;
+        for (int i = 0; i < samples; i++) {
+            sum_a += raw_a[i];
+            sum_b += raw_b[i];
+        }
+        float voltage_a = _io.signalVoltageFromRaw((float)sum_a / samples);
+        float voltage_b = _io.signalVoltageFromRaw((float)sum_b / samples, SIGNAL_CHANNEL_B);
+        if (input == RECIPE_IN_SIGNAL_A) return voltage_a;
+        if (input == RECIPE_IN_SIGNAL_B) return voltage_b;
+        return voltage_a - voltage_b;
+    }
+    if (input == RECIPE_IN_TEMPERATURE) {
+        return _io.readTemperature();
+    }
+    // One scan frame per sample: the filtered reading lags and would repeat within a SETTLE interval
+    float sum = 0.0f;
+    for (int i = 0; i < samples; i++) {
+        float voltage_raw = 0.0f, current_raw = 0.0f;
+        _io.readPowerFeedbackFresh(&voltage_raw, &current_raw);
+        sum += input == RECIPE_IN_POWER_VOLTAGE ? _io.powerVoltageFromRaw(voltage_raw) : _io.powerCurrentFromRaw(current_raw);
+    }
+    return sum / samples;
+}
+
+void RecipeVM::_waitUs(uint32_t us, volatile bool& running) {
+    int64_t t_end = esp_timer_get_time() + us;
+    int64_t remaining_us = us;
+    while (running && remaining_us > 3000) {
+        // Sleep in slices so a stop request is seen, busy-wait the last 2ms
+        vTaskDelay(pdMS_TO_TICKS(min(remaining_us - 2000, (int64_t)50000) / 1000));
+        remaining_us = t_end - esp_timer_get_time();
+    }
+    while (running && esp_timer_get_time() < t_end) {
+    }
+}
+
+RecipeStatus RecipeVM::run(volatile bool& running, uint32_t timeout_ms) {
+    memset(_reg, 0, sizeof(_reg));
+    _flag = false;
+    _checks = 0;
+    _failures = 0;
+    _instructions = 0;
+    _error_pc = 0;
+    _error = "";
+    _digital_mask = 0;
+
+    const int64_t t_start = esp_timer_get_time();
+    const int64_t timeout_us = (int64_t)timeout_ms * 1000;
+    int64_t last_yield = t_start;
+    RecipeResult result;
+    uint16_t pc = 0;
+
+    while (pc < _code_length) {
+        if (!running) {
+            _error_pc = pc;
+            return RECIPE_STOPPED;
+        }
+        int64_t now = esp_timer_get_time();
+        if (now - t_start > timeout_us) {
+            _error_pc = pc;
+            _error = "Time budget exceeded";
+            return RECIPE_TIMEOUT;
+        }
+        if (now - last_yield > 10000) {
+            // Tight compute loops still let loop() publish results
+            vTaskDelay(1);
+            last_yield = esp_timer_get_time();
+        }
+
+        const uint8_t op = _code[pc];
+        const uint8_t* a = &_code[pc + 1];
+        uint16_t next = pc + 1 + _operandBytes(op);
+        _instructions++;
+
+        switch (op) {
+            case RECIPE_OP_END:
+                next = _code_length;
+                break;
+            case RECIPE_OP_STAGE:
+            case RECIPE_OP_SET:
+                if (!_stage(a[0], _reg[a[1]])) {
+                    _error_pc = pc;
+                    _error = "Output value out of range";
+                    return RECIPE_ERROR;
+                }
+                if (op == RECIPE_OP_SET) _io.updateAllDACs();
+                break;
+            case RECIPE_OP_LATCH:
+                _io.updateAllDACs();
+                break;
+            case RECIPE_OP_DIGITAL:
+                if (a[0] < 4) {
+                    _io.digitalWriteDA(a[0], a[1]);
+                } else {
+                    _io.digitalWriteDB(a[0] - 4, a[1]);
+                }
+                _digital_mask |= 1 << a[0];
+                break;
+            case RECIPE_OP_WAIT_US:
+                _waitUs(_readU32(pc + 1), running);
+                break;
+            case RECIPE_OP_MEASURE:
+                _reg[a[0]] = _measure(a[1], a[2]);
+                break;
+            case RECIPE_OP_SETTLE: {
+                // Consecutive readings one interval apart must agree within the tolerance
+                float tolerance = _readF32(pc + 3);
+                uint16_t interval_us = _readU16(pc + 7);
+                int64_t t_timeout = esp_timer_get_time() + (int64_t)_readU16(pc + 9) * 1000;
+                float last = _measure(a[1], 4);
+                _flag = false;
+                while (running) {
+                    _waitUs(interval_us, running);
+                    float value = _measure(a[1], 4);
+                    if (fabsf(value - last) <= tolerance) {
+                        _reg[a[0]] = 0.5f * (value + last);
+                        _flag = true;
+                        break;
+                    }
+                    last = value;
+                    if (esp_timer_get_time() >= t_timeout) {
+                        _reg[a[0]] = value;
+                        break;
+                    }
+                }
+                break;
+            }
+            case RECIPE_OP_LOAD:
+                _reg[a[0]] = _readF32(pc + 2);
+                break;
+            case RECIPE_OP_MOV:
+                _reg[a[0]] = _reg[a[1]];
+                break;
+            case RECIPE_OP_ADD:
+                _reg[a[0]] = _reg[a[1]] + _reg[a[2]];
+                break;
+            case RECIPE_OP_SUB:
+                _reg[a[0]] = _reg[a[1]] - _reg[a[2]];
+                break;
+            case RECIPE_OP_MUL:
+                _reg[a[0]] = _reg[a[1]] * _reg[a[2]];
+                break;
+            case RECIPE_OP_DIV:
+                _reg[a[0]] = _reg[a[2]] != 0.0f ? _reg[a[1]] / _reg[a[2]] : NAN;
+                break;
+            case RECIPE_OP_CHECK:
+                result.kind = RECIPE_RESULT_CHECK;
+                result.name = a[0];
+                result.value = _reg[a[1]];
+                result.low = _readF32(pc + 3);
+                result.high = _readF32(pc + 7);
+                result.pass = result.value >= result.low && result.value <= result.high;  // NaN fails
+                result.t_us = (uint32_t)(esp_timer_get_time() - t_start);
+                _flag = result.pass;
+                _checks++;
+                if (!result.pass) _failures++;
+                if (_emit) _emit(result);
+                break;
+            case RECIPE_OP_EMIT:
+                result.kind = RECIPE_RESULT_EMIT;
+                result.name = a[0];
+                result.value = _reg[a[1]];
+                result.low = result.high = NAN;
+                result.pass = true;
+                result.t_us = (uint32_t)(esp_timer_get_time() - t_start);
+                if (_emit) _emit(result);
+                break;
+            case RECIPE_OP_JMP:
+                next = _readU16(pc + 1);
+                break;
+            case RECIPE_OP_JMP_IF:
+                if (_flag) next = _readU16(pc + 1);
+                break;
+            case RECIPE_OP_JMP_IFNOT:
+                if (!_flag) next = _readU16(pc + 1);
+                break;
+            case RECIPE_OP_DJNZ:
+                _reg[a[0]] -= 1.0f;
+                if (_reg[a[0]] > 0.5f) next = _readU16(pc + 2);
+                break;
+            case RECIPE_OP_JLT:
+                if (_reg[a[0]] < _reg[a[1]]) next = _readU16(pc + 3);
+                break;
+            case RECIPE_OP_ABORT:
+                result.kind = RECIPE_RESULT_ABORT;
+                result.name = a[0];
+                result.value = result.low = result.high = NAN;
+                result.pass = false;
+                result.t_us = (uint32_t)(esp_timer_get_time() - t_start);
+                _failures++;
+                if (_emit) _emit(result);
+                _error_pc = pc;
+                return RECIPE_FAILED;
+        }
+        pc = next;
+    }
+    return _failures > 0 ? RECIPE_FAILED : RECIPE_PASSED;
+}
+
+const char* RecipeVM::statusName(RecipeStatus status) {
+    switch (status) {
+        case RECIPE_PASSED:  return "passed";
+        case RECIPE_FAILED:  return "failed";
+        case RECIPE_STOPPED: return "stopped";
+        case RECIPE_TIMEOUT: return "timeout";
+        default:             return "error";
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef RECIPE_VM_H
+#define RECIPE_VM_H
+
+#include <Arduino.h>
+#include <functional>
+#include "pocketlab_io.h"
+
+// Recipe image limits
+#define RECIPE_MAX_CODE 4096           // Bytecode bytes after the header and string table
+#define RECIPE_MAX_STRINGS 32          // Result names referenced by check/emit/abort
+#define RECIPE_MAX_STRING_LENGTH 24
+#define RECIPE_MAX_IMAGE (8 + RECIPE_MAX_STRINGS * (RECIPE_MAX_STRING_LENGTH + 1) + RECIPE_MAX_CODE)
+#define RECIPE_REGISTERS 16
+#define RECIPE_MAX_SAMPLES 64          // Conversions averaged by one measure
+#define RECIPE_VERSION 1
+
+// Image layout: "PLRB", version, string count, strings (length byte + chars), code.
+// Operands follow the opcode byte: registers, outputs, inputs and names are one byte,
+// values are little-endian float32, times uint32/uint16 and jump targets uint16 code offsets.
+enum RecipeOpcode : uint8_t {
+    RECIPE_OP_END = 0x00,        //
+    RECIPE_OP_STAGE = 0x01,      // output, reg        DAC input register only
+    RECIPE_OP_LATCH = 0x02,      //                    LDAC: staged outputs change together
+    RECIPE_OP_SET = 0x03,        // output, reg        stage + latch
+    RECIPE_OP_DIGITAL = 0x04,    // line, level        DA0-3 = 0-3, DB0-3 = 4-7
+    RECIPE_OP_WAIT_US = 0x05,    // u32
+    RECIPE_OP_MEASURE = 0x06,    // reg, input, samples
+    RECIPE_OP_SETTLE = 0x07,     // reg, input, tolerance f32, interval_us u16, timeout_ms u16; flag = settled
+    RECIPE_OP_LOAD = 0x08,       // reg, f32
+    RECIPE_OP_MOV = 0x09,        // reg, reg
+    RECIPE_OP_ADD = 0x0A,        // reg, reg, reg      d = a + b
+    RECIPE_OP_SUB = 0x0B,        // reg, reg, reg
+    RECIPE_OP_MUL = 0x0C,        // reg, reg, reg
+    RECIPE_OP_DIV = 0x0D,        // reg, reg, reg
+    RECIPE_OP_CHECK = 0x0E,      // name, reg, low f32, high f32; flag = pass, result emitted
+    RECIPE_OP_EMIT = 0x0F,       // name, reg
+    RECIPE_OP_JMP = 0x10,        // addr
+    RECIPE_OP_JMP_IF = 0x11,     // addr               flag set
+    RECIPE_OP_JMP_IFNOT = 0x12,  // addr               flag clear
+    RECIPE_OP_DJNZ = 0x13,       // reg, addr          reg -= 1, jump while reg > 0
+    RECIPE_OP_JLT = 0x14,        // reg, reg, addr     jump if a < b
+    RECIPE_OP_ABORT = 0x15,      // name               stop the recipe as failed
+    RECIPE_OP_COUNT
+};
+
+enum RecipeOutput : uint8_t {
+    RECIPE_OUT_SIGNAL_A,
+    RECIPE_OUT_SIGNAL_B,
+    RECIPE_OUT_POWER_VOLTAGE,
+    RECIPE_OUT_CURRENT_LIMIT,
+    RECIPE_OUT_COUNT
+};
+
+enum RecipeInput : uint8_t {
+    RECIPE_IN_SIGNAL_A,
+    RECIPE_IN_SIGNAL_B,
+    RECIPE_IN_DEVICE_VOLTAGE,    // V_A - V_B (VA topology)
+    RECIPE_IN_POWER_VOLTAGE,
+    RECIPE_IN_POWER_CURRENT,
+    RECIPE_IN_TEMPERATURE,
+    RECIPE_IN_COUNT
+};
+
+enum RecipeStatus {
+    RECIPE_PASSED,               // Reached end with every check in limits
+    RECIPE_FAILED,               // Reached end (or abort) with failed checks
+    RECIPE_STOPPED,              // Stopped from outside
+    RECIPE_TIMEOUT,              // Ran past the time budget
+    RECIPE_ERROR                 // Runtime fault, e.g. output out of range
+};
+
+enum RecipeResultKind : uint8_t {
+    RECIPE_RESULT_EMIT,
+    RECIPE_RESULT_CHECK,
+    RECIPE_RESULT_ABORT
+};
+
+// One emitted value or limit check
+struct RecipeResult {
+    RecipeResultKind kind;
+    uint8_t name;                // String table index
+    bool pass;
+    float value;
+    float low, high;
+    uint32_t t_us;               // From the start of the run
+};
+
+// Compact bytecode interpreter for on-device measurement recipes.
+// load() validates the whole image once, so run() executes without per-instruction checks.
+class RecipeVM {
+public:
+    typedef std::function<void(const RecipeResult&)> EmitCallback;
+
+    RecipeVM(PocKETlabIO& io);
+
+    // Validate and copy an image. On failure error describes the first problem found.
+    bool load(const uint8_t* image, size_t length, String& error);
+    bool isLoaded() const { return _code_length > 0; }
+
+    void setEmitCallback(EmitCallback callback) { _emit = callback; }
+
+    // Execute from the start until end/abort, until running goes false or timeout_ms passes
+    RecipeStatus run(volatile bool& running, uint32_t timeout_ms);
+
+    const char* getString(uint8_t id) const;
+    int getStringCount() const { return _string_count; }
+    int getChecks() const { return _checks; }
+    int getFailures() const { return _failures; }
+    uint32_t getInstructions() const { return _instructions; }
+    uint16_t getErrorPc() const { return _error_pc; }
+    const char* getError() const { return _error; }
+    uint8_t getDigitalMask() const { return _digital_mask; }  // DA/DB lines the last run drove
+
+    static const char* statusName(RecipeStatus status);
+
+private:
+    PocKETlabIO& _io;
+    EmitCallback _emit;
+
+    uint8_t _code[RECIPE_MAX_CODE];
+    uint16_t _code_length;
+    char _strings[RECIPE_MAX_STRINGS][RECIPE_MAX_STRING_LENGTH + 1];
+    uint8_t _string_count;
+
+    float _reg[RECIPE_REGISTERS];
+    bool _flag;
+    int _checks;
+    int _failures;
+    uint32_t _instructions;
+    uint16_t _error_pc;
+    const char* _error;
+    uint8_t _digital_mask;
+
+    static int _operandBytes(uint8_t opcode);
+    bool _validate(String& error);
+
+    float _readF32(uint16_t pc) const;
+    uint16_t _readU16(uint16_t pc) const;
+    uint32_t _readU32(uint16_t pc) const;
+
+    bool _stage(uint8_t output, float value);
+    float _measure(uint8_t input, int samples);
+    void _waitUs(uint32_t us, volatile bool& running);
+};
+
+#endif // RECIPE_VM_H
@@ -0,0 +1,361 @@
+#include "scan_scheduler.h"
+
+ScanScheduler::ScanScheduler(PocKETlabIO& io)
+    : _io(io), _mutex(NULL), _task(NULL), _timer(NULL), _running(false), _tickRate(0.0f),
+      _ticks(0), _overruns(0), _spiBatches(0) {
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        _subs[i].active = false;
+    }
+    for (int s = 0; s < SCAN_SOURCES; s++) {
+        _schedule[s].divider = 0;
+        _schedule[s].phase = 0;
+    }
+}
+
+ScanScheduler::~ScanScheduler() {
+    end();
+    if (_timer != NULL) {
+        esp_timer_delete(_timer);
+    }
+    if (_mutex != NULL) {
+        vSemaphoreDelete(_mutex);
+    }
+}
+
+bool ScanScheduler::begin() {
+    if (_task != NULL) {
+        return true;
+    }
+    if (_mutex == NULL) {
+        _mutex = xSemaphoreCreateMutex();
+    }
+    if (_timer == NULL) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &ScanScheduler::_timerCallback;
+        timer_args.arg = this;
+        timer_args.name = "scan";
+        if (esp_timer_create(&timer_args, &_timer) != ESP_OK) {
+            Serial.println("ScanScheduler: failed to create timer");
+            return false;
+        }
+    }
+
+    _running = true;
+    BaseType_t result = xTaskCreatePinnedToCore(
+        &ScanScheduler::_taskWrapper, // Task function
+        "ScanScheduler",              // Task name
+        4096,                         // Stack size
+        this,                         // Parameter
+        SCAN_TASK_PRIORITY,           // Priority
+        &_task,                       // Task handle
+        1                             // Core 1 (with the measurement tasks that preempt it)
+    );
+    if (result != pdPASS) {
+        _running = false;
+        _task = NULL;
+        Serial.println("ScanScheduler: failed to create task");
+        return false;
+    }
+
+    // Subscriptions made before begin() start now
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _tickRate = 0.0f;
+    _reschedule();
+    xSemaphoreGive(_mutex);
+    return true;
+}
+
+void ScanScheduler::end() {
+    if (_task == NULL) {
+        return;
+    }
+    _running = false;
+    esp_timer_stop(_timer);
+    _tickRate = 0.0f;
+
+    // Wait for the task to finish its tick and delete itself. It is not deleted from here:
+    // mid-tick it waits on a bus batch that lives on its stack.
+    while (_task != NULL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+int ScanScheduler::subscribe(ScanSource source, float rate_hz, ScanCallback callback, void* arg) {
+    if (_mutex == NULL || source < 0 || source >= SCAN_SOURCES || !(rate_hz > 0.0f)) {
+        return -1;
+    }
+    rate_hz = constrain(rate_hz, SCAN_MIN_RATE, SCAN_MAX_TICK_RATE);
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    int id = -1;
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        if (!_subs[i].active) {
+            id = i;
+            break;
+        }
+    }
+    if (id >= 0) {
+        Subscription& sub = _subs[id];
+        sub.source = source;
+        sub.rate = rate_hz;
+        sub.divider = 1;
+        sub.counter = 0;
+        sub.callback = callback;
+        sub.arg = arg;
+        sub.value = NAN;
+        sub.time_us = 0;
+        sub.samples = 0;
+        sub.window_samples = 0;
+        sub.window_start_us = esp_timer_get_time();
+        sub.achieved = 0.0f;
+        sub.active = true;
+        _reschedule();
+        // The first conversion of the source goes to the new subscriber
+        sub.counter = sub.divider - 1;
+    }
+    xSemaphoreGive(_mutex);
+    return id;
+}
+
+void ScanScheduler::unsubscribe(int id) {
+    if (_mutex == NULL || id < 0 || id >= SCAN_MAX_SUBSCRIPTIONS) {
+        return;
+    }
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_subs[id].active) {
+        _subs[id].active = false;
+        _reschedule();
+    }
+    xSemaphoreGive(_mutex);
+}
+
+void ScanScheduler::_reschedule() {
+    // Each source is converted at the fastest rate any of its subscribers asked for
+    float source_rate[SCAN_SOURCES] = {0};
+    float fastest = 0.0f;
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        if (_subs[i].active && _subs[i].rate > source_rate[_subs[i].source]) {
+            source_rate[_subs[i].source] = _subs[i].rate;
+        }
+    }
+    for (int s = 0; s < SCAN_SOURCES; s++) {
+        if (source_rate[s] > fastest) fastest = source_rate[s];
+    }
+
+    // One tick at the fastest rate; every source is converted on a whole divider of it
+    float tick_rate = fastest < SCAN_MAX_TICK_RATE ? fastest : SCAN_MAX_TICK_RATE;
+    for (int s = 0; s < SCAN_SOURCES; s++) {
+        SourceSchedule& slot = _schedule[s];
+        if (source_rate[s] <= 0.0f) {
+            slot.divider = 0;
+            continue;
+        }
+        long divider = lroundf(tick_rate / source_rate[s]);
+        slot.divider = divider < 1 ? 1 : (uint32_t)divider;
+        // Both signal ADC channels share phase 0 so they land in the same SPI bus batch;
+        // the MCU sources are spread over the ticks
+        slot.phase = (s == SCAN_SIGNAL_A || s == SCAN_SIGNAL_B) ? 0 : (uint32_t)s % slot.divider;
+    }
+
+    // Subscribers slower than their source get every n-th conversion
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        Subscription& sub = _subs[i];
+        if (!sub.active) continue;
+        float converted = tick_rate / (float)_schedule[sub.source].divider;
+        long divider = lroundf(converted / sub.rate);
+        sub.divider = divider < 1 ? 1 : (uint32_t)divider;
+        if (sub.counter >= sub.divider) sub.counter = sub.divider - 1;
+    }
+
+    if (tick_rate == _tickRate || _timer == NULL || !_running) {
+        return;
+    }
+    _tickRate = tick_rate;
+    esp_timer_stop(_timer);
+    if (tick_rate > 0.0f) {
+        esp_timer_start_periodic(_timer, (uint64_t)(1000000.0f / tick_rate + 0.5f));
+    }
+}
+
+float ScanScheduler::readNow(ScanSource source) {
+    switch (source) {
+        case SCAN_SIGNAL_A:      return _io.readSignalVoltage(SIGNAL_CHANNEL_A);
+        case SCAN_SIGNAL_B:      return _io.readSignalVoltage(SIGNAL_CHANNEL_B);
+        case SCAN_POWER_VOLTAGE: return _io.readPowerVoltage();
+        case SCAN_POWER_CURRENT: return _io.readPowerCurrent();
+        case SCAN_GROUND_VOLTAGE: return _io.readGroundVoltage();
+        case SCAN_FEEDBACK_A:    return _io.readSignalFeedback(SIGNAL_CHANNEL_A);
+        case SCAN_FEEDBACK_B:    return _io.readSignalFeedback(SIGNAL_CHANNEL_B);
+        case SCAN_DA0:
+        case SCAN_DA1:
+        case SCAN_DA2:
+        case SCAN_DA3:           return _io.analogReadDA((uint8_t)(source - SCAN_DA0));
+        case SCAN_TEMPERATURE:   return _io.readTemperature();
+        default:                 return NAN;
+    }
+}
+
+void ScanScheduler::_tick() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    const uint32_t tick = _ticks;
+    const int64_t now = esp_timer_get_time();
+
+    bool due[SCAN_SOURCES];
+    for (int s = 0; s < SCAN_SOURCES; s++) {
+        due[s] = _schedule[s].divider != 0 && tick % _schedule[s].divider == _schedule[s].phase;
+    }
+
+    // Conversion sequence: one SPI bus batch for whichever signal channels are due, then the
+    // MCU sources (latest feedback scan values, no conversion)
+    float values[SCAN_SOURCES];
+    if (due[SCAN_SIGNAL_A] || due[SCAN_SIGNAL_B]) {
+        uint16_t raw_a = 0, raw_b = 0;
+        if (_io.readSignalBurst(due[SCAN_SIGNAL_A] ? &raw_a : nullptr, due[SCAN_SIGNAL_B] ? &raw_b : nullptr, 1) == 1) {
+            _spiBatches++;
+            values[SCAN_SIGNAL_A] = _io.signalVoltageFromRaw(raw_a);
+            values[SCAN_SIGNAL_B] = _io.signalVoltageFromRaw(raw_b, SIGNAL_CHANNEL_B);
+        } else {
+            due[SCAN_SIGNAL_A] = false;
+            due[SCAN_SIGNAL_B] = false;
+        }
+    }
+    for (int s = SCAN_SIGNAL_B + 1; s < SCAN_SOURCES; s++) {
+        if (due[s]) {
+            values[s] = readNow((ScanSource)s);
+        }
+    }
+
+    // Fan out
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        Subscription& sub = _subs[i];
+        if (!sub.active || !due[sub.source]) continue;
+        if (++sub.counter < sub.divider) continue;
+        sub.counter = 0;
+
+        sub.value = values[sub.source];
+        sub.time_us = now;
+        sub.samples++;
+        sub.window_samples++;
+        int64_t window = now - sub.window_start_us;
+        if (window >= SCAN_RATE_WINDOW_US) {
+            sub.achieved = (float)sub.window_samples * 1000000.0f / (float)window;
+            sub.window_samples = 0;
+            sub.window_start_us = now;
+        }
+        if (sub.callback != nullptr) {
+            sub.callback(sub.source, sub.value, now, sub.arg);
+        }
+    }
+
+    _ticks = tick + 1;
+    xSemaphoreGive(_mutex);
+}
+
+void ScanScheduler::_timerCallback(void* arg) {
+    ScanScheduler* instance = static_cast<ScanScheduler*>(arg);
+    if (instance->_task != NULL) {
+        xTaskNotifyGive(instance->_task);
+    }
+}
+
+// FreeRTOS task wrapper (static function)
+void ScanScheduler::_taskWrapper(void* parameter) {
+    ScanScheduler* instance = static_cast<ScanScheduler*>(parameter);
+    instance->_run();
+}
+
+void ScanScheduler::_run() {
+    Serial.printf("ScanScheduler task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    while (_running) {
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        if (ticks == 0) {
+            continue;
+        }
+        if (ticks > 1) {
+            _overruns += ticks - 1;
+        }
+        _tick();
+    }
+    _task = NULL;
+    vTaskDelete(NULL);
+}
+
+float ScanScheduler::getLatest(int id) const {
+    if (id < 0 || id >= SCAN_MAX_SUBSCRIPTIONS || !_subs[id].active) {
+        return NAN;
+    }
+    return _subs[id].value;
+}
+
+int64_t ScanScheduler::getLatestTime(int id) const {
+    if (id < 0 || id >= SCAN_MAX_SUBSCRIPTIONS || !_subs[id].active) {
+        return 0;
+    }
+    return _subs[id].time_us;
+}
+
+uint32_t ScanScheduler::getSampleCount(int id) const {
+    if (id < 0 || id >= SCAN_MAX_SUBSCRIPTIONS || !_subs[id].active) {
+        return 0;
+    }
+    return _subs[id].samples;
+}
+
+float ScanScheduler::getRequestedRate(int id) const {
+    if (id < 0 || id >= SCAN_MAX_SUBSCRIPTIONS || !_subs[id].active) {
+        return 0.0f;
+    }
+    return _subs[id].rate;
+}
+
+float ScanScheduler::getAchievedRate(int id) const {
+    if (id < 0 || id >= SCAN_MAX_SUBSCRIPTIONS || !_subs[id].active) {
+        return 0.0f;
+    }
+    return _subs[id].achieved;
+}
+
+float ScanScheduler::getSourceRate(ScanSource source) const {
+    if (source < 0 || source >= SCAN_SOURCES || _schedule[source].divider == 0) {
+        return 0.0f;
+    }
+    return _tickRate / (float)_schedule[source].divider;
+}
+
+uint8_t ScanScheduler::getSubscriptionCount() const {
+    uint8_t count = 0;
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        if (_subs[i].active) count++;
+    }
+    return count;
+}
+
+const char* ScanScheduler::sourceName(ScanSource source) {
+    switch (source) {
+        case SCAN_SIGNAL_A:       return "signal_a";
+        case SCAN_SIGNAL_B:       return "signal_b";
+        case SCAN_POWER_VOLTAGE:  return "power_voltage";
+        case SCAN_POWER_CURRENT:  return "power_current";
+        case SCAN_GROUND_VOLTAGE: return "ground_voltage";
+        case SCAN_FEEDBACK_A:     return "feedback_a";
+        case SCAN_FEEDBACK_B:     return "feedback_b";
+        case SCAN_DA0:            return "da0";
+        case SCAN_DA1:            return "da1";
+        case SCAN_DA2:            return "da2";
+        case SCAN_DA3:            return "da3";
+        case SCAN_TEMPERATURE:    return "temperature";
+        default:                  return "unknown";
+    }
+}
+
+void ScanScheduler::printStatus() {
+    Serial.printf("Scan scheduler: %s, tick %.1f Hz, %u subscriptions, %u ticks, %u overruns, %u SPI batches\n",
+                  isRunning() ? "running" : "stopped", _tickRate, getSubscriptionCount(),
+                  (unsigned)_ticks, (unsigned)_overruns, (unsigned)_spiBatches);
+    for (int i = 0; i < SCAN_MAX_SUBSCRIPTIONS; i++) {
+        const Subscription& sub = _subs[i];
+        if (!sub.active) continue;
+        Serial.printf("  #%d %s: %.2f Hz requested, %.2f Hz achieved (source %.2f Hz), latest %.3f\n",
+                      i, sourceName(sub.source), sub.rate, sub.achieved, getSourceRate(sub.source), sub.value);
+    }
+}
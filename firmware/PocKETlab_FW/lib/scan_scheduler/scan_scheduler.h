@@ -0,0 +1,124 @@
+#ifndef SCAN_SCHEDULER_H
+#define SCAN_SCHEDULER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include "pocketlab_io.h"
+
+// Scheduler limits
+#define SCAN_MAX_SUBSCRIPTIONS 16
+#define SCAN_MAX_TICK_RATE 2000.0f        // Hz, fastest scheduler tick (and so fastest source rate)
+#define SCAN_MIN_RATE 0.1f                // Hz
+#define SCAN_TASK_PRIORITY 2              // Below the measurement tasks (3), above loop() (1)
+#define SCAN_RATE_WINDOW_US 1000000       // Achieved rates are measured over this window
+
+// Every analog source on the board. Values are delivered in engineering units:
+// signal inputs in V at the input terminal, power feedback in V/A, DA pins in V, temperature in degC.
+enum ScanSource {
+    SCAN_SIGNAL_A = 0,         // MCP3202 CH0 (SPI)
+    SCAN_SIGNAL_B,             // MCP3202 CH1 (SPI)
+    SCAN_POWER_VOLTAGE,        // FB_VOUT
+    SCAN_POWER_CURRENT,        // FB_IOUT
+    SCAN_GROUND_VOLTAGE,       // FB_GOUT
+    SCAN_FEEDBACK_A,           // FB_AO (signal DAC A, before the amplifier)
+    SCAN_FEEDBACK_B,           // FB_A1 (signal DAC B, before the amplifier)
+    SCAN_DA0,
+    SCAN_DA1,
+    SCAN_DA2,
+    SCAN_DA3,
+    SCAN_TEMPERATURE,          // NTC probe
+    SCAN_SOURCES
+};
+
+// Called from the scheduler task for every sample delivered to a subscription.
+// Keep it short and do not subscribe/unsubscribe from inside it.
+typedef void (*ScanCallback)(ScanSource source, float value, int64_t timestamp_us, void* arg);
+
+// Central multi-rate scheduler for the analog inputs.
+// Consumers subscribe to a source at a rate; the scheduler converts each source once at the
+// fastest rate any subscriber asked for and hands every subscriber its own decimated stream.
+// Both MCP3202 channels due on the same tick are read in one SPI bus batch, so the scheduler
+// occupies the bus for one short, fixed-length batch per tick. MCU pins are taken from
+// the PocKETlab I/O feedback scan and cost no conversion at all.
+class ScanScheduler {
+public:
+    explicit ScanScheduler(PocKETlabIO& io);
+    ~ScanScheduler();
+
+    bool begin();    // Creates the scheduler task; call after PocKETlabIO::begin()
+    void end();
+
+    // Returns a subscription id, or -1 if the table is full or the arguments are invalid.
+    // rate_hz is clamped to SCAN_MIN_RATE..SCAN_MAX_TICK_RATE.
+    int subscribe(ScanSource source, float rate_hz, ScanCallback callback = nullptr, void* arg = nullptr);
+    void unsubscribe(int id);
+
+    // Latest sample of a subscription (NAN before the first one)
+    float getLatest(int id) const;
+    int64_t getLatestTime(int id) const;
+    uint32_t getSampleCount(int id) const;
+    float getRequestedRate(int id) const;
+    float getAchievedRate(int id) const;      // Delivered samples per second over the last window
+
+    // One conversion outside the schedule, for consumers whose subscription has no sample yet
+    // (or when the scheduler is not running)
+    float readNow(ScanSource source);
+
+    // Scheduler status
+    bool isRunning() const { return _task != NULL; }
+    float getTickRate() const { return _tickRate; }
+    float getSourceRate(ScanSource source) const;   // Conversion rate the schedule gives a source (0 = idle)
+    uint32_t getTicks() const { return _ticks; }
+    uint32_t getOverruns() const { return _overruns; }
+    uint32_t getSpiBatches() const { return _spiBatches; }
+    uint8_t getSubscriptionCount() const;
+    void printStatus();
+
+    static const char* sourceName(ScanSource source);
+
+private:
+    struct Subscription {
+        bool active;
+        ScanSource source;
+        float rate;                  // Requested
+        uint32_t divider;            // Deliver every divider-th sample of the source
+        uint32_t counter;
+        ScanCallback callback;
+        void* arg;
+        volatile float value;
+        volatile int64_t time_us;
+        volatile uint32_t samples;
+        uint32_t window_samples;
+        int64_t window_start_us;
+        volatile float achieved;
+    };
+
+    struct SourceSchedule {
+        uint32_t divider;            // Convert every divider-th tick (0 = no subscribers)
+        uint32_t phase;
+    };
+
+    PocKETlabIO& _io;
+    SemaphoreHandle_t _mutex;        // Schedule and subscription table
+    TaskHandle_t _task;
+    esp_timer_handle_t _timer;
+    volatile bool _running;
+
+    Subscription _subs[SCAN_MAX_SUBSCRIPTIONS];
+    SourceSchedule _schedule[SCAN_SOURCES];
+    float _tickRate;                 // 0 = timer stopped
+    volatile uint32_t _ticks;
+    volatile uint32_t _overruns;
+    volatile uint32_t _spiBatches;
+
+    void _reschedule();              // Caller holds _mutex
+    void _tick();
+    static void _timerCallback(void* arg);
+    static void _taskWrapper(void* parameter);
+    void _run();
+};
+
+#endif // SCAN_SCHEDULER_H
@@ -0,0 +1,277 @@
+#include "spectral.h"
+#include <esp_dsp.h>
+#include <esp_heap_caps.h>
+#include <math.h>
+
+bool SpectrumAnalyzer::_tablesReady = false;
+
+SpectrumAnalyzer::SpectrumAnalyzer()
+    : _n(0), _window(WINDOW_HANN), _lobe_bins(2), _enbw(1.5f), _power_scale(0.0f), _averages(0),
+      _work(nullptr), _win(nullptr), _twiddle(nullptr), _power(nullptr) {
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {
+    end();
+}
+
+bool SpectrumAnalyzer::begin(int fft_size, SpectralWindow window) {
+    end();
+
+    if (fft_size < SPECTRAL_MIN_FFT_SIZE || fft_size > SPECTRAL_MAX_FFT_SIZE || (fft_size & (fft_size - 1)) != 0) {
+        return false;
+    }
+
+    // esp-dsp keeps one shared sin/cos table; size it for the largest complex FFT once
+    if (!_tablesReady) {
+        if (dsps_fft2r_init_fc32(NULL, SPECTRAL_MAX_FFT_SIZE / 2) != ESP_OK) {
+            Serial.println("ERROR: esp-dsp FFT init failed");
+            return false;
+        }
+        _tablesReady = true;
+    }
+
+    _n = fft_size;
+    _window = window;
+
+    // The vectorised kernels want 16-byte aligned data
+    _work = (float*)heap_caps_aligned_alloc(16, _n * sizeof(float), MALLOC_CAP_8BIT);
+    _win = (float*)heap_caps_aligned_alloc(16, _n * sizeof(float), MALLOC_CAP_8BIT);
+    _twiddle = (float*)heap_caps_aligned_alloc(16, _n * sizeof(float), MALLOC_CAP_8BIT);
+    _power = (float*)heap_caps_aligned_alloc(16, (_n / 2 + 1) * sizeof(float), MALLOC_CAP_8BIT);
+    if (!_work || !_win || !_twiddle || !_power) {
+        end();
+        return false;
+    }
+
+    // Periodic window (DFT-even) plus its coherent gain and noise bandwidth
+    float sum = 0.0f, sum_sq = 0.0f;
+    for (int i = 0; i < _n; i++) {
+        float x = 2.0f * (float)M_PI * i / _n;
+        float w;
+        switch (window) {
+            case WINDOW_HANN:
+                w = 0.5f - 0.5f * cosf(x);
+                break;
+            case WINDOW_HAMMING:
+                w = 0.54f - 0.46f * cosf(x);
+                break;
+            case WINDOW_BLACKMAN:
+                w = 0.42f - 0.5f * cosf(x) + 0.08f * cosf(2.0f * x);
+                break;
+            case WINDOW_FLATTOP:
+                w = 0.21557895f - 0.41663158f * cosf(x) + 0.277263158f * cosf(2.0f * x)
+                    - 0.083578947f * cosf(3.0f * x) + 0.006947368f * cosf(4.0f * x);
+                break;
+            default:
+                w = 1.0f;
+                break;
+        }
+        _win[i] = w;
+        sum += w;
+        sum_sq += w * w;
+    }
+    float coherent_gain = sum / _n;
+    _enbw = _n * sum_sq / (sum * sum);
+    _power_scale = 2.0f / ((_n * coherent_gain) * (_n * coherent_gain));
+
+    switch (window) {
+        case WINDOW_RECTANGULAR: _lobe_bins = 1; break;
+        case WINDOW_BLACKMAN:    _lobe_bins = 3; break;
+        case WINDOW_FLATTOP:     _lobe_bins = 5; break;
+        default:                 _lobe_bins = 2; break;
+    }
+
+    // W^k = exp(-j 2 pi k / N) for the split of the N/2-point complex result
+    for (int k = 0; k < _n / 2; k++) {
+        float a = 2.0f * (float)M_PI * k / _n;
+        _twiddle[2 * k] = cosf(a);
+        _twiddle[2 * k + 1] = sinf(a);
+    }
+
+    reset();
+    return true;
+}
+
+void SpectrumAnalyzer::end() {
+    heap_caps_free(_work);
+    heap_caps_free(_win);
+    heap_caps_free(_twiddle);
+    heap_caps_free(_power);
+    _work = _win = _twiddle = _power = nullptr;
+    _n = 0;
+    _averages = 0;
+}
+
+void SpectrumAnalyzer::reset() {
+    if (_power) {
+        memset(_power, 0, (_n / 2 + 1) * sizeof(float));
+    }
+    _averages = 0;
+}
+
+void SpectrumAnalyzer::_fft(const float* samples) {
+    // Windowed input read as N/2 complex points: even samples real, odd samples imaginary.
+    // samples may be _work itself (inputBuffer()); the multiply is element by element.
+    dsps_mul_f32(samples, _win, _work, _n, 1, 1, 1);
+    dsps_fft2r_fc32(_work, _n / 2);
+    dsps_bit_rev_fc32(_work, _n / 2);
+}
+
+void SpectrumAnalyzer::_splitBin(int k, float& xr, float& xi) const {
+    const int m = _n / 2;
+    if (k == 0 || k == m) {
+        // Z[0] carries DC (re + im) and Nyquist (re - im)
+        xr = (k == 0) ? _work[0] + _work[1] : _work[0] - _work[1];
+        xi = 0.0f;
+        return;
+    }
+    // X[k] = E[k] + W^k O[k], E = (Z[k] + Z*[m-k]) / 2, O = -j (Z[k] - Z*[m-k]) / 2
+    float zr = _work[2 * k], zi = _work[2 * k + 1];
+    float cr = _work[2 * (m - k)], ci = -_work[2 * (m - k) + 1];
+    float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+    float orr = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+    float c = _twiddle[2 * k], s = _twiddle[2 * k + 1];
+    xr = er + c * orr + s * oi;
+    xi = ei + c * oi - s * orr;
+}
+
+void SpectrumAnalyzer::addBlock(const float* samples) {
+    if (_n == 0) return;
+    _fft(samples);
+    for (int k = 0; k <= _n / 2; k++) {
+        float xr, xi;
+        _splitBin(k, xr, xi);
+        _power[k] += xr * xr + xi * xi;
+    }
+    _averages++;
+}
+
+void SpectrumAnalyzer::transform(const float* samples, float* spectrum) {
+    if (_n == 0) return;
+    _fft(samples);
+    for (int k = 0; k <= _n / 2; k++) {
+        _splitBin(k, spectrum[2 * k], spectrum[2 * k + 1]);
+    }
+}
+
+float SpectrumAnalyzer::getBinPower(int bin) const {
+    if (_averages == 0 || bin < 0 || bin > _n / 2) return 0.0f;
+    float scale = (bin == 0 || bin == _n / 2) ? _power_scale * 0.5f : _power_scale;
+    return _power[bin] * scale / _averages;
+}
+
+float SpectrumAnalyzer::getBinDb(int bin) const {
+    float p = getBinPower(bin);
+    return 10.0f * log10f(p > 1e-20f ? p : 1e-20f);
+}
+
+float SpectrumAnalyzer::_bandPower(int center, int& lo, int& hi) const {
+    // Main lobe plus the strongest side lobes so leakage is not counted as noise
+    int half_width = 3 * _lobe_bins;
+    lo = max(center - half_width, 0);
+    hi = min(center + half_width, _n / 2);
+    float sum = 0.0f;
+    for (int k = lo; k <= hi; k++) {
+        sum += getBinPower(k);
+    }
+    // Summing across the lobe counts the signal ENBW times
+    return sum / _enbw;
+}
+
+SpectralMetrics SpectrumAnalyzer::analyze(float sample_rate, int max_harmonics) const {
+    SpectralMetrics metrics = {};
+    const int m = _n / 2;
+    if (_averages == 0 || _n == 0) {
+        return metrics;
+    }
+
+    // Fundamental: strongest bin clear of the DC band
+    int first = 3 * _lobe_bins + 1;
+    int k0 = first;
+    for (int k = first; k < m; k++) {
+        if (_power[k] > _power[k0]) k0 = k;
+    }
+
+    // Parabolic interpolation on the log spectrum around the peak
+    float delta = 0.0f;
+    if (k0 > 0 && k0 < m) {
+        float a = getBinDb(k0 - 1), b = getBinDb(k0), c = getBinDb(k0 + 1);
+        float denom = a - 2.0f * b + c;
+        if (fabsf(denom) > 1e-6f) {
+            delta = constrain(0.5f * (a - c) / denom, -0.5f, 0.5f);
+        }
+    }
+    float f0_bins = k0 + delta;
+    metrics.peak_frequency = f0_bins * sample_rate / _n;
+
+    // Bands excluded from the noise: DC, fundamental, harmonics
+    int band_lo[SPECTRAL_MAX_HARMONICS + 1], band_hi[SPECTRAL_MAX_HARMONICS + 1];
+    int bands = 0;
+    band_lo[bands] = 0;
+    band_hi[bands] = 3 * _lobe_bins;
+    bands++;
+
+    float fundamental = _bandPower(k0, band_lo[bands], band_hi[bands]);
+    bands++;
+
+    float harmonic_sum = 0.0f;
+    metrics.harmonics = 0;
+    for (int h = 2; h <= max_harmonics && h <= SPECTRAL_MAX_HARMONICS; h++) {
+        int center = (int)(h * f0_bins + 0.5f);
+        if (center + 3 * _lobe_bins >= m) break;
+        if (bands > SPECTRAL_MAX_HARMONICS) break;
+        harmonic_sum += _bandPower(center, band_lo[bands], band_hi[bands]);
+        bands++;
+        metrics.harmonics++;
+    }
+
+    float noise = 0.0f;
+    int noise_bins = 0;
+    for (int k = 0; k <= m; k++) {
+        bool excluded = false;
+        for (int b = 0; b < bands && !excluded; b++) {
+            excluded = (k >= band_lo[b] && k <= band_hi[b]);
+        }
+        if (!excluded) {
+            noise += getBinPower(k);
+            noise_bins++;
+        }
+    }
+    noise /= _enbw;
+
+    const float floor_power = 1e-20f;
+    metrics.peak_dbv = 10.0f * log10f(max(fundamental, floor_power));
+    metrics.snr_db = 10.0f * log10f(max(fundamental, floor_power) / max(noise, floor_power));
+    metrics.thd_db = 10.0f * log10f(max(harmonic_sum, floor_power) / max(fundamental, floor_power));
+    metrics.thd_percent = fundamental > 0.0f ? 100.0f * sqrtf(harmonic_sum / fundamental) : 0.0f;
+    metrics.noise_floor_dbv = noise_bins > 0 ? 10.0f * log10f(max(noise * _enbw / noise_bins, floor_power)) : -200.0f;
+    return metrics;
+}
+
+bool SpectrumAnalyzer::parseWindow(const char* name, SpectralWindow& window) {
+    if (name == nullptr) return false;
+    if (strcmp(name, "rectangular") == 0) {
+        window = WINDOW_RECTANGULAR;
+    } else if (strcmp(name, "hann") == 0) {
+        window = WINDOW_HANN;
+    } else if (strcmp(name, "hamming") == 0) {
+        window = WINDOW_HAMMING;
+    } else if (strcmp(name, "blackman") == 0) {
+        window = WINDOW_BLACKMAN;
+    } else if (strcmp(name, "flattop") == 0) {
+        window = WINDOW_FLATTOP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* SpectrumAnalyzer::windowName(SpectralWindow window) {
+    switch (window) {
+        case WINDOW_RECTANGULAR: return "rectangular";
+        case WINDOW_HAMMING:     return "hamming";
+        case WINDOW_BLACKMAN:    return "blackman";
+        case WINDOW_FLATTOP:     return "flattop";
+        default:                 return "hann";
+    }
+}
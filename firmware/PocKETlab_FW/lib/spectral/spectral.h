@@ -0,0 +1,91 @@
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+
+#include <Arduino.h>
+
+// FFT size limits (power of two, real input)
+#define SPECTRAL_MIN_FFT_SIZE 64
+#define SPECTRAL_MAX_FFT_SIZE 4096
+#define SPECTRAL_MAX_HARMONICS 6  // Harmonics 2..6 are included in THD
+
+enum SpectralWindow {
+    WINDOW_RECTANGULAR,
+    WINDOW_HANN,
+    WINDOW_HAMMING,
+    WINDOW_BLACKMAN,
+    WINDOW_FLATTOP
+};
+
+// Single-tone analysis of an averaged spectrum
+struct SpectralMetrics {
+    float peak_frequency;   // Interpolated fundamental frequency in Hz
+    float peak_dbv;         // Fundamental level in dBV (rms)
+    float snr_db;           // Fundamental vs. everything except DC and harmonics
+    float thd_db;           // Harmonics 2..N vs. fundamental
+    float thd_percent;
+    float noise_floor_dbv;  // Average noise level per bin in dBV
+    int harmonics;          // Harmonics that fell below Nyquist
+};
+
+// Windowed real FFT with power averaging.
+// The real block of N samples is packed into N/2 complex points and transformed with
+// esp-dsp's radix-2 kernel (vectorised on the ESP32-S3), then split into the N/2+1 bins.
+class SpectrumAnalyzer {
+public:
+    SpectrumAnalyzer();
+    ~SpectrumAnalyzer();
+
+    // Allocate buffers for fft_size points and build the window. Returns false on bad size or no memory.
+    bool begin(int fft_size, SpectralWindow window);
+    void end();
+
+    // Clear the accumulated average
+    void reset();
+
+    // Window, transform and add one block of fft_size samples (volts) to the average
+    void addBlock(const float* samples);
+
+    // Scratch block of fft_size floats the caller may fill and pass straight to addBlock()
+    // or transform(), so a block does not need a second copy outside the analyzer
+    float* inputBuffer() { return _work; }
+
+    // Window and transform one block without averaging. spectrum receives the N/2+1
+    // complex bins interleaved (re, im), unscaled; it may not alias samples.
+    void transform(const float* samples, float* spectrum);
+
+    int getFFTSize() const { return _n; }
+    int getBinCount() const { return _n / 2 + 1; }
+    int getAverages() const { return _averages; }
+    SpectralWindow getWindow() const { return _window; }
+
+    // Averaged single-sided power of one bin in V^2 (rms) and the same in dBV
+    float getBinPower(int bin) const;
+    float getBinDb(int bin) const;
+
+    // Fundamental, SNR and THD from the current average
+    SpectralMetrics analyze(float sample_rate, int max_harmonics = SPECTRAL_MAX_HARMONICS) const;
+
+    static bool parseWindow(const char* name, SpectralWindow& window);
+    static const char* windowName(SpectralWindow window);
+
+private:
+    int _n;                  // Real FFT size
+    SpectralWindow _window;
+    int _lobe_bins;          // Main-lobe half width of the window in bins
+    float _enbw;             // Equivalent noise bandwidth of the window in bins
+    float _power_scale;      // |X|^2 to V^2 rms for bins between DC and Nyquist
+    int _averages;
+
+    float* _work;            // N floats: packed complex input and FFT output
+    float* _win;             // N window coefficients
+    float* _twiddle;         // cos/sin pairs for the real-FFT split, N/2 of them
+    float* _power;           // N/2+1 accumulated |X|^2
+
+    static bool _tablesReady;
+
+    float _bandPower(int center, int& lo, int& hi) const;
+    void _fft(const float* samples);
+    void _splitBin(int k, float& xr, float& xi) const;
+};
+
+#endif // SPECTRAL_H
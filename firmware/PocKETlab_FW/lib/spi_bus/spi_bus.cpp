@@ -0,0 +1,373 @@
+#include "spi_bus.h"
+#include <esp_timer.h>
+#include <soc/gpio_struct.h>
+
+// === SpiBatch ===
+
+SpiBatch::SpiBatch() : _count(0), _ok(false) {
+    _done = xSemaphoreCreateBinaryStatic(&_doneBuffer);
+}
+
+bool SpiBatch::_add(const SpiOp& op) {
+    if (_count >= SPI_BATCH_MAX_OPS) {
+        return false;
+    }
+    _ops[_count++] = op;
+    return true;
+}
+
+bool SpiBatch::writeDAC(SpiDevice dac, uint8_t channel, uint16_t code) {
+    if (dac == SPI_DEVICE_SIGNAL_ADC || dac >= SPI_DEVICES || channel > 1) {
+        return false;
+    }
+    SpiOp op = {SPI_OP_DAC_WRITE, dac, channel, code, nullptr, nullptr, 0, nullptr};
+    return _add(op);
+}
+
+bool SpiBatch::readADC(uint8_t channel, uint16_t* result) {
+    if (channel > 1 || result == nullptr) {
+        return false;
+    }
+    SpiOp op = {SPI_OP_ADC_READ, SPI_DEVICE_SIGNAL_ADC, channel, 0, result, nullptr, 0, nullptr};
+    return _add(op);
+}
+
+bool SpiBatch::readADCBurst(uint16_t* rawA, uint16_t* rawB, size_t count) {
+    SpiOp op = {SPI_OP_ADC_BURST, SPI_DEVICE_SIGNAL_ADC, 0, 0, rawA, rawB, count, nullptr};
+    return _add(op);
+}
+
+bool SpiBatch::latch(const uint32_t* gpio) {
+    SpiOp op = {SPI_OP_LATCH, SPI_DEVICES, 0, 0, nullptr, nullptr, 0, gpio};
+    return _add(op);
+}
+
+bool SpiBatch::latchPending(const uint32_t* gpio) {
+    SpiOp op = {SPI_OP_LATCH, SPI_DEVICES, 0, 1, nullptr, nullptr, 0, gpio};
+    return _add(op);
+}
+
+// === SpiBus ===
+
+SpiBus::SpiBus()
+    : _queue(NULL), _task(NULL), _running(false), _busReady(false), _ldac(-1),
+      _batches(0), _transactions(0), _errors(0), _maxQueued(0), _latchesSkipped(0), _dacPending(true), _busyUs(0),
+      _utilizationStartUs(0), _utilizationBusyUs(0) {
+    for (int d = 0; d < SPI_DEVICES; d++) {
+        _devices[d] = NULL;
+    }
+}
+
+SpiBus::~SpiBus() {
+    end();
+    if (_busReady) {
+        for (int d = 0; d < SPI_DEVICES; d++) {
+            if (_devices[d] != NULL) {
+                spi_bus_remove_device(_devices[d]);
+                _devices[d] = NULL;
+            }
+        }
+        spi_bus_free(SPI_BUS_HOST);
+        _busReady = false;
+    }
+    if (_queue != NULL) {
+        vQueueDelete(_queue);
+    }
+}
+
+bool SpiBus::begin(int sck, int miso, int mosi, int cs_adc, int cs_signal_dac, int cs_power_dac, int ldac) {
+    if (_task != NULL) {
+        return true;
+    }
+    _ldac = ldac;
+
+    if (!_busReady) {
+        spi_bus_config_t bus = {};
+        bus.mosi_io_num = mosi;
+        bus.miso_io_num = miso;
+        bus.sclk_io_num = sck;
+        bus.quadwp_io_num = -1;
+        bus.quadhd_io_num = -1;
+        bus.max_transfer_sz = 32;
+        esp_err_t err = spi_bus_initialize(SPI_BUS_HOST, &bus, SPI_DMA_CH_AUTO);
+        if (err != ESP_OK) {
+            Serial.printf("SpiBus: bus initialization failed (%d)\n", err);
+            return false;
+        }
+
+        // One handle per chip: the driver drives each chip select and clocks each chip at its own speed
+        const int cs[SPI_DEVICES] = { cs_adc, cs_signal_dac, cs_power_dac };
+        for (int d = 0; d < SPI_DEVICES; d++) {
+            spi_device_interface_config_t device = {};
+            device.mode = 0;
+            device.clock_speed_hz = d == SPI_DEVICE_SIGNAL_ADC ? SPI_BUS_ADC_CLOCK_HZ : SPI_BUS_DAC_CLOCK_HZ;
+            device.spics_io_num = cs[d];
+            device.queue_size = SPI_BUS_DEVICE_QUEUE;
+            err = spi_bus_add_device(SPI_BUS_HOST, &device, &_devices[d]);
+            if (err != ESP_OK) {
+                Serial.printf("SpiBus: adding device %d failed (%d)\n", d, err);
+                for (int i = 0; i < d; i++) {
+                    spi_bus_remove_device(_devices[i]);
+                    _devices[i] = NULL;
+                }
+                spi_bus_free(SPI_BUS_HOST);
+                return false;
+            }
+        }
+        _busReady = true;
+    }
+
+    if (_queue == NULL) {
+        _queue = xQueueCreate(SPI_BUS_BATCH_QUEUE, sizeof(SpiBatch*));
+        if (_queue == NULL) {
+            return false;
+        }
+    }
+
+    _running = true;
+    BaseType_t result = xTaskCreatePinnedToCore(
+        &SpiBus::_taskWrapper,       // Task function
+        "SpiBus",                    // Task name
+        4096,                        // Stack size
+        this,                        // Parameter
+        SPI_BUS_TASK_PRIORITY,       // Priority
+        &_task,                      // Task handle
+        1                            // Core 1 (with the measurement tasks, its main clients)
+    );
+    if (result != pdPASS) {
+        _running = false;
+        _task = NULL;
+        Serial.println("SpiBus: failed to create owner task");
+        return false;
+    }
+    _utilizationStartUs = esp_timer_get_time();
+    _utilizationBusyUs = _busyUs;
+    return true;
+}
+
+void SpiBus::end() {
+    if (_task == NULL) {
+        return;
+    }
+    _running = false;
+
+    // The owner finishes its batch, fails the queued ones and deletes itself. Deleting it from
+    // here would leave the clients of those batches blocked for good.
+    while (_task != NULL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+bool SpiBus::execute(SpiBatch& batch, bool urgent) {
+    if (batch._count == 0) {
+        return true;
+    }
+    if (_task == NULL || _queue == NULL) {
+        return false;
+    }
+    if (xTaskGetCurrentTaskHandle() == _task) {
+        return _runBatch(batch);
+    }
+
+    SpiBatch* pointer = &batch;
+    BaseType_t sent = urgent ? xQueueSendToFront(_queue, &pointer, portMAX_DELAY)
+                             : xQueueSend(_queue, &pointer, portMAX_DELAY);
+    if (sent != pdTRUE) {
+        return false;
+    }
+    xSemaphoreTake(batch._done, portMAX_DELAY);
+    return batch._ok;
+}
+
+float SpiBus::getUtilization() {
+    int64_t now = esp_timer_get_time();
+    int64_t busy = _busyUs;
+    int64_t elapsed = now - _utilizationStartUs;
+    float utilization = elapsed > 0 ? (float)(busy - _utilizationBusyUs) / (float)elapsed : 0.0f;
+    _utilizationStartUs = now;
+    _utilizationBusyUs = busy;
+    return utilization;
+}
+
+// FreeRTOS task wrapper (static function)
+void SpiBus::_taskWrapper(void* parameter) {
+    SpiBus* instance = static_cast<SpiBus*>(parameter);
+    instance->_run();
+}
+
+void SpiBus::_run() {
+    Serial.printf("SPI bus task started (stack: %d bytes)\n", uxTaskGetStackHighWaterMark(NULL));
+    SpiBatch* batch;
+    while (_running) {
+        if (xQueueReceive(_queue, &batch, pdMS_TO_TICKS(100)) != pdTRUE) {
+            continue;
+        }
+        uint32_t queued = uxQueueMessagesWaiting(_queue) + 1;
+        if (queued > _maxQueued) {
+            _maxQueued = queued;
+        }
+
+        int64_t start = esp_timer_get_time();
+        batch->_ok = _runBatch(*batch);
+        _busyUs += esp_timer_get_time() - start;
+        _batches++;
+        if (!batch->_ok) {
+            _errors++;
+        }
+        xSemaphoreGive(batch->_done);
+    }
+
+    // Nobody may stay blocked on a batch that will never run
+    while (xQueueReceive(_queue, &batch, 0) == pdTRUE) {
+        batch->_ok = false;
+        xSemaphoreGive(batch->_done);
+    }
+    _task = NULL;
+    vTaskDelete(NULL);
+}
+
+bool SpiBus::_runBatch(SpiBatch& batch) {
+    uint8_t i = 0;
+    while (i < batch._count) {
+        const SpiOp& op = batch._ops[i];
+        bool ok;
+        if (op.type == SPI_OP_LATCH) {
+            // Every write before it has completed (results collected), so the latch sees them all
+            _latch(op);
+            ok = true;
+            i++;
+        } else if (op.type == SPI_OP_ADC_BURST) {
+            ok = _runBurst(op);
+            i++;
+        } else {
+            // A run of single transactions is queued to the driver at once
+            uint8_t end = i;
+            while (end < batch._count &&
+                   (batch._ops[end].type == SPI_OP_DAC_WRITE || batch._ops[end].type == SPI_OP_ADC_READ)) {
+                end++;
+            }
+            ok = _runTransactions(&batch._ops[i], end - i);
+            i = end;
+        }
+        if (!ok) {
+            // Do not latch or read behind a failed transaction
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpiBus::_runTransactions(const SpiOp* ops, size_t count) {
+    spi_transaction_t trans[SPI_BATCH_MAX_OPS];
+    size_t queued = 0;
+    bool ok = true;
+    for (; queued < count; queued++) {
+        _prepare(trans[queued], ops[queued], ops[queued].channel);
+        if (ops[queued].type == SPI_OP_DAC_WRITE) {
+            _dacPending = true;
+        }
+        if (spi_device_queue_trans(_devices[ops[queued].device], &trans[queued], portMAX_DELAY) != ESP_OK) {
+            ok = false;
+            break;
+        }
+    }
+
+    // Results come back in queue order per device
+    for (size_t i = 0; i < queued; i++) {
+        spi_transaction_t* done;
+        if (spi_device_get_trans_result(_devices[ops[i].device], &done, portMAX_DELAY) != ESP_OK) {
+            ok = false;
+            continue;
+        }
+        _transactions++;
+        if (ops[i].type == SPI_OP_ADC_READ) {
+            *ops[i].rawA = _adcResult(*done);
+        }
+    }
+    return ok;
+}
+
+bool SpiBus::_runBurst(const SpiOp& op) {
+    const size_t per_sample = (op.rawA ? 1 : 0) + (op.rawB ? 1 : 0);
+    const size_t total = op.count * per_sample;
+    if (total == 0) {
+        return true;
+    }
+
+    // Keep the driver's queue full: the conversions run back to back from the SPI interrupt
+    // while this task only refills the ring and stores results
+    spi_transaction_t ring[SPI_BUS_DEVICE_QUEUE];
+    spi_device_handle_t adc = _devices[SPI_DEVICE_SIGNAL_ADC];
+    const SpiOp conversion = {SPI_OP_ADC_READ, SPI_DEVICE_SIGNAL_ADC, 0, 0, nullptr, nullptr, 0, nullptr};
+    size_t queued = 0;
+    size_t done = 0;
+    bool ok = true;
+    while (done < queued || (ok && queued < total)) {
+        while (ok && queued < total && queued - done < SPI_BUS_DEVICE_QUEUE) {
+            uint8_t channel = per_sample == 2 ? (uint8_t)(queued & 1) : (op.rawA ? 0 : 1);
+            _prepare(ring[queued % SPI_BUS_DEVICE_QUEUE], conversion, channel);
+            if (spi_device_queue_trans(adc, &ring[queued % SPI_BUS_DEVICE_QUEUE], portMAX_DELAY) != ESP_OK) {
+                ok = false;
+                break;
+            }
+            queued++;
+        }
+        if (done == queued) {
+            break;
+        }
+
+        spi_transaction_t* result;
+        if (spi_device_get_trans_result(adc, &result, portMAX_DELAY) != ESP_OK) {
+            return false;
+        }
+        _transactions++;
+        size_t sample = done / per_sample;
+        bool channel_a = per_sample == 2 ? (done & 1) == 0 : op.rawA != nullptr;
+        (channel_a ? op.rawA : op.rawB)[sample] = _adcResult(*result);
+        done++;
+    }
+    return ok;
+}
+
+void SpiBus::_latch(const SpiOp& op) {
+    if (op.gpio != nullptr) {
+        // Digital lines switch in the same microsecond as the DAC outputs
+        GPIO.out_w1ts = op.gpio[0];
+        GPIO.out_w1tc = op.gpio[1];
+        GPIO.out1_w1ts.val = op.gpio[2];
+        GPIO.out1_w1tc.val = op.gpio[3];
+    }
+    // Only pulses from this task clear the pending flag; a timed LDAC edge from the latch
+    // timer leaves it set, which costs at most one redundant pulse
+    if (op.value == 1 && !_dacPending) {
+        _latchesSkipped++;
+        return;
+    }
+    _dacPending = false;
+    digitalWrite(_ldac, LOW);
+    delayMicroseconds(1);  // MCP4822 needs >100ns LDAC low
+    digitalWrite(_ldac, HIGH);
+}
+
+void SpiBus::_prepare(spi_transaction_t& trans, const SpiOp& op, uint8_t channel) {
+    memset(&trans, 0, sizeof(trans));
+    trans.flags = SPI_TRANS_USE_TXDATA;
+    if (op.type == SPI_OP_DAC_WRITE) {
+        // MCP4822 command: channel, /GA = 1 (1x gain), /SHDN = 1 (active), 12-bit code
+        uint16_t word = ((uint16_t)(channel & 0x01) << 15) | 0x3000 | (op.value & 0x0FFF);
+        trans.length = 16;
+        trans.tx_data[0] = (uint8_t)(word >> 8);
+        trans.tx_data[1] = (uint8_t)(word & 0xFF);
+    } else {
+        // MCP3202 frame: start bit, then SGL=1 / ODD=channel / MSBF=1, 12-bit result in the last 1.5 bytes
+        trans.flags |= SPI_TRANS_USE_RXDATA;
+        trans.length = 24;
+        trans.tx_data[0] = 0x01;
+        trans.tx_data[1] = 0xA0 | ((channel & 0x01) << 6);
+        trans.tx_data[2] = 0x00;
+    }
+}
+
+uint16_t SpiBus::_adcResult(const spi_transaction_t& trans) {
+    return ((uint16_t)(trans.rx_data[1] & 0x0F) << 8) | trans.rx_data[2];
+}
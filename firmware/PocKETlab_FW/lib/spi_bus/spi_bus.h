@@ -0,0 +1,130 @@
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+#include <Arduino.h>
+#include <driver/spi_master.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+// Bus configuration
+#define SPI_BUS_HOST SPI2_HOST
+#define SPI_BUS_ADC_CLOCK_HZ 1000000      // MCP3202 at 3.3 V
+#define SPI_BUS_DAC_CLOCK_HZ 10000000     // MCP4822 (20 MHz max)
+#define SPI_BUS_DEVICE_QUEUE 8            // Transactions in flight per device
+#define SPI_BUS_BATCH_QUEUE 16            // Batches waiting for the owner task
+#define SPI_BUS_TASK_PRIORITY (configMAX_PRIORITIES - 3)  // Below the feedback scan, above every client
+#define SPI_BATCH_MAX_OPS 8
+
+// The chips on the bus
+enum SpiDevice : uint8_t {
+    SPI_DEVICE_SIGNAL_ADC = 0,   // U8 - MCP3202
+    SPI_DEVICE_SIGNAL_DAC,       // U5 - MCP4822
+    SPI_DEVICE_POWER_DAC,        // U6 - MCP4822
+    SPI_DEVICES
+};
+
+enum SpiOpType : uint8_t {
+    SPI_OP_DAC_WRITE,            // Stage a code in a DAC channel (output changes at the next latch)
+    SPI_OP_ADC_READ,             // One MCP3202 conversion
+    SPI_OP_ADC_BURST,            // count conversions of A and/or B, interleaved
+    SPI_OP_LATCH                 // LDAC pulse: both DACs update together (plus optional GPIO masks);
+                                 // value 1 = only if a DAC write ran since the last pulse
+};
+
+struct SpiOp {
+    SpiOpType type;
+    SpiDevice device;
+    uint8_t channel;
+    uint16_t value;
+    uint16_t* rawA;              // ADC results (rawA also holds single reads)
+    uint16_t* rawB;
+    size_t count;
+    const uint32_t* gpio;        // Latch: set/clear GPIO0-31, set/clear GPIO32+ written just before LDAC
+};
+
+// An ordered list of bus operations executed back to back by the bus owner task.
+// Consecutive transactions are queued to the driver together; a latch waits for every
+// write queued before it. Lives on the client's stack; not copyable. The owner task writes the
+// result into it, so a client must never be deleted from outside while execute() is waiting.
+class SpiBatch {
+public:
+    SpiBatch();
+    SpiBatch(const SpiBatch&) = delete;
+    SpiBatch& operator=(const SpiBatch&) = delete;
+
+    // Each returns false when the batch is full
+    bool writeDAC(SpiDevice dac, uint8_t channel, uint16_t code);
+    bool readADC(uint8_t channel, uint16_t* result);
+    bool readADCBurst(uint16_t* rawA, uint16_t* rawB, size_t count);  // Either buffer may be nullptr
+    bool latch(const uint32_t* gpio = nullptr);   // gpio: 4 masks, must outlive execute()
+    bool latchPending(const uint32_t* gpio = nullptr);  // Same, but no pulse when no write is pending
+
+    void clear() { _count = 0; }
+    uint8_t size() const { return _count; }
+    const SpiOp& op(uint8_t index) const { return _ops[index]; }
+
+private:
+    friend class SpiBus;
+    SpiOp _ops[SPI_BATCH_MAX_OPS];
+    uint8_t _count;
+    volatile bool _ok;
+    StaticSemaphore_t _doneBuffer;
+    SemaphoreHandle_t _done;     // Given by the owner task when the batch has run
+    bool _add(const SpiOp& op);
+};
+
+// Owner of the shared SPI bus (ESP-IDF spi_master, one device handle per chip, DMA-capable host).
+// Only the owner task talks to the driver; clients hand it batches through a queue and block
+// until their batch has run, so tasks on either core get whole batches without interleaving.
+class SpiBus {
+public:
+    SpiBus();
+    ~SpiBus();
+
+    bool begin(int sck, int miso, int mosi, int cs_adc, int cs_signal_dac, int cs_power_dac, int ldac);
+    void end();
+    bool isRunning() const { return _task != NULL; }
+
+    // Run a batch and wait for it. urgent batches go to the front of the queue (the power trip).
+    // Returns false if the bus is not running or a transaction failed.
+    bool execute(SpiBatch& batch, bool urgent = false);
+
+    // Statistics
+    uint32_t getBatches() const { return _batches; }
+    uint32_t getTransactions() const { return _transactions; }
+    uint32_t getErrors() const { return _errors; }
+    uint32_t getMaxQueued() const { return _maxQueued; }
+    uint32_t getLatchesSkipped() const { return _latchesSkipped; }   // latchPending() with nothing to latch
+    float getUtilization();      // Share of time the owner task spent running batches since the last call
+
+private:
+    spi_device_handle_t _devices[SPI_DEVICES];
+    QueueHandle_t _queue;
+    TaskHandle_t _task;
+    volatile bool _running;
+    bool _busReady;
+    int _ldac;
+
+    volatile uint32_t _batches;
+    volatile uint32_t _transactions;
+    volatile uint32_t _errors;
+    volatile uint32_t _maxQueued;
+    volatile uint32_t _latchesSkipped;
+    bool _dacPending;            // A DAC write ran since the last LDAC pulse (owner task only)
+    volatile int64_t _busyUs;
+    int64_t _utilizationStartUs;
+    int64_t _utilizationBusyUs;
+
+    static void _taskWrapper(void* parameter);
+    void _run();
+    bool _runBatch(SpiBatch& batch);
+    bool _runTransactions(const SpiOp* ops, size_t count);
+    bool _runBurst(const SpiOp& op);
+    void _latch(const SpiOp& op);
+    static void _prepare(spi_transaction_t& trans, const SpiOp& op, uint8_t channel);
+    static uint16_t _adcResult(const spi_transaction_t& trans);
+};
+
+#endif // SPI_BUS_H
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+PocKETlab Logger Decoder
+Downloads (or reads) a logger session and writes it as CSV.
+
+    python logger_decode.py http://pocketlab.local soak.csv password   # Log in, fetch /logger/index and /logger/data
+    python logger_decode.py session.bin soak.csv [index.json]   # Decode a saved download
+
+The download is a sequence of 4096-byte chunks. Each chunk starts with a 32-byte header
+(little-endian):
+
+    magic "PLLG", version u8, flags u8, record_size u8, channels u8,
+    session u32, sequence u32, first_record u32, record_period_us u32,
+    record_count u16, reserved u16, crc32 u32
+
+followed by record_count records of int16 values, one per channel for each field
+(value, or mean/min/max when flags bit 0 is set). The CRC-32 covers the first 28 header
+bytes and the records. Chunks that fail the check (torn, or overwritten during the
+download) are reported and skipped.
+
+Without the index the CSV holds raw codes (temperature in 0.01 degC).
+"""
+
+import csv
+import json
+import struct
+import sys
+import urllib.parse
+import urllib.request
+import zlib
+
+CHUNK_SIZE = 4096
+HEADER = struct.Struct("<4sBBBBIIIIHHI")
+MAGIC = b"PLLG"
+FLAG_DECIMATED = 0x01
+CHANNEL_NAMES = ["power_voltage", "power_current", "signal_a", "signal_b", "temperature"]
+
+
+def parse_chunks(data):
+    """Yield (header, records) for every valid chunk, oldest first"""
+    for offset in range(0, len(data) - CHUNK_SIZE + 1, CHUNK_SIZE):
+        chunk = data[offset:offset + CHUNK_SIZE]
+        (magic, version, flags, record_size, channels, session, sequence, first_record,
+         period_us, count, _reserved, crc) = HEADER.unpack_from(chunk)
+        if magic != MAGIC:
+            print(f"chunk at {offset}: not a logger chunk, skipped", file=sys.stderr)
+            continue
+        payload = chunk[HEADER.size:HEADER.size + count * record_size]
+        if len(payload) != count * record_size or zlib.crc32(chunk[:28] + payload) != crc:
+            print(f"chunk {sequence}: CRC mismatch, skipped", file=sys.stderr)
+            continue
+        header = dict(version=version, flags=flags, record_size=record_size, channels=channels,
+                      session=session, sequence=sequence, first_record=first_record,
+                      record_period_us=period_us, record_count=count)
+        values = record_size // 2
+        records = [struct.unpack_from(f"<{values}h", payload, i * record_size) for i in range(count)]
+        yield header, records
+
+
+def login(base, password):
+    """Log in through /auth and return the session cookie the downloads require"""
+    body = urllib.parse.urlencode({"password": password}).encode()
+    with urllib.request.urlopen(base + "/auth", data=body) as response:
+        for header in response.headers.get_all("Set-Cookie") or []:
+            cookie = header.split(";", 1)[0]
+            if cookie.startswith("auth="):
+                return cookie
+    sys.exit("login failed: no auth cookie in the /auth response")
+
+
+def fetch(base, path, cookie):
+    request = urllib.request.Request(base + path, headers={"Cookie": cookie})
+    return urllib.request.urlopen(request)
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        sys.exit(1)
+    source, output = sys.argv[1], sys.argv[2]
+
+    index = None
+    if source.startswith("http://") or source.startswith("https://"):
+        if len(sys.argv) < 4:
+            sys.exit("downloads need the web interface admin password as the third argument")
+        base = source.rstrip("/")
+        cookie = login(base, sys.argv[3])
+        with fetch(base, "/logger/index", cookie) as response:
+            index = json.load(response)
+        with fetch(base, "/logger/data", cookie) as response:
+            data = response.read()
+    else:
+        with open(source, "rb") as f:
+            data = f.read()
+        if len(sys.argv) > 3:
+            with open(sys.argv[3]) as f:
+                index = json.load(f)
+
+    scales = [1.0] * len(CHANNEL_NAMES)
+    offsets = [0.0] * len(CHANNEL_NAMES)
+    if index:
+        scales = [channel["scale"] for channel in index["channels"]]
+        offsets = [channel.get("offset", 0.0) for channel in index["channels"]]
+
+    rows = 0
+    with open(output, "w", newline="") as f:
+        writer = csv.writer(f)
+        header_written = False
+        for header, records in parse_chunks(data):
+            channels = header["channels"]
+            fields = ["mean", "min", "max"] if header["flags"] & FLAG_DECIMATED else ["value"]
+            if not header_written:
+                columns = ["record", "time_s"]
+                for field in fields:
+                    for name in CHANNEL_NAMES[:channels]:
+                        columns.append(name if field == "value" else f"{name}_{field}")
+                writer.writerow(columns)
+                header_written = True
+            period_s = header["record_period_us"] / 1e6
+            for i, record in enumerate(records):
+                index_number = header["first_record"] + i
+                row = [index_number, round(index_number * period_s, 6)]
+                for j, value in enumerate(record):
+                    scale = scales[j % channels] if index else 1.0
+                    offset = offsets[j % channels] if index else 0.0
+                    row.append(round(value * scale + offset, 6) if index else value)
+                writer.writerow(row)
+                rows += 1
+
+    print(f"Wrote {rows} records to {output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,312 @@
+#!/usr/bin/env python3
+"""
+PocKETlab Recipe Compiler
+Compiles a text or JSON measurement recipe into the bytecode image run by the
+firmware's recipe mode, and wraps it in a ready-to-publish MQTT command.
+
+Text recipe, one instruction per line ('#' starts a comment):
+
+    name "diode_test"             # Recipe name reported with the results
+    timeout 30s                   # Time budget on the device (default 60s)
+    set current_limit 0.05        # Stage and latch one output
+    stage signal_a 1.0            # Stage only...
+    stage signal_b 0.0
+    latch                         # ...and latch everything staged on one LDAC edge
+    digital da0 1                 # da0-da3, db0-db3
+    wait 5ms                      # us, ms or s
+    measure r0 device_voltage 16  # Average of up to 64 conversions
+    settle r1 power_current 0.001 10ms [500us]   # Tolerance, timeout, read interval
+    load r2 0.5
+    add r3 r0 r2                  # add/sub/mul/div rD rA (rB | number)
+    check "vf" r0 0.55 0.75       # Emits a pass/fail result
+    jump_if_fail done             # Also: jump, jump_if_pass, jump_lt rA rB label
+    emit "vf_raw" r0
+    repeat 10                     # Loops nest; endrepeat closes
+        ...
+    endrepeat
+    abort "no_device"             # Stop here as failed
+    done:                         # Label
+    end
+
+Inputs: signal_a, signal_b, device_voltage, power_voltage, power_current, temperature.
+Outputs: signal_a, signal_b, power_voltage, current_limit.
+Registers r0-r11 are free; r12-r15 are used by the compiler (loop counters, immediates).
+
+A JSON recipe is {"name": ..., "timeout_s": ..., "steps": [["set", "power_voltage", 5], ...]},
+each step being the tokens of one text line.
+"""
+
+import base64
+import json
+import shlex
+import struct
+import sys
+
+VERSION = 1
+MAX_CODE = 4096
+MAX_STRINGS = 32
+MAX_STRING_LENGTH = 24
+USER_REGISTERS = 12
+SCRATCH_REGISTER = 15
+
+OPCODES = {
+    "end": 0x00, "stage": 0x01, "latch": 0x02, "set": 0x03, "digital": 0x04, "wait": 0x05,
+    "measure": 0x06, "settle": 0x07, "load": 0x08, "mov": 0x09, "add": 0x0A, "sub": 0x0B,
+    "mul": 0x0C, "div": 0x0D, "check": 0x0E, "emit": 0x0F, "jump": 0x10, "jump_if_pass": 0x11,
+    "jump_if_fail": 0x12, "djnz": 0x13, "jump_lt": 0x14, "abort": 0x15,
+}
+OUTPUTS = ["signal_a", "signal_b", "power_voltage", "current_limit"]
+INPUTS = ["signal_a", "signal_b", "device_voltage", "power_voltage", "power_current", "temperature"]
+LINES = ["da0", "da1", "da2", "da3", "db0", "db1", "db2", "db3"]
+TIME_UNITS = {"us": 1, "ms": 1000, "s": 1000000}
+
+
+class RecipeError(Exception):
+    pass
+
+
+class RecipeCompiler:
+    def __init__(self):
+        self.code = bytearray()
+        self.strings = []
+        self.labels = {}
+        self.fixups = []        # (code offset, label, source line)
+        self.loops = []         # (counter register, loop start)
+        self.name = "recipe"
+        self.timeout_s = 60.0
+        self.line = 0
+
+    # --- operand helpers ---
+
+    def error(self, message):
+        raise RecipeError(f"line {self.line}: {message}")
+
+    def register(self, token, user=True):
+        if not token.startswith("r") or not token[1:].isdigit():
+            self.error(f"expected a register, got '{token}'")
+        index = int(token[1:])
+        limit = USER_REGISTERS if user else 16
+        if index >= limit:
+            self.error(f"register {token} is reserved (use r0-r{USER_REGISTERS - 1})")
+        return index
+
+    def choice(self, token, options, what):
+        if token not in options:
+            self.error(f"unknown {what} '{token}' (use {', '.join(options)})")
+        return options.index(token)
+
+    def number(self, token):
+        try:
+            return float(token)
+        except ValueError:
+            self.error(f"expected a number, got '{token}'")
+
+    def duration_us(self, token):
+        for unit in sorted(TIME_UNITS, key=len, reverse=True):
+            if token.endswith(unit):
+                value = self.number(token[:-len(unit)])
+                return int(round(value * TIME_UNITS[unit]))
+        self.error(f"time '{token}' needs a unit (us, ms or s)")
+
+    def string(self, token):
+        if len(token) > MAX_STRING_LENGTH:
+            self.error(f"name '{token}' is longer than {MAX_STRING_LENGTH} characters")
+        if token not in self.strings:
+            if len(self.strings) >= MAX_STRINGS:
+                self.error(f"more than {MAX_STRINGS} distinct names")
+            self.strings.append(token)
+        return self.strings.index(token)
+
+    def emit(self, opcode, fmt="", *values):
+        self.code.append(OPCODES[opcode])
+        if fmt:
+            self.code += struct.pack("<" + fmt, *values)
+
+    def jump_target(self, label):
+        # Placeholder, patched once every label is known
+        self.fixups.append((len(self.code), label, self.line))
+        self.code += b"\x00\x00"
+
+    def value_register(self, token):
+        """Register operand, or an immediate loaded into the scratch register."""
+        if token.startswith("r") and token[1:].isdigit():
+            return self.register(token)
+        self.emit("load", "Bf", SCRATCH_REGISTER, self.number(token))
+        return SCRATCH_REGISTER
+
+    def expect(self, args, count, usage):
+        if len(args) not in (count if isinstance(count, tuple) else (count,)):
+            self.error(f"usage: {usage}")
+
+    # --- instructions ---
+
+    def statement(self, tokens):
+        op, args = tokens[0].lower(), tokens[1:]
+
+        if tokens[0].endswith(":") and not args:
+            label = tokens[0][:-1]
+            if label in self.labels:
+                self.error(f"label '{label}' defined twice")
+            self.labels[label] = len(self.code)
+        elif op == "name":
+            self.expect(args, 1, 'name "text"')
+            self.name = args[0]
+        elif op == "timeout":
+            self.expect(args, 1, "timeout <time>")
+            self.timeout_s = self.duration_us(args[0]) / 1e6
+        elif op in ("set", "stage"):
+            self.expect(args, 2, f"{op} <output> <value|rN>")
+            output = self.choice(args[0], OUTPUTS, "output")
+            self.emit(op, "BB", output, self.value_register(args[1]))
+        elif op in ("latch", "end"):
+            self.expect(args, 0, op)
+            self.emit(op)
+        elif op == "digital":
+            self.expect(args, 2, "digital <da0-db3> <0|1>")
+            self.emit(op, "BB", self.choice(args[0], LINES, "line"), 1 if self.number(args[1]) else 0)
+        elif op == "wait":
+            self.expect(args, 1, "wait <time>")
+            self.emit(op, "I", self.duration_us(args[0]))
+        elif op == "measure":
+            self.expect(args, (2, 3), "measure rN <input> [samples]")
+            samples = int(self.number(args[2])) if len(args) > 2 else 1
+            if not 1 <= samples <= 64:
+                self.error("samples must be 1 to 64")
+            self.emit(op, "BBB", self.register(args[0]), self.choice(args[1], INPUTS, "input"), samples)
+        elif op == "settle":
+            self.expect(args, (4, 5), "settle rN <input> <tolerance> <timeout> [interval]")
+            timeout_ms = self.duration_us(args[3]) // 1000
+            interval_us = self.duration_us(args[4]) if len(args) > 4 else 1000
+            if not 1 <= timeout_ms <= 65535 or not 50 <= interval_us <= 65535:
+                self.error("timeout 1ms-65s, interval 50us-65ms")
+            self.emit(op, "BBfHH", self.register(args[0]), self.choice(args[1], INPUTS, "input"),
+                      self.number(args[2]), interval_us, timeout_ms)
+        elif op == "load":
+            self.expect(args, 2, "load rN <number>")
+            self.emit(op, "Bf", self.register(args[0]), self.number(args[1]))
+        elif op == "mov":
+            self.expect(args, 2, "mov rD rS")
+            self.emit(op, "BB", self.register(args[0]), self.register(args[1]))
+        elif op in ("add", "sub", "mul", "div"):
+            self.expect(args, 3, f"{op} rD rA <rB|number>")
+            b = self.value_register(args[2])
+            self.emit(op, "BBB", self.register(args[0]), self.register(args[1]), b)
+        elif op == "check":
+            self.expect(args, 4, 'check "name" rN <low> <high>')
+            low, high = self.number(args[2]), self.number(args[3])
+            if low > high:
+                self.error("low limit above high limit")
+            self.emit(op, "BBff", self.string(args[0]), self.register(args[1]), low, high)
+        elif op == "emit":
+            self.expect(args, 2, 'emit "name" rN')
+            self.emit(op, "BB", self.string(args[0]), self.register(args[1]))
+        elif op == "abort":
+            self.expect(args, 1, 'abort "name"')
+            self.emit(op, "B", self.string(args[0]))
+        elif op in ("jump", "jump_if_pass", "jump_if_fail"):
+            self.expect(args, 1, f"{op} <label>")
+            self.emit(op)
+            self.jump_target(args[0])
+        elif op == "jump_lt":
+            self.expect(args, 3, "jump_lt rA rB <label>")
+            self.emit(op, "BB", self.register(args[0]), self.register(args[1]))
+            self.jump_target(args[2])
+        elif op == "repeat":
+            self.expect(args, 1, "repeat <count>")
+            count = int(self.number(args[0]))
+            counter = SCRATCH_REGISTER - 1 - len(self.loops)
+            if counter < USER_REGISTERS:
+                self.error("loops nested too deep (max 3)")
+            if count < 1:
+                self.error("repeat count must be at least 1")
+            self.emit("load", "Bf", counter, float(count))
+            self.loops.append((counter, len(self.code)))
+        elif op == "endrepeat":
+            self.expect(args, 0, "endrepeat")
+            if not self.loops:
+                self.error("endrepeat without repeat")
+            counter, start = self.loops.pop()
+            self.emit("djnz", "BH", counter, start)
+        else:
+            self.error(f"unknown instruction '{op}'")
+
+    def compile(self, lines):
+        for self.line, tokens in lines:
+            if tokens:
+                self.statement(tokens)
+        if self.loops:
+            raise RecipeError("repeat without endrepeat")
+        self.code.append(OPCODES["end"])
+
+        for offset, label, line in self.fixups:
+            if label not in self.labels:
+                raise RecipeError(f"line {line}: undefined label '{label}'")
+            struct.pack_into("<H", self.code, offset, self.labels[label])
+        if len(self.code) > MAX_CODE:
+            raise RecipeError(f"code is {len(self.code)} bytes, the device accepts {MAX_CODE}")
+
+        image = bytearray(b"PLRB")
+        image += bytes([VERSION, len(self.strings)])
+        for text in self.strings:
+            encoded = text.encode("ascii")
+            image += bytes([len(encoded)]) + encoded
+        return bytes(image + self.code)
+
+
+def read_recipe(path):
+    """Return [(line number, tokens)] from a text or JSON recipe."""
+    with open(path, "r", encoding="utf-8") as f:
+        source = f.read()
+    if path.lower().endswith(".json"):
+        recipe = json.loads(source)
+        lines = []
+        if "name" in recipe:
+            lines.append((0, ["name", str(recipe["name"])]))
+        if "timeout_s" in recipe:
+            lines.append((0, ["timeout", f"{recipe['timeout_s']}s"]))
+        for number, step in enumerate(recipe.get("steps", []), start=1):
+            lines.append((number, [str(token) for token in step]))
+        return lines
+    return [(number, shlex.split(text, comments=True)) for number, text in enumerate(source.splitlines(), start=1)]
+
+
+def main():
+    """Compile a recipe file and write the MQTT command for it."""
+
+    print("PocKETlab Recipe Compiler")
+    print("=" * 40)
+
+    if len(sys.argv) < 2:
+        print("Usage: recipe_compiler.py <recipe.txt|recipe.json> [command.json]")
+        sys.exit(1)
+    source = sys.argv[1]
+    output_file = sys.argv[2] if len(sys.argv) > 2 else source.rsplit(".", 1)[0] + ".cmd.json"
+
+    compiler = RecipeCompiler()
+    try:
+        image = compiler.compile(read_recipe(source))
+    except (RecipeError, OSError, json.JSONDecodeError) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+
+    command = {
+        "type": "command",
+        "payload": {
+            "mode": "recipe",
+            "settings": {
+                "name": compiler.name,
+                "timeout_s": compiler.timeout_s,
+                "bytecode": base64.b64encode(image).decode("ascii"),
+            },
+        },
+    }
+    with open(output_file, "w", encoding="utf-8") as f:
+        json.dump(command, f, indent=2)
+
+    print(f"Recipe: {compiler.name}")
+    print(f"Image: {len(image)} bytes ({len(compiler.code)} bytes code, {len(compiler.strings)} names)")
+    print(f"\n✓ Command written to {output_file}")
+
+
+if __name__ == "__main__":
+    main()
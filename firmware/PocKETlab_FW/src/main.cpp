@@ -13,6 +13,7 @@
 #include "pocketlab_io.h"
 #include "postman_mqtt.h"
 #include "driver_control.h"
+#include "scan_scheduler.h"
 
 // LED Configuration
 #define LED_PIN 38
@@ -34,6 +35,12 @@ NetMan netManager("PocKETlab", "admin123");
 // PocKETlab I/O system instance
 PocKETlabIO pocketlabIO;
 
+// Scan scheduler: every periodic analog reading goes through a subscription
+ScanScheduler scanScheduler(pocketlabIO);
+const ScanSource statusSources[] = {SCAN_POWER_VOLTAGE, SCAN_POWER_CURRENT, SCAN_SIGNAL_A, SCAN_SIGNAL_B,
+                                    SCAN_FEEDBACK_A, SCAN_FEEDBACK_B, SCAN_TEMPERATURE};
+int statusScan[SCAN_SOURCES];
+
 // MQTT and Driver Control
 const char* mqtt_server = "broker.hivemq.com"; // <<< CHANGE TO YOUR MQTT BROKER
 WiFiClient espClient;
@@ -43,7 +50,7 @@ PubSubClient mqttClient(espClient);
 // String mac = WiFi.macAddress();
 PostmanMQTT postman(mqttClient, "pocketlab_02");
 
-DriverControl driver(postman, pocketlabIO);
+DriverControl driver(postman, pocketlabIO, scanScheduler);
 
 void callback(char* topic, byte* payload, unsigned int length) {
     Serial.print("Message arrived in topic: ");
@@ -134,12 +141,26 @@ void setup()
 		Serial.println("PocKETlab I/O system initialized successfully");
 	}
 
+	// Start the scan scheduler with the readings of the periodic status report
+	if (!scanScheduler.begin())
+	{
+		Serial.println("ERROR: Failed to start the scan scheduler!");
+	}
+	for (ScanSource source : statusSources)
+	{
+		statusScan[source] = scanScheduler.subscribe(source, 1.0f);
+	}
+
 	// Initialize PD Control
 	Serial.println("Initializing PD Control...");
 	pdControl.begin();
 	Serial.print("Max tested source voltage: ");
 	Serial.print(pdControl.getMaxTestedSourceVoltage());
 	Serial.println("V");
+	// Data logger downloads, served by the web server in every network mode behind the admin login
+	netManager.addRoute("/logger/data", HTTP_GET, [](WebServer& server) { driver.handleLoggerData(server); });
+	netManager.addRoute("/logger/index", HTTP_GET, [](WebServer& server) { driver.handleLoggerIndex(server); });
+
 	// Initialize Network Manager
 	Serial.println("Initializing Network Manager...");
 	if (!netManager.begin())
@@ -272,15 +293,19 @@ void loop()
 		{
 			Serial.println("--- I/O Status ---");
 			Serial.printf("Power: %.2fV, %.3fA\n",
-						  pocketlabIO.readPowerVoltage(),
-						  pocketlabIO.readPowerCurrent());
+						  scanScheduler.getLatest(statusScan[SCAN_POWER_VOLTAGE]),
+						  scanScheduler.getLatest(statusScan[SCAN_POWER_CURRENT]));
 			Serial.printf("Signal Inputs: A=%.3fV, B=%.3fV\n",
-						  pocketlabIO.readSignalVoltage(SIGNAL_CHANNEL_A),
-						  pocketlabIO.readSignalVoltage(SIGNAL_CHANNEL_B));
+						  scanScheduler.getLatest(statusScan[SCAN_SIGNAL_A]),
+						  scanScheduler.getLatest(statusScan[SCAN_SIGNAL_B]));
 			Serial.printf("Signal Outputs: A=%.2fV, B=%.2fV (amplified)\n",
-						  pocketlabIO.getExpectedSignalOutput(SIGNAL_CHANNEL_A),
-						  pocketlabIO.getExpectedSignalOutput(SIGNAL_CHANNEL_B));
-			Serial.printf("Temperature: %.1f°C\n", pocketlabIO.readTemperature());
+						  scanScheduler.getLatest(statusScan[SCAN_FEEDBACK_A]) * SIGNAL_AMPLIFIER_GAIN,
+						  scanScheduler.getLatest(statusScan[SCAN_FEEDBACK_B]) * SIGNAL_AMPLIFIER_GAIN);
+			Serial.printf("Temperature: %.1f°C\n", scanScheduler.getLatest(statusScan[SCAN_TEMPERATURE]));
+			Serial.printf("DAC writes: %lu sent, %lu skipped, %lu latches skipped\n",
+						  (unsigned long)pocketlabIO.getDacWrites(), (unsigned long)pocketlabIO.getDacWritesSkipped(),
+						  (unsigned long)pocketlabIO.getLatchesSkipped());
+			scanScheduler.printStatus();
 		}
 		Serial.println("==================");
 	}
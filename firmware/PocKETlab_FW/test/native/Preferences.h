@@ -0,0 +1,47 @@
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+#include <stddef.h>
+#include <string.h>
+
+// In-memory NVS with a single blob, enough for code that stores one key per namespace.
+// Tests reach the stored bytes through nativeNvsBlob() to corrupt or clear them; it is
+// inline rather than static so the library and the test share one store.
+struct NativeNvsBlob {
+    unsigned char data[512];
+    size_t length;
+};
+
+inline NativeNvsBlob& nativeNvsBlob() {
+    static NativeNvsBlob blob = {{0}, 0};
+    return blob;
+}
+
+class Preferences {
+public:
+    bool begin(const char*, bool read_only = false) { _read_only = read_only; return true; }
+    void end() {}
+    size_t getBytes(const char*, void* buffer, size_t length) {
+        NativeNvsBlob& blob = nativeNvsBlob();
+        if (blob.length == 0 || blob.length > length) return 0;
+        memcpy(buffer, blob.data, blob.length);
+        return blob.length;
+    }
+    size_t putBytes(const char*, const void* value, size_t length) {
+        NativeNvsBlob& blob = nativeNvsBlob();
+        if (_read_only || length > sizeof(blob.data)) return 0;
+        memcpy(blob.data, value, length);
+        blob.length = length;
+        return length;
+    }
+    bool clear() {
+        if (_read_only) return false;
+        nativeNvsBlob().length = 0;
+        return true;
+    }
+
+private:
+    bool _read_only = false;
+};
+
+#endif // NATIVE_PREFERENCES_H
@@ -0,0 +1,167 @@
+// Host-side tests for the board calibration math and its NVS table check.
+// Run with: pio test -e native
+
+#include <unity.h>
+#include <board_calibration.h>
+#include <Preferences.h>   // test/native: in-memory NVS
+
+static const float kDacGain = 2.048f / 4096.0f;
+
+void setUp() {}
+void tearDown() {}
+
+// A sweep on an exact line: the fit has to return its gain and offset
+static void test_fit_recovers_line() {
+    float codes[9], volts[9];
+    for (int i = 0; i < 9; i++) {
+        codes[i] = 100.0f + i * 480.0f;
+        volts[i] = 0.0125f + codes[i] * kDacGain * 1.03f;
+    }
+    CalibrationEntry entry;
+    TEST_ASSERT_TRUE(CalibrationEngine::fit(codes, volts, 9, false, entry));
+    TEST_ASSERT_FLOAT_WITHIN(1e-8f, kDacGain * 1.03f, entry.gain);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.0125f, entry.offset);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.0f, entry.residual);
+    TEST_ASSERT_EQUAL_UINT8(9, entry.points);
+    TEST_ASSERT_EQUAL_UINT8(0, entry.piecewise);
+}
+
+// Order of the sweep points must not matter
+static void test_fit_unordered_sweep() {
+    float codes[5] = {4000.0f, 0.0f, 2000.0f, 1000.0f, 3000.0f};
+    float volts[5];
+    for (int i = 0; i < 5; i++) volts[i] = codes[i] * kDacGain;
+    CalibrationEntry entry;
+    TEST_ASSERT_TRUE(CalibrationEngine::fit(codes, volts, 5, true, entry));
+    TEST_ASSERT_FLOAT_WITHIN(1e-8f, kDacGain, entry.gain);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.0f, entry.offset);
+    for (int node = 0; node < CAL_PWL_POINTS; node++) {
+        TEST_ASSERT_INT_WITHIN(1, 0, entry.pwl[node]);
+    }
+}
+
+static void test_fit_rejects_bad_sweeps() {
+    float codes[3] = {1000.0f, 1000.0f, 1000.0f};
+    float volts[3] = {0.5f, 0.5f, 0.5f};
+    CalibrationEntry entry = CalibrationEngine::nominal(kDacGain);
+    TEST_ASSERT_FALSE(CalibrationEngine::fit(codes, volts, 1, false, entry));   // Too few points
+    TEST_ASSERT_FALSE(CalibrationEngine::fit(codes, volts, 3, false, entry));   // Flat sweep
+
+    float falling_codes[3] = {0.0f, 2000.0f, 4000.0f};
+    float falling_volts[3] = {2.0f, 1.0f, 0.0f};
+    TEST_ASSERT_FALSE(CalibrationEngine::fit(falling_codes, falling_volts, 3, false, entry));
+    TEST_ASSERT_FLOAT_WITHIN(1e-12f, kDacGain, entry.gain);   // Untouched on failure
+}
+
+// A bowed transfer curve: the piecewise correction has to take out what the line leaves
+static void test_fit_piecewise_reduces_residual() {
+    float codes[17], volts[17];
+    for (int i = 0; i < 17; i++) {
+        codes[i] = i * 255.0f;
+        float bow = 3.0f * sinf((float)M_PI * codes[i] / 4095.0f);   // Up to 3 LSB of INL
+        volts[i] = (codes[i] + bow) * kDacGain;
+    }
+    CalibrationEntry line, piecewise;
+    TEST_ASSERT_TRUE(CalibrationEngine::fit(codes, volts, 17, false, line));
+    TEST_ASSERT_TRUE(CalibrationEngine::fit(codes, volts, 17, true, piecewise));
+    TEST_ASSERT_EQUAL_UINT8(1, piecewise.piecewise);
+    TEST_ASSERT_TRUE(piecewise.residual < line.residual / 4.0f);
+    TEST_ASSERT_TRUE(piecewise.residual < 0.25f * kDacGain);
+}
+
+// Correction is exact at the nodes, linear between them and clamped outside
+static void test_correction_interpolates_nodes() {
+    int16_t pwl[CAL_PWL_POINTS] = {0, 32, -16, 0, 0, 8, 8, -64, 48};
+    const int32_t step = 1 << CAL_PWL_SHIFT;
+    for (int node = 0; node < CAL_PWL_POINTS - 1; node++) {
+        TEST_ASSERT_EQUAL_INT32(pwl[node], CalibrationEngine::correction(pwl, node * step));
+    }
+    TEST_ASSERT_EQUAL_INT32(16, CalibrationEngine::correction(pwl, step / 2));
+    TEST_ASSERT_EQUAL_INT32(8, CalibrationEngine::correction(pwl, step + step / 2));
+    TEST_ASSERT_EQUAL_INT32(26, CalibrationEngine::correction(pwl, step + step / 8));
+    TEST_ASSERT_EQUAL_INT32(8, CalibrationEngine::correction(pwl, 5 * step + 100));
+    TEST_ASSERT_EQUAL_INT32(0, CalibrationEngine::correction(pwl, -5));
+    TEST_ASSERT_EQUAL_INT32(48, CalibrationEngine::correction(pwl, (CAL_PWL_POINTS - 1) * step));
+    TEST_ASSERT_EQUAL_INT32(48, CalibrationEngine::correction(pwl, 5000));
+}
+
+// Every code survives toVolts() -> toCode(), with and without a correction and with a scale
+static void test_code_volts_round_trip() {
+    CalibrationEntry entry = CalibrationEngine::nominal(kDacGain * 0.98f);
+    entry.offset = 0.004f;
+    CalibrationCoefficients linear = CalibrationEngine::coefficients(entry, 6.7f);
+
+    int16_t pwl[CAL_PWL_POINTS] = {0, 24, 40, 32, 8, -16, -32, -24, 0};   // Up to 2.5 LSB
+    for (int i = 0; i < CAL_PWL_POINTS; i++) entry.pwl[i] = pwl[i];
+    entry.piecewise = 1;
+    CalibrationCoefficients corrected = CalibrationEngine::coefficients(entry, 6.7f);
+
+    for (int code = 0; code <= CAL_CODE_MAX; code++) {
+        float volts = CalibrationEngine::toVolts(linear, (float)code);
+        TEST_ASSERT_EQUAL_UINT16(code, CalibrationEngine::toCode(linear, volts));
+        volts = CalibrationEngine::toVolts(corrected, (float)code);
+        TEST_ASSERT_EQUAL_UINT16(code, CalibrationEngine::toCode(corrected, volts));
+    }
+
+    // Out of range requests clamp to the converter
+    TEST_ASSERT_EQUAL_UINT16(0, CalibrationEngine::toCode(linear, -1.0f));
+    TEST_ASSERT_EQUAL_UINT16(CAL_CODE_MAX, CalibrationEngine::toCode(linear, 100.0f));
+}
+
+static BoardCalibration makeTable() {
+    BoardCalibration cal;
+    memset(&cal, 0, sizeof(cal));
+    for (int map = 0; map < CAL_MAPS; map++) {
+        cal.map[map] = CalibrationEngine::nominal(kDacGain * (1.0f + 0.01f * map));
+        cal.map[map].points = 9;
+    }
+    return cal;
+}
+
+static void test_load_round_trip() {
+    BoardCalibration cal = makeTable();
+    TEST_ASSERT_TRUE(CalibrationEngine::save(cal));
+    BoardCalibration loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    TEST_ASSERT_TRUE(CalibrationEngine::load(loaded));
+    TEST_ASSERT_EQUAL_MEMORY(&cal, &loaded, sizeof(cal));
+}
+
+// A flipped byte anywhere in the table fails the CRC and leaves the caller's table alone
+static void test_load_rejects_corrupt_table() {
+    BoardCalibration cal = makeTable();
+    TEST_ASSERT_TRUE(CalibrationEngine::save(cal));
+    NativeNvsBlob& blob = nativeNvsBlob();
+    blob.data[offsetof(BoardCalibration, map) + sizeof(CalibrationEntry) + 2] ^= 0x40;
+
+    BoardCalibration loaded;
+    memset(&loaded, 0xA5, sizeof(loaded));
+    TEST_ASSERT_FALSE(CalibrationEngine::load(loaded));
+    TEST_ASSERT_EQUAL_UINT8(0xA5, ((uint8_t*)&loaded)[0]);
+    TEST_ASSERT_EQUAL_UINT8(0xA5, ((uint8_t*)&loaded)[sizeof(loaded) - 1]);
+}
+
+static void test_load_rejects_other_layouts() {
+    BoardCalibration cal = makeTable();
+    TEST_ASSERT_TRUE(CalibrationEngine::save(cal));
+    nativeNvsBlob().length -= 4;   // Table from a build with a different size
+    BoardCalibration loaded;
+    TEST_ASSERT_FALSE(CalibrationEngine::load(loaded));
+
+    TEST_ASSERT_TRUE(CalibrationEngine::erase());
+    TEST_ASSERT_FALSE(CalibrationEngine::load(loaded));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fit_recovers_line);
+    RUN_TEST(test_fit_unordered_sweep);
+    RUN_TEST(test_fit_rejects_bad_sweeps);
+    RUN_TEST(test_fit_piecewise_reduces_residual);
+    RUN_TEST(test_correction_interpolates_nodes);
+    RUN_TEST(test_code_volts_round_trip);
+    RUN_TEST(test_load_round_trip);
+    RUN_TEST(test_load_rejects_corrupt_table);
+    RUN_TEST(test_load_rejects_other_layouts);
+    return UNITY_END();
+}